@@ -31,7 +31,16 @@
 
 
 
-#define EDUFS_VERSION 1
+/* 2: struct denode reordered, hot fields first
+   3: cg summary area at fs_csaddr
+   newfs_edufs records it in fs_version, which is 0 on older images;
+   the kernel and fsck_edufs refuse any other version */
+#define EDUFS_VERSION 3
+
+#define EDUFS_MAGIC 0x5DFB
+
+/* the superblock takes the first this many bytes of the disk */
+#define EDUFS_SBSIZE 1024
 
 /* number of direct blocks kept inside of the inode */
 #define DIRECTBLOCKS 12
@@ -116,7 +125,7 @@ struct ecsum_total {
 /* the actual superblock */
 struct edufs_superblock {
   int32_t	 fs_firstfield;		/* historic filesystem linked list, */
-  int32_t	 fs_unused_1;		/*     used for incore super blocks */
+  int32_t	 fs_version;		/* EDUFS_VERSION; was fs_unused_1 */
   int32_t	 fs_sblkno;		/* offset of super-block in filesys */
   int32_t	 fs_cblkno;		/* offset of cyl-block in filesys */
   int32_t	 fs_iblkno;		/* offset of inode-blocks in filesys */
@@ -170,7 +179,7 @@ struct edufs_superblock {
   
   /* sizes determined by number of cylinder groups and their sizes */  
   u_int64_t fs_swuid;		/* system-wide uid */
-  int32_t  fs_pad;		/* due to alignment of fs_swuid */
+  int32_t  fs_flags;		/* FS_* below; was alignment padding */
   
   /* these fields retain the current block allocation info */
   int32_t	 fs_cgrotor;		/* last cg searched */
@@ -188,6 +197,9 @@ struct edufs_superblock {
   int32_t	 fs_magic;		/* magic number */
 };
 
+/* fs_flags */
+#define	FS_EXTENTS	0x0001	/* new files are extent mapped (DE_EXTENTS) */
+
 /* edufs cylinder group */
 struct cg {
   int32_t	 cg_next;		    /* historic cyl groups linked list */
@@ -221,4 +233,28 @@ struct cg {
   u_int8_t cg_space[1];		    /* space for cylinder group maps */
 };
 
+/*
+ * Cylinder group summary area: a copy of the interesting part of every
+ * cg header, fs_ncg of them back to back at byte offset fs_csaddr
+ * (fs_cssize bytes, a whole number of sectors), so mount can pick up
+ * all of them with a read or two instead of walking the cg_next chain.
+ * The cg headers are still the real thing; the copy is only trusted
+ * when the file system was unmounted cleanly (fs_clean).
+ */
+struct edufs_cgsum {
+  int32_t	 sc_cgoff;		    /* byte offset of the cg header */
+  int32_t	 sc_next;		    /* cg_next */
+  int32_t	 sc_ndblk;		    /* cg_ndblk */
+  int32_t	 sc_neblk;		    /* cg_neblk */
+  int32_t	 sc_dboff;		    /* cg_dboff */
+  int32_t	 sc_eusedoff;		/* cg_eusedoff */
+  int32_t	 sc_freeoff;		/* cg_freeoff */
+  int32_t	 sc_enodeoff;		/* cg_enodeoff */
+  struct	ecsum sc_cs;		/* cg_cs */
+  int32_t	 sc_rotor;		    /* cg_rotor */
+  int32_t	 sc_frotor;		    /* cg_frotor */
+  int32_t	 sc_irotor;		    /* cg_irotor */
+  int32_t	 sc_spare;		    /* pads it to 64 bytes */
+};
+
 #endif
@@ -0,0 +1,739 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Block and enode allocation.
+ *
+ * Each cg has a one block free map at cg_freeoff, a bit per data block,
+ * most significant bit first, set when the block is in use (the layout
+ * newfs_edufs writes).  Block b of a cg starts cg_dboff + b * fs_bsize
+ * bytes into the disk, and that byte offset is what goes in de_db[],
+ * de_ib[] and indirect blocks (see edufs_bmap.c).  The enode map at
+ * cg_eusedoff is laid out the same way, a bit per enode.  Block
+ * allocation tries to keep files contiguous, see edufs_blkalloc().
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mount.h>
+#include <sys/mutex.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/sx.h>
+#include <sys/vnode.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
+#include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_map.h>
+#include <fs/edufs/edufs_stats.h>
+#include <fs/edufs/edufs_trace.h>
+
+/* enodes below this in cg 0 are never handed out */
+#define	EDUFS_FIRSTENO	3
+
+static int edufs_indirnew(struct edufsmount *emp, int32_t pref,
+    int32_t *offp);
+static int edufs_indiralloc(struct vnode *vp, int slot, int level,
+    const int *idx, int32_t *offp, int *newp);
+static int edufs_indirfree(struct edufsmount *emp, int32_t off, int level,
+    int *np);
+static void edufs_clusteracct(struct edufs_cgmap *cm, int ndblk, int b,
+    int cnt);
+static int edufs_dirpref(struct edufsmount *emp, struct vnode *pvp);
+
+/*
+ * Free block cluster summary.  cm_clustersum[i] counts the runs of i
+ * free blocks in a cg, with the runs of EDUFS_MAXCONTIG or more all in
+ * the last slot, as in FFS's cg_clustersum; so whether a cg has room
+ * for a long sequential file is one look.  It lives in core only: it
+ * is counted from the free map when the map is read in and kept up as
+ * blocks are taken.
+ */
+void
+edufs_clusterinit(emp, cm)
+	struct edufsmount *emp;
+	struct edufs_cgmap *cm;
+{
+	int b, e, ndblk;
+
+	bzero(cm->cm_clustersum, sizeof(cm->cm_clustersum));
+	ndblk = emp->cglist[cm->cm_cg].cg_ndblk;
+	for (b = 0; (b = edufs_mapscan(cm->cm_fmap, b, ndblk, 0)) >= 0;
+	    b = e) {
+		if ((e = edufs_mapscan(cm->cm_fmap, b, ndblk, 1)) < 0)
+			e = ndblk;
+		cm->cm_clustersum[imin(e - b, EDUFS_MAXCONTIG)]++;
+	}
+}
+
+/*
+ * Block b is being taken (cnt -1), so the run it was in becomes the
+ * runs either side of it, or given back (cnt 1), joining them up.
+ * Neither side needs looking at past EDUFS_MAXCONTIG.
+ */
+static void
+edufs_clusteracct(cm, ndblk, b, cnt)
+	struct edufs_cgmap *cm;
+	int ndblk;
+	int b;
+	int cnt;
+{
+	int back, fwd;
+
+	for (back = 0; back < EDUFS_MAXCONTIG && b - back - 1 >= 0 &&
+	    MAPISCLR(cm->cm_fmap, b - back - 1); back++)
+		;
+	for (fwd = 0; fwd < EDUFS_MAXCONTIG && b + fwd + 1 < ndblk &&
+	    MAPISCLR(cm->cm_fmap, b + fwd + 1); fwd++)
+		;
+	cm->cm_clustersum[imin(back + 1 + fwd, EDUFS_MAXCONTIG)] += cnt;
+	if (back > 0)
+		cm->cm_clustersum[back] -= cnt;
+	if (fwd > 0)
+		cm->cm_clustersum[fwd] -= cnt;
+}
+
+/*
+ * Allocate a data block; its byte offset goes in *offp.  pref is the
+ * byte offset of the block before it in the file, or 0.  In order of
+ * preference the block is
+ *
+ *  - the one right after pref, so the file stays contiguous;
+ *  - the start of a free run of EDUFS_MAXCONTIG blocks, so it can go on
+ *    doing so, looking in pref's cg first and then on from fs_cgrotor;
+ *  - any free block, searching each cg from its cg_rotor.
+ *
+ * The maps are the in-core copies edufs_cgmapget() hands out.  Only
+ * the cg being looked at is locked, so allocations in different cgs go
+ * on side by side; the unlocked cs_nbfree checks are just hints.
+ */
+int
+edufs_blkalloc(emp, pref, offp)
+	struct edufsmount *emp;
+	int32_t pref;
+	int32_t *offp;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct edufs_cgmap *cm;
+	struct cg *cgp;
+	int b, c, error, i, need, pass, start;
+
+	start = esb->fs_cgrotor;
+	if (pref != 0 && (c = edufs_dtog(&emp->e_geom, pref)) >= 0) {
+		start = c;
+		cgp = &emp->cglist[c];
+		b = edufs_dtogd(&emp->e_geom, c, pref) + 1;
+		if (b < cgp->cg_ndblk && cgp->cg_cs.cs_nbfree > 0) {
+			EDUFS_CGLOCK(emp, c);
+			if ((error = edufs_cgmapget(emp, c, &cm)) != 0)
+				goto out;
+			if (MAPISCLR(cm->cm_fmap, b)) {
+				ES_INC(emp, ES_BALLOCCONTIG);
+				goto gotit;
+			}
+			EDUFS_CGUNLOCK(emp, c);
+		}
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		need = pass == 0 ? EDUFS_MAXCONTIG : 1;
+		for (i = 0; i < esb->fs_ncg; i++) {
+			c = (start + i) % esb->fs_ncg;
+			cgp = &emp->cglist[c];
+			if (cgp->cg_cs.cs_nbfree < need)
+				continue;
+			EDUFS_CGLOCK(emp, c);
+			if ((error = edufs_cgmapget(emp, c, &cm)) != 0)
+				goto out;
+			if (pass == 0) {
+				if (cm->cm_clustersum[EDUFS_MAXCONTIG] == 0) {
+					EDUFS_CGUNLOCK(emp, c);
+					continue;
+				}
+				b = edufs_maprun(cm->cm_fmap, cgp->cg_rotor,
+				    cgp->cg_ndblk, EDUFS_MAXCONTIG);
+				if (b < 0)
+					b = edufs_maprun(cm->cm_fmap, 0,
+					    imin(cgp->cg_ndblk,
+					    cgp->cg_rotor + EDUFS_MAXCONTIG),
+					    EDUFS_MAXCONTIG);
+				if (b >= 0)
+					goto gotit;
+				EDUFS_CGUNLOCK(emp, c);
+				continue;
+			}
+			b = edufs_mapfind(cm->cm_fmap, 0, cgp->cg_ndblk,
+			    cgp->cg_rotor);
+			if (b >= 0)
+				goto gotit;
+			/* the summary was off; trust the map */
+			if (cgp->cg_cs.cs_nbfree > 0) {
+				EDUFS_CSADD(emp, cd_nbfree,
+				    -cgp->cg_cs.cs_nbfree);
+				cgp->cg_cs.cs_nbfree = 0;
+				edufs_cgmod(emp, cgp);
+			}
+			EDUFS_CGUNLOCK(emp, c);
+		}
+	}
+	return (ENOSPC);
+
+gotit:
+	edufs_clusteracct(cm, cgp->cg_ndblk, b, -1);
+	MAPSET(cm->cm_fmap, b);
+	cm->cm_flags |= CM_FDIRTY;
+	cgp->cg_cs.cs_nbfree--;
+	EDUFS_CSADD(emp, cd_nbfree, -1);
+	cgp->cg_rotor = b;
+	esb->fs_cgrotor = c;
+	edufs_cgmod(emp, cgp);
+	*offp = edufs_dblkoff(&emp->e_geom, c, b);
+	ES_INC(emp, ES_BALLOC);
+	ETRACE(ETR_ALLOC, "blkalloc cg %d block %d", c, b);
+	error = 0;
+out:
+	EDUFS_CGUNLOCK(emp, c);
+	return (error);
+}
+
+/* what edufs_dirpref() expects of the average file and directory */
+#define	EDUFS_AVGFILESIZE	16384
+#define	EDUFS_AVGFPDIR		64
+
+/*
+ * The cg for a new directory under pvp, after FFS's Orlov allocator.
+ * A directory made at the top goes to the cg with the fewest
+ * directories of those with at least the average number of free enodes
+ * and blocks, which spreads unrelated trees out.  Deeper ones stay in
+ * or after their parent's cg, so a subtree keeps together, as long as
+ * that cg isn't short of space compared to the rest and hasn't just had
+ * too many directories in a row (fs_contigdirs) to leave room for their
+ * files.
+ */
+static int
+edufs_dirpref(emp, pvp)
+	struct edufsmount *emp;
+	struct vnode *pvp;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct ecsum *cs;
+	int avgefree, avgbfree, avgndir, c, i, mincg, minndir, pcg;
+	int maxndir, minefree, minbfree, maxcontigdirs;
+	int64_t cgsize, curdirsize, dirsize;
+	struct ecsum_total cst;
+
+	edufs_cstotal(emp, &cst);
+	avgefree = cst.cs_nefree / esb->fs_ncg;
+	avgbfree = cst.cs_nbfree / esb->fs_ncg;
+	avgndir = cst.cs_ndir / esb->fs_ncg;
+
+	if (pvp->v_vflag & VV_ROOT) {
+		pcg = arc4random() % esb->fs_ncg;
+		mincg = pcg;
+		minndir = esb->fs_epg;
+		for (i = 0; i < esb->fs_ncg; i++) {
+			c = (pcg + i) % esb->fs_ncg;
+			cs = &emp->cglist[c].cg_cs;
+			if (cs->cs_ndir < minndir &&
+			    cs->cs_nefree >= avgefree &&
+			    cs->cs_nbfree >= avgbfree) {
+				mincg = c;
+				minndir = cs->cs_ndir;
+			}
+		}
+		return (mincg);
+	}
+
+	pcg = edufs_ino_cg(&emp->e_geom, VTOE(pvp)->e_number);
+	maxndir = imin(avgndir + esb->fs_epg / 16, esb->fs_epg);
+	minefree = imax(avgefree - avgefree / 4, 1);
+	minbfree = imax(avgbfree - avgbfree / 4, 1);
+	cgsize = (int64_t)esb->fs_bpg * esb->fs_bsize;
+	dirsize = EDUFS_AVGFILESIZE * EDUFS_AVGFPDIR;
+	curdirsize = avgndir ?
+	    (cgsize - (int64_t)avgbfree * esb->fs_bsize) / avgndir : 0;
+	if (curdirsize > dirsize)
+		dirsize = curdirsize;
+	maxcontigdirs = imin((int)((int64_t)avgbfree * esb->fs_bsize / dirsize),
+	    255);
+	maxcontigdirs = imin(maxcontigdirs, esb->fs_epg / EDUFS_AVGFPDIR);
+	if (maxcontigdirs == 0)
+		maxcontigdirs = 1;
+
+	for (i = 0; i < esb->fs_ncg; i++) {
+		c = (pcg + i) % esb->fs_ncg;
+		cs = &emp->cglist[c].cg_cs;
+		if (cs->cs_ndir < maxndir && cs->cs_nefree >= minefree &&
+		    cs->cs_nbfree >= minbfree &&
+		    esb->fs_contigdirs[c] < maxcontigdirs)
+			return (c);
+	}
+	/* short of space everywhere; settle for enodes */
+	for (i = 0; i < esb->fs_ncg; i++) {
+		c = (pcg + i) % esb->fs_ncg;
+		if (emp->cglist[c].cg_cs.cs_nefree >= avgefree)
+			return (c);
+	}
+	return (pcg);
+}
+
+/*
+ * Allocate an enode for a new file of the given mode in directory pvp;
+ * its number goes in *inop.  Directories go where edufs_dirpref() says,
+ * anything else in its parent's cg, and failing that the next cg on
+ * with both enodes and blocks free.  Each cg's search starts at
+ * cg_irotor, just after the last enode it handed out.
+ */
+int
+edufs_enodealloc(pvp, mode, inop)
+	struct vnode *pvp;
+	int mode;
+	ino_t *inop;
+{
+	struct edufsmount *emp = VTOE(pvp)->e_emp;
+	struct edufs_superblock *esb = emp->e_esb;
+	struct edufs_cgmap *cm;
+	struct ecsum_total cst;
+	struct cg *cgp;
+	int c, error, i, idx, start;
+
+	edufs_cstotal(emp, &cst);
+	if (cst.cs_nefree < 1 || cst.cs_nbfree < 1)
+		return (ENOSPC);
+	if ((mode & DIFMT) == DIFDIR)
+		start = edufs_dirpref(emp, pvp);
+	else
+		start = edufs_ino_cg(&emp->e_geom, VTOE(pvp)->e_number);
+	for (i = 0; i < esb->fs_ncg; i++) {
+		c = (start + i) % esb->fs_ncg;
+		cgp = &emp->cglist[c];
+		if (cgp->cg_cs.cs_nefree <= 0 || cgp->cg_cs.cs_nbfree <= 0)
+			continue;
+		EDUFS_CGLOCK(emp, c);
+		if ((error = edufs_cgmapget(emp, c, &cm)) != 0) {
+			EDUFS_CGUNLOCK(emp, c);
+			return (error);
+		}
+		idx = edufs_mapfind(cm->cm_emap, c == 0 ? EDUFS_FIRSTENO : 0,
+		    esb->fs_epg, cgp->cg_irotor + 1);
+		if (idx < 0) {
+			/* the summary was off; trust the map */
+			if (cgp->cg_cs.cs_nefree > 0) {
+				EDUFS_CSADD(emp, cd_nefree,
+				    -cgp->cg_cs.cs_nefree);
+				cgp->cg_cs.cs_nefree = 0;
+				edufs_cgmod(emp, cgp);
+			}
+			EDUFS_CGUNLOCK(emp, c);
+			continue;
+		}
+		MAPSET(cm->cm_emap, idx);
+		cm->cm_flags |= CM_EDIRTY;
+		cgp->cg_irotor = idx;
+		cgp->cg_cs.cs_nefree--;
+		EDUFS_CSADD(emp, cd_nefree, -1);
+		if ((mode & DIFMT) == DIFDIR) {
+			cgp->cg_cs.cs_ndir++;
+			EDUFS_CSADD(emp, cd_ndir, 1);
+			if (esb->fs_contigdirs[c] < 255)
+				esb->fs_contigdirs[c]++;
+		} else if (esb->fs_contigdirs[c] > 0)
+			esb->fs_contigdirs[c]--;
+		edufs_cgmod(emp, cgp);
+		EDUFS_CGUNLOCK(emp, c);
+		*inop = (ino_t)c * esb->fs_epg + idx;
+		ETRACE(ETR_ALLOC, "enodealloc cg %d enode %d (from cg %d)", c,
+		    idx, start);
+		return (0);
+	}
+	return (ENOSPC);
+}
+
+/*
+ * Give back the data block at byte offset off.
+ */
+int
+edufs_blkfree(emp, off)
+	struct edufsmount *emp;
+	int32_t off;
+{
+	struct edufs_cgmap *cm;
+	struct cg *cgp;
+	int b, c, error;
+
+	if ((c = edufs_dtog(&emp->e_geom, off)) < 0) {
+		printf("edufs: freeing bad block at %d\n", off);
+		return (EINVAL);
+	}
+	cgp = &emp->cglist[c];
+	b = edufs_dtogd(&emp->e_geom, c, off);
+	EDUFS_CGLOCK(emp, c);
+	if ((error = edufs_cgmapget(emp, c, &cm)) != 0)
+		goto out;
+	if (MAPISCLR(cm->cm_fmap, b)) {
+		printf("edufs: freeing free block %d in cg %d\n", b, c);
+		error = EINVAL;
+		goto out;
+	}
+	MAPCLR(cm->cm_fmap, b);
+	edufs_clusteracct(cm, cgp->cg_ndblk, b, 1);
+	cm->cm_flags |= CM_FDIRTY;
+	cgp->cg_cs.cs_nbfree++;
+	EDUFS_CSADD(emp, cd_nbfree, 1);
+	edufs_cgmod(emp, cgp);
+	ETRACE(ETR_ALLOC, "blkfree cg %d block %d", c, b);
+out:
+	EDUFS_CGUNLOCK(emp, c);
+	return (error);
+}
+
+/*
+ * Give back enode ino, which had the given mode.
+ */
+int
+edufs_enodefree(emp, ino, mode)
+	struct edufsmount *emp;
+	ino_t ino;
+	int mode;
+{
+	struct edufs_cgmap *cm;
+	struct cg *cgp;
+	int c, error, idx;
+
+	c = edufs_ino_cg(&emp->e_geom, ino);
+	idx = edufs_ino_idx(&emp->e_geom, ino);
+	cgp = &emp->cglist[c];
+	EDUFS_CGLOCK(emp, c);
+	if ((error = edufs_cgmapget(emp, c, &cm)) != 0)
+		goto out;
+	if (MAPISCLR(cm->cm_emap, idx)) {
+		printf("edufs: freeing free enode %d\n", (int)ino);
+		error = EINVAL;
+		goto out;
+	}
+	MAPCLR(cm->cm_emap, idx);
+	cm->cm_flags |= CM_EDIRTY;
+	cgp->cg_cs.cs_nefree++;
+	EDUFS_CSADD(emp, cd_nefree, 1);
+	if ((mode & DIFMT) == DIFDIR) {
+		cgp->cg_cs.cs_ndir--;
+		EDUFS_CSADD(emp, cd_ndir, -1);
+	}
+	edufs_cgmod(emp, cgp);
+	ETRACE(ETR_ALLOC, "enodefree cg %d enode %d", c, idx);
+out:
+	EDUFS_CGUNLOCK(emp, c);
+	return (error);
+}
+
+/*
+ * Throw away vp's cached data and free all its blocks, leaving it
+ * empty.
+ */
+int
+edufs_freeblocks(vp, td)
+	struct vnode *vp;
+	struct thread *td;
+{
+	struct enode *ep = VTOE(vp);
+	int error, i, n;
+
+	if ((error = vinvalbuf(vp, 0, NOCRED, td, 0, 0)) != 0)
+		return (error);
+	edufs_expurge(ep);
+	if (ep->e_flags & DE_EXTENTS) {
+		if ((error = edufs_dxfree(ep)) != 0)
+			return (error);
+		ep->e_flags &= ~DE_EXTENTS;
+		ep->e_size = 0;
+		ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+		return (0);
+	}
+	if (ep->e_flags & DE_INLINEDATA) {
+		bzero(DE_INLINEPTR(&ep->e_den), EDUFS_MAXINLINE);
+		ep->e_size = 0;
+		ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+		return (0);
+	}
+	for (i = 0; i < NDADDR; i++) {
+		if (ep->e_den.de_db[i] == 0)
+			continue;
+		if ((error = edufs_blkfree(ep->e_emp, ep->e_den.de_db[i])) != 0)
+			return (error);
+		ep->e_den.de_db[i] = 0;
+		ep->e_blocks--;
+	}
+	for (i = 0; i < NIADDR; i++) {
+		if (ep->e_den.de_ib[i] == 0)
+			continue;
+		n = 0;
+		error = edufs_indirfree(ep->e_emp, ep->e_den.de_ib[i], i, &n);
+		ep->e_blocks -= n;
+		if (error)
+			return (error);
+		ep->e_den.de_ib[i] = 0;
+	}
+	ep->e_size = 0;
+	ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+	return (0);
+}
+
+/*
+ * Free the indirect block at off, which is level levels of indirection
+ * above the data, and everything under it.  *np counts the blocks
+ * freed.  The block's buffer is thrown away rather than written.
+ */
+static int
+edufs_indirfree(emp, off, level, np)
+	struct edufsmount *emp;
+	int32_t off;
+	int level;
+	int *np;
+{
+	struct buf *bp;
+	edufs_daddr_t *ptrs;
+	int error, i;
+
+	error = bread(emp->e_devvp, edufs_btosec(&emp->e_geom, off),
+	    emp->e_esb->fs_bsize, NOCRED, &bp);
+	if (error) {
+		brelse(bp);
+		return (error);
+	}
+	ptrs = (edufs_daddr_t *)bp->b_data;
+	for (i = 0; i < emp->e_geom.g_nindir; i++) {
+		if (ptrs[i] == 0)
+			continue;
+		if (level > 0)
+			error = edufs_indirfree(emp, ptrs[i], level - 1, np);
+		else if ((error = edufs_blkfree(emp, ptrs[i])) == 0)
+			(*np)++;
+		if (error) {
+			bqrelse(bp);
+			return (error);
+		}
+		ptrs[i] = 0;
+	}
+	bp->b_flags |= B_INVAL | B_NOCACHE;
+	brelse(bp);
+	if ((error = edufs_blkfree(emp, off)) == 0)
+		(*np)++;
+	return (error);
+}
+
+/*
+ * Get the buffer for logical block lbn of vp, allocating the block if
+ * there isn't one.  With EB_CLRBUF the old contents of an existing
+ * block are read in; a new block always comes back zeroed.
+ */
+int
+edufs_balloc(vp, lbn, flags, bpp)
+	struct vnode *vp;
+	daddr_t lbn;
+	int flags;
+	struct buf **bpp;
+{
+	struct enode *ep = VTOE(vp);
+	struct edufsmount *emp = ep->e_emp;
+	struct edufs_superblock *esb = ep->e_fs;
+	struct buf *bp;
+	int32_t off, pref;
+	int error, idx[NIADDR], level, new, slot;
+
+	KASSERT((ep->e_flags & DE_INLINEDATA) == 0,
+	    ("edufs_balloc: inline enode %d", (int)ep->e_number));
+	if (lbn < 0 ||
+	    (level = edufs_getlbns(&emp->e_geom, lbn, &slot, idx)) < 0)
+		return (EFBIG);
+	if ((ep->e_flags & DE_EXTENTS) == 0 && ep->e_blocks == 0 &&
+	    (esb->fs_flags & FS_EXTENTS)) {
+		/* a file's first block decides how it is mapped */
+		bzero(DE_INLINEPTR(&ep->e_den), EDUFS_MAXINLINE);
+		ep->e_flags |= DE_EXTENTS;
+	}
+	new = 0;
+	if (ep->e_flags & DE_EXTENTS) {
+		if ((error = edufs_dxalloc(ep, lbn, &off, &new)) != 0)
+			return (error);
+	} else if (level > 0) {
+		error = edufs_indiralloc(vp, slot, level, idx, &off, &new);
+		if (error)
+			return (error);
+	} else if ((off = ep->e_den.de_db[lbn]) == 0) {
+		pref = lbn > 0 ? ep->e_den.de_db[lbn - 1] : 0;
+		if ((error = edufs_blkalloc(emp, pref, &off)) != 0)
+			return (error);
+		ep->e_den.de_db[lbn] = off;
+		ep->e_blocks++;
+		ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+		new = 1;
+	}
+
+	if (new) {
+		edufs_exinval(ep, lbn);
+		bp = getblk(vp, lbn, esb->fs_bsize, 0, 0, 0);
+		bp->b_blkno = edufs_btosec(&emp->e_geom, off);
+		vfs_bio_clrbuf(bp);
+	} else if (flags & EB_CLRBUF) {
+		edufs_statsbread(emp, vp, lbn);
+		error = bread(vp, lbn, esb->fs_bsize, NOCRED, &bp);
+		if (error) {
+			brelse(bp);
+			return (error);
+		}
+	} else {
+		bp = getblk(vp, lbn, esb->fs_bsize, 0, 0, 0);
+		bp->b_blkno = edufs_btosec(&emp->e_geom, off);
+	}
+	*bpp = bp;
+	return (0);
+}
+
+/*
+ * Allocate an indirect block near pref and write it out zeroed before
+ * anything points at it, as ffs does without soft updates.
+ */
+static int
+edufs_indirnew(emp, pref, offp)
+	struct edufsmount *emp;
+	int32_t pref;
+	int32_t *offp;
+{
+	struct buf *bp;
+	int error;
+
+	if ((error = edufs_blkalloc(emp, pref, offp)) != 0)
+		return (error);
+	bp = getblk(emp->e_devvp, edufs_btosec(&emp->e_geom, *offp),
+	    emp->e_esb->fs_bsize, 0, 0, 0);
+	vfs_bio_clrbuf(bp);
+	if ((error = bwrite(bp)) != 0) {
+		(void)edufs_blkfree(emp, *offp);
+		return (error);
+	}
+	return (0);
+}
+
+/*
+ * Follow idx[] down from de_ib[slot] (see edufs_getlbns()) to a data
+ * block, allocating whatever isn't there yet on the way.  The data
+ * block's offset goes in *offp, and *newp is set if it is new.
+ * Indirect blocks are read and written through the device vnode and
+ * released with bqrelse(), so they stay cached ahead of file data.
+ */
+static int
+edufs_indiralloc(vp, slot, level, idx, offp, newp)
+	struct vnode *vp;
+	int slot;
+	int level;
+	const int *idx;
+	int32_t *offp;
+	int *newp;
+{
+	struct enode *ep = VTOE(vp);
+	struct edufsmount *emp = ep->e_emp;
+	struct buf *bp;
+	edufs_daddr_t *ptrs;
+	int32_t off, pref;
+	int error, i;
+
+	*newp = 0;
+	if ((off = ep->e_den.de_ib[slot]) == 0) {
+		pref = slot > 0 ? ep->e_den.de_ib[slot - 1] :
+		    ep->e_den.de_db[NDADDR - 1];
+		if ((error = edufs_indirnew(emp, pref, &off)) != 0)
+			return (error);
+		ep->e_den.de_ib[slot] = off;
+		ep->e_blocks++;
+		ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+	}
+	for (i = 0; i < level; i++) {
+		error = bread(emp->e_devvp, edufs_btosec(&emp->e_geom, off),
+		    emp->e_esb->fs_bsize, NOCRED, &bp);
+		if (error) {
+			brelse(bp);
+			return (error);
+		}
+		ptrs = (edufs_daddr_t *)bp->b_data;
+		if (ptrs[idx[i]] != 0) {
+			off = ptrs[idx[i]];
+			bqrelse(bp);
+			continue;
+		}
+		/* after the block before it, or the one pointing at it */
+		pref = idx[i] > 0 ? ptrs[idx[i] - 1] : off;
+		if (i < level - 1)
+			error = edufs_indirnew(emp, pref, &off);
+		else if ((error = edufs_blkalloc(emp, pref, &off)) == 0)
+			*newp = 1;
+		if (error) {
+			bqrelse(bp);
+			return (error);
+		}
+		ptrs[idx[i]] = off;
+		ep->e_blocks++;
+		ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+		bdwrite(bp);
+	}
+	*offp = off;
+	return (0);
+}
+
+/*
+ * Move the data of an inline file out to a block of its own, before it
+ * grows past e_maxinline.
+ */
+int
+edufs_inlinepromote(vp)
+	struct vnode *vp;
+{
+	struct enode *ep = VTOE(vp);
+	char data[EDUFS_MAXINLINE];
+	struct buf *bp;
+	int error;
+
+	bcopy(DE_INLINEPTR(&ep->e_den), data, sizeof(data));
+	bzero(DE_INLINEPTR(&ep->e_den), sizeof(data));
+	ep->e_flags &= ~DE_INLINEDATA;
+	if ((error = edufs_balloc(vp, 0, 0, &bp)) != 0) {
+		bcopy(data, DE_INLINEPTR(&ep->e_den), sizeof(data));
+		ep->e_flags |= DE_INLINEDATA;
+		return (error);
+	}
+	bcopy(data, bp->b_data, ep->e_size);
+	bdwrite(bp);
+	ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+	ETRACE(ETR_ALLOC, "promoted inline enode %d", (int)ep->e_number);
+	return (0);
+}
@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Logical to physical block mapping.
+ *
+ * de_db[] maps a file's first NDADDR blocks.  Past them de_ib[0] points
+ * at a block of g_nindir pointers to data blocks, de_ib[1] at a block
+ * of pointers to such blocks, and de_ib[2] one level further up.  Like
+ * de_db[], the pointers are byte offsets, 0 for a hole.  Indirect
+ * blocks are read through the device vnode.
+ *
+ * So that a random read deep in a big file needn't go through up to
+ * three indirect blocks first, each enode can have a small cache of
+ * the extents edufs_bmaparray() has found (struct edufs_excache).  It
+ * holds EDUFS_NEXTENT of them and gives up its least recently used
+ * when full.  The caches of a mount share e_exmtx and an LRU list, and
+ * hold at most vfs.edufs.excache_maxmem bytes between them; past that,
+ * the least recently used enode's cache goes.  Direct blocks are
+ * cheap to map and aren't cached.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mount.h>
+#include <sys/mutex.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/vnode.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
+#include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_stats.h>
+#include <fs/edufs/edufs_trace.h>
+
+static void edufs_bmapruns(const edufs_daddr_t *ptrs, int n, int i,
+    int bsize, int maxrun, int *runp, int *runb);
+static int edufs_exlookup(struct enode *ep, daddr_t bn, int maxrun,
+    daddr_t *bnp, int *runp, int *runb);
+static void edufs_exinsert(struct enode *ep, daddr_t lbn, daddr_t pbn,
+    int len);
+static int edufs_bmapext(struct enode *ep, daddr_t bn, int maxrun,
+    daddr_t *bnp, int *runp, int *runb);
+static void edufs_exremove(struct edufs_excache *xc, int i);
+static void edufs_exdrop(struct edufsmount *emp, struct edufs_excache *xc);
+
+static int edufs_excache_maxmem = 1024 * 1024;
+SYSCTL_INT(_vfs_edufs, OID_AUTO, excache_maxmem, CTLFLAG_RW,
+	&edufs_excache_maxmem, 0, "bytes of extent caches each mount may keep");
+
+/*
+ * Work out the way down to logical block lbn.  For a direct block the
+ * result is 0 and *slotp is its de_db[] index.  Otherwise it is the
+ * number of levels of indirection, *slotp is the de_ib[] index, and
+ * idx[] the pointer to follow in each indirect block, top level first.
+ * -1 means lbn is past what triple indirection can reach.
+ */
+int
+edufs_getlbns(g, lbn, slotp, idx)
+	const struct edufs_geom *g;
+	daddr_t lbn;
+	int *slotp;
+	int idx[NIADDR];
+{
+	daddr_t span;
+	int i, level;
+
+	if (lbn < NDADDR) {
+		*slotp = lbn;
+		return (0);
+	}
+	lbn -= NDADDR;
+	span = g->g_nindir;
+	for (level = 1; level <= NIADDR; level++) {
+		if (lbn < span)
+			break;
+		lbn -= span;
+		span <<= g->g_nishift;
+	}
+	if (level > NIADDR)
+		return (-1);
+	*slotp = level - 1;
+	for (i = level - 1; i >= 0; i--) {
+		idx[i] = lbn & (g->g_nindir - 1);
+		lbn >>= g->g_nishift;
+	}
+	return (level);
+}
+
+/*
+ * Map logical block bn of vp to a sector on the device, -1 for a hole.
+ * If runp or runb isn't NULL it gets the number of blocks after or
+ * before bn that follow on from it on disk, as far as one transfer
+ * (mnt_iosize_max) goes.  Only pointers in the same block of pointers
+ * as bn's are looked at, which is what cluster_read() and
+ * cluster_write() need to build their transfers.
+ */
+int
+edufs_bmaparray(vp, bn, bnp, runp, runb)
+	struct vnode *vp;
+	daddr_t bn;
+	daddr_t *bnp;
+	int *runp;
+	int *runb;
+{
+	struct enode *ep = VTOE(vp);
+	struct edufsmount *emp = ep->e_emp;
+	const struct edufs_geom *g = &emp->e_geom;
+	int bsize = emp->e_esb->fs_bsize;
+	struct buf *bp;
+	const edufs_daddr_t *ptrs;
+	edufs_daddr_t off;
+	int error, i, idx[NIADDR], level, maxrun, rb, rp, slot;
+
+	if (runp != NULL)
+		*runp = 0;
+	if (runb != NULL)
+		*runb = 0;
+	*bnp = -1;
+	/* de_db[] holds data, not pointers; the pager falls back to read */
+	if (ep->e_flags & DE_INLINEDATA)
+		return (EOPNOTSUPP);
+	if (bn < 0 || (level = edufs_getlbns(g, bn, &slot, idx)) < 0)
+		return (EFBIG);
+	maxrun = vp->v_mount->mnt_iosize_max / bsize - 1;
+
+	if (ep->e_flags & DE_EXTENTS)
+		return (edufs_bmapext(ep, bn, maxrun, bnp, runp, runb));
+	if (level == 0) {
+		if ((off = ep->e_den.de_db[slot]) == 0)
+			return (0);
+		edufs_bmapruns(ep->e_den.de_db, NDADDR, slot, bsize, maxrun,
+		    runp, runb);
+		*bnp = edufs_btosec(g, off);
+		return (0);
+	}
+	if (edufs_exlookup(ep, bn, maxrun, bnp, runp, runb)) {
+		ES_INC(emp, ES_EXHIT);
+		return (0);
+	}
+	ES_INC(emp, ES_EXMISS);
+
+	bp = NULL;
+	ptrs = NULL;
+	off = ep->e_den.de_ib[slot];
+	for (i = 0; i < level && off != 0; i++) {
+		if (bp != NULL)
+			bqrelse(bp);
+		error = bread(emp->e_devvp, edufs_btosec(g, off), bsize,
+		    NOCRED, &bp);
+		if (error) {
+			brelse(bp);
+			return (error);
+		}
+		ptrs = (const edufs_daddr_t *)bp->b_data;
+		off = ptrs[idx[i]];
+	}
+	if (off != 0) {
+		rp = rb = 0;
+		edufs_bmapruns(ptrs, g->g_nindir, idx[level - 1], bsize,
+		    maxrun, &rp, &rb);
+		*bnp = edufs_btosec(g, off);
+		if (runp != NULL)
+			*runp = rp;
+		if (runb != NULL)
+			*runb = rb;
+	}
+	if (bp != NULL)
+		bqrelse(bp);
+	if (off != 0)
+		edufs_exinsert(ep, bn - rb,
+		    *bnp - ((daddr_t)rb << (g->g_bshift - g->g_sshift)),
+		    rb + 1 + rp);
+	return (0);
+}
+
+/*
+ * edufs_bmaparray() for an extent mapped file.  The extent cache is
+ * only worth it once the tree has left the denode.
+ */
+static int
+edufs_bmapext(ep, bn, maxrun, bnp, runp, runb)
+	struct enode *ep;
+	daddr_t bn;
+	int maxrun;
+	daddr_t *bnp;
+	int *runp;
+	int *runb;
+{
+	struct edufsmount *emp = ep->e_emp;
+	const struct edufs_geom *g = &emp->e_geom;
+	struct edufs_dextent dx;
+	int cache, error;
+
+	cache = DE_DXROOT(&ep->e_den)->dh_depth > 0;
+	if (cache) {
+		if (edufs_exlookup(ep, bn, maxrun, bnp, runp, runb)) {
+			ES_INC(emp, ES_EXHIT);
+			return (0);
+		}
+		ES_INC(emp, ES_EXMISS);
+	}
+	if ((error = edufs_dxlookup(ep, bn, &dx)) != 0)
+		return (error);
+	if (dx.dx_len == 0)
+		return (0);
+	*bnp = edufs_btosec(g, dx.dx_off) +
+	    ((bn - dx.dx_lbn) << (g->g_bshift - g->g_sshift));
+	if (runp != NULL)
+		*runp = imin(dx.dx_lbn + dx.dx_len - 1 - bn, maxrun);
+	if (runb != NULL)
+		*runb = imin(bn - dx.dx_lbn, maxrun);
+	if (cache)
+		edufs_exinsert(ep, dx.dx_lbn, edufs_btosec(g, dx.dx_off),
+		    dx.dx_len);
+	return (0);
+}
+
+/* count the pointers either side of ptrs[i] that run on from it */
+static void
+edufs_bmapruns(ptrs, n, i, bsize, maxrun, runp, runb)
+	const edufs_daddr_t *ptrs;
+	int n;
+	int i;
+	int bsize;
+	int maxrun;
+	int *runp;
+	int *runb;
+{
+	int k;
+
+	if (runp != NULL)
+		for (k = i + 1; k < n && *runp < maxrun &&
+		    ptrs[k] == ptrs[k - 1] + bsize; k++)
+			(*runp)++;
+	if (runb != NULL)
+		for (k = i - 1; k >= 0 && *runb < maxrun &&
+		    ptrs[k] != 0 && ptrs[k] == ptrs[k + 1] - bsize; k--)
+			(*runb)++;
+}
+
+void
+edufs_exinit(emp)
+	struct edufsmount *emp;
+{
+
+	mtx_init(&emp->e_exmtx, "edufs excache", NULL, MTX_DEF);
+	TAILQ_INIT(&emp->e_exlru);
+	emp->e_exmem = 0;
+	emp->e_exmaxmem = edufs_excache_maxmem;
+}
+
+void
+edufs_exuninit(emp)
+	struct edufsmount *emp;
+{
+	struct edufs_excache *xc;
+
+	/* reclaim has normally freed them all */
+	mtx_lock(&emp->e_exmtx);
+	while ((xc = TAILQ_FIRST(&emp->e_exlru)) != NULL)
+		edufs_exdrop(emp, xc);
+	mtx_unlock(&emp->e_exmtx);
+	mtx_destroy(&emp->e_exmtx);
+}
+
+/*
+ * Look bn up in ep's extent cache.  On a hit, fill in *bnp, *runp and
+ * *runb as edufs_bmaparray() would and return 1.
+ */
+static int
+edufs_exlookup(ep, bn, maxrun, bnp, runp, runb)
+	struct enode *ep;
+	daddr_t bn;
+	int maxrun;
+	daddr_t *bnp;
+	int *runp;
+	int *runb;
+{
+	struct edufsmount *emp = ep->e_emp;
+	struct edufs_excache *xc;
+	struct edufs_extent *ex;
+	int hi, lo, mid;
+
+	mtx_lock(&emp->e_exmtx);
+	if ((xc = ep->e_excache) == NULL) {
+		mtx_unlock(&emp->e_exmtx);
+		return (0);
+	}
+	lo = 0;
+	hi = xc->xc_n - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		ex = &xc->xc_ext[mid];
+		if (bn < ex->ex_lbn)
+			hi = mid - 1;
+		else if (bn >= ex->ex_lbn + ex->ex_len)
+			lo = mid + 1;
+		else {
+			*bnp = ex->ex_pbn + ((bn - ex->ex_lbn) <<
+			    (emp->e_geom.g_bshift - emp->e_geom.g_sshift));
+			if (runp != NULL)
+				*runp = imin(ex->ex_lbn + ex->ex_len - 1 - bn,
+				    maxrun);
+			if (runb != NULL)
+				*runb = imin(bn - ex->ex_lbn, maxrun);
+			ex->ex_tick = ++xc->xc_tick;
+			TAILQ_REMOVE(&emp->e_exlru, xc, xc_lru);
+			TAILQ_INSERT_TAIL(&emp->e_exlru, xc, xc_lru);
+			mtx_unlock(&emp->e_exmtx);
+			return (1);
+		}
+	}
+	mtx_unlock(&emp->e_exmtx);
+	return (0);
+}
+
+/*
+ * Remember that logical blocks lbn to lbn + len - 1 of ep start at
+ * sector pbn, in place of any extents that overlap them.
+ */
+static void
+edufs_exinsert(ep, lbn, pbn, len)
+	struct enode *ep;
+	daddr_t lbn;
+	daddr_t pbn;
+	int len;
+{
+	struct edufsmount *emp = ep->e_emp;
+	struct edufs_excache *xc;
+	struct edufs_extent *ex;
+	int i, old;
+
+	mtx_lock(&emp->e_exmtx);
+	if ((xc = ep->e_excache) == NULL) {
+		while (emp->e_exmem + (int)sizeof(*xc) > emp->e_exmaxmem &&
+		    (xc = TAILQ_FIRST(&emp->e_exlru)) != NULL) {
+			edufs_exdrop(emp, xc);
+			ES_INC(emp, ES_EXEVICT);
+		}
+		xc = NULL;
+		if (emp->e_exmem + (int)sizeof(*xc) <= emp->e_exmaxmem)
+			xc = malloc(sizeof(*xc), M_EDUFSMNT, M_NOWAIT | M_ZERO);
+		if (xc == NULL) {
+			mtx_unlock(&emp->e_exmtx);
+			return;
+		}
+		xc->xc_ep = ep;
+		ep->e_excache = xc;
+		emp->e_exmem += sizeof(*xc);
+		TAILQ_INSERT_TAIL(&emp->e_exlru, xc, xc_lru);
+	}
+
+	for (i = 0; i < xc->xc_n;) {
+		ex = &xc->xc_ext[i];
+		if (ex->ex_lbn < lbn + len && lbn < ex->ex_lbn + ex->ex_len)
+			edufs_exremove(xc, i);
+		else
+			i++;
+	}
+	if (xc->xc_n == EDUFS_NEXTENT) {
+		for (old = 0, i = 1; i < xc->xc_n; i++)
+			if (xc->xc_ext[i].ex_tick < xc->xc_ext[old].ex_tick)
+				old = i;
+		edufs_exremove(xc, old);
+	}
+	for (i = xc->xc_n; i > 0 && xc->xc_ext[i - 1].ex_lbn > lbn; i--)
+		xc->xc_ext[i] = xc->xc_ext[i - 1];
+	ex = &xc->xc_ext[i];
+	ex->ex_lbn = lbn;
+	ex->ex_pbn = pbn;
+	ex->ex_len = len;
+	ex->ex_tick = ++xc->xc_tick;
+	xc->xc_n++;
+	mtx_unlock(&emp->e_exmtx);
+}
+
+/* forget the cached extent covering block lbn of ep, if any */
+void
+edufs_exinval(ep, lbn)
+	struct enode *ep;
+	daddr_t lbn;
+{
+	struct edufsmount *emp = ep->e_emp;
+	struct edufs_excache *xc;
+	struct edufs_extent *ex;
+	int i;
+
+	mtx_lock(&emp->e_exmtx);
+	if ((xc = ep->e_excache) != NULL)
+		for (i = 0; i < xc->xc_n; i++) {
+			ex = &xc->xc_ext[i];
+			if (lbn >= ex->ex_lbn &&
+			    lbn < ex->ex_lbn + ex->ex_len) {
+				edufs_exremove(xc, i);
+				break;
+			}
+		}
+	mtx_unlock(&emp->e_exmtx);
+}
+
+/* throw away ep's whole extent cache, when its blocks go or it does */
+void
+edufs_expurge(ep)
+	struct enode *ep;
+{
+	struct edufsmount *emp = ep->e_emp;
+
+	mtx_lock(&emp->e_exmtx);
+	if (ep->e_excache != NULL)
+		edufs_exdrop(emp, ep->e_excache);
+	mtx_unlock(&emp->e_exmtx);
+}
+
+static void
+edufs_exremove(xc, i)
+	struct edufs_excache *xc;
+	int i;
+{
+
+	for (xc->xc_n--; i < xc->xc_n; i++)
+		xc->xc_ext[i] = xc->xc_ext[i + 1];
+}
+
+static void
+edufs_exdrop(emp, xc)
+	struct edufsmount *emp;
+	struct edufs_excache *xc;
+{
+
+	mtx_assert(&emp->e_exmtx, MA_OWNED);
+	TAILQ_REMOVE(&emp->e_exlru, xc, xc_lru);
+	xc->xc_ep->e_excache = NULL;
+	emp->e_exmem -= sizeof(*xc);
+	free(xc, M_EDUFSMNT);
+}
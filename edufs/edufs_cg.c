@@ -0,0 +1,749 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Cylinder group headers.
+ *
+ * emp->cglist holds a copy of every cg header for the life of the
+ * mount.  At mount time it comes from the summary area at fs_csaddr
+ * if the last unmount was clean, otherwise from the headers
+ * themselves.  Allocation changes the in-core copies and calls
+ * edufs_cgmod(); edufs_cgflush(), from the sync path and unmount,
+ * writes the changed headers, the summary area and the superblock.
+ *
+ * The enode and free block maps are cached too, a cg at a time: the
+ * first allocation in a cg reads both in, and from then on allocation
+ * works on the copies without any I/O.  Changed maps go out with the
+ * headers in edufs_cgflush().  Up to vfs.edufs.cgmap_maxmem bytes of
+ * maps stay in core per mount; past that the least recently used cg's
+ * are written if need be and dropped.
+ *
+ * A cg's header, maps and fs_contigdirs slot are under that cg's own
+ * lock, an sx lock since it is held across reading the maps in.
+ * e_cgmapmtx covers only the LRU list and the memory count.  The
+ * fs_cstotal counts are kept as per cpu deltas from their value at
+ * mount (e_csdelta, e_csbase); edufs_cstotal() adds them up.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mount.h>
+#include <sys/mutex.h>
+#include <sys/pcpu.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/vnode.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
+#include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_map.h>
+#include <fs/edufs/edufs_stats.h>
+#include <fs/edufs/edufs_trace.h>
+
+static int edufs_cgsumread(struct edufsmount *emp);
+static int edufs_cgsumwrite(struct edufsmount *emp, int waitfor);
+static int edufs_cgscan(struct edufsmount *emp);
+static int edufs_cgmapread(struct edufsmount *emp, int32_t off,
+    u_int8_t *map);
+static int edufs_cgmapwrite(struct edufsmount *emp, struct edufs_cgmap *cm,
+    int waitfor);
+static int edufs_cgmapwrite1(struct edufsmount *emp, int32_t off,
+    u_int8_t *map, int waitfor);
+static void edufs_cgmapfree(struct edufsmount *emp, struct edufs_cgmap *cm);
+static int edufs_cgmapflush(struct edufsmount *emp, int waitfor);
+static void edufs_csinit(struct edufsmount *emp);
+
+/* the summary area is read and written in pieces this big */
+#define	CGSUMIOSIZE(esb)	(MAXBSIZE - MAXBSIZE % (esb)->fs_bps)
+
+/* cg header reads edufs_cgscan() keeps in flight */
+#define	CGSCANWINDOW	32
+
+/* bytes of cg maps a mount may keep in core; read at mount time */
+static int edufs_cgmap_maxmem = 8 * 1024 * 1024;
+SYSCTL_INT(_vfs_edufs, OID_AUTO, cgmap_maxmem, CTLFLAG_RW,
+	&edufs_cgmap_maxmem, 0, "bytes of cg maps each mount may cache");
+
+/*
+ * Load the cg headers into emp->cglist, and set up emp->e_geom over it.
+ */
+int
+edufs_cginit(emp)
+	struct edufsmount *emp;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	int c, error;
+
+	emp->cglist = malloc(esb->fs_ncg * sizeof(struct cg), M_EDUFSMNT,
+	    M_WAITOK | M_ZERO);
+	emp->e_cgoff = malloc(esb->fs_ncg * sizeof(int32_t), M_EDUFSMNT,
+	    M_WAITOK);
+	/* in core only; edufs_sbupdate() doesn't write the pointer */
+	esb->fs_contigdirs = malloc(esb->fs_ncg, M_EDUFSMNT,
+	    M_WAITOK | M_ZERO);
+	emp->e_cgmap = malloc(esb->fs_ncg * sizeof(struct edufs_cgmap *),
+	    M_EDUFSMNT, M_WAITOK | M_ZERO);
+	TAILQ_INIT(&emp->e_cgmaplru);
+	/* always room for one cg's maps, whatever the limit says */
+	emp->e_cgmapmaxmem = imax(edufs_cgmap_maxmem,
+	    (int)sizeof(struct edufs_cgmap) + 2 * esb->fs_bsize);
+	mtx_init(&emp->e_cgmapmtx, "edufs cgmap", NULL, MTX_DEF);
+	emp->e_cglock = malloc(esb->fs_ncg * sizeof(struct edufs_cglock),
+	    M_EDUFSMNT, M_WAITOK | M_ZERO);
+	for (c = 0; c < esb->fs_ncg; c++)
+		sx_init(&emp->e_cglock[c].cl_sx, "edufs cg");
+	emp->e_csdelta = malloc((mp_maxid + 1) * sizeof(struct edufs_csdelta),
+	    M_EDUFSMNT, M_WAITOK | M_ZERO);
+	if ((error = edufs_geominit(&emp->e_geom, esb, emp->cglist)) != 0) {
+		printf("edufs: bad geometry (bsize %d, bps %d, epg %d)\n",
+		    esb->fs_bsize, esb->fs_bps, esb->fs_epg);
+		edufs_cguninit(emp);
+		return (error);
+	}
+	/* older newfs_edufs left these zero */
+	esb->fs_nindir = emp->e_geom.g_nindir;
+	esb->fs_maxfilesize = edufs_maxfilesize(&emp->e_geom);
+
+	error = ENOENT;
+	if (esb->fs_csaddr != 0 && esb->fs_clean &&
+	    esb->fs_cssize >= esb->fs_ncg * (int)sizeof(struct edufs_cgsum) &&
+	    (error = edufs_cgsumread(emp)) != 0)
+		ETRACE(ETR_VFS, "cg summary area unusable (%d), scanning",
+		    error);
+	if (error != 0 && (error = edufs_cgscan(emp)) != 0) {
+		edufs_cguninit(emp);
+		return (error);
+	}
+	edufs_csinit(emp);
+	return (0);
+}
+
+void
+edufs_cguninit(emp)
+	struct edufsmount *emp;
+{
+	struct edufs_cgmap *cm;
+	int c;
+
+	/* anything still dirty was given up on by unmount */
+	while ((cm = TAILQ_FIRST(&emp->e_cgmaplru)) != NULL)
+		edufs_cgmapfree(emp, cm);
+	free(emp->e_csdelta, M_EDUFSMNT);
+	for (c = 0; c < emp->e_esb->fs_ncg; c++)
+		sx_destroy(&emp->e_cglock[c].cl_sx);
+	free(emp->e_cglock, M_EDUFSMNT);
+	mtx_destroy(&emp->e_cgmapmtx);
+	free(emp->e_cgmap, M_EDUFSMNT);
+	free(emp->e_esb->fs_contigdirs, M_EDUFSMNT);
+	emp->e_esb->fs_contigdirs = NULL;
+	free(emp->e_cgoff, M_EDUFSMNT);
+	free(emp->cglist, M_EDUFSMNT);
+	emp->cglist = NULL;
+}
+
+/*
+ * Note that the in-core copy of a cg header (its counts or rotors) has
+ * changed.  The caller holds the cg's lock, which covers cl_dirty.
+ * fs_fmod is only a hint to edufs_cgflush() and is set unlocked, as
+ * ffs does; it is set after cl_dirty, and cleared before the flush
+ * looks at any cg, so no change is missed.
+ */
+void
+edufs_cgmod(emp, cgp)
+	struct edufsmount *emp;
+	struct cg *cgp;
+{
+	int c = cgp - emp->cglist;
+
+	EDUFS_CGLOCKED(emp, c);
+	emp->e_cglock[c].cl_dirty = 1;
+	emp->e_esb->fs_fmod = 1;
+}
+
+/*
+ * Pick up every cg from the summary area.  The records have to chain
+ * together the way the headers do, or we don't believe any of them.
+ * They are packed back to back and don't fit a MAXBSIZE read evenly,
+ * so the whole area is gathered into one buffer before it's looked at.
+ */
+static int
+edufs_cgsumread(emp)
+	struct edufsmount *emp;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct edufs_cgsum *sc, *sums;
+	struct cg *cgp;
+	struct buf *bp;
+	daddr_t blkno;
+	int32_t next;
+	int c, done, error, len;
+
+	sums = malloc(esb->fs_cssize, M_EDUFSMNT, M_WAITOK);
+	for (done = 0; done < esb->fs_cssize; done += len) {
+		len = imin(esb->fs_cssize - done, CGSUMIOSIZE(esb));
+		blkno = edufs_btosec(&emp->e_geom, esb->fs_csaddr + done);
+		edufs_statsbread(emp, emp->e_devvp, blkno);
+		error = bread(emp->e_devvp, blkno, len, NOCRED, &bp);
+		if (error) {
+			brelse(bp);
+			free(sums, M_EDUFSMNT);
+			return (error);
+		}
+		bcopy(bp->b_data, (char *)sums + done, len);
+		bp->b_flags |= B_AGE;
+		brelse(bp);
+	}
+	next = esb->fs_cblkno;
+	for (c = 0, sc = sums; c < esb->fs_ncg; c++, sc++) {
+		if (sc->sc_cgoff != next) {
+			free(sums, M_EDUFSMNT);
+			return (EINVAL);
+		}
+		cgp = &emp->cglist[c];
+		cgp->cg_next = sc->sc_next;
+		cgp->cg_magic = esb->fs_magic;
+		cgp->cg_cgx = c;
+		cgp->cg_ncyl = esb->fs_cpg;
+		cgp->cg_ndblk = sc->sc_ndblk;
+		cgp->cg_neblk = sc->sc_neblk;
+		cgp->cg_cs = sc->sc_cs;
+		cgp->cg_dboff = sc->sc_dboff;
+		cgp->cg_eusedoff = sc->sc_eusedoff;
+		cgp->cg_freeoff = sc->sc_freeoff;
+		cgp->cg_enodeoff = sc->sc_enodeoff;
+		cgp->cg_rotor = sc->sc_rotor;
+		cgp->cg_frotor = sc->sc_frotor;
+		cgp->cg_irotor = sc->sc_irotor;
+		emp->e_cgoff[c] = next;
+		next = sc->sc_next;
+	}
+	free(sums, M_EDUFSMNT);
+	ETRACE(ETR_VFS, "%d cgs from the summary area", c);
+	return (0);
+}
+
+/*
+ * The slow way: follow cg_next from one header to the next.  Headers
+ * are normally evenly spaced, so once two gaps in a row agree we guess
+ * where the next CGSCANWINDOW of them are and have breadn() start
+ * those reads; by the time we get to them they're in, or on the way.
+ * A wrong guess only costs a wasted read, since every header is still
+ * read from where the one before it says it is.
+ */
+static int
+edufs_cgscan(emp)
+	struct edufsmount *emp;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	daddr_t rablkno[CGSCANWINDOW], blkno;
+	int rabsize[CGSCANWINDOW];
+	struct cg *cgp;
+	struct buf *bp;
+	int32_t next, gap, lastgap;
+	int c, error, i, issued, n;
+
+	next = esb->fs_cblkno;
+	gap = lastgap = 0;
+	issued = 0;		/* reads already started for cgs before this */
+	for (c = 0; c < esb->fs_ncg; c++) {
+		n = 0;
+		if (gap > 0 && gap == lastgap) {
+			for (i = imax(issued, c + 1);
+			    i < esb->fs_ncg && i <= c + CGSCANWINDOW; i++, n++) {
+				rablkno[n] = edufs_btosec(&emp->e_geom,
+				    next + (i - c) * gap);
+				rabsize[n] = esb->fs_bsize;
+			}
+			issued = i;
+		}
+		blkno = edufs_btosec(&emp->e_geom, next);
+		edufs_statsbread(emp, emp->e_devvp, blkno);
+		error = breadn(emp->e_devvp, blkno, esb->fs_bsize,
+		    rablkno, rabsize, n, NOCRED, &bp);
+		if (error) {
+			brelse(bp);
+			return (error);
+		}
+		cgp = (struct cg *)bp->b_data;
+		if (cgp->cg_magic != esb->fs_magic || cgp->cg_cgx != c) {
+			printf("edufs: cg %d at %d: bad magic %x or index %d\n",
+			    c, next, cgp->cg_magic, cgp->cg_cgx);
+			brelse(bp);
+			return (EINVAL);
+		}
+		bcopy(bp->b_data, &emp->cglist[c], sizeof(struct cg));
+		bp->b_flags |= B_AGE;
+		brelse(bp);
+		emp->e_cgoff[c] = next;
+		lastgap = gap;
+		gap = emp->cglist[c].cg_next - next;
+		if (gap != lastgap)
+			issued = c + 1;	/* the guesses were off */
+		next = emp->cglist[c].cg_next;
+	}
+	return (0);
+}
+
+/*
+ * Write out the summary area from cglist.  Every byte of it gets
+ * rewritten, so nothing needs reading first.  As in edufs_cgsumread(),
+ * the records are laid out in one buffer and then cut into writes.
+ */
+static int
+edufs_cgsumwrite(emp, waitfor)
+	struct edufsmount *emp;
+	int waitfor;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct edufs_cgsum *sc, *sums;
+	struct cg *cgp;
+	struct buf *bp;
+	int c, done, error, len;
+
+	sums = malloc(esb->fs_cssize, M_EDUFSMNT, M_WAITOK | M_ZERO);
+	for (c = 0, sc = sums; c < esb->fs_ncg; c++, sc++) {
+		cgp = &emp->cglist[c];
+		EDUFS_CGLOCK(emp, c);
+		sc->sc_cgoff = emp->e_cgoff[c];
+		sc->sc_next = cgp->cg_next;
+		sc->sc_ndblk = cgp->cg_ndblk;
+		sc->sc_neblk = cgp->cg_neblk;
+		sc->sc_dboff = cgp->cg_dboff;
+		sc->sc_eusedoff = cgp->cg_eusedoff;
+		sc->sc_freeoff = cgp->cg_freeoff;
+		sc->sc_enodeoff = cgp->cg_enodeoff;
+		sc->sc_cs = cgp->cg_cs;
+		sc->sc_rotor = cgp->cg_rotor;
+		sc->sc_frotor = cgp->cg_frotor;
+		sc->sc_irotor = cgp->cg_irotor;
+		EDUFS_CGUNLOCK(emp, c);
+	}
+	error = 0;
+	for (done = 0; done < esb->fs_cssize; done += len) {
+		len = imin(esb->fs_cssize - done, CGSUMIOSIZE(esb));
+		bp = getblk(emp->e_devvp,
+		    edufs_btosec(&emp->e_geom, esb->fs_csaddr + done), len,
+		    0, 0, 0);
+		bcopy((char *)sums + done, bp->b_data, len);
+		if (waitfor == MNT_WAIT) {
+			if ((c = bwrite(bp)) != 0)
+				error = c;
+		} else
+			bawrite(bp);
+	}
+	free(sums, M_EDUFSMNT);
+	return (error);
+}
+
+/*
+ * Write the cg headers that changed, then the summary area and the
+ * superblock.
+ */
+int
+edufs_cgflush(emp, waitfor)
+	struct edufsmount *emp;
+	int waitfor;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct buf *bp;
+	struct cg *cgp;
+	daddr_t blkno;
+	int c, error, allerror;
+
+	if (emp->e_mountp->mnt_flag & MNT_RDONLY)
+		return (0);
+	if (esb->fs_fmod == 0)
+		return (0);
+	esb->fs_fmod = 0;
+
+	allerror = edufs_cgmapflush(emp, waitfor);
+	for (c = 0; c < esb->fs_ncg; c++) {
+		EDUFS_CGLOCK(emp, c);
+		if (!emp->e_cglock[c].cl_dirty) {
+			EDUFS_CGUNLOCK(emp, c);
+			continue;
+		}
+		blkno = edufs_btosec(&emp->e_geom, emp->e_cgoff[c]);
+		edufs_statsbread(emp, emp->e_devvp, blkno);
+		error = bread(emp->e_devvp, blkno, esb->fs_bsize, NOCRED, &bp);
+		if (error) {
+			brelse(bp);
+			/* still dirty; see that the next sync tries again */
+			esb->fs_fmod = 1;
+			EDUFS_CGUNLOCK(emp, c);
+			allerror = error;
+			continue;
+		}
+		/*
+		 * Only the counts and rotors change in core, and after a
+		 * summary area mount the rest of cglist[c] isn't filled in,
+		 * so just those go into the header.
+		 */
+		cgp = (struct cg *)bp->b_data;
+		cgp->cg_cs = emp->cglist[c].cg_cs;
+		cgp->cg_rotor = emp->cglist[c].cg_rotor;
+		cgp->cg_frotor = emp->cglist[c].cg_frotor;
+		cgp->cg_irotor = emp->cglist[c].cg_irotor;
+		emp->e_cglock[c].cl_dirty = 0;
+		EDUFS_CGUNLOCK(emp, c);
+		if (waitfor == MNT_WAIT) {
+			if ((error = bwrite(bp)) != 0)
+				allerror = error;
+		} else
+			bawrite(bp);
+	}
+	if (esb->fs_csaddr != 0 &&
+	    (error = edufs_cgsumwrite(emp, waitfor)) != 0)
+		allerror = error;
+	if ((error = edufs_sbupdate(emp, waitfor)) != 0)
+		allerror = error;
+	return (allerror);
+}
+
+/*
+ * Write the in-core superblock back to the disk.
+ */
+int
+edufs_sbupdate(emp, waitfor)
+	struct edufsmount *emp;
+	int waitfor;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct buf *bp;
+	int error;
+
+	edufs_statsbread(emp, emp->e_devvp, 0);
+	error = bread(emp->e_devvp, 0, EDUFS_SBSIZE, NOCRED, &bp);
+	if (error) {
+		brelse(bp);
+		return (error);
+	}
+	edufs_cstotal(emp, &esb->fs_cstotal);
+	bcopy(esb, bp->b_data, esb->fs_sbsize);
+	((struct edufs_superblock *)bp->b_data)->fs_contigdirs = NULL;
+	if (waitfor == MNT_WAIT)
+		return (bwrite(bp));
+	bawrite(bp);
+	return (0);
+}
+
+/*
+ * Get cg c's maps into core, reading them in if they aren't.  The
+ * caller holds cg c's lock, and sets CM_EDIRTY or CM_FDIRTY after
+ * changing a map.
+ */
+int
+edufs_cgmapget(emp, c, cmp)
+	struct edufsmount *emp;
+	int c;
+	struct edufs_cgmap **cmp;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct edufs_cgmap *cm;
+	int error, size;
+
+	EDUFS_CGLOCKED(emp, c);
+	if ((cm = emp->e_cgmap[c]) != NULL) {
+		/*
+		 * Allocations in a row mostly hit the same cg, whose maps
+		 * are then the newest already.  Our cg lock keeps cm on
+		 * the list; the unlocked look at its successor is a hint,
+		 * and at worst leaves it just short of the tail.
+		 */
+		if (TAILQ_NEXT(cm, cm_lru) != NULL) {
+			mtx_lock(&emp->e_cgmapmtx);
+			TAILQ_REMOVE(&emp->e_cgmaplru, cm, cm_lru);
+			TAILQ_INSERT_TAIL(&emp->e_cgmaplru, cm, cm_lru);
+			mtx_unlock(&emp->e_cgmapmtx);
+		}
+		*cmp = cm;
+		return (0);
+	}
+
+	/*
+	 * Make room.  A cg whose lock is busy is in use, so its maps are
+	 * passed over; if every one is, we go over the limit for a while.
+	 */
+	size = sizeof(struct edufs_cgmap) + 2 * esb->fs_bsize;
+	mtx_lock(&emp->e_cgmapmtx);
+	while (emp->e_cgmapmem + size > emp->e_cgmapmaxmem) {
+		TAILQ_FOREACH(cm, &emp->e_cgmaplru, cm_lru)
+			if (sx_try_xlock(&emp->e_cglock[cm->cm_cg].cl_sx))
+				break;
+		if (cm == NULL)
+			break;
+		TAILQ_REMOVE(&emp->e_cgmaplru, cm, cm_lru);
+		emp->e_cgmapmem -= size;
+		mtx_unlock(&emp->e_cgmapmtx);
+		/* an async write can't fail here; errors show up later */
+		(void)edufs_cgmapwrite(emp, cm, 0);
+		emp->e_cgmap[cm->cm_cg] = NULL;
+		EDUFS_CGUNLOCK(emp, cm->cm_cg);
+		free(cm, M_EDUFSMNT);
+		ES_INC(emp, ES_CGMAPEVICT);
+		mtx_lock(&emp->e_cgmapmtx);
+	}
+	mtx_unlock(&emp->e_cgmapmtx);
+
+	cm = malloc(size, M_EDUFSMNT, M_WAITOK);
+	cm->cm_cg = c;
+	cm->cm_flags = 0;
+	cm->cm_emap = (u_int8_t *)(cm + 1);
+	cm->cm_fmap = cm->cm_emap + esb->fs_bsize;
+	if ((error = edufs_cgmapread(emp, emp->cglist[c].cg_eusedoff,
+	    cm->cm_emap)) != 0 ||
+	    (error = edufs_cgmapread(emp, emp->cglist[c].cg_freeoff,
+	    cm->cm_fmap)) != 0) {
+		free(cm, M_EDUFSMNT);
+		return (error);
+	}
+	edufs_clusterinit(emp, cm);
+	emp->e_cgmap[c] = cm;
+	mtx_lock(&emp->e_cgmapmtx);
+	TAILQ_INSERT_TAIL(&emp->e_cgmaplru, cm, cm_lru);
+	emp->e_cgmapmem += size;
+	mtx_unlock(&emp->e_cgmapmtx);
+	ES_INC(emp, ES_CGMAPLOAD);
+	ETRACE(ETR_ALLOC, "cgmap %d in", c);
+	*cmp = cm;
+	return (0);
+}
+
+static int
+edufs_cgmapread(emp, off, map)
+	struct edufsmount *emp;
+	int32_t off;
+	u_int8_t *map;
+{
+	struct buf *bp;
+	daddr_t blkno;
+	int error;
+
+	blkno = edufs_btosec(&emp->e_geom, off);
+	edufs_statsbread(emp, emp->e_devvp, blkno);
+	error = bread(emp->e_devvp, blkno, emp->e_esb->fs_bsize, NOCRED, &bp);
+	if (error) {
+		brelse(bp);
+		return (error);
+	}
+	bcopy(bp->b_data, map, emp->e_esb->fs_bsize);
+	/* the copy is what gets used from now on */
+	bp->b_flags |= B_AGE;
+	brelse(bp);
+	return (0);
+}
+
+/*
+ * Write whichever of cm's maps changed.
+ */
+static int
+edufs_cgmapwrite(emp, cm, waitfor)
+	struct edufsmount *emp;
+	struct edufs_cgmap *cm;
+	int waitfor;
+{
+	struct cg *cgp = &emp->cglist[cm->cm_cg];
+	int error, err;
+
+	error = 0;
+	if (cm->cm_flags & CM_EDIRTY) {
+		cm->cm_flags &= ~CM_EDIRTY;
+		err = edufs_cgmapwrite1(emp, cgp->cg_eusedoff, cm->cm_emap,
+		    waitfor);
+		if (err) {
+			cm->cm_flags |= CM_EDIRTY;
+			error = err;
+		}
+	}
+	if (cm->cm_flags & CM_FDIRTY) {
+		cm->cm_flags &= ~CM_FDIRTY;
+		err = edufs_cgmapwrite1(emp, cgp->cg_freeoff, cm->cm_fmap,
+		    waitfor);
+		if (err) {
+			cm->cm_flags |= CM_FDIRTY;
+			error = err;
+		}
+	}
+	return (error);
+}
+
+/* maps are whole blocks, so the buffer needn't be read first */
+static int
+edufs_cgmapwrite1(emp, off, map, waitfor)
+	struct edufsmount *emp;
+	int32_t off;
+	u_int8_t *map;
+	int waitfor;
+{
+	struct buf *bp;
+
+	bp = getblk(emp->e_devvp, edufs_btosec(&emp->e_geom, off),
+	    emp->e_esb->fs_bsize, 0, 0, 0);
+	bcopy(map, bp->b_data, emp->e_esb->fs_bsize);
+	ES_INC(emp, ES_CGMAPWRITE);
+	if (waitfor == MNT_WAIT)
+		return (bwrite(bp));
+	bawrite(bp);
+	return (0);
+}
+
+static void
+edufs_cgmapfree(emp, cm)
+	struct edufsmount *emp;
+	struct edufs_cgmap *cm;
+{
+
+	TAILQ_REMOVE(&emp->e_cgmaplru, cm, cm_lru);
+	emp->e_cgmap[cm->cm_cg] = NULL;
+	emp->e_cgmapmem -= sizeof(struct edufs_cgmap) +
+	    2 * emp->e_esb->fs_bsize;
+	free(cm, M_EDUFSMNT);
+}
+
+/* write every changed map, in cg (and so disk) order */
+static int
+edufs_cgmapflush(emp, waitfor)
+	struct edufsmount *emp;
+	int waitfor;
+{
+	struct edufs_cgmap *cm;
+	int c, error, allerror;
+
+	allerror = 0;
+	for (c = 0; c < emp->e_esb->fs_ncg; c++) {
+		EDUFS_CGLOCK(emp, c);
+		if ((cm = emp->e_cgmap[c]) != NULL &&
+		    (cm->cm_flags & (CM_EDIRTY | CM_FDIRTY)) != 0 &&
+		    (error = edufs_cgmapwrite(emp, cm, waitfor)) != 0) {
+			/* so the next sync tries again */
+			edufs_cgmod(emp, &emp->cglist[c]);
+			allerror = error;
+		}
+		EDUFS_CGUNLOCK(emp, c);
+	}
+	return (allerror);
+}
+
+/*
+ * Start the fs_cstotal counts off from the cg headers, which are what
+ * allocation keeps up; the superblock's copy may be stale after a crash.
+ */
+static void
+edufs_csinit(emp)
+	struct edufsmount *emp;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct ecsum_total *cs = &emp->e_csbase;
+	int c;
+
+	bzero(cs, sizeof(*cs));
+	for (c = 0; c < esb->fs_ncg; c++) {
+		cs->cs_ndir += emp->cglist[c].cg_cs.cs_ndir;
+		cs->cs_nbfree += emp->cglist[c].cg_cs.cs_nbfree;
+		cs->cs_nefree += emp->cglist[c].cg_cs.cs_nefree;
+	}
+	if (cs->cs_nbfree != esb->fs_cstotal.cs_nbfree ||
+	    cs->cs_nefree != esb->fs_cstotal.cs_nefree ||
+	    cs->cs_ndir != esb->fs_cstotal.cs_ndir)
+		ETRACE(ETR_VFS, "fs_cstotal was off; using the cg counts");
+	esb->fs_cstotal = *cs;
+}
+
+#ifdef DIAGNOSTIC
+/*
+ * Recount every cg's free blocks and enodes from its maps and complain
+ * about any summary, or total, that has drifted from them.
+ */
+void
+edufs_cscheck(emp)
+	struct edufsmount *emp;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct edufs_cgmap *cm;
+	struct ecsum_total cst;
+	struct cg *cgp;
+	int64_t nbfree, nefree;
+	int b, c, nb, ne;
+
+	nbfree = nefree = 0;
+	for (c = 0; c < esb->fs_ncg; c++) {
+		cgp = &emp->cglist[c];
+		EDUFS_CGLOCK(emp, c);
+		if (edufs_cgmapget(emp, c, &cm) != 0) {
+			EDUFS_CGUNLOCK(emp, c);
+			printf("edufs: cscheck: can't read cg %d\n", c);
+			return;
+		}
+		for (nb = b = 0; b < cgp->cg_ndblk; b++)
+			nb += MAPISCLR(cm->cm_fmap, b) ? 1 : 0;
+		for (ne = b = 0; b < esb->fs_epg; b++)
+			ne += MAPISCLR(cm->cm_emap, b) ? 1 : 0;
+		if (nb != cgp->cg_cs.cs_nbfree || ne != cgp->cg_cs.cs_nefree)
+			printf("edufs: cg %d has %d/%d free blocks/enodes, "
+			    "summary says %d/%d\n", c, nb, ne,
+			    cgp->cg_cs.cs_nbfree, cgp->cg_cs.cs_nefree);
+		EDUFS_CGUNLOCK(emp, c);
+		nbfree += nb;
+		nefree += ne;
+	}
+	edufs_cstotal(emp, &cst);
+	if (nbfree != cst.cs_nbfree || nefree != cst.cs_nefree)
+		printf("edufs: %lld/%lld free blocks/enodes, totals say "
+		    "%lld/%lld\n", (long long)nbfree, (long long)nefree,
+		    (long long)cst.cs_nbfree, (long long)cst.cs_nefree);
+}
+#endif
+
+/*
+ * The current totals: the counts at mount plus every cpu's changes.
+ * Not a snapshot; allocations may go on while the cpus are summed.
+ */
+void
+edufs_cstotal(emp, cs)
+	struct edufsmount *emp;
+	struct ecsum_total *cs;
+{
+	struct edufs_csdelta *cd;
+	int cpu;
+
+	*cs = emp->e_csbase;
+	for (cpu = 0; cpu <= mp_maxid; cpu++) {
+		cd = &emp->e_csdelta[cpu];
+		cs->cs_ndir += cd->cd_ndir;
+		cs->cs_nbfree += cd->cd_nbfree;
+		cs->cs_nefree += cd->cd_nefree;
+	}
+}
@@ -80,24 +80,73 @@ typedef	int32_t	edufs_daddr_t;
 #define	NIADDR	3			/* Indirect addresses in inode. */
 
 
+/*
+ * Everything getattr, access and lookup look at lives in the first 56
+ * bytes so it shares a cache line once the denode is in core (see
+ * struct enode); the block pointers follow.  de_size is 8 byte aligned
+ * so the layout, and the 128 byte size, is the same on every arch.
+ */
 struct denode {
-  u_int16_t	    de_mode;	    /* 0: IFMT, permissions; see below. */
-  int16_t		de_nlink;	    /* 2: File link count. */
-  u_int64_t	    de_size;	    /* : File byte count. */
-  uint32_t		de_atime;	    /* : Last access time. */
-  uint32_t		de_atimensec;	/* : Last access time. */
-  uint32_t		de_mtime;	    /* : Last modified time. */
-  uint32_t		de_mtimensec;	/* : Last modified time. */
-  uint32_t		de_ctime;	    /* : Last inode change time. */
-  uint32_t		de_ctimensec;	/* : Last inode change time. */
-  edufs_daddr_t	de_db[NDADDR];	/* : Direct disk blocks. */
-  edufs_daddr_t	de_ib[NIADDR];	/* : Indirect disk blocks. */
-  u_int32_t	    de_flags;	    /* : Status flags (chflags). */
-  int32_t		de_blocks;	    /* : Blocks actually held. */
-  int32_t		de_gen;		    /* : Generation number. */
-  u_int32_t	    de_uid;		    /* : File owner. */
-  u_int32_t	    de_gid;		    /* : File group. */
-  int32_t		de_spare[3];	/* : Reserved; currently unused */
+  u_int16_t	    de_mode;	    /*   0: IFMT, permissions; see below. */
+  int16_t		de_nlink;	    /*   2: File link count. */
+  u_int32_t	    de_uid;		    /*   4: File owner. */
+  u_int32_t	    de_gid;		    /*   8: File group. */
+  u_int32_t	    de_flags;	    /*  12: Status flags (chflags). */
+  u_int64_t	    de_size;	    /*  16: File byte count. */
+  int32_t		de_blocks;	    /*  24: Blocks actually held. */
+  int32_t		de_gen;		    /*  28: Generation number. */
+  uint32_t		de_atime;	    /*  32: Last access time. */
+  uint32_t		de_atimensec;	/*  36: Last access time. */
+  uint32_t		de_mtime;	    /*  40: Last modified time. */
+  uint32_t		de_mtimensec;	/*  44: Last modified time. */
+  uint32_t		de_ctime;	    /*  48: Last inode change time. */
+  uint32_t		de_ctimensec;	/*  52: Last inode change time. */
+  edufs_daddr_t	de_db[NDADDR];	/*  56: Direct disk blocks. */
+  edufs_daddr_t	de_ib[NIADDR];	/* 104: Indirect disk blocks. */
+  int32_t		de_spare[3];	/* 116: Reserved; currently unused */
 };
 
+/*
+ * de_flags bits that aren't chflags(2) flags.  They never show up in
+ * va_flags.
+ */
+#define	DE_INLINEDATA	0x80000000	/* File data is in de_db/de_ib. */
+#define	DE_EXTENTS	0x40000000	/* de_db/de_ib hold an extent tree. */
+#define	DE_INTERNAL	(DE_INLINEDATA | DE_EXTENTS)
+
+/*
+ * Files no bigger than this can keep their data in the block pointer
+ * area instead of a block of their own, if the file system allows it
+ * (fs_maxsymlinklen > 0).  Bytes past de_size are kept zero.
+ */
+#define	EDUFS_MAXINLINE	((NDADDR + NIADDR) * sizeof(edufs_daddr_t))
+#define	DE_INLINEPTR(dp)	((char *)(dp)->de_db)
+
+/*
+ * An extent mapped file (DE_EXTENTS) keeps the root of an extent tree
+ * in the block pointer area instead: a header and EDUFS_NROOTEXT
+ * entries.  In a leaf (dh_depth 0) an entry maps dx_len blocks from
+ * logical block dx_lbn on to the blocks from byte offset dx_off on.
+ * Above the leaves, dx_off is a node block covering logical blocks
+ * from dx_lbn up to the next entry's, and dx_len is unused.  A node
+ * block is a header and EDUFS_NODEEXT(fs_bsize) entries.  Entries are
+ * sorted by dx_lbn.
+ */
+struct edufs_dxhdr {
+  u_int16_t	    dh_n;		    /* Entries in use. */
+  u_int16_t	    dh_depth;	    /* Levels of nodes below this one. */
+};
+
+struct edufs_dextent {
+  u_int32_t	    dx_lbn;		    /* First logical block. */
+  edufs_daddr_t	dx_off;		    /* Byte offset of its block or node. */
+  u_int32_t	    dx_len;		    /* Blocks in the run, leaves only. */
+};
+
+#define	EDUFS_NROOTEXT	4
+#define	EDUFS_NODEEXT(bsize)	\
+	(((bsize) - sizeof(struct edufs_dxhdr)) / sizeof(struct edufs_dextent))
+#define	DE_DXROOT(dp)	((struct edufs_dxhdr *)(dp)->de_db)
+#define	DX_ENTRY(dh)	((struct edufs_dextent *)((dh) + 1))
+
 #endif /* _EDUFS_DENODE_H_ */
@@ -94,4 +94,7 @@ struct edufs_dirblock {
   char      d_name[26]; /* max is 25 chars... 1 byte for fun */
 };
 
+/* longest name that fits in d_name with its terminating NUL */
+#define EDUFS_MAXNAMLEN	25
+
 #endif
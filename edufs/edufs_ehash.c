@@ -42,67 +42,312 @@
 #include <sys/proc.h>
 #include <sys/mutex.h>
 #include <sys/mount.h>
+#include <sys/smp.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
+#include <machine/atomic.h>
+#include <vm/uma.h>
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_denode.h>
 #include <fs/edufs/edufs_enode.h>
+#include <fs/edufs/edufs_trace.h>
+
+extern uma_zone_t uma_enode;
 
 
 static MALLOC_DEFINE(M_EDUFSEHASH, "EDUFS ehash", "EDUFS Enode hashtables");
 
 /*
  * Structures associated with enode cacheing.
+ *
+ * Every mount has its own enode hash (struct edufs_ehash, hung off
+ * emp->e_ehash), so enode numbers from different filesystems never
+ * share chains.  Enode numbers are run through a 32 bit integer mixer
+ * before being masked, so runs of sequential enodes spread over the
+ * whole table instead of marching through neighbouring buckets.
+ *
+ * The table grows when the load factor goes above EHASH_MAXLOAD and
+ * shrinks when it falls below 1/EHASH_SHRINKDIV.  Resizing is done
+ * incrementally: a second table is allocated and every insert or remove
+ * moves the next EHASH_MIGRATESTEP buckets of the current table into it.
+ * Buckets below eh_split have already been moved, so for any enode the
+ * chain to search is new[h] if (h & cur_mask) < eh_split and cur[h]
+ * otherwise.  Lookups keep running the whole time.
+ */
+LIST_HEAD(ehashhead, enode);
+
+struct ehashtable {
+	struct ehashtable *et_next;	/* retired tables waiting to be freed */
+	u_long		et_mask;	/* number of buckets - 1 */
+	struct ehashhead et_heads[1];	/* et_mask + 1 chains */
+};
+
+#define	EHASH_MINBUCKETS	256	/* smallest (and initial) table */
+#define	EHASH_MAXLOAD		2	/* grow above 2 enodes per bucket */
+#define	EHASH_SHRINKDIV		4	/* shrink below 1 enode per 4 buckets */
+#define	EHASH_MIGRATESTEP	8	/* buckets moved per insert/remove */
+
+/*
+ * The hash chains are protected by an array of striped mutexes instead
+ * of a single lock.  Bucket i is covered by lock (i & eh_lockmask); both
+ * tables are always at least as big as the stripe array, so an enode is
+ * covered by the same stripe whichever table it currently lives in.
+ * Each lock is padded out to its own cache line so that neighbouring
+ * stripes don't bounce the same line between cpus.
+ *
+ * Writers (insert, remove and bucket migration) still serialize on the
+ * stripe mutex, but edufs_ehashlookup walks the chain without taking
+ * it.  Every change to a chain is bracketed by el_seq: it is odd while a
+ * writer is busy and bumped again when the writer is done, so a reader
+ * that sees the same even value before and after its walk knows nothing
+ * moved underneath it.  Starting and finishing a resize takes every
+ * stripe, so that is covered too.  Readers also advertise themselves in
+ * el_readers while they walk.  An enode that has been reclaimed while
+ * readers are active is parked on el_limbo instead of going straight back
+ * to uma_enode, and is only freed once the stripe has no readers left;
+ * retired tables are kept around on eh_retired the same way.
+ *
+ * A reader bumps el_readers and then loads the chain; a writer changes
+ * the chain and then loads el_readers.  Each side is a store followed by
+ * a load, which acquire and release atomics don't keep in order, so both
+ * have a full barrier (mb()) in between.  Otherwise a reader could walk
+ * onto an enode that the writer saw no readers for and freed.
+ *
+ * Reclamation is opportunistic: nothing waits for readers to drain.
+ * Limbo enodes are only freed by a later edufs_ehashfree() on the same
+ * stripe that finds it quiet, or at unmount, and retired tables only
+ * when a later resize starts or finishes with every stripe quiet.  A
+ * stripe that always has a reader on it, or a table that stops
+ * resizing, keeps that memory until then.
+ */
+#define	EHASH_LOCKSPERCPU	4	/* stripes per cpu */
+#define	EHASH_MAXLOCKS		1024	/* upper bound on the stripe count */
+#define	EHASH_CACHELINE		64
+#define	EHASH_READRETRIES	4	/* lockless attempts before locking */
+
+struct ehashlock {
+	struct mtx	el_mtx;
+	volatile u_int	el_seq;		/* odd while a writer is active */
+	volatile u_int	el_readers;	/* lockless readers on this stripe */
+	struct ehashhead el_limbo;	/* reclaimed, waiting for readers */
+} __aligned(EHASH_CACHELINE);
+
+struct edufs_ehash {
+	struct ehashtable * volatile eh_cur;	/* table being moved out of */
+	struct ehashtable * volatile eh_new;	/* table being moved into */
+	volatile u_long	eh_split;	/* eh_cur buckets already moved */
+	struct ehashtable *eh_retired;	/* old tables, freed when quiet */
+	volatile u_long	eh_count;	/* enodes on the chains */
+	u_long		eh_minmask;	/* never shrink below this */
+	u_long		eh_resizes;	/* completed resizes */
+	struct mtx	eh_rsmtx;	/* one resizer at a time */
+	struct ehashlock *eh_locks;
+	u_long		eh_lockmask;	/* number of stripes - 1 */
+};
+
+#define	EHASHSTRIPE(eh, h)	(&(eh)->eh_locks[(h) & (eh)->eh_lockmask])
+
+/*
+ * A full memory barrier, see the comment above struct ehashlock.  Newer
+ * kernels have mb(); this is what they use on x86.
+ */
+#ifndef mb
+#if defined(__i386__)
+#define	mb()	__asm __volatile("lock; addl $0,(%%esp)" : : : "memory")
+#elif defined(__amd64__)
+#define	mb()	__asm __volatile("lock; addl $0,(%%rsp)" : : : "memory")
+#else
+#error "edufs_ehash.c needs mb() on this platform"
+#endif
+#endif
+
+/*
+ * Open and close a chain update.  Must be called with el_mtx held.
  */
-static LIST_HEAD(ehashhead, enode) *ehashtbl;
-static u_long	ehash;		/* size of hash table - 1 */
-/* didnt want to rename inum to enum because enum is reserved... duh */
-#define	ENOHASH(device, inum)	(&ehashtbl[(minor(device) + (inum)) & ehash])
-static struct mtx edufs_ehash_mtx;
+#define	EHASH_WRITE_BEGIN(el)	atomic_add_acq_int(&(el)->el_seq, 1)
+#define	EHASH_WRITE_END(el)	atomic_add_rel_int(&(el)->el_seq, 1)
 
+static struct ehashtable *ehash_tblalloc(u_long nbuckets, int flags);
+static struct ehashhead *ehash_bucket(struct edufs_ehash *eh, u_int32_t h);
+static void ehash_lockall(struct edufs_ehash *eh);
+static void ehash_unlockall(struct edufs_ehash *eh);
+static void ehash_migrate(struct edufs_ehash *eh, u_long idx);
+static void ehash_resize(struct edufs_ehash *eh);
+static void ehash_reap(struct edufs_ehash *eh);
+static void edufs_ehashdrain(struct ehashlock *el);
 
 
 /*
- * Initialize enode hash table.
+ * Integer mixer (the murmur3 finalizer).  Every input bit affects every
+ * output bit, so the low bits used to pick a bucket are well spread even
+ * for dense runs of enode numbers.
+ */
+static __inline u_int32_t
+ehash_mix(ino_t inum)
+{
+	u_int32_t h = (u_int32_t)inum;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return (h);
+}
+
+static struct ehashtable *
+ehash_tblalloc(nbuckets, flags)
+	u_long nbuckets;
+	int flags;
+{
+	struct ehashtable *et;
+	u_long i;
+
+	et = malloc(sizeof(struct ehashtable) +
+	    (nbuckets - 1) * sizeof(struct ehashhead), M_EDUFSEHASH, flags);
+	if (et == NULL)
+		return (NULL);
+	et->et_next = NULL;
+	et->et_mask = nbuckets - 1;
+	for (i = 0; i < nbuckets; i++)
+		LIST_INIT(&et->et_heads[i]);
+	return (et);
+}
+
+/*
+ * Find the chain an enode with hash h belongs on.  The caller holds the
+ * stripe lock for h, or is a lockless reader that will validate el_seq.
+ */
+static __inline struct ehashhead *
+ehash_bucket(eh, h)
+	struct edufs_ehash *eh;
+	u_int32_t h;
+{
+	struct ehashtable *cur = eh->eh_cur;
+	struct ehashtable *new = eh->eh_new;
+
+	if (new != NULL && (h & cur->et_mask) < eh->eh_split)
+		return (&new->et_heads[h & new->et_mask]);
+	return (&cur->et_heads[h & cur->et_mask]);
+}
+
+/*
+ * Initialize a mount's enode hash table.
  */
 void
-edufs_ehashinit()
+edufs_ehashinit(emp)
+	struct edufsmount *emp;
 {
+	struct edufs_ehash *eh;
+	u_long nlocks, i;
+
+	eh = malloc(sizeof(struct edufs_ehash), M_EDUFSEHASH,
+	    M_WAITOK | M_ZERO);
 
-	ehashtbl = hashinit(desiredvnodes, M_EDUFSEHASH, &ehash);
-	mtx_init(&edufs_ehash_mtx, "ufs ehash", NULL, MTX_DEF);
+	/*
+	 * Scale the stripe count with the number of cpus, and keep it a
+	 * power of two no larger than the smallest table we'll ever use.
+	 */
+	for (nlocks = 1; nlocks < EHASH_MAXLOCKS &&
+	    nlocks < mp_ncpus * EHASH_LOCKSPERCPU; nlocks <<= 1)
+		continue;
+	eh->eh_lockmask = nlocks - 1;
+	eh->eh_minmask = MAX(nlocks, EHASH_MINBUCKETS) - 1;
+	eh->eh_locks = malloc(nlocks * sizeof(struct ehashlock),
+	    M_EDUFSEHASH, M_WAITOK | M_ZERO);
+	for (i = 0; i < nlocks; i++) {
+		/* ehash_lockall takes all of them at once */
+		mtx_init(&eh->eh_locks[i].el_mtx, "edufs ehash", NULL,
+		    MTX_DEF | MTX_DUPOK);
+		LIST_INIT(&eh->eh_locks[i].el_limbo);
+	}
+	mtx_init(&eh->eh_rsmtx, "edufs ehash resize", NULL, MTX_DEF);
+	eh->eh_cur = ehash_tblalloc(eh->eh_minmask + 1, M_WAITOK);
+	emp->e_ehash = eh;
 }
 
 /*
- * Destroy the enode hash table.
+ * Destroy a mount's enode hash table.  Every vnode has been flushed by
+ * now, so the chains are empty and nobody is reading them.
  */
 void
-edufs_ehashuninit()
+edufs_ehashuninit(emp)
+	struct edufsmount *emp;
 {
+	struct edufs_ehash *eh = emp->e_ehash;
+	struct ehashtable *et;
+	u_long i;
 
-	hashdestroy(ehashtbl, M_EDUFSEHASH, ehash);
-	mtx_destroy(&edufs_ehash_mtx);
+	for (i = 0; i <= eh->eh_lockmask; i++) {
+		mtx_lock(&eh->eh_locks[i].el_mtx);
+		edufs_ehashdrain(&eh->eh_locks[i]);
+		KASSERT(LIST_EMPTY(&eh->eh_locks[i].el_limbo),
+		    ("edufs_ehashuninit: readers still active"));
+		mtx_unlock(&eh->eh_locks[i].el_mtx);
+		mtx_destroy(&eh->eh_locks[i].el_mtx);
+	}
+	while ((et = eh->eh_retired) != NULL) {
+		eh->eh_retired = et->et_next;
+		free(et, M_EDUFSEHASH);
+	}
+	if (eh->eh_new != NULL)
+		free(eh->eh_new, M_EDUFSEHASH);
+	free(eh->eh_cur, M_EDUFSEHASH);
+	mtx_destroy(&eh->eh_rsmtx);
+	free(eh->eh_locks, M_EDUFSEHASH);
+	free(eh, M_EDUFSEHASH);
+	emp->e_ehash = NULL;
 }
 
 /*
- * Use the device/inum pair to find the incore enode, and return a pointer
+ * Use the mount/inum pair to find the incore enode, and return a pointer
  * to it. If it is in core, return it, even if it is locked.
+ *
+ * The chain is walked without the stripe mutex; see the comment above
+ * struct ehashlock.  If a writer keeps changing the stripe underneath us
+ * we give up after EHASH_READRETRIES attempts and take the lock.
  */
 struct vnode *
-edufs_ehashlookup(dev, inum)
-	dev_t dev;
+edufs_ehashlookup(emp, inum)
+	struct edufsmount *emp;
 	ino_t inum;
 {
+	struct edufs_ehash *eh = emp->e_ehash;
+	u_int32_t h = ehash_mix(inum);
+	struct ehashlock *el = EHASHSTRIPE(eh, h);
 	struct enode *ep;
+	struct vnode *vp;
+	u_int seq;
+	int tries;
 
-	mtx_lock(&edufs_ehash_mtx);
-	uprintf("LOOKUP ENOHASH = %lu\n",(minor(dev) + (inum)) & ehash);
-	LIST_FOREACH(ep, ENOHASH(dev, inum), e_hash)
-		if (inum == ep->e_number && dev == ep->e_dev)
+	ETRACE(ETR_EHASH, "LOOKUP ENOHASH = %u\n", h);
+	for (tries = 0; tries < EHASH_READRETRIES; tries++) {
+		atomic_add_int(&el->el_readers, 1);
+		mb();
+		seq = atomic_load_acq_int(&el->el_seq);
+		if (seq & 1) {
+			atomic_subtract_rel_int(&el->el_readers, 1);
+			continue;
+		}
+		LIST_FOREACH(ep, ehash_bucket(eh, h), e_hash)
+			if (inum == ep->e_number)
+				break;
+		vp = ep ? ETOV(ep) : NULLVP;
+		if (atomic_load_acq_int(&el->el_seq) == seq) {
+			atomic_subtract_rel_int(&el->el_readers, 1);
+			return (vp);
+		}
+		atomic_subtract_rel_int(&el->el_readers, 1);
+	}
+
+	mtx_lock(&el->el_mtx);
+	LIST_FOREACH(ep, ehash_bucket(eh, h), e_hash)
+		if (inum == ep->e_number)
 			break;
-	mtx_unlock(&edufs_ehash_mtx);
+	vp = ep ? ETOV(ep) : NULLVP;
+	mtx_unlock(&el->el_mtx);
 
-	if (ep)
-		return (ETOV(ep));
-	return (NULLVP);
+	return (vp);
 }
 
 
@@ -110,51 +355,64 @@ edufs_ehashlookup(dev, inum)
  * dump the enode list
  */
 void
-edufs_ehashdump(dev)
-	dev_t dev;
+edufs_ehashdump(emp)
+	struct edufsmount *emp;
 {  
+  struct edufs_ehash *eh = emp->e_ehash;
   struct enode *ep;
-  struct ehashhead *headp = ehashtbl;
+  u_long i;
   
-  uprintf("Dumping enode list\n");
-  mtx_lock(&edufs_ehash_mtx);
-  LIST_FOREACH(ep,headp,e_hash) {
-	  uprintf("--->ENODE [%d]\n",ep->e_number);
-  }				 
-  mtx_unlock(&edufs_ehash_mtx);
+  ETRACE(ETR_EHASH, "Dumping enode list\n");
+  ehash_lockall(eh);
+  for (i = 0; i <= eh->eh_cur->et_mask; i++) {
+	LIST_FOREACH(ep,&eh->eh_cur->et_heads[i],e_hash) {
+	  ETRACE(ETR_EHASH, "--->ENODE [%d]\n",ep->e_number);
+	}
+  }
+  if (eh->eh_new != NULL) {
+	for (i = 0; i <= eh->eh_new->et_mask; i++) {
+	  LIST_FOREACH(ep,&eh->eh_new->et_heads[i],e_hash) {
+		ETRACE(ETR_EHASH, "--->ENODE [%d]\n",ep->e_number);
+	  }
+	}
+  }
+  ehash_unlockall(eh);
   return;
 }
 
 /*
- * Use the device/inum pair to find the incore enode, and return a pointer
+ * Use the mount/inum pair to find the incore enode, and return a pointer
  * to it. If it is in core, but locked, wait for it.
  */
 int
-edufs_ehashget(dev, inum, flags, vpp)
-	dev_t dev;
+edufs_ehashget(emp, inum, flags, vpp)
+	struct edufsmount *emp;
 	ino_t inum;
 	int flags;
 	struct vnode **vpp;
 {
 	struct thread *td = curthread;	/* XXX */
+	struct edufs_ehash *eh = emp->e_ehash;
+	u_int32_t h = ehash_mix(inum);
+	struct mtx *lockp = &EHASHSTRIPE(eh, h)->el_mtx;
 	struct enode *ep;
 	struct vnode *vp;
 	int error;
 
 	*vpp = NULL;
 loop:
-	uprintf("Inside ehashget\n");
-	uprintf("HASHGET ENOHASH = %lu\n",(minor(dev) + (inum)) & ehash);
-	mtx_lock(&edufs_ehash_mtx);
-	LIST_FOREACH(ep, ENOHASH(dev, inum), e_hash) {
-	  uprintf(".");
-	  if (inum == ep->e_number && dev == ep->e_dev) {
+	ETRACE(ETR_EHASH, "Inside ehashget\n");
+	ETRACE(ETR_EHASH, "HASHGET ENOHASH = %u\n", h);
+	mtx_lock(lockp);
+	LIST_FOREACH(ep, ehash_bucket(eh, h), e_hash) {
+	  ETRACE(ETR_EHASH, ".");
+	  if (inum == ep->e_number) {
 			vp = ETOV(ep);
 			/*mtx_lock(&vp->v_interlock);*/
 			VI_LOCK(vp);
-			mtx_unlock(&edufs_ehash_mtx);
+			mtx_unlock(lockp);
 			error = vget(vp, flags | LK_INTERLOCK, td);
-			uprintf("got the enode");
+			ETRACE(ETR_EHASH, "got the enode");
 			if (error == ENOENT)
 			  goto loop;
 			if (error) {
@@ -165,7 +423,7 @@ loop:
 			return (0);
 	  }
 	}
-	mtx_unlock(&edufs_ehash_mtx);
+	mtx_unlock(lockp);
 
 	return (0);
 }
@@ -181,6 +439,10 @@ edufs_ehashins(ep, flags, ovpp)
 	struct vnode **ovpp;
 {
 	struct thread *td = curthread;		/* XXX */
+	struct edufs_ehash *eh = ep->e_emp->e_ehash;
+	u_int32_t h = ehash_mix(ep->e_number);
+	struct ehashlock *el = EHASHSTRIPE(eh, h);
+	struct mtx *lockp = &el->el_mtx;
 	struct ehashhead *epp;
 	struct enode *oep;
 	struct vnode *ovp;
@@ -188,19 +450,19 @@ edufs_ehashins(ep, flags, ovpp)
 
 	
 loop:
-	uprintf("EDUFS_HASHINS\n");
-	mtx_lock(&edufs_ehash_mtx);
-	epp = ENOHASH(ep->e_dev, ep->e_number);
-	uprintf("ENOHASH = %lu\n",(minor(ep->e_dev) + (ep->e_number)) & ehash);
+	ETRACE(ETR_EHASH, "EDUFS_HASHINS\n");
+	mtx_lock(lockp);
+	epp = ehash_bucket(eh, h);
+	ETRACE(ETR_EHASH, "ENOHASH = %u\n", h);
 	
 	LIST_FOREACH(oep, epp, e_hash) {
 
-	  if (ep->e_number == oep->e_number && ep->e_dev == oep->e_dev) {
+	  if (ep->e_number == oep->e_number) {
 			ovp = ETOV(oep);
 
 			mtx_lock(&ovp->v_interlock);
-			mtx_unlock(&edufs_ehash_mtx);
-			uprintf("hashins flags=[%d]",flags);
+			mtx_unlock(lockp);
+			ETRACE(ETR_EHASH, "hashins flags=[%d]",flags);
 			error = vget(ovp, flags | LK_INTERLOCK, td);
 			if (error == ENOENT) {
 			  goto loop;
@@ -213,11 +475,15 @@ loop:
 		}
 	}
 
-	uprintf("NEW ENODE INFO #[%d]\n",ep->e_number);
+	ETRACE(ETR_EHASH, "NEW ENODE INFO #[%d]\n",ep->e_number);
+	EHASH_WRITE_BEGIN(el);
 	LIST_INSERT_HEAD(epp, ep, e_hash);
+	EHASH_WRITE_END(el);
 	ep->e_flag |= EN_HASHED;
-	mtx_unlock(&edufs_ehash_mtx);
+	atomic_add_long(&eh->eh_count, 1);
+	mtx_unlock(lockp);
 
+	ehash_resize(eh);
 	*ovpp = NULL;
 	return (0);
 }
@@ -229,10 +495,257 @@ void
 edufs_ehashrem(ep)
 	struct enode *ep;
 {
-	mtx_lock(&edufs_ehash_mtx);
+	struct edufs_ehash *eh = ep->e_emp->e_ehash;
+	struct ehashlock *el = EHASHSTRIPE(eh, ehash_mix(ep->e_number));
+	int removed = 0;
+
+	mtx_lock(&el->el_mtx);
 	if (ep->e_flag & EN_HASHED) {
 		ep->e_flag &= ~EN_HASHED;
+		/*
+		 * LIST_REMOVE leaves e_hash.le_next alone, so a lockless
+		 * reader that is standing on this enode can still step off
+		 * it onto the rest of the chain.
+		 */
+		EHASH_WRITE_BEGIN(el);
 		LIST_REMOVE(ep, e_hash);
+		EHASH_WRITE_END(el);
+		atomic_subtract_long(&eh->eh_count, 1);
+		removed = 1;
+	}
+	mtx_unlock(&el->el_mtx);
+	if (removed)
+		ehash_resize(eh);
+}
+
+/*
+ * Give an enode that has already been pulled off its hash chain back to
+ * uma_enode.  If lockless readers are still walking the stripe the
+ * enode may be under one of them, so park it on the stripe's limbo list
+ * and let a later call free it once the stripe goes quiet.
+ */
+void
+edufs_ehashfree(ep)
+	struct enode *ep;
+{
+	struct edufs_ehash *eh = ep->e_emp->e_ehash;
+	struct ehashlock *el = EHASHSTRIPE(eh, ehash_mix(ep->e_number));
+
+	KASSERT((ep->e_flag & EN_HASHED) == 0,
+	    ("edufs_ehashfree: enode %d still hashed", (int)ep->e_number));
+	mtx_lock(&el->el_mtx);
+	/*
+	 * Reusing e_hash for the limbo link redirects anyone still standing
+	 * on this enode, so treat it like any other chain update.
+	 */
+	EHASH_WRITE_BEGIN(el);
+	LIST_INSERT_HEAD(&el->el_limbo, ep, e_hash);
+	EHASH_WRITE_END(el);
+	edufs_ehashdrain(el);
+	mtx_unlock(&el->el_mtx);
+}
+
+/*
+ * Free everything on the stripe's limbo list if no lockless readers are
+ * active.  The barrier keeps our chain updates ahead of the load of
+ * el_readers; if it's still in use, a later call will have to do.
+ */
+static void
+edufs_ehashdrain(el)
+	struct ehashlock *el;
+{
+	struct enode *ep;
+
+	mtx_assert(&el->el_mtx, MA_OWNED);
+	if (LIST_EMPTY(&el->el_limbo))
+		return;
+	mb();
+	if (el->el_readers != 0)
+		return;
+	while ((ep = LIST_FIRST(&el->el_limbo)) != NULL) {
+		LIST_REMOVE(ep, e_hash);
+		uma_zfree(uma_enode, ep);
+	}
+}
+
+/*
+ * Take (and release) every stripe, opening a write section on each so
+ * that lockless readers retry across the change.  Only used to start and
+ * finish a resize and for statistics, so the cost doesn't matter.
+ */
+static void
+ehash_lockall(eh)
+	struct edufs_ehash *eh;
+{
+	u_long i;
+
+	for (i = 0; i <= eh->eh_lockmask; i++) {
+		mtx_lock(&eh->eh_locks[i].el_mtx);
+		EHASH_WRITE_BEGIN(&eh->eh_locks[i]);
+	}
+}
+
+static void
+ehash_unlockall(eh)
+	struct edufs_ehash *eh;
+{
+	u_long i;
+
+	for (i = eh->eh_lockmask + 1; i-- > 0; ) {
+		EHASH_WRITE_END(&eh->eh_locks[i]);
+		mtx_unlock(&eh->eh_locks[i].el_mtx);
+	}
+}
+
+/*
+ * Move bucket idx of the current table over to the new one.
+ */
+static void
+ehash_migrate(eh, idx)
+	struct edufs_ehash *eh;
+	u_long idx;
+{
+	struct ehashtable *cur = eh->eh_cur;
+	struct ehashtable *new = eh->eh_new;
+	struct ehashlock *el = EHASHSTRIPE(eh, idx);
+	struct enode *ep;
+
+	mtx_lock(&el->el_mtx);
+	EHASH_WRITE_BEGIN(el);
+	while ((ep = LIST_FIRST(&cur->et_heads[idx])) != NULL) {
+		LIST_REMOVE(ep, e_hash);
+		LIST_INSERT_HEAD(
+		    &new->et_heads[ehash_mix(ep->e_number) & new->et_mask],
+		    ep, e_hash);
+	}
+	eh->eh_split = idx + 1;
+	EHASH_WRITE_END(el);
+	mtx_unlock(&el->el_mtx);
+}
+
+/*
+ * Called after every insert and remove, with no stripe held.  Starts a
+ * resize if the load factor is out of bounds, and otherwise pushes a
+ * resize in progress along by a few buckets.  If another thread is
+ * already doing this we just leave it to them.
+ */
+static void
+ehash_resize(eh)
+	struct edufs_ehash *eh;
+{
+	struct ehashtable *cur, *new;
+	u_long nbuckets, i;
+
+	if (!mtx_trylock(&eh->eh_rsmtx))
+		return;
+	cur = eh->eh_cur;
+	if (eh->eh_new == NULL) {
+		nbuckets = cur->et_mask + 1;
+		if (eh->eh_count > nbuckets * EHASH_MAXLOAD)
+			nbuckets <<= 1;
+		else if (cur->et_mask > eh->eh_minmask &&
+		    eh->eh_count < nbuckets / EHASH_SHRINKDIV)
+			nbuckets >>= 1;
+		else
+			goto out;
+		/* we're called with vnodes locked, so don't sleep here */
+		new = ehash_tblalloc(nbuckets, M_NOWAIT);
+		if (new == NULL)
+			goto out;
+		ehash_lockall(eh);
+		eh->eh_split = 0;
+		eh->eh_new = new;
+		ehash_reap(eh);
+		ehash_unlockall(eh);
+	}
+
+	for (i = 0; i < EHASH_MIGRATESTEP && eh->eh_split <= cur->et_mask; i++)
+		ehash_migrate(eh, eh->eh_split);
+
+	if (eh->eh_split > cur->et_mask) {
+		ehash_lockall(eh);
+		cur->et_next = eh->eh_retired;
+		eh->eh_retired = cur;
+		eh->eh_cur = eh->eh_new;
+		eh->eh_new = NULL;
+		eh->eh_resizes++;
+		ehash_reap(eh);
+		ehash_unlockall(eh);
+	}
+out:
+	mtx_unlock(&eh->eh_rsmtx);
+}
+
+/*
+ * Free retired tables once no lockless reader can still be holding a
+ * pointer into them.  Called with every stripe held, so new readers will
+ * only ever see the current tables.  As in edufs_ehashdrain(), the
+ * barrier keeps the table switch ahead of the loads of el_readers.
+ */
+static void
+ehash_reap(eh)
+	struct edufs_ehash *eh;
+{
+	struct ehashtable *et;
+	u_long i;
+
+	if (eh->eh_retired == NULL)
+		return;
+	mb();
+	for (i = 0; i <= eh->eh_lockmask; i++)
+		if (eh->eh_locks[i].el_readers != 0)
+			return;
+	while ((et = eh->eh_retired) != NULL) {
+		eh->eh_retired = et->et_next;
+		free(et, M_EDUFSEHASH);
+	}
+}
+
+/*
+ * Gather chain length statistics for the mount's enode hash.
+ */
+void
+edufs_ehashstats(emp, es)
+	struct edufsmount *emp;
+	struct edufs_ehashstats *es;
+{
+	struct edufs_ehash *eh = emp->e_ehash;
+	struct ehashtable *tables[2];
+	struct enode *ep;
+	u_long i, len;
+	int t, slot;
+
+	bzero(es, sizeof(*es));
+	ehash_lockall(eh);
+	tables[0] = eh->eh_cur;
+	tables[1] = eh->eh_new;
+	es->es_buckets = eh->eh_cur->et_mask + 1;
+	es->es_resizes = eh->eh_resizes;
+	es->es_stripes = eh->eh_lockmask + 1;
+	if (eh->eh_new != NULL) {
+		es->es_resizing = 1;
+		es->es_newbuckets = eh->eh_new->et_mask + 1;
+	}
+	/*
+	 * While a resize is in progress both tables are walked; each enode
+	 * is only on one of them, but empty buckets are counted twice.
+	 */
+	for (t = 0; t < 2 && tables[t] != NULL; t++) {
+		for (i = 0; i <= tables[t]->et_mask; i++) {
+			len = 0;
+			LIST_FOREACH(ep, &tables[t]->et_heads[i], e_hash)
+				len++;
+			es->es_entries += len;
+			if (len > 0)
+				es->es_used++;
+			if (len > es->es_maxchain)
+				es->es_maxchain = len;
+			/* 0, 1, 2-3, 4-7, ... */
+			for (slot = 0; len > 0 &&
+			    slot < EHASH_STATSLOTS - 1; len >>= 1)
+				slot++;
+			es->es_chains[slot]++;
+		}
 	}
-	mtx_unlock(&edufs_ehash_mtx);
+	ehash_unlockall(eh);
 }
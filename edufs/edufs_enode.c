@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Enode writeback.
+ *
+ * Changing an enode doesn't write it.  edufs_edirty() just puts it on
+ * its mount's dirty queue, and edufs_eflush() - run from VFS_SYNC, so
+ * from the syncer every few seconds and from sync(2) - takes the whole
+ * queue, sorts it by enode table chunk and writes every chunk once,
+ * however many of its enodes changed.  edufs_update() with waitfor set
+ * is the fsync/reclaim path: it pulls one enode off the queue and
+ * writes it out right away.
+ *
+ * e_wflag and the queue are protected by the mount's e_dirtymtx.  The
+ * flusher doesn't hold any vnode locks; an enode it has taken off the
+ * queue is marked EW_FLUSHING until its denode has been copied into the
+ * chunk buffer, and edufs_update() waits for that before it touches the
+ * queue, so the enode can't be reclaimed from under the flusher.
+ *
+ * On EDUFSMNT_LAZYTIME mounts an enode whose only change is its time
+ * stamps goes on the lazy queue instead (edufs_elazy()).  It's written
+ * when something else about it changes, on fsync, when it's reclaimed,
+ * at unmount, or once it has sat there vfs.edufs.lazytime_age seconds;
+ * edufs_sync() moves the expired ones over to the dirty queue.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mount.h>
+#include <sys/mutex.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
+#include <sys/vnode.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
+#include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_stats.h>
+#include <fs/edufs/edufs_trace.h>
+
+/* one dirty enode, keyed by the enode table chunk it lives in */
+struct eref {
+	daddr_t		er_blkno;
+	struct enode	*er_ep;
+};
+
+static int edufs_lazytime_age = 3600;
+SYSCTL_INT(_vfs_edufs, OID_AUTO, lazytime_age, CTLFLAG_RW,
+    &edufs_lazytime_age, 0, "seconds lazytime stamps may stay in core");
+
+static int	edufs_erefcmp(const void *a, const void *b);
+static int	edufs_ewrite(struct enode *ep);
+
+void
+edufs_wbinit(emp)
+	struct edufsmount *emp;
+{
+
+	mtx_init(&emp->e_dirtymtx, "edufs dirty", NULL, MTX_DEF);
+	TAILQ_INIT(&emp->e_dirty);
+	TAILQ_INIT(&emp->e_lazy);
+	emp->e_ndirty = 0;
+}
+
+void
+edufs_wbuninit(emp)
+	struct edufsmount *emp;
+{
+
+	KASSERT(TAILQ_EMPTY(&emp->e_dirty), ("edufs_wbuninit: dirty enodes"));
+	KASSERT(TAILQ_EMPTY(&emp->e_lazy), ("edufs_wbuninit: lazy enodes"));
+	mtx_destroy(&emp->e_dirtymtx);
+}
+
+/*
+ * Hand a modified enode over to writeback.  The caller holds the vnode
+ * lock, or at least its interlock; only the dirty queue mutex is taken
+ * here so it's fine to call from edufs_etimes().
+ */
+void
+edufs_edirty(ep)
+	struct enode *ep;
+{
+	struct edufsmount *emp = ep->e_emp;
+
+	if (emp->e_mountp->mnt_flag & MNT_RDONLY)
+		return;
+	ep->e_flag &= ~(EN_MODIFIED | EN_LAZYMOD);
+	mtx_lock(&emp->e_dirtymtx);
+	if (ep->e_wflag & EW_LAZY) {
+		TAILQ_REMOVE(&emp->e_lazy, ep, e_dirtylist);
+		ep->e_wflag &= ~EW_LAZY;
+	}
+	if ((ep->e_wflag & EW_QUEUED) == 0) {
+		ep->e_wflag |= EW_QUEUED;
+		TAILQ_INSERT_TAIL(&emp->e_dirty, ep, e_dirtylist);
+		emp->e_ndirty++;
+	}
+	mtx_unlock(&emp->e_dirtymtx);
+}
+
+/*
+ * Same for an enode whose only change is EN_LAZYMOD time stamps.  If
+ * it's already queued for a real write the stamps just go along.
+ */
+void
+edufs_elazy(ep)
+	struct enode *ep;
+{
+	struct edufsmount *emp = ep->e_emp;
+
+	if (emp->e_mountp->mnt_flag & MNT_RDONLY)
+		return;
+	ep->e_flag &= ~EN_LAZYMOD;
+	mtx_lock(&emp->e_dirtymtx);
+	if ((ep->e_wflag & (EW_QUEUED | EW_LAZY)) == 0) {
+		ep->e_wflag |= EW_LAZY;
+		ep->e_lazytime = time_second;
+		TAILQ_INSERT_TAIL(&emp->e_lazy, ep, e_dirtylist);
+	}
+	mtx_unlock(&emp->e_dirtymtx);
+}
+
+/*
+ * Move lazy enodes that have waited 'age' seconds or more over to the
+ * dirty queue; 0 moves them all.
+ */
+void
+edufs_elazyage(emp, age)
+	struct edufsmount *emp;
+	int age;
+{
+	struct enode *ep;
+
+	mtx_lock(&emp->e_dirtymtx);
+	while ((ep = TAILQ_FIRST(&emp->e_lazy)) != NULL &&
+	    (age == 0 || time_second - ep->e_lazytime >= age)) {
+		TAILQ_REMOVE(&emp->e_lazy, ep, e_dirtylist);
+		ep->e_wflag = (ep->e_wflag & ~EW_LAZY) | EW_QUEUED;
+		TAILQ_INSERT_TAIL(&emp->e_dirty, ep, e_dirtylist);
+		emp->e_ndirty++;
+	}
+	mtx_unlock(&emp->e_dirtymtx);
+}
+
+/*
+ * Run by edufs_sync(): expire the lazy queue, then flush.
+ */
+int
+edufs_esync(emp, waitfor)
+	struct edufsmount *emp;
+	int waitfor;
+{
+
+	if (emp->e_mntflags & EDUFSMNT_LAZYTIME)
+		edufs_elazyage(emp, edufs_lazytime_age);
+	return (edufs_eflush(emp, waitfor));
+}
+
+/*
+ * Push pending time stamps into the denode and queue it if it changed.
+ * With waitfor set the enode is written before returning.
+ */
+int
+edufs_update(vp, waitfor)
+	struct vnode *vp;
+	int waitfor;
+{
+	struct enode *ep = VTOE(vp);
+
+	edufs_etimes(vp);
+	if (vp->v_mount->mnt_flag & MNT_RDONLY)
+		return (0);
+	if (ep->e_flag & EN_MODIFIED)
+		edufs_edirty(ep);
+	else if (ep->e_flag & EN_LAZYMOD)
+		edufs_elazy(ep);
+	if (!waitfor)
+		return (0);
+	return (edufs_ewrite(ep));
+}
+
+/*
+ * Take ep off the dirty or lazy queue and write its chunk synchronously.
+ * If edufs_eflush() has it, that write may only have been started, so
+ * wait for the flush and write the chunk again anyway.
+ */
+static int
+edufs_ewrite(ep)
+	struct enode *ep;
+{
+	struct edufsmount *emp = ep->e_emp;
+	struct edufs_superblock *esb = emp->e_esb;
+	struct denode *dp;
+	struct buf *bp;
+	daddr_t blkno;
+	int error, flushed;
+
+	flushed = 0;
+	mtx_lock(&emp->e_dirtymtx);
+	while (ep->e_wflag & EW_FLUSHING) {
+		flushed = 1;
+		msleep(&ep->e_wflag, &emp->e_dirtymtx, PINOD, "edflsh", 0);
+	}
+	if (ep->e_wflag & EW_QUEUED) {
+		TAILQ_REMOVE(&emp->e_dirty, ep, e_dirtylist);
+		emp->e_ndirty--;
+	} else if (ep->e_wflag & EW_LAZY)
+		TAILQ_REMOVE(&emp->e_lazy, ep, e_dirtylist);
+	else if (!flushed) {
+		mtx_unlock(&emp->e_dirtymtx);
+		return (0);
+	}
+	ep->e_wflag &= ~(EW_QUEUED | EW_LAZY);
+	mtx_unlock(&emp->e_dirtymtx);
+
+	blkno = edufs_enodesec(&emp->e_geom, ep->e_number);
+	edufs_statsbread(emp, emp->e_devvp, blkno);
+	error = bread(emp->e_devvp, blkno, esb->fs_bps, NOCRED, &bp);
+	if (error) {
+		brelse(bp);
+		edufs_edirty(ep);
+		return (error);
+	}
+	dp = (struct denode *)bp->b_data;
+	dp[edufs_enodeslot(&emp->e_geom, ep->e_number)] = ep->e_den;
+	ES_INC(emp, ES_EWRITTEN);
+	ES_INC(emp, ES_ECHUNKWRITE);
+	ETRACE(ETR_VNOPS, "ewrite enode %d chunk %lld", (int)ep->e_number,
+	    (long long)blkno);
+	return (bwrite(bp));
+}
+
+static int
+edufs_erefcmp(a, b)
+	const void *a;
+	const void *b;
+{
+	const struct eref *ra = a, *rb = b;
+
+	if (ra->er_blkno != rb->er_blkno)
+		return (ra->er_blkno < rb->er_blkno ? -1 : 1);
+	return (0);
+}
+
+/*
+ * Write out everything on the dirty queue, one I/O per enode table
+ * chunk.  MNT_WAIT waits for the writes, anything else just starts them.
+ * The enodes stay EW_FLUSHING until their chunk's write has been issued.
+ */
+int
+edufs_eflush(emp, waitfor)
+	struct edufsmount *emp;
+	int waitfor;
+{
+	struct edufs_superblock *esb = emp->e_esb;
+	struct denode *dp;
+	struct enode *ep;
+	struct eref *refs;
+	struct buf *bp;
+	int error, err, i, j, k, n;
+
+	mtx_lock(&emp->e_dirtymtx);
+	n = emp->e_ndirty;
+	mtx_unlock(&emp->e_dirtymtx);
+	if (n == 0)
+		return (0);
+	refs = malloc(n * sizeof(*refs), M_TEMP, M_WAITOK);
+
+	/* more may have been queued meanwhile; they'll go next time */
+	mtx_lock(&emp->e_dirtymtx);
+	for (i = 0; i < n && (ep = TAILQ_FIRST(&emp->e_dirty)) != NULL; i++) {
+		TAILQ_REMOVE(&emp->e_dirty, ep, e_dirtylist);
+		emp->e_ndirty--;
+		ep->e_wflag = EW_FLUSHING;
+		refs[i].er_ep = ep;
+		refs[i].er_blkno = edufs_enodesec(&emp->e_geom, ep->e_number);
+	}
+	mtx_unlock(&emp->e_dirtymtx);
+	n = i;
+	qsort(refs, n, sizeof(*refs), edufs_erefcmp);
+
+	error = 0;
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && refs[j].er_blkno == refs[i].er_blkno;
+		    j++)
+			;
+		edufs_statsbread(emp, emp->e_devvp, refs[i].er_blkno);
+		err = bread(emp->e_devvp, refs[i].er_blkno, esb->fs_bps,
+		    NOCRED, &bp);
+		if (err)
+			brelse(bp);
+		if (err == 0) {
+			dp = (struct denode *)bp->b_data;
+			mtx_lock(&emp->e_dirtymtx);
+			for (k = i; k < j; k++)
+				dp[edufs_enodeslot(&emp->e_geom,
+				    refs[k].er_ep->e_number)] =
+				    refs[k].er_ep->e_den;
+			mtx_unlock(&emp->e_dirtymtx);
+			ES_ADD(emp, ES_EWRITTEN, j - i);
+			ES_INC(emp, ES_ECHUNKWRITE);
+			if (waitfor == MNT_WAIT)
+				err = bwrite(bp);
+			else
+				bawrite(bp);
+		}
+		mtx_lock(&emp->e_dirtymtx);
+		for (k = i; k < j; k++) {
+			ep = refs[k].er_ep;
+			if (err != 0 && (ep->e_wflag & EW_QUEUED) == 0) {
+				/* put it back for the next flush */
+				if (ep->e_wflag & EW_LAZY)
+					TAILQ_REMOVE(&emp->e_lazy, ep,
+					    e_dirtylist);
+				ep->e_wflag = (ep->e_wflag & ~EW_LAZY) |
+				    EW_QUEUED;
+				TAILQ_INSERT_TAIL(&emp->e_dirty, ep,
+				    e_dirtylist);
+				emp->e_ndirty++;
+			}
+			ep->e_wflag &= ~EW_FLUSHING;
+			wakeup(&ep->e_wflag);
+		}
+		mtx_unlock(&emp->e_dirtymtx);
+		if (err)
+			error = err;
+	}
+	ETRACE(ETR_VFS, "eflush %d enodes", n);
+	free(refs, M_TEMP);
+	return (error);
+}
@@ -32,21 +32,31 @@
 #include <sys/lock.h>
 #include <sys/queue.h>
 
+#include <fs/edufs/edufs_readahead.h>
+
 
 #define doff_t long
 
-/* most of this code if from the struct inode definition */
+/*
+ * most of this code if from the struct inode definition
+ *
+ * The on-disk denode is kept in the enode itself, first, and the zone
+ * is cache aligned, so the denode's hot fields sit in the enode's first
+ * cache line.  The hash linkage and identity follow.
+ * The denode must be included before this file.
+ */
 struct enode {
+  struct     denode e_den;             /* The on-disk denode itself. */
   LIST_ENTRY(enode) e_hash;            /* Hash chain. */
   struct	 vnode  *e_vnode;          /* Vnode associated with this inode. */
-  struct	 edufsmount *e_emp;        /* Ufsmount point associated with this inode. */
-  struct	 vnode  *e_devvp;          /* Vnode for block I/O. */
+  ino_t	     e_number;	               /* The identity of the inode. */
   u_int32_t  e_flag;	               /* flags, see below */
+  struct	 edufsmount *e_emp;        /* Ufsmount point associated with this inode. */
   struct     cdev *e_dev;	           /* Device associated with the inode. */
-  ino_t	     e_number;	               /* The identity of the inode. */
-  int	     e_effnlink;	           /* i_nlink when I/O completes */  
+  struct	 vnode  *e_devvp;          /* Vnode for block I/O. */
   struct	 edufs_superblock *e_fs;   /* Associated filesystem superblock. */
   struct	 lockf *e_lockf;           /* Head of byte-level lock list. */
+  int	     e_effnlink;	           /* i_nlink when I/O completes */  
 
   /*
    * Side effects; used during directory lookup.
@@ -64,38 +74,131 @@ struct enode {
   /* unused at the moment */
   struct dirhash *dirhash; /* Hashing for large directories. */
 
-  /*
-   * Copies from the on-disk dinode itself.
-   */
-  u_int16_t e_mode;	                   /* IFMT, permissions; see below. */
-  int16_t	e_nlink;	               /* File link count. */
-  u_int64_t e_size;	                   /* File byte count. */
-  u_int32_t e_flags;	               /* Status flags (chflags). */
-  int64_t	e_gen;	                   /* Generation number. */
-  u_int32_t e_uid;	                   /* File owner. */
-  u_int32_t e_gid;	                   /* File group. */
-
-  struct denode *den;
+  TAILQ_ENTRY(enode) e_dirtylist;      /* Mount's dirty or lazy queue. */
+  u_int32_t  e_wflag;                  /* writeback state, see below */
+  time_t     e_lazytime;               /* when it went on the lazy queue */
+  struct     edufs_excache *e_excache; /* see edufs_bmap.c, NULL if none */
+  struct     edufs_ra e_ra;            /* read pattern, see edufs_read() */
 };
 
+/*
+ * Cached block map extents: logical blocks ex_lbn to ex_lbn + ex_len - 1
+ * of the file are at device sector ex_pbn onwards.  The extents in a
+ * cache are kept sorted by ex_lbn and never overlap.
+ */
+#define	EDUFS_NEXTENT	8
+struct edufs_extent {
+  daddr_t    ex_lbn;
+  daddr_t    ex_pbn;
+  int        ex_len;
+  u_int      ex_tick;                  /* xc_tick when last used */
+};
+
+struct edufs_excache {
+  TAILQ_ENTRY(edufs_excache) xc_lru;   /* mount's e_exlru */
+  struct     enode *xc_ep;
+  int        xc_n;                     /* extents in use */
+  u_int      xc_tick;
+  struct     edufs_extent xc_ext[EDUFS_NEXTENT];
+};
+
+/* shorthands for the denode fields, like the old i_din ones */
+#define	e_mode		e_den.de_mode
+#define	e_nlink		e_den.de_nlink
+#define	e_uid		e_den.de_uid
+#define	e_gid		e_den.de_gid
+#define	e_flags		e_den.de_flags
+#define	e_size		e_den.de_size
+#define	e_blocks	e_den.de_blocks
+#define	e_gen		e_den.de_gen
+
 /* renamed these for edufs so they were easier to find in the headers */
 #define	EN_ACCESS	0x0001		/* Access time update request. */
 #define	EN_CHANGE	0x0002		/* Inode change time update request. */
 #define	EN_UPDATE	0x0004		/* Modification time update request. */
-#define	EN_MODIFIED	0x0008		/* Inode has been modified. */
+#define	EN_MODIFIED	0x0008		/* More than the time stamps changed. */
 #define	EN_RENAME	0x0010		/* Inode is being renamed. */
 #define	EN_HASHED	0x0020		/* Inode is on hash list */
 #define	EN_LAZYMOD	0x0040		/* Modified, but don't write yet. */
 #define	EN_SPACECOUNTED	0x0080		/* Blocks to be freed in free count. */
 
-void edufs_ehashinit(void);
-void edufs_ehashuninit(void);
-struct vnode *edufs_ehashlookup(dev_t dev, ino_t inum);
-int edufs_ehashget(dev_t dev, ino_t inum, int flags, struct vnode **vpp);
+/* edufs_balloc flags */
+#define	EB_CLRBUF	0x0001		/* Read in an existing block. */
+
+/* e_wflag, protected by the mount's e_dirtymtx (see edufs_enode.c) */
+#define	EW_QUEUED	0x0001		/* On the dirty queue. */
+#define	EW_FLUSHING	0x0002		/* Being copied out by edufs_eflush. */
+#define	EW_LAZY		0x0004		/* On the lazy queue. */
+
+/* enode hash chain length statistics, see edufs_ehashstats() */
+#define	EHASH_STATSLOTS	8		/* chains of 0, 1, 2-3, ... 64+ */
+struct edufs_ehashstats {
+  u_long es_buckets;                   /* buckets in the current table */
+  u_long es_newbuckets;                /* buckets in the table being filled */
+  int    es_resizing;                  /* resize in progress */
+  u_long es_resizes;                   /* completed resizes */
+  u_long es_stripes;                   /* number of chain locks */
+  u_long es_entries;                   /* enodes on the chains */
+  u_long es_used;                      /* non-empty buckets */
+  u_long es_maxchain;                  /* longest chain */
+  u_long es_chains[EHASH_STATSLOTS];   /* log2 histogram of chain lengths */
+};
+
+struct buf;
+struct cg;
+struct edufs_cgmap;
+struct edufs_dextent;
+struct edufs_geom;
+struct edufsmount;
+struct thread;
+
+void edufs_ehashinit(struct edufsmount *emp);
+void edufs_ehashuninit(struct edufsmount *emp);
+struct vnode *edufs_ehashlookup(struct edufsmount *emp, ino_t inum);
+int edufs_ehashget(struct edufsmount *emp, ino_t inum, int flags, struct vnode **vpp);
 int edufs_ehashins(struct enode *ep, int flags, struct vnode **ovpp);
 void edufs_ehashrem(struct enode *ep);
-void edufs_ehashdump(dev_t dev);
-/*int edufs_update(struct vnode *vp, int waitfor);*/
+void edufs_ehashfree(struct enode *ep);
+void edufs_ehashdump(struct edufsmount *emp);
+void edufs_ehashstats(struct edufsmount *emp, struct edufs_ehashstats *es);
+void edufs_wbinit(struct edufsmount *emp);
+void edufs_wbuninit(struct edufsmount *emp);
+void edufs_edirty(struct enode *ep);
+void edufs_elazy(struct enode *ep);
+void edufs_elazyage(struct edufsmount *emp, int age);
+int edufs_update(struct vnode *vp, int waitfor);
+int edufs_eflush(struct edufsmount *emp, int waitfor);
+int edufs_esync(struct edufsmount *emp, int waitfor);
+void edufs_etimes(struct vnode *vp);
+int edufs_blkalloc(struct edufsmount *emp, int32_t pref, int32_t *offp);
+void edufs_clusterinit(struct edufsmount *emp, struct edufs_cgmap *cm);
+int edufs_enodealloc(struct vnode *pvp, int mode, ino_t *inop);
+int edufs_blkfree(struct edufsmount *emp, int32_t off);
+int edufs_enodefree(struct edufsmount *emp, ino_t ino, int mode);
+int edufs_freeblocks(struct vnode *vp, struct thread *td);
+int edufs_balloc(struct vnode *vp, daddr_t lbn, int flags, struct buf **bpp);
+int edufs_getlbns(const struct edufs_geom *g, daddr_t lbn, int *slotp,
+    int idx[NIADDR]);
+int edufs_bmaparray(struct vnode *vp, daddr_t bn, daddr_t *bnp, int *runp,
+    int *runb);
+void edufs_exinit(struct edufsmount *emp);
+void edufs_exuninit(struct edufsmount *emp);
+void edufs_exinval(struct enode *ep, daddr_t lbn);
+void edufs_expurge(struct enode *ep);
+int edufs_dxlookup(struct enode *ep, daddr_t lbn, struct edufs_dextent *xp);
+int edufs_dxalloc(struct enode *ep, daddr_t lbn, int32_t *offp, int *newp);
+int edufs_dxfree(struct enode *ep);
+int edufs_inlinepromote(struct vnode *vp);
+int edufs_cginit(struct edufsmount *emp);
+void edufs_cguninit(struct edufsmount *emp);
+void edufs_cgmod(struct edufsmount *emp, struct cg *cgp);
+void edufs_cstotal(struct edufsmount *emp, struct ecsum_total *cs);
+#ifdef DIAGNOSTIC
+void edufs_cscheck(struct edufsmount *emp);
+#endif
+int edufs_cgflush(struct edufsmount *emp, int waitfor);
+int edufs_cgmapget(struct edufsmount *emp, int c, struct edufs_cgmap **cmp);
+int edufs_sbupdate(struct edufsmount *emp, int waitfor);
 
 #ifdef _KERNEL
 
@@ -103,6 +206,15 @@ void edufs_ehashdump(dev_t dev);
 #define VTOE(vp)	((struct enode *)(vp)->v_data)
 #define ETOV(ep)	((ep)->e_vnode)
 
+#define	MAKEIMODE(indx, mode)	(int)(VTTOIF(indx) | (mode))
+
+struct componentname;
+struct vop_cachedlookup_args;
+
+int edufs_lookup(struct vop_cachedlookup_args *ap);
+int edufs_direnter(struct vnode *dvp, ino_t ino, int type,
+    struct componentname *cnp);
+
 
 #endif /* _KERNEL */
 
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Extent mapped files.
+ *
+ * On a file system made with newfs_edufs -E (FS_EXTENTS), a file that
+ * gets its first block becomes extent mapped: its block pointer area
+ * holds the root of a B+tree of extents instead (see edufs_denode.h).
+ * Four extents fit in the denode itself, which covers most files the
+ * block allocator keeps contiguous.  When the root fills up its
+ * entries move down into a node block and the root points at that;
+ * a full node splits in two, and the new node goes in its parent
+ * beside the old one.  So the tree only ever gets deeper at the root.
+ *
+ * Node blocks are read and written through the device vnode like
+ * indirect blocks.  A new node is written before anything points at
+ * it.  Only appending to a leaf extent and inserting a new one are
+ * needed, since blocks are never moved once allocated; they are only
+ * all freed together, by edufs_dxfree().
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/lock.h>
+#include <sys/mount.h>
+#include <sys/mutex.h>
+#include <sys/sx.h>
+#include <sys/vnode.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
+#include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_trace.h>
+
+CTASSERT(sizeof(struct edufs_dxhdr) +
+    EDUFS_NROOTEXT * sizeof(struct edufs_dextent) <= EDUFS_MAXINLINE);
+
+static int edufs_dxfind(const struct edufs_dxhdr *dh, daddr_t lbn);
+static int edufs_dxread(struct enode *ep, int32_t off, struct buf **bpp);
+static int edufs_dxnode(struct enode *ep, int32_t pref, int32_t *offp,
+    struct buf **bpp);
+static int edufs_dxins(struct enode *ep, struct edufs_dxhdr *dh, int max,
+    daddr_t lbn, int32_t off, struct edufs_dextent *sibp);
+static int edufs_dxput(struct enode *ep, struct edufs_dxhdr *dh, int max,
+    int pos, const struct edufs_dextent *dx, struct edufs_dextent *sibp);
+static int edufs_dxfree1(struct enode *ep, struct edufs_dxhdr *dh, int *np);
+
+/* the last entry of dh starting at or before lbn, -1 if none */
+static int
+edufs_dxfind(dh, lbn)
+	const struct edufs_dxhdr *dh;
+	daddr_t lbn;
+{
+	const struct edufs_dextent *dx = DX_ENTRY(dh);
+	int hi, lo, mid;
+
+	lo = 0;
+	hi = dh->dh_n - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (dx[mid].dx_lbn <= lbn)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return (hi);
+}
+
+/* read the node block at off, checking it could be one */
+static int
+edufs_dxread(ep, off, bpp)
+	struct enode *ep;
+	int32_t off;
+	struct buf **bpp;
+{
+	struct edufsmount *emp = ep->e_emp;
+	int bsize = emp->e_esb->fs_bsize;
+	int error;
+
+	error = bread(emp->e_devvp, edufs_btosec(&emp->e_geom, off), bsize,
+	    NOCRED, bpp);
+	if (error == 0 && ((struct edufs_dxhdr *)(*bpp)->b_data)->dh_n >
+	    EDUFS_NODEEXT(bsize)) {
+		printf("edufs: enode %d: bad extent node at %d\n",
+		    (int)ep->e_number, off);
+		error = EIO;
+	}
+	if (error) {
+		brelse(*bpp);
+		*bpp = NULL;
+	}
+	return (error);
+}
+
+/*
+ * Find the extent holding logical block lbn of ep and copy it to *xp.
+ * xp->dx_len is 0 if lbn is a hole.
+ */
+int
+edufs_dxlookup(ep, lbn, xp)
+	struct enode *ep;
+	daddr_t lbn;
+	struct edufs_dextent *xp;
+{
+	struct edufs_dxhdr *dh;
+	struct edufs_dextent *dx;
+	struct buf *bp, *nbp;
+	int error, i;
+
+	xp->dx_len = 0;
+	dh = DE_DXROOT(&ep->e_den);
+	bp = NULL;
+	for (;;) {
+		if ((i = edufs_dxfind(dh, lbn)) < 0)
+			break;
+		dx = &DX_ENTRY(dh)[i];
+		if (dh->dh_depth == 0) {
+			if (lbn < (daddr_t)dx->dx_lbn + dx->dx_len)
+				*xp = *dx;
+			break;
+		}
+		error = edufs_dxread(ep, dx->dx_off, &nbp);
+		if (bp != NULL)
+			bqrelse(bp);
+		if (error)
+			return (error);
+		bp = nbp;
+		dh = (struct edufs_dxhdr *)bp->b_data;
+	}
+	if (bp != NULL)
+		bqrelse(bp);
+	return (0);
+}
+
+/*
+ * Get the block at logical block lbn of extent mapped ep, allocating
+ * it if there isn't one.  *offp gets its byte offset; *newp is set if
+ * it was just allocated.
+ */
+int
+edufs_dxalloc(ep, lbn, offp, newp)
+	struct enode *ep;
+	daddr_t lbn;
+	int32_t *offp;
+	int *newp;
+{
+	struct edufsmount *emp = ep->e_emp;
+	struct edufs_dextent dx, sib;
+	int32_t off, pref;
+	int error;
+
+	*newp = 0;
+	if ((error = edufs_dxlookup(ep, lbn, &dx)) != 0)
+		return (error);
+	if (dx.dx_len != 0) {
+		*offp = dx.dx_off + (lbn - dx.dx_lbn) * emp->e_esb->fs_bsize;
+		return (0);
+	}
+	/* right after the block before it, so its extent grows */
+	pref = 0;
+	if (lbn > 0 && (error = edufs_dxlookup(ep, lbn - 1, &dx)) == 0 &&
+	    dx.dx_len != 0)
+		pref = dx.dx_off + (lbn - 1 - dx.dx_lbn) * emp->e_esb->fs_bsize;
+	if ((error = edufs_blkalloc(emp, pref, &off)) != 0)
+		return (error);
+	error = edufs_dxins(ep, DE_DXROOT(&ep->e_den), EDUFS_NROOTEXT, lbn,
+	    off, &sib);
+	if (error) {
+		(void)edufs_blkfree(emp, off);
+		return (error);
+	}
+	KASSERT(sib.dx_off == 0, ("edufs_dxalloc: root split"));
+	ep->e_blocks++;
+	ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+	*offp = off;
+	*newp = 1;
+	return (0);
+}
+
+/*
+ * Allocate a node block near pref and hand back its buffer, zeroed.
+ * The caller fills it in and writes it before linking it in.
+ */
+static int
+edufs_dxnode(ep, pref, offp, bpp)
+	struct enode *ep;
+	int32_t pref;
+	int32_t *offp;
+	struct buf **bpp;
+{
+	struct edufsmount *emp = ep->e_emp;
+	int error;
+
+	if ((error = edufs_blkalloc(emp, pref, offp)) != 0)
+		return (error);
+	*bpp = getblk(emp->e_devvp, edufs_btosec(&emp->e_geom, *offp),
+	    emp->e_esb->fs_bsize, 0, 0, 0);
+	vfs_bio_clrbuf(*bpp);
+	return (0);
+}
+
+/*
+ * Map lbn to the block at off in the subtree under dh, which has room
+ * for max entries.  If dh has to split, *sibp is the entry for the new
+ * node, to go in dh's parent after dh's; otherwise sibp->dx_off is 0.
+ */
+static int
+edufs_dxins(ep, dh, max, lbn, off, sibp)
+	struct enode *ep;
+	struct edufs_dxhdr *dh;
+	int max;
+	daddr_t lbn;
+	int32_t off;
+	struct edufs_dextent *sibp;
+{
+	int bsize = ep->e_fs->fs_bsize;
+	struct edufs_dextent *dx = DX_ENTRY(dh);
+	struct edufs_dextent nx, sib;
+	struct buf *bp;
+	int error, i;
+
+	sibp->dx_off = 0;
+	i = edufs_dxfind(dh, lbn);
+	if (dh->dh_depth == 0) {
+		if (i >= 0 && dx[i].dx_lbn + dx[i].dx_len == lbn &&
+		    dx[i].dx_off + (int64_t)dx[i].dx_len * bsize == off) {
+			dx[i].dx_len++;
+			return (0);
+		}
+		nx.dx_lbn = lbn;
+		nx.dx_off = off;
+		nx.dx_len = 1;
+		return (edufs_dxput(ep, dh, max, i + 1, &nx, sibp));
+	}
+
+	if (i < 0) {
+		/* before anything in the tree: the first node takes it */
+		i = 0;
+		dx[0].dx_lbn = lbn;
+	}
+	if ((error = edufs_dxread(ep, dx[i].dx_off, &bp)) != 0)
+		return (error);
+	error = edufs_dxins(ep, (struct edufs_dxhdr *)bp->b_data,
+	    EDUFS_NODEEXT(bsize), lbn, off, &sib);
+	if (error) {
+		bqrelse(bp);
+		return (error);
+	}
+	bdwrite(bp);
+	if (sib.dx_off == 0)
+		return (0);
+	return (edufs_dxput(ep, dh, max, i + 1, &sib, sibp));
+}
+
+/*
+ * Put dx in dh at position pos.  A full root moves down a level; any
+ * other full node splits, as described for edufs_dxins().
+ */
+static int
+edufs_dxput(ep, dh, max, pos, dx, sibp)
+	struct enode *ep;
+	struct edufs_dxhdr *dh;
+	int max;
+	int pos;
+	const struct edufs_dextent *dx;
+	struct edufs_dextent *sibp;
+{
+	int nodemax = EDUFS_NODEEXT(ep->e_fs->fs_bsize);
+	struct edufs_dextent *ents = DX_ENTRY(dh);
+	struct edufs_dextent *nents, none;
+	struct edufs_dxhdr *ndh;
+	struct buf *bp;
+	u_int32_t first;
+	int32_t noff;
+	int error, half, i;
+
+	sibp->dx_off = 0;
+	if (dh->dh_n < max) {
+		for (i = dh->dh_n; i > pos; i--)
+			ents[i] = ents[i - 1];
+		ents[pos] = *dx;
+		dh->dh_n++;
+		return (0);
+	}
+
+	if ((error = edufs_dxnode(ep, dx->dx_off, &noff, &bp)) != 0)
+		return (error);
+	ndh = (struct edufs_dxhdr *)bp->b_data;
+	nents = DX_ENTRY(ndh);
+	ndh->dh_depth = dh->dh_depth;
+
+	if (dh == DE_DXROOT(&ep->e_den)) {
+		/* the root is full: its entries move down into the new node */
+		ndh->dh_n = dh->dh_n;
+		bcopy(ents, nents, dh->dh_n * sizeof(*ents));
+		(void)edufs_dxput(ep, ndh, nodemax, pos, dx, &none);
+		first = nents[0].dx_lbn;
+		if ((error = bwrite(bp)) != 0) {
+			(void)edufs_blkfree(ep->e_emp, noff);
+			return (error);
+		}
+		dh->dh_n = 1;
+		dh->dh_depth++;
+		ents[0].dx_lbn = first;
+		ents[0].dx_off = noff;
+		ents[0].dx_len = 0;
+		ep->e_blocks++;
+		ETRACE(ETR_ALLOC, "enode %d: extent tree now %d deep",
+		    (int)ep->e_number, dh->dh_depth);
+		return (0);
+	}
+
+	/* split, the upper half going to the new node */
+	half = max / 2;
+	ndh->dh_n = dh->dh_n - half;
+	bcopy(&ents[half], nents, ndh->dh_n * sizeof(*ents));
+	if (pos > half)
+		(void)edufs_dxput(ep, ndh, nodemax, pos - half, dx, &none);
+	first = nents[0].dx_lbn;
+	if ((error = bwrite(bp)) != 0) {
+		(void)edufs_blkfree(ep->e_emp, noff);
+		return (error);
+	}
+	dh->dh_n = half;
+	if (pos <= half)
+		(void)edufs_dxput(ep, dh, max, pos, dx, &none);
+	ep->e_blocks++;
+	sibp->dx_lbn = first;
+	sibp->dx_off = noff;
+	sibp->dx_len = 0;
+	return (0);
+}
+
+/*
+ * Free all of extent mapped ep's blocks and its tree, leaving it with
+ * an empty root.
+ */
+int
+edufs_dxfree(ep)
+	struct enode *ep;
+{
+	int error, n;
+
+	n = 0;
+	error = edufs_dxfree1(ep, DE_DXROOT(&ep->e_den), &n);
+	ep->e_blocks -= n;
+	if (error == 0)
+		bzero(DE_INLINEPTR(&ep->e_den), EDUFS_MAXINLINE);
+	return (error);
+}
+
+static int
+edufs_dxfree1(ep, dh, np)
+	struct enode *ep;
+	struct edufs_dxhdr *dh;
+	int *np;
+{
+	struct edufsmount *emp = ep->e_emp;
+	int bsize = emp->e_esb->fs_bsize;
+	struct edufs_dextent *dx;
+	struct buf *bp;
+	int error, i;
+
+	for (; dh->dh_n > 0; dh->dh_n--) {
+		dx = &DX_ENTRY(dh)[dh->dh_n - 1];
+		if (dh->dh_depth == 0) {
+			for (; dx->dx_len > 0; dx->dx_len--) {
+				error = edufs_blkfree(emp,
+				    dx->dx_off + (dx->dx_len - 1) * bsize);
+				if (error)
+					return (error);
+				(*np)++;
+			}
+			continue;
+		}
+		if ((error = edufs_dxread(ep, dx->dx_off, &bp)) != 0)
+			return (error);
+		error = edufs_dxfree1(ep, (struct edufs_dxhdr *)bp->b_data,
+		    np);
+		if (error) {
+			bqrelse(bp);
+			return (error);
+		}
+		bp->b_flags |= B_INVAL | B_NOCACHE;
+		brelse(bp);
+		if ((error = edufs_blkfree(emp, dx->dx_off)) != 0)
+			return (error);
+		(*np)++;
+	}
+	return (0);
+}
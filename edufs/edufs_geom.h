@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Address translation.
+ *
+ * Everything on an edufs disk is found by byte offset: de_db[] and the
+ * cg_*off fields hold offsets, while the buffer cache wants sector
+ * (fs_bps) numbers and logical block numbers, and enodes are found by
+ * cg and index.  struct edufs_geom turns the superblock's sizes into
+ * shifts and masks once - in domount, and in newfs_edufs once the cgs
+ * are laid out - and the inlines below do every conversion, so nothing
+ * divides by a block size on the I/O paths.
+ *
+ * fs_bsize and fs_bps must be powers of two.  fs_epg needn't be; when
+ * it isn't the enode helpers divide.
+ */
+
+#ifndef _EDUFS_GEOM_H_
+#define	_EDUFS_GEOM_H_
+
+#ifdef _KERNEL
+#include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs.h>
+#endif
+
+struct edufs_geom {
+	int32_t	g_bshift;		/* log2(fs_bsize) */
+	int32_t	g_bmask;		/* fs_bsize - 1 */
+	int32_t	g_sshift;		/* log2(fs_bps) */
+	int32_t	g_smask;		/* fs_bps - 1 */
+	int32_t	g_nindir;		/* pointers per indirect block */
+	int32_t	g_nishift;		/* log2(g_nindir) */
+	int32_t	g_epg;			/* fs_epg */
+	int32_t	g_eshift;		/* log2(fs_epg), -1 if not a power of 2 */
+	int32_t	g_ncg;			/* fs_ncg */
+	const struct cg *g_cg;		/* per cg base offsets (the cglist) */
+};
+
+/* log2(x), or -1 if x isn't a power of two */
+static __inline int
+edufs_ilog2(int32_t x)
+{
+	int n;
+
+	if (x <= 0 || (x & (x - 1)) != 0)
+		return (-1);
+	for (n = 0; (1 << n) != x; n++)
+		;
+	return (n);
+}
+
+static __inline int
+edufs_geominit(struct edufs_geom *g, const struct edufs_superblock *esb,
+    const struct cg *cgs)
+{
+
+	g->g_bshift = edufs_ilog2(esb->fs_bsize);
+	g->g_sshift = edufs_ilog2(esb->fs_bps);
+	if (g->g_bshift < 0 || g->g_sshift < 0 || esb->fs_epg <= 0 ||
+	    esb->fs_bps % sizeof(struct denode) != 0)
+		return (EINVAL);
+	g->g_bmask = esb->fs_bsize - 1;
+	g->g_smask = esb->fs_bps - 1;
+	g->g_nindir = esb->fs_bsize / sizeof(edufs_daddr_t);
+	g->g_nishift = edufs_ilog2(g->g_nindir);
+	g->g_epg = esb->fs_epg;
+	g->g_eshift = edufs_ilog2(esb->fs_epg);
+	g->g_ncg = esb->fs_ncg;
+	g->g_cg = cgs;
+	return (0);
+}
+
+/*
+ * The largest file that de_db[] and three levels of indirection can
+ * map.  With fs_bsize at most MAXBSIZE this can't overflow.
+ */
+static __inline u_int64_t
+edufs_maxfilesize(const struct edufs_geom *g)
+{
+	u_int64_t nblk, span;
+	int i;
+
+	nblk = NDADDR;
+	for (span = 1, i = 0; i < NIADDR; i++) {
+		span <<= g->g_nishift;
+		nblk += span;
+	}
+	return (nblk << g->g_bshift);
+}
+
+/* byte offset to sector number, for the device vnode */
+static __inline daddr_t
+edufs_btosec(const struct edufs_geom *g, off_t off)
+{
+
+	return (off >> g->g_sshift);
+}
+
+/* byte offset in a file to logical block, and offset in that block */
+static __inline daddr_t
+edufs_lblkno(const struct edufs_geom *g, off_t off)
+{
+
+	return (off >> g->g_bshift);
+}
+
+static __inline int32_t
+edufs_blkoff(const struct edufs_geom *g, off_t off)
+{
+
+	return ((int32_t)(off & g->g_bmask));
+}
+
+static __inline off_t
+edufs_lblktob(const struct edufs_geom *g, daddr_t lbn)
+{
+
+	return ((off_t)lbn << g->g_bshift);
+}
+
+/* data block b of cg c, as the byte offset de_db[] holds */
+static __inline off_t
+edufs_dblkoff(const struct edufs_geom *g, int c, int32_t b)
+{
+
+	return (g->g_cg[c].cg_dboff + ((off_t)b << g->g_bshift));
+}
+
+/*
+ * The cg whose data area holds byte offset off, or -1, and which of its
+ * blocks that is.  cgs needn't be evenly spaced, so this is a binary
+ * search of the cg_dboffs.
+ */
+static __inline int
+edufs_dtog(const struct edufs_geom *g, off_t off)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = g->g_ncg - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (g->g_cg[mid].cg_dboff <= off)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	if (off < g->g_cg[lo].cg_dboff ||
+	    ((off - g->g_cg[lo].cg_dboff) >> g->g_bshift) >=
+	    g->g_cg[lo].cg_ndblk)
+		return (-1);
+	return (lo);
+}
+
+static __inline int32_t
+edufs_dtogd(const struct edufs_geom *g, int c, off_t off)
+{
+
+	return ((int32_t)((off - g->g_cg[c].cg_dboff) >> g->g_bshift));
+}
+
+/* which cg enode ino is in, and its index there */
+static __inline int
+edufs_ino_cg(const struct edufs_geom *g, ino_t ino)
+{
+
+	if (g->g_eshift >= 0)
+		return (ino >> g->g_eshift);
+	return (ino / g->g_epg);
+}
+
+static __inline int
+edufs_ino_idx(const struct edufs_geom *g, ino_t ino)
+{
+
+	if (g->g_eshift >= 0)
+		return (ino & (g->g_epg - 1));
+	return (ino % g->g_epg);
+}
+
+/* byte offset of enode ino's denode */
+static __inline off_t
+edufs_enodeoff(const struct edufs_geom *g, ino_t ino)
+{
+
+	return (g->g_cg[edufs_ino_cg(g, ino)].cg_enodeoff +
+	    (off_t)edufs_ino_idx(g, ino) * sizeof(struct denode));
+}
+
+/* the sector (enode table "chunk") holding it, and its slot there */
+static __inline daddr_t
+edufs_enodesec(const struct edufs_geom *g, ino_t ino)
+{
+
+	return (edufs_btosec(g, edufs_enodeoff(g, ino)));
+}
+
+static __inline int
+edufs_enodeslot(const struct edufs_geom *g, ino_t ino)
+{
+
+	return ((int)(edufs_enodeoff(g, ino) & g->g_smask) /
+	    sizeof(struct denode));
+}
+
+#endif /* !_EDUFS_GEOM_H_ */
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Directory lookup and entry creation.
+ *
+ * A directory is an array of fixed size struct edufs_dirblock entries,
+ * e_size bytes long; a slot with d_type 0 is free.  Entries never
+ * straddle a block since fs_bsize is a multiple of the entry size.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mount.h>
+#include <sys/mutex.h>
+#include <sys/namei.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/vnode.h>
+
+#include <vm/vm.h>
+#include <vm/vnode_pager.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
+#include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_dir.h>
+#include <fs/edufs/edufs_stats.h>
+#include <fs/edufs/edufs_trace.h>
+
+static int edufs_dirlookup(struct vnode *vp, char *name, int namelen,
+    ino_t *inop);
+
+/*
+ * Look name up in directory vp; its enode number goes in *inop.
+ */
+static int
+edufs_dirlookup(vp, name, namelen, inop)
+	struct vnode *vp;
+	char *name;
+	int namelen;
+	ino_t *inop;
+{
+	struct enode *dp = VTOE(vp);
+	struct edufsmount *emp = dp->e_emp;
+	struct edufs_superblock *esb = dp->e_fs;
+	struct edufs_dirblock *db;
+	struct buf *bp;
+	off_t off;
+	daddr_t lbn;
+	int error;
+
+	bp = NULL;
+	for (off = 0; off < dp->e_size; off += sizeof(*db)) {
+		lbn = edufs_lblkno(&emp->e_geom, off);
+		if (bp == NULL || bp->b_lblkno != lbn) {
+			if (bp != NULL)
+				brelse(bp);
+			edufs_statsbread(emp, vp, lbn);
+			error = bread(vp, lbn, esb->fs_bsize, NOCRED, &bp);
+			if (error) {
+				brelse(bp);
+				return (error);
+			}
+		}
+		db = (struct edufs_dirblock *)(bp->b_data +
+		    edufs_blkoff(&emp->e_geom, off));
+		if (db->d_type != 0 && db->d_namelen == namelen &&
+		    bcmp(db->d_name, name, namelen) == 0) {
+			*inop = db->d_eno;
+			brelse(bp);
+			return (0);
+		}
+	}
+	if (bp != NULL)
+		brelse(bp);
+	return (ENOENT);
+}
+
+/*
+ * vfs_cache_lookup() has checked search permission and the name cache;
+ * this is the miss path.  Locking follows ufs_lookup().
+ */
+int
+edufs_lookup(ap)
+	struct vop_cachedlookup_args /* {
+		struct vnode *a_dvp;
+		struct vnode **a_vpp;
+		struct componentname *a_cnp;
+	} */ *ap;
+{
+	struct vnode *vdp = ap->a_dvp;
+	struct vnode **vpp = ap->a_vpp;
+	struct componentname *cnp = ap->a_cnp;
+	struct thread *td = cnp->cn_thread;
+	struct enode *dp = VTOE(vdp);
+	struct vnode *tdp;
+	ino_t ino;
+	int error, flags, lockparent, nameiop;
+
+	ETRACE(ETR_VNOPS, "EDUFS_LOOKUP\n");
+	*vpp = NULL;
+	flags = cnp->cn_flags;
+	nameiop = cnp->cn_nameiop;
+	lockparent = flags & LOCKPARENT;
+	cnp->cn_flags &= ~PDIRUNLOCK;
+
+	error = edufs_dirlookup(vdp, cnp->cn_nameptr, cnp->cn_namelen, &ino);
+	if (error == ENOENT) {
+		if ((nameiop == CREATE || nameiop == RENAME) &&
+		    (flags & ISLASTCN)) {
+			if (vdp->v_mount->mnt_flag & MNT_RDONLY)
+				return (EROFS);
+			error = VOP_ACCESS(vdp, VWRITE, cnp->cn_cred, td);
+			if (error)
+				return (error);
+			/* edufs_direnter() finds the slot again */
+			cnp->cn_flags |= SAVENAME;
+			if (!lockparent) {
+				VOP_UNLOCK(vdp, 0, td);
+				cnp->cn_flags |= PDIRUNLOCK;
+			}
+			return (EJUSTRETURN);
+		}
+		if ((cnp->cn_flags & MAKEENTRY) && nameiop != CREATE)
+			cache_enter(vdp, NULL, cnp);
+		return (ENOENT);
+	}
+	if (error)
+		return (error);
+
+	if ((nameiop == DELETE || nameiop == RENAME) && (flags & ISLASTCN)) {
+		if (vdp->v_mount->mnt_flag & MNT_RDONLY)
+			return (EROFS);
+		error = VOP_ACCESS(vdp, VWRITE, cnp->cn_cred, td);
+		if (error)
+			return (error);
+	}
+
+	if (flags & ISDOTDOT) {
+		/* unlock the parent first, or we can deadlock with a child */
+		VOP_UNLOCK(vdp, 0, td);
+		cnp->cn_flags |= PDIRUNLOCK;
+		error = VFS_VGET(vdp->v_mount, ino, LK_EXCLUSIVE, &tdp);
+		if (error) {
+			if (vn_lock(vdp, LK_EXCLUSIVE | LK_RETRY, td) == 0)
+				cnp->cn_flags &= ~PDIRUNLOCK;
+			return (error);
+		}
+		if (lockparent && (flags & ISLASTCN)) {
+			if ((error = vn_lock(vdp, LK_EXCLUSIVE, td)) != 0) {
+				vput(tdp);
+				return (error);
+			}
+			cnp->cn_flags &= ~PDIRUNLOCK;
+		}
+		*vpp = tdp;
+	} else if (ino == dp->e_number) {
+		VREF(vdp);
+		*vpp = vdp;
+	} else {
+		error = VFS_VGET(vdp->v_mount, ino, LK_EXCLUSIVE, &tdp);
+		if (error)
+			return (error);
+		if (!lockparent || !(flags & ISLASTCN)) {
+			VOP_UNLOCK(vdp, 0, td);
+			cnp->cn_flags |= PDIRUNLOCK;
+		}
+		*vpp = tdp;
+	}
+
+	if (cnp->cn_flags & MAKEENTRY)
+		cache_enter(vdp, *vpp, cnp);
+	return (0);
+}
+
+/*
+ * Add an entry for enode ino to directory dvp, in the first free slot
+ * or at the end.  The entry is written synchronously so it never
+ * reaches the disk ahead of the enode it names.
+ */
+int
+edufs_direnter(dvp, ino, type, cnp)
+	struct vnode *dvp;
+	ino_t ino;
+	int type;
+	struct componentname *cnp;
+{
+	struct enode *dp = VTOE(dvp);
+	struct edufsmount *emp = dp->e_emp;
+	struct edufs_superblock *esb = dp->e_fs;
+	struct edufs_dirblock *db;
+	struct buf *bp;
+	off_t off;
+	daddr_t lbn;
+	int error;
+
+	if (cnp->cn_namelen > EDUFS_MAXNAMLEN)
+		return (ENAMETOOLONG);
+	bp = NULL;
+	for (off = 0; off < dp->e_size; off += sizeof(*db)) {
+		lbn = edufs_lblkno(&emp->e_geom, off);
+		if (bp == NULL || bp->b_lblkno != lbn) {
+			if (bp != NULL)
+				brelse(bp);
+			edufs_statsbread(emp, dvp, lbn);
+			error = bread(dvp, lbn, esb->fs_bsize, NOCRED, &bp);
+			if (error) {
+				brelse(bp);
+				return (error);
+			}
+		}
+		db = (struct edufs_dirblock *)(bp->b_data +
+		    edufs_blkoff(&emp->e_geom, off));
+		if (db->d_type == 0)
+			break;
+	}
+	if (off == dp->e_size) {
+		/* no free slot; grow the directory by one entry */
+		if (bp != NULL)
+			brelse(bp);
+		error = edufs_balloc(dvp, edufs_lblkno(&emp->e_geom, off),
+		    EB_CLRBUF, &bp);
+		if (error)
+			return (error);
+		dp->e_size += sizeof(*db);
+		dp->e_flag |= EN_MODIFIED;
+		vnode_pager_setsize(dvp, dp->e_size);
+		db = (struct edufs_dirblock *)(bp->b_data +
+		    edufs_blkoff(&emp->e_geom, off));
+	}
+
+	bzero(db, sizeof(*db));
+	db->d_eno = ino;
+	db->d_type = type;
+	db->d_namelen = cnp->cn_namelen;
+	bcopy(cnp->cn_nameptr, db->d_name, cnp->cn_namelen);
+	ETRACE(ETR_ALLOC, "direnter %s -> %d at %lld", db->d_name, (int)ino,
+	    (long long)off);
+	if ((error = bwrite(bp)) != 0)
+		return (error);
+	dp->e_flag |= EN_CHANGE | EN_UPDATE;
+	return (edufs_update(dvp, 1));
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Enode and free block maps.
+ *
+ * Each is a bit per enode or data block, most significant bit of each
+ * byte first, set when in use: the layout newfs_edufs writes and
+ * fsck_edufs reads.  Anything that tests or changes a map bit goes
+ * through these, so allocation and the recounts agree on the order.
+ */
+
+#ifndef _EDUFS_MAP_H_
+#define	_EDUFS_MAP_H_
+
+#include <sys/endian.h>
+#ifndef _KERNEL
+#include <strings.h>		/* fls(); the kernel's is in libkern */
+#endif
+
+#define	MAPBIT(b)		(0x80 >> ((b) % NBBY))
+#define	MAPISSET(map, b)	(((map)[(b) / NBBY] & MAPBIT(b)) != 0)
+#define	MAPISCLR(map, b)	(((map)[(b) / NBBY] & MAPBIT(b)) == 0)
+#define	MAPSET(map, b)		((map)[(b) / NBBY] |= MAPBIT(b))
+#define	MAPCLR(map, b)		((map)[(b) / NBBY] &= ~MAPBIT(b))
+
+/*
+ * First bit in [from, to) that is set (or clear, if set is 0), or -1.
+ * The map is taken 64 bits at a time: a big endian load puts bit 0 of
+ * each word at the top, so the first one wanted is the leading zero
+ * count of the word, inverted when looking for a clear bit.  Maps are
+ * whole blocks, so the word loads never run off the end.
+ */
+static __inline int
+edufs_mapscan(const u_int8_t *map, int from, int to, int set)
+{
+	u_int64_t w;
+	u_int32_t hi;
+	int b;
+
+	for (b = from & ~63; b < to; b += 64) {
+		w = be64dec(map + b / NBBY);
+		if (!set)
+			w = ~w;
+		if (b < from)
+			w &= ~(u_int64_t)0 >> (from - b);
+		if (w == 0)
+			continue;
+		hi = w >> 32;
+		b += hi != 0 ? 32 - fls(hi) : 64 - fls((u_int32_t)w);
+		return (b < to ? b : -1);
+	}
+	return (-1);
+}
+
+/* a clear bit in [lo, hi), looking from start first and then wrapping */
+static __inline int
+edufs_mapfind(const u_int8_t *map, int lo, int hi, int start)
+{
+	int b;
+
+	if (start < lo || start >= hi)
+		start = lo;
+	if ((b = edufs_mapscan(map, start, hi, 0)) < 0 && start > lo)
+		b = edufs_mapscan(map, lo, start, 0);
+	return (b);
+}
+
+/* the first run of n clear bits that starts at or after from and ends by to */
+static __inline int
+edufs_maprun(const u_int8_t *map, int from, int to, int n)
+{
+	int b, e;
+
+	while ((b = edufs_mapscan(map, from, to, 0)) >= 0) {
+		if (b + n > to)
+			break;
+		if ((e = edufs_mapscan(map, b, b + n, 1)) < 0)
+			return (b);
+		from = e;
+	}
+	return (-1);
+}
+
+#endif /* !_EDUFS_MAP_H_ */
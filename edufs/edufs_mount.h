@@ -35,11 +35,79 @@ struct edufs_args {
   uid_t	  uid;		/* uid that owns edufs files */
   gid_t	  gid;		/* gid that owns edufs files */
   mode_t  mask;		/* mask to be applied for edufs perms */
-  int	  flags;	/* flags - not used yet... */
+  int	  flags;	/* EDUFSMNT_* flags, see below */
   int     magic;	/* version number */
   char    *fspec;    /* where to mount */
 };
 
+/* edufs_args flags */
+#define EDUFSMNT_LAZYTIME	0x0001	/* keep time stamp only changes in core */
+#define EDUFSMNT_MNTOPT		(EDUFSMNT_LAZYTIME)
+
+
+#ifdef _KERNEL
+
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/queue.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+
+#include <fs/edufs/edufs_geom.h>
+#include <fs/edufs/edufs_readahead.h>
+
+SYSCTL_DECL(_vfs_edufs);
+MALLOC_DECLARE(M_EDUFSMNT);
+
+/* longest free run the cluster summary tells apart */
+#define	EDUFS_MAXCONTIG	16
+
+/*
+ * In-core copy of one cg's enode and free block maps, see edufs_cg.c.
+ * Each map is one fs_bsize block, kept right after the structure.
+ */
+struct edufs_cgmap {
+  TAILQ_ENTRY(edufs_cgmap) cm_lru;              /* least recently used first */
+  int       cm_cg;
+  int       cm_flags;
+  u_int8_t  *cm_emap;                           /* the block at cg_eusedoff */
+  u_int8_t  *cm_fmap;                           /* the block at cg_freeoff */
+  int32_t   cm_clustersum[EDUFS_MAXCONTIG + 1]; /* free runs by length, see edufs_alloc.c */
+};
+
+#define	CM_EDIRTY	0x0001		/* cm_emap changed since written */
+#define	CM_FDIRTY	0x0002		/* cm_fmap changed since written */
+
+/*
+ * Each cg has a lock of its own, covering its in-core header, its
+ * cached maps and its fs_contigdirs slot, so allocations in different
+ * cgs don't wait on each other.  Padded so no two share a cache line.
+ */
+struct edufs_cglock {
+  struct    sx cl_sx;
+  int       cl_dirty;                           /* header changed since written */
+} __aligned(64);
+
+#define	EDUFS_CGLOCK(emp, c)	sx_xlock(&(emp)->e_cglock[(c)].cl_sx)
+#define	EDUFS_CGUNLOCK(emp, c)	sx_xunlock(&(emp)->e_cglock[(c)].cl_sx)
+#define	EDUFS_CGLOCKED(emp, c)	sx_assert(&(emp)->e_cglock[(c)].cl_sx, SX_XLOCKED)
+
+/*
+ * One cpu's changes to the fs_cstotal counts since mount.  Allocation
+ * adds to its own cpu's copy; edufs_cstotal() adds them all up.
+ */
+struct edufs_csdelta {
+  int64_t   cd_ndir;
+  int64_t   cd_nbfree;
+  int64_t   cd_nefree;
+} __aligned(64);
+
+#define	EDUFS_CSADD(emp, fld, n) do {					\
+	critical_enter();						\
+	(emp)->e_csdelta[PCPU_GET(cpuid)].fld += (n);			\
+	critical_exit();						\
+} while (0)
 
 /* the kernel mount structure */
 struct edufsmount {
@@ -49,9 +117,36 @@ struct edufsmount {
   u_long	e_fstype;			                /* type of filesystem */
   struct	edufs_superblock *e_esb;			/* pointer to superblock */
   struct    cg *cglist;
+  struct    edufs_geom e_geom;                  /* address translation, see edufs_geom.h */
+  int32_t   *e_cgoff;                           /* byte offset of each cg header */
+  struct    edufs_cglock *e_cglock;             /* one per cg */
+  struct    edufs_csdelta *e_csdelta;           /* per cpu, see edufs_cstotal() */
+  struct    ecsum_total e_csbase;               /* the counts at mount time */
+  struct    edufs_cgmap **e_cgmap;              /* cached maps by cg, NULL if not in */
+  struct    mtx e_cgmapmtx;                     /* protects e_cgmaplru, e_cgmapmem */
+  TAILQ_HEAD(, edufs_cgmap) e_cgmaplru;
+  int       e_cgmapmem;                         /* bytes of maps in core */
+  int       e_cgmapmaxmem;                      /* ... and the most there may be */
+  struct    mtx e_exmtx;                        /* protects the extent caches */
+  TAILQ_HEAD(, edufs_excache) e_exlru;          /* every enode's, see edufs_bmap.c */
+  int       e_exmem;                            /* bytes of extent caches */
+  int       e_exmaxmem;                         /* ... and the most there may be */
+  struct    edufs_ehash *e_ehash;               /* enode cache, see edufs_ehash.c */
+  struct    sysctl_ctx_list e_sysctl_ctx;       /* vfs.edufs.<dev> sysctl tree */
+  struct    sysctl_oid *e_sysctl_tree;
+  struct    edufs_pcpustats *e_stats;           /* per-cpu counters, see edufs_stats.h */
+  struct    edufs_era e_era;                    /* enode table readahead, see edufs_readahead.h */
+  struct    mtx e_dirtymtx;                     /* protects e_dirty, e_ndirty */
+  TAILQ_HEAD(, enode) e_dirty;                  /* enodes waiting for writeback */
+  int       e_ndirty;
+  TAILQ_HEAD(, enode) e_lazy;                   /* only time stamps changed, oldest first */
+  int       e_mntflags;                         /* EDUFSMNT_* from the mount args */
+  int       e_maxinline;                        /* largest inline file, 0 for none */
 };
 
 /* this macro converts the data stored in the struct mount to a struct edufsmount */
 #define VFSTOEDUFS(mp)                  ((struct edufsmount*)mp->mnt_data)
 
+#endif /* _KERNEL */
+
 #endif
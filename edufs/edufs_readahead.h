@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Readahead policy.
+ *
+ * edufs_read() keeps a struct edufs_ra in each enode and hands every
+ * read to edufs_raupdate(), which sorts it by where it starts:
+ *
+ *   sequential	where the last read ended.  The window starts at
+ *		EDUFS_RAINIT blocks and doubles with each such read.
+ *		edufs_read() passes it to cluster_read() as seqcount.
+ *   strided	as far past the last read's start as that was past the
+ *		one before.  The window grows by one stride per read, and
+ *		edufs_read() asks breadn() for that many strides ahead.
+ *   random	anywhere else.  The window shuts.
+ *
+ * Windows are capped at max (vfs.edufs.readahead_max), and a strided
+ * one at EDUFS_RAMAXSTRIDE too.  The state is a hint updated without
+ * locks; two readers of one file can spoil each other's pattern but
+ * nothing worse.
+ *
+ * edufs_vget() has a policy of its own for the enode table, in
+ * edufs_eraupdate().  Each enode cache miss reads the table chunk
+ * (fs_bps bytes) its denode is in.  A miss in or just past the chunks
+ * read last time, as when ls -l stats a directory's entries in order,
+ * counts as clustered, and the next chunks of the cg's table are read
+ * ahead: 2, 4, 8, ... of them for the 1st, 2nd, 3rd, ... clustered
+ * miss in a row, up to vfs.edufs.enode_readahead.  This state is a
+ * hint too.
+ *
+ * Nothing here is kernel only: edufs_rasim and edufs_erasim replay
+ * reads through the same code.
+ */
+
+#ifndef _EDUFS_READAHEAD_H_
+#define	_EDUFS_READAHEAD_H_
+
+#define	EDUFS_RAINIT		4	/* first sequential window, blocks */
+#define	EDUFS_RAMAXSTRIDE	8	/* most strides read ahead */
+
+#define	EDUFS_RA_RANDOM		0
+#define	EDUFS_RA_SEQ		1
+#define	EDUFS_RA_STRIDE		2
+
+struct edufs_ra {
+	int64_t	ra_next;		/* byte after the last read */
+	int64_t	ra_last;		/* where the last read started */
+	int64_t	ra_stride;		/* ra_last less the start before it */
+	int32_t	ra_win;			/* window, blocks or strides */
+	int32_t	ra_mode;		/* EDUFS_RA_* of the last read */
+};
+
+/* account a read of len bytes at off; returns the new window */
+static __inline int
+edufs_raupdate(struct edufs_ra *ra, int64_t off, int64_t len, int max)
+{
+	int64_t stride = off - ra->ra_last;
+
+	if (off == ra->ra_next) {
+		ra->ra_win = ra->ra_mode == EDUFS_RA_SEQ && ra->ra_win > 0 ?
+		    ra->ra_win * 2 : EDUFS_RAINIT;
+		ra->ra_mode = EDUFS_RA_SEQ;
+		ra->ra_stride = stride;
+	} else if (stride != 0 && stride == ra->ra_stride) {
+		ra->ra_win = ra->ra_mode == EDUFS_RA_STRIDE ?
+		    ra->ra_win + 1 : 1;
+		if (ra->ra_win > EDUFS_RAMAXSTRIDE)
+			ra->ra_win = EDUFS_RAMAXSTRIDE;
+		ra->ra_mode = EDUFS_RA_STRIDE;
+	} else {
+		ra->ra_win = 0;
+		ra->ra_mode = EDUFS_RA_RANDOM;
+		ra->ra_stride = stride;
+	}
+	if (ra->ra_win > max)
+		ra->ra_win = max;
+	ra->ra_last = off;
+	ra->ra_next = off + len;
+	return (ra->ra_win);
+}
+
+#define	EDUFS_MAXENODERA	32	/* cap on vfs.edufs.enode_readahead */
+
+struct edufs_era {
+	int64_t	era_last;		/* chunk the last miss read */
+	int32_t	era_seq;		/* clustered misses in a row */
+	int32_t	era_win;		/* chunks read ahead then */
+};
+
+/*
+ * account a miss in chunk blkno, end being the last chunk of its cg's
+ * table; returns the chunks after it to read ahead
+ */
+static __inline int
+edufs_eraupdate(struct edufs_era *era, int64_t blkno, int64_t end, int max)
+{
+	int nra;
+
+	if (blkno >= era->era_last &&
+	    blkno <= era->era_last + era->era_win + 1) {
+		if ((1 << era->era_seq) < EDUFS_MAXENODERA)
+			era->era_seq++;
+	} else
+		era->era_seq = 0;
+	era->era_last = blkno;
+
+	if (max > EDUFS_MAXENODERA)
+		max = EDUFS_MAXENODERA;
+	nra = era->era_seq == 0 ? 0 : 1 << era->era_seq;
+	if (nra > max)
+		nra = max;
+	/* don't run off the end of the table */
+	if (nra > end - blkno)
+		nra = end - blkno;
+	if (nra < 0)
+		nra = 0;
+	era->era_win = nra;
+	return (nra);
+}
+
+#endif /* !_EDUFS_READAHEAD_H_ */
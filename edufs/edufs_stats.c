@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Per-mount counters and vnode op latency histograms, see edufs_stats.h.
+ * Everything ends up under vfs.edufs.<device>.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/bio.h>
+#include <sys/buf.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/mount.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <sys/vnode.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_stats.h>
+
+static MALLOC_DEFINE(M_EDUFSSTATS, "EDUFS stats", "EDUFS per-cpu counters");
+
+static const char *edufs_countnames[ES_NCOUNTERS][2] = {
+	{ "bread",		"blocks asked of bread()" },
+	{ "bcache_hits",	"breads satisfied from the buffer cache" },
+	{ "bytes_read",		"bytes returned by read" },
+	{ "ecache_hits",	"enode lookups that hit the enode hash" },
+	{ "ecache_misses",	"enode lookups that read the enode table" },
+	{ "enode_readahead",	"enode table chunks read ahead" },
+	{ "enodes_written",	"enodes written back" },
+	{ "enode_chunk_writes",	"enode table chunk writes" },
+	{ "cgmap_loads",	"cg maps read into core" },
+	{ "cgmap_evictions",	"cg maps dropped from core" },
+	{ "cgmap_writes",	"cg map blocks written back" },
+	{ "blocks_allocated",	"data blocks allocated" },
+	{ "blocks_contiguous",	"blocks allocated right after the file's last" },
+	{ "excache_hits",	"indirect block lookups the extent cache saved" },
+	{ "excache_misses",	"indirect block lookups that read the disk" },
+	{ "excache_evictions",	"enode extent caches dropped to make room" },
+	{ "ra_sequential",	"reads that started where the last ended" },
+	{ "ra_strided",		"reads that kept to the file's stride" },
+	{ "ra_random",		"reads with readahead shut off" },
+	{ "ra_stride_blocks",	"blocks read ahead for strided reads" },
+};
+
+static const char *edufs_vopnames[ES_NVOPS] = {
+	"access", "bmap", "cachedlookup", "close", "create", "fsync",
+	"getattr", "inactive", "link", "lookup", "mkdir", "mknod", "open",
+	"pathconf", "print", "read", "readdir", "readlink", "reclaim",
+	"remove", "rename", "rmdir", "setattr", "strategy", "symlink",
+	"write",
+};
+
+static int edufs_sysctl_count(SYSCTL_HANDLER_ARGS);
+static int edufs_sysctl_vop(SYSCTL_HANDLER_ARGS);
+
+void
+edufs_statsinit(emp)
+	struct edufsmount *emp;
+{
+
+	emp->e_stats = malloc((mp_maxid + 1) * sizeof(struct edufs_pcpustats),
+	    M_EDUFSSTATS, M_WAITOK | M_ZERO);
+}
+
+void
+edufs_statsuninit(emp)
+	struct edufsmount *emp;
+{
+
+	free(emp->e_stats, M_EDUFSSTATS);
+	emp->e_stats = NULL;
+}
+
+/*
+ * Count a block read and whether the buffer cache already had it.  Call
+ * it just before the bread()/breadn()/cluster_read() it accounts for.
+ */
+void
+edufs_statsbread(emp, vp, blkno)
+	struct edufsmount *emp;
+	struct vnode *vp;
+	daddr_t blkno;
+{
+
+	if (incore(vp, blkno) != NULL)
+		ES_INC(emp, ES_BCACHEHIT);
+	ES_INC(emp, ES_BREAD);
+}
+
+/*
+ * Account one call of vnode op 'vop' that started at 'start'.
+ */
+void
+edufs_statsvop(emp, vop, start)
+	struct edufsmount *emp;
+	int vop;
+	struct bintime *start;
+{
+	struct edufs_vopstats *vs;
+	struct bintime bt;
+	u_int64_t ns;
+	int b;
+
+	binuptime(&bt);
+	bintime_sub(&bt, start);
+	ns = (u_int64_t)bt.sec * 1000000000 +
+	    (((u_int64_t)1000000000 * (u_int32_t)(bt.frac >> 32)) >> 32);
+	if (ns >> 32)
+		b = 32 + fls((u_int32_t)(ns >> 32));
+	else
+		b = fls((u_int32_t)ns);
+	if (b >= ES_HISTBUCKETS)
+		b = ES_HISTBUCKETS - 1;
+
+	critical_enter();
+	vs = &emp->e_stats[PCPU_GET(cpuid)].ps_vop[vop];
+	vs->vs_calls++;
+	vs->vs_nsec += ns;
+	vs->vs_hist[b]++;
+	critical_exit();
+}
+
+/*
+ * Add the counters and a vop.<name> node per vnode op to the mount's
+ * sysctl tree.
+ */
+void
+edufs_statsattach(emp)
+	struct edufsmount *emp;
+{
+	struct sysctl_oid *vop;
+	int i;
+
+	if (emp->e_sysctl_tree == NULL)
+		return;
+	for (i = 0; i < ES_NCOUNTERS; i++)
+		SYSCTL_ADD_PROC(&emp->e_sysctl_ctx,
+		    SYSCTL_CHILDREN(emp->e_sysctl_tree), OID_AUTO,
+		    edufs_countnames[i][0], CTLTYPE_QUAD | CTLFLAG_RD, emp, i,
+		    edufs_sysctl_count, "QU", edufs_countnames[i][1]);
+	vop = SYSCTL_ADD_NODE(&emp->e_sysctl_ctx,
+	    SYSCTL_CHILDREN(emp->e_sysctl_tree), OID_AUTO, "vop", CTLFLAG_RD,
+	    0, "vnode op latencies");
+	if (vop == NULL)
+		return;
+	for (i = 0; i < ES_NVOPS; i++)
+		SYSCTL_ADD_PROC(&emp->e_sysctl_ctx, SYSCTL_CHILDREN(vop),
+		    OID_AUTO, edufs_vopnames[i], CTLTYPE_STRING | CTLFLAG_RD,
+		    emp, i, edufs_sysctl_vop, "A",
+		    "calls, total ns and log2 ns histogram");
+}
+
+static int
+edufs_sysctl_count(SYSCTL_HANDLER_ARGS)
+{
+	struct edufsmount *emp = arg1;
+	u_int64_t sum;
+
+	sum = edufs_statsum(emp->e_stats, mp_maxid, arg2);
+	return (SYSCTL_OUT(req, &sum, sizeof(sum)));
+}
+
+static int
+edufs_sysctl_vop(SYSCTL_HANDLER_ARGS)
+{
+	struct edufsmount *emp = arg1;
+	struct edufs_vopstats *vs, sum;
+	struct sbuf *sb;
+	u_int cpu;
+	int error, i;
+
+	bzero(&sum, sizeof(sum));
+	for (cpu = 0; cpu <= mp_maxid; cpu++) {
+		vs = &emp->e_stats[cpu].ps_vop[arg2];
+		sum.vs_calls += vs->vs_calls;
+		sum.vs_nsec += vs->vs_nsec;
+		for (i = 0; i < ES_HISTBUCKETS; i++)
+			sum.vs_hist[i] += vs->vs_hist[i];
+	}
+
+	sb = sbuf_new(NULL, NULL, 256, SBUF_AUTOEXTEND);
+	sbuf_printf(sb, "calls %ju nsec %ju\n", (uintmax_t)sum.vs_calls,
+	    (uintmax_t)sum.vs_nsec);
+	/* only the non-empty buckets, "<2^n ns>:<count>" */
+	for (i = 0; i < ES_HISTBUCKETS; i++)
+		if (sum.vs_hist[i] != 0)
+			sbuf_printf(sb, " <%ju:%ju", (uintmax_t)1 << i,
+			    (uintmax_t)sum.vs_hist[i]);
+	sbuf_finish(sb);
+	error = SYSCTL_OUT(req, sbuf_data(sb), sbuf_len(sb) + 1);
+	sbuf_delete(sb);
+	return (error);
+}
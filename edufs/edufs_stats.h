@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _EDUFS_STATS_H_
+#define	_EDUFS_STATS_H_
+
+/*
+ * Per-mount performance counters.
+ *
+ * Every mount carries one struct edufs_pcpustats per cpu.  A cpu only
+ * ever touches its own copy and does so inside a critical section, so
+ * the hot paths take no locks and don't bounce cache lines around; the
+ * sysctl handlers add the copies up when they are read.  The sums are
+ * not a snapshot - counters keep moving while the others are summed.
+ */
+
+/* event counters */
+#define	ES_BREAD	0	/* blocks asked of bread() and friends */
+#define	ES_BCACHEHIT	1	/* ... that were already in the buffer cache */
+#define	ES_BYTESREAD	2	/* bytes handed out by edufs_read */
+#define	ES_ECACHEHIT	3	/* edufs_vget found the enode hashed */
+#define	ES_ECACHEMISS	4	/* edufs_vget had to read the enode in */
+#define	ES_ENODERA	5	/* enode table chunks read ahead */
+#define	ES_EWRITTEN	6	/* enodes written back */
+#define	ES_ECHUNKWRITE	7	/* ... and the chunk writes that took */
+#define	ES_CGMAPLOAD	8	/* cg maps read into core */
+#define	ES_CGMAPEVICT	9	/* ... and dropped again to make room */
+#define	ES_CGMAPWRITE	10	/* cg map blocks written back */
+#define	ES_BALLOC	11	/* data blocks allocated */
+#define	ES_BALLOCCONTIG	12	/* ... right after the file's previous block */
+#define	ES_EXHIT	13	/* indirect block lookups the extent cache saved */
+#define	ES_EXMISS	14	/* ... and those it didn't */
+#define	ES_EXEVICT	15	/* extent caches dropped to make room */
+#define	ES_RASEQ	16	/* reads that followed on from the last */
+#define	ES_RASTRIDE	17	/* ... that kept to its stride */
+#define	ES_RARANDOM	18	/* ... and that did neither */
+#define	ES_RASTRIDEBLK	19	/* blocks read ahead for strided reads */
+#define	ES_NCOUNTERS	20
+
+/* timed vnode ops, one for each entry in edufs_vnodeop_entries[] */
+#define	ES_VOP_ACCESS		0
+#define	ES_VOP_BMAP		1
+#define	ES_VOP_CACHEDLOOKUP	2
+#define	ES_VOP_CLOSE		3
+#define	ES_VOP_CREATE		4
+#define	ES_VOP_FSYNC		5
+#define	ES_VOP_GETATTR		6
+#define	ES_VOP_INACTIVE		7
+#define	ES_VOP_LINK		8
+#define	ES_VOP_LOOKUP		9
+#define	ES_VOP_MKDIR		10
+#define	ES_VOP_MKNOD		11
+#define	ES_VOP_OPEN		12
+#define	ES_VOP_PATHCONF		13
+#define	ES_VOP_PRINT		14
+#define	ES_VOP_READ		15
+#define	ES_VOP_READDIR		16
+#define	ES_VOP_READLINK		17
+#define	ES_VOP_RECLAIM		18
+#define	ES_VOP_REMOVE		19
+#define	ES_VOP_RENAME		20
+#define	ES_VOP_RMDIR		21
+#define	ES_VOP_SETATTR		22
+#define	ES_VOP_STRATEGY		23
+#define	ES_VOP_SYMLINK		24
+#define	ES_VOP_WRITE		25
+#define	ES_NVOPS		26
+
+/* latency histogram: bucket 0 is < 1ns, bucket n is [2^(n-1), 2^n) ns */
+#define	ES_HISTBUCKETS	40
+
+struct edufs_vopstats {
+	u_int64_t	vs_calls;
+	u_int64_t	vs_nsec;		/* total time spent in the op */
+	u_int64_t	vs_hist[ES_HISTBUCKETS];
+};
+
+struct edufs_pcpustats {
+	u_int64_t	ps_count[ES_NCOUNTERS];
+	struct edufs_vopstats ps_vop[ES_NVOPS];
+} __aligned(64);
+
+/* one counter added up over cpus 0 to maxid, as the sysctl reads it */
+static __inline u_int64_t
+edufs_statsum(const struct edufs_pcpustats *ps, u_int maxid, int ctr)
+{
+	u_int64_t sum;
+	u_int cpu;
+
+	sum = 0;
+	for (cpu = 0; cpu <= maxid; cpu++)
+		sum += ps[cpu].ps_count[ctr];
+	return (sum);
+}
+
+#ifdef _KERNEL
+
+struct bintime;
+struct edufsmount;
+struct vnode;
+
+void	edufs_statsinit(struct edufsmount *emp);
+void	edufs_statsuninit(struct edufsmount *emp);
+void	edufs_statsattach(struct edufsmount *emp);
+void	edufs_statsbread(struct edufsmount *emp, struct vnode *vp,
+	    daddr_t blkno);
+void	edufs_statsvop(struct edufsmount *emp, int vop, struct bintime *start);
+
+#define	ES_ADD(emp, ctr, n) do {					\
+	critical_enter();						\
+	(emp)->e_stats[PCPU_GET(cpuid)].ps_count[(ctr)] += (n);	\
+	critical_exit();						\
+} while (0)
+#define	ES_INC(emp, ctr)	ES_ADD(emp, ctr, 1)
+
+#endif /* _KERNEL */
+
+#endif /* !_EDUFS_STATS_H_ */
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Per-cpu trace rings for ETRACE(), see edufs_trace.h.
+ *
+ * Each cpu owns one ring and is the only writer to it; records are
+ * written inside a critical section so the thread can't be preempted or
+ * migrated half way through, which is all the synchronization the write
+ * side needs.  The sysctl reader copies the rings out without stopping
+ * the writers, so a record that is being overwritten while it is copied
+ * may come out garbled.  That's fine for a debugging aid.
+ */
+
+#ifdef EDUFS_TRACE
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sysctl.h>
+#include <machine/cpu.h>
+#include <machine/stdarg.h>
+
+#include <fs/edufs/edufs_trace.h>
+
+static MALLOC_DEFINE(M_EDUFSTRACE, "EDUFS trace", "EDUFS trace buffers");
+
+#define	ETR_ENTRIES	1024		/* records per cpu, power of 2 */
+#define	ETR_MSGLEN	96		/* formatted record size */
+
+struct etr_entry {
+	u_int64_t	te_time;	/* get_cyclecount() */
+	u_int		te_cat;		/* ETR_* category */
+	char		te_msg[ETR_MSGLEN];
+};
+
+struct etr_ring {
+	u_int		tr_next;	/* next slot to fill */
+	struct etr_entry tr_ents[ETR_ENTRIES];
+} __aligned(64);
+
+static struct etr_ring *etr_rings;	/* one per cpu */
+
+u_int edufs_trace_mask = ETR_ALL;
+
+SYSCTL_DECL(_vfs_edufs);
+SYSCTL_UINT(_vfs_edufs, OID_AUTO, trace_mask, CTLFLAG_RW, &edufs_trace_mask,
+    0, "ETR_* categories recorded in the trace rings");
+
+static int edufs_sysctl_trace(SYSCTL_HANDLER_ARGS);
+SYSCTL_PROC(_vfs_edufs, OID_AUTO, trace, CTLTYPE_STRING | CTLFLAG_RD,
+    NULL, 0, edufs_sysctl_trace, "A", "contents of the trace rings");
+
+void
+edufs_traceinit()
+{
+
+	etr_rings = malloc((mp_maxid + 1) * sizeof(struct etr_ring),
+	    M_EDUFSTRACE, M_WAITOK | M_ZERO);
+}
+
+void
+edufs_traceuninit()
+{
+
+	free(etr_rings, M_EDUFSTRACE);
+	etr_rings = NULL;
+}
+
+void
+edufs_trace(u_int cat, const char *fmt, ...)
+{
+	struct etr_ring *tr;
+	struct etr_entry *te;
+	va_list ap;
+
+	if (etr_rings == NULL)
+		return;
+	critical_enter();
+	tr = &etr_rings[PCPU_GET(cpuid)];
+	te = &tr->tr_ents[tr->tr_next++ & (ETR_ENTRIES - 1)];
+	te->te_time = get_cyclecount();
+	te->te_cat = cat;
+	va_start(ap, fmt);
+	vsnprintf(te->te_msg, sizeof(te->te_msg), fmt, ap);
+	va_end(ap);
+	critical_exit();
+}
+
+/*
+ * Dump every cpu's ring, oldest record first.
+ */
+static int
+edufs_sysctl_trace(SYSCTL_HANDLER_ARGS)
+{
+	struct etr_ring *tr;
+	struct etr_entry *te;
+	struct sbuf *sb;
+	u_int cpu, i, next;
+	int error;
+
+	if (etr_rings == NULL)
+		return (SYSCTL_OUT(req, "", 1));
+	sb = sbuf_new(NULL, NULL, 4096, SBUF_AUTOEXTEND);
+	for (cpu = 0; cpu <= mp_maxid; cpu++) {
+		if (CPU_ABSENT(cpu))
+			continue;
+		tr = &etr_rings[cpu];
+		next = tr->tr_next;
+		i = next > ETR_ENTRIES ? next - ETR_ENTRIES : 0;
+		for (; i != next; i++) {
+			te = &tr->tr_ents[i & (ETR_ENTRIES - 1)];
+			sbuf_printf(sb, "%u %ju %02x %s\n", cpu,
+			    (uintmax_t)te->te_time, te->te_cat, te->te_msg);
+		}
+	}
+	sbuf_finish(sb);
+	error = SYSCTL_OUT(req, sbuf_data(sb), sbuf_len(sb) + 1);
+	sbuf_delete(sb);
+	return (error);
+}
+
+#endif /* EDUFS_TRACE */
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _EDUFS_TRACE_H_
+#define	_EDUFS_TRACE_H_
+
+/*
+ * Debug tracing.
+ *
+ * ETRACE(category, fmt, ...) replaces the uprintf()s that used to be
+ * scattered through the hot paths.  By default EDUFS_TRACE is not
+ * defined and every trace point compiles to nothing - the arguments
+ * aren't even evaluated.  Building with -DEDUFS_TRACE=<mask> compiles in
+ * the categories in <mask> (ETR_ALL for everything); those records go to
+ * a per-cpu ring buffer instead of the tty, and vfs.edufs.trace_mask
+ * picks which of the compiled in categories are actually recorded.  The
+ * rings can be read back through vfs.edufs.trace.
+ */
+
+/* trace categories */
+#define	ETR_EHASH	0x0001		/* enode hash */
+#define	ETR_VGET	0x0002		/* enode loading */
+#define	ETR_ALLOC	0x0004		/* enode/block allocation */
+#define	ETR_READ	0x0008		/* edufs_read */
+#define	ETR_READDIR	0x0010		/* edufs_readdir */
+#define	ETR_STRATEGY	0x0020		/* edufs_strategy */
+#define	ETR_VFS		0x0040		/* mount, unmount, statfs, ... */
+#define	ETR_VNOPS	0x0080		/* the rest of the vnode ops */
+#define	ETR_ALL		0x00ff
+
+#if defined(_KERNEL) && defined(EDUFS_TRACE)
+
+extern u_int edufs_trace_mask;
+
+void	edufs_traceinit(void);
+void	edufs_traceuninit(void);
+void	edufs_trace(u_int cat, const char *fmt, ...) __printflike(2, 3);
+
+#define	ETRACE(cat, ...) do {						\
+	if (((EDUFS_TRACE) & (cat)) && (edufs_trace_mask & (cat)))	\
+		edufs_trace((cat), __VA_ARGS__);			\
+} while (0)
+
+#else
+
+#define	ETRACE(cat, ...)	do { } while (0)
+
+#endif /* _KERNEL && EDUFS_TRACE */
+
+#endif /* !_EDUFS_TRACE_H_ */
@@ -45,44 +45,56 @@
 #include <sys/errno.h>
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
+#include <sys/pcpu.h>
 #include <vm/uma.h>
 
 #include <fs/edufs/edufs_mount.h>
-#include <fs/edufs/edufs_enode.h>
 #include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
 #include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_stats.h>
+#include <fs/edufs/edufs_trace.h>
 
 extern vop_t **edufs_vnodeop_p;
 #define ROOTENO 2
 
-static MALLOC_DEFINE(M_EDUFSMNT, "EDUFS mount", "EDUFS mount structure");
+MALLOC_DEFINE(M_EDUFSMNT, "EDUFS mount", "EDUFS mount structure");
 static MALLOC_DEFINE(M_EDUFSNODE, "EDUFS node", "EDUFS vnode private part");
 
+SYSCTL_NODE(_vfs, OID_AUTO, edufs, CTLFLAG_RW, 0, "EDUFS filesystem");
+
+/* enode table chunks vget may read ahead, at most EDUFS_MAXENODERA */
+static int edufs_enode_readahead = 8;
+SYSCTL_INT(_vfs_edufs, OID_AUTO, enode_readahead, CTLFLAG_RW,
+	&edufs_enode_readahead, 0, "enode table chunks to read ahead in vget");
+
 
 vfs_mount_t   edufs_mount;
 vfs_root_t    edufs_root;
 vfs_unmount_t edufs_unmount;
 vfs_statfs_t  edufs_statfs;
+vfs_sync_t    edufs_sync;
 vfs_init_t    edufs_init;
 vfs_uninit_t  edufs_uninit;
 vfs_vget_t    edufs_vget;
 
 
-uma_zone_t uma_enode,uma_denode; /*, uma_edufs;*/
+uma_zone_t uma_enode; /*, uma_edufs;*/
 
-int64_t startingoffsets[NIADDR]; 
 
 
 /* do the actual mounting */
 static int domount(struct vnode *devvp, struct mount *mp, struct thread *td);
+static void edufs_sysctl_attach(struct edufsmount *emp);
+static int edufs_sysctl_ehash(SYSCTL_HANDLER_ARGS);
 
 
 int edufs_vinit(struct mount *, vop_t **, vop_t **, struct vnode **);
 int edufs_flushfiles(struct mount *, int, struct thread*);
-int edufs_sync(struct mount *mp, int waitfor,struct ucred *cred,struct thread *td);
 void printsuper2(struct edufs_superblock *esb);
-off_t enodeoff(int enodenum, struct edufsmount *emp);
-off_t enodechunkoff(int enodenum, struct edufsmount *emp);
+static int edufs_enodebread(struct edufsmount *emp, ino_t ino, daddr_t blkno, struct buf **bpp);
 void edufs_loadenode(struct buf *bp,struct enode *ep, struct edufs_superblock *esb, ino_t ino);
 
 int domount(devvp,mp,td)
@@ -100,9 +112,8 @@ int domount(devvp,mp,td)
   struct edufsmount *emp;       /* ump */
   size_t strsize;
   struct ucred *cred;
-  struct cg *allcg;
   cred = td ? td->td_ucred : NOCRED;
-  uprintf("mount1"); 
+  ETRACE(ETR_VFS, "mount1"); 
   error = vfs_mountedon(devvp);
   if(error) {
 	return (error);
@@ -112,12 +123,12 @@ int domount(devvp,mp,td)
     return (EBUSY);
   }
   
-  uprintf("2");
+  ETRACE(ETR_VFS, "2");
   vn_lock(devvp, LK_EXCLUSIVE | LK_RETRY, td);
 
 
   error=vinvalbuf(devvp, V_SAVE, td->td_ucred, td,0,0);
-  uprintf("3");
+  ETRACE(ETR_VFS, "3");
   VOP_UNLOCK(devvp,0,td);
   if(error) {
 	return (error);
@@ -131,19 +142,19 @@ int domount(devvp,mp,td)
    * increases the opportunity for metadata caching.
    */
   if (vn_isdisk(devvp, NULL)) {
-	uprintf("4");
+	ETRACE(ETR_VFS, "4");
 	vn_lock(devvp, LK_EXCLUSIVE | LK_RETRY, td);
 	vfs_object_create(devvp, td, cred);
 	VOP_UNLOCK(devvp,0,td);
   }
   
-   uprintf("5"); 
+   ETRACE(ETR_VFS, "5"); 
   vn_lock(devvp, LK_EXCLUSIVE | LK_RETRY, td);
-   uprintf("6"); 
+   ETRACE(ETR_VFS, "6"); 
   error = VOP_OPEN(devvp,FREAD|FWRITE,FSCRED,td,-1);
   /* -1 is "fdidx", currently not in the man page */
 
-   uprintf("7"); 
+   ETRACE(ETR_VFS, "7"); 
   VOP_UNLOCK(devvp,0,td);
   if(error) {	
 	return (error);
@@ -156,9 +167,9 @@ int domount(devvp,mp,td)
   
   bp = NULL;
 
-   uprintf("8"); 
+   ETRACE(ETR_VFS, "8"); 
   /* should clean up the bread code here */
-  error = bread(devvp, 0, 1024, NOCRED, &bp);
+  error = bread(devvp, 0, EDUFS_SBSIZE, NOCRED, &bp);
 
   if(error) {
 	return (error);
@@ -166,15 +177,25 @@ int domount(devvp,mp,td)
 
   bp->b_flags |= B_AGE;
   esb = (struct edufs_superblock *)bp->b_data;
+  /* an older image's denodes would be misread, then written back */
+  if (esb->fs_magic != EDUFS_MAGIC || esb->fs_version != EDUFS_VERSION) {
+	printf("edufs: %s: magic %x, format version %d; this kernel "
+	    "mounts version %d\n", devtoname(devvp->v_rdev), esb->fs_magic,
+	    esb->fs_version, EDUFS_VERSION);
+	brelse(bp);
+	(void)VOP_CLOSE(devvp, FREAD | FWRITE, NOCRED, td);
+	return (EINVAL);
+  }
 
-  uprintf("Successfully read the EDUFS superblock\n");  
+  ETRACE(ETR_VFS, "Successfully read the EDUFS superblock\n");  
 
-  printf("MAGIC = %d\n",esb->fs_magic);
+  ETRACE(ETR_VFS, "MAGIC = %d\n",esb->fs_magic);
   
   MALLOC(emp, struct edufsmount *, sizeof(struct edufsmount),
-		 M_EDUFSMNT, M_WAITOK);
+		 M_EDUFSMNT, M_WAITOK | M_ZERO);
   
   dev = devvp->v_rdev;  
+  emp->e_mountp = mp;
   emp->e_devvp = devvp;
   emp->e_dev = dev;
   emp->e_esb = malloc((u_long)esb->fs_sbsize, M_EDUFSMNT,M_WAITOK);
@@ -209,34 +230,28 @@ int domount(devvp,mp,td)
   brelse(bp);  
   bp = NULL;
 
-  MALLOC(allcg,struct cg*,esb->fs_ncg * sizeof(struct cg),M_EDUFSMNT,M_WAITOK);
-  
-  
   /*-------------------------------- */
   /* read all the cylinder groups in */
   /*-------------------------------- */
-  int cgcounter = 0;
-  daddr_t nextblock = esb->fs_cblkno/esb->fs_bps;   
-  struct cg *cgs = allcg;
-  
-  for(cgcounter = 0;cgcounter < esb->fs_ncg;cgcounter++) {		
-	error = bread(devvp,nextblock,esb->fs_bsize,NOCRED,&bp);
-	
-	struct cg *thiscg = (struct cg *)bp->b_data;		
-	memcpy(cgs,thiscg,sizeof(struct cg));	
-	/* TODO: be sure to check cg magic!! */	
-	bp->b_flags |= B_AGE;	
-	brelse(bp);
-	bp = NULL;		
-	nextblock = thiscg->cg_next / esb->fs_bps;	
-	cgs++;
+  esb = emp->e_esb;
+  edufs_statsinit(emp);
+  if ((error = edufs_cginit(emp)) != 0) {
+	edufs_statsuninit(emp);
+	return (error);
   }
-  
-  emp->cglist = allcg;
+  /* newfs_edufs sets fs_maxsymlinklen on file systems that do inline data */
+  emp->e_maxinline = imin(emp->e_esb->fs_maxsymlinklen, EDUFS_MAXINLINE);
+  if (emp->e_maxinline < 0)
+	emp->e_maxinline = 0;
+  mp->mnt_maxsymlinklen = emp->e_maxinline;
+  edufs_ehashinit(emp);
+  edufs_wbinit(emp);
+  edufs_exinit(emp);
+  edufs_sysctl_attach(emp);
   /* TODO: NEED TO DO SOMETHING WITH EMP, ESB */
   /* UNMOUNT SHOULD FREE MEMORY... */  
   
-   uprintf("9"); 
+   ETRACE(ETR_VFS, "9"); 
   return 0;
 }
 
@@ -262,7 +277,7 @@ edufs_mount(mp, path, data, ndp, td)
   mode_t accessmode;
   /*
 	struct edufs_args args;*/    	
-  uprintf("EDUFS_MOUNT "); 
+  ETRACE(ETR_VFS, "EDUFS_MOUNT "); 
   cred = td ? td->td_ucred : NOCRED;
   prtactive = 1;
   
@@ -276,10 +291,7 @@ edufs_mount(mp, path, data, ndp, td)
   if (uma_enode == NULL) {
 	uma_enode = uma_zcreate("EDUFS enode",
 							sizeof(struct enode), NULL, NULL, NULL, NULL,
-							UMA_ALIGN_PTR, 0);
-	uma_denode = uma_zcreate("EDUFS denode",
-							sizeof(struct denode), NULL, NULL, NULL, NULL,
-							UMA_ALIGN_PTR, 0);	
+							UMA_ALIGN_CACHE, 0);
   }
 
 
@@ -350,6 +362,7 @@ edufs_mount(mp, path, data, ndp, td)
 	vrele(devvp);
 	return (error);
   }
+  VFSTOEDUFS(mp)->e_mntflags = ea.flags & EDUFSMNT_MNTOPT;
 
   
   copyinstr(ea.fspec, mp->mnt_stat.f_mntfromname, MNAMELEN - 1, &size);
@@ -357,6 +370,13 @@ edufs_mount(mp, path, data, ndp, td)
   bzero( mp->mnt_stat.f_mntfromname + size, MNAMELEN - size);
   
   (void)VFS_STATFS(mp,&mp->mnt_stat,td);   
+  if ((mp->mnt_flag & MNT_RDONLY) == 0) {
+	/* until unmount the summary area may be behind the cg headers */
+	VFSTOEDUFS(mp)->e_esb->fs_clean = 0;
+	(void) edufs_sbupdate(VFSTOEDUFS(mp), MNT_WAIT);
+	/* the syncer calls edufs_sync to push out dirty enodes */
+	vfs_allocate_syncvnode(mp);
+  }
   return 0; 
   
 }
@@ -371,27 +391,51 @@ edufs_unmount(mp, mntflags, td)
   int error, flags;
   struct edufsmount *emp = VFSTOEDUFS(mp);
   
-  uprintf("edufs_unmount");
+  ETRACE(ETR_VFS, "edufs_unmount");
     
   flags = 0;
   if (mntflags & MNT_FORCE)
 	flags |= FORCECLOSE;
+  /* write the dirty enodes in one go; reclaim catches any stragglers */
+  edufs_elazyage(emp, 0);
+  error = edufs_eflush(emp, MNT_WAIT);
+  if (error && (mntflags & MNT_FORCE) == 0)
+	return (error);
   error = vflush(mp,0,flags);
   if(error) {
 	return (error);
   }
+  /* cg headers, then the summary area and a clean superblock */
+  if ((mp->mnt_flag & MNT_RDONLY) == 0) {
+#ifdef DIAGNOSTIC
+	edufs_cscheck(emp);
+#endif
+	error = edufs_cgflush(emp, MNT_WAIT);
+	if (error == 0) {
+	  emp->e_esb->fs_clean = 1;
+	  error = edufs_sbupdate(emp, MNT_WAIT);
+	}
+	if (error && (mntflags & MNT_FORCE) == 0)
+	  return (error);
+  }
   
   
+  sysctl_ctx_free(&emp->e_sysctl_ctx);
+  edufs_ehashuninit(emp);
+  edufs_wbuninit(emp);
+  edufs_exuninit(emp);
+  edufs_cguninit(emp);
+  edufs_statsuninit(emp);
+
   emp->e_devvp->v_rdev->si_mountpoint = NULL;      
   error = VOP_CLOSE(emp->e_devvp, FREAD|FWRITE, NOCRED, td);
 
   vrele(emp->e_devvp);
-  free(emp->cglist, M_EDUFSMNT);
   free(emp->e_esb, M_EDUFSMNT);
   free(emp, M_EDUFSMNT);
   mp->mnt_data = (qaddr_t)0;
   mp->mnt_flag &= ~MNT_LOCAL;
-  uprintf("EDUFS UNMOUNTED");
+  ETRACE(ETR_VFS, "EDUFS UNMOUNTED");
   return (error);    
 }
 
@@ -400,13 +444,13 @@ edufs_root(mp, vpp)
 	struct mount *mp;
 	struct vnode **vpp;
 {
-  uprintf("EDUFS_ROOT");
+  ETRACE(ETR_VFS, "EDUFS_ROOT");
   struct vnode *nvp;
   int error;
 
 
   error = edufs_vget(mp, (ino_t)ROOTENO, LK_EXCLUSIVE, &nvp);
-  uprintf("FINISHED CALLING ROOT\n");
+  ETRACE(ETR_VFS, "FINISHED CALLING ROOT\n");
   if (error)
 	return (error);
   
@@ -422,6 +466,7 @@ edufs_statfs(mp, sbp, td)
 {  
   struct edufsmount *emp = VFSTOEDUFS(mp);  
   struct edufs_superblock *esb;
+  struct ecsum_total cst;
   
   esb = emp->e_esb;
   
@@ -429,15 +474,16 @@ edufs_statfs(mp, sbp, td)
 	  panic("ffs_statfs");*/
   /* TODO: magic */
   
-  uprintf("edufs_statfs");
+  ETRACE(ETR_VFS, "edufs_statfs");
   
   sbp->f_bsize = esb->fs_bsize;
-  sbp->f_iosize = esb->fs_bps;
+  sbp->f_iosize = esb->fs_bsize;
   sbp->f_blocks = esb->fs_dsize;
-  sbp->f_bfree = esb->fs_cstotal.cs_nbfree; 
-  sbp->f_bavail = esb->fs_cstotal.cs_nbfree; /* extra space for root? */
+  edufs_cstotal(emp, &cst);
+  sbp->f_bfree = cst.cs_nbfree;
+  sbp->f_bavail = cst.cs_nbfree; /* extra space for root? */
   sbp->f_files =  esb->fs_ncg * esb->fs_epg;  
-  sbp->f_ffree = 0;/*TODO: esb->fs_cstotal.cs_nefree;*/
+  sbp->f_ffree = cst.cs_nefree;
    
   if (sbp != &mp->mnt_stat) {
 	sbp->f_type = mp->mnt_vfc->vfc_typenum;
@@ -455,7 +501,9 @@ edufs_init(vfsp)
 {
   /* this shows up during system startup - type dmesg to see it*/
   printf("Initializing edufs\n");
-  edufs_ehashinit();  
+#ifdef EDUFS_TRACE
+  edufs_traceinit();
+#endif
   return (0);
 }
 
@@ -464,7 +512,9 @@ edufs_init(vfsp)
 edufs_uninit(vfsp)
 	 struct vfsconf *vfsp;
 {
-  edufs_ehashuninit();
+#ifdef EDUFS_TRACE
+  edufs_traceuninit();
+#endif
   return (0);
 }
 
@@ -484,30 +534,33 @@ edufs_vget(mp,ino,flags,vpp)
   dev_t dev;
   int error;
 
-  off_t dechunkoff; /* offset of 512 byte block (chunk) that enode is in */
+  daddr_t dechunk; /* the sector (chunk) the enode is in */
 	
-  uprintf("edufs_vget\n");
-  uprintf("vget - requesting enode [%d] ",(int)ino);
+  ETRACE(ETR_VGET, "edufs_vget\n");
+  ETRACE(ETR_VGET, "vget - requesting enode [%d] ",(int)ino);
 
   emp = VFSTOEDUFS(mp);
   dev = emp->e_dev;
 
-  uprintf("calling hashget ");
-  if ((error = edufs_ehashget(dev, ino, flags, vpp)) != 0)
+  ETRACE(ETR_VGET, "calling hashget ");
+  if ((error = edufs_ehashget(emp, ino, flags, vpp)) != 0)
 	return (error);
-  if (*vpp != NULL)
+  if (*vpp != NULL) {
+	ES_INC(emp, ES_ECACHEHIT);
 	return (0);  
+  }
+  ES_INC(emp, ES_ECACHEMISS);
 
   
   ep = uma_zalloc(uma_enode, M_WAITOK);
   
   
-  printf("getnewvnode ");
+  ETRACE(ETR_VGET, "getnewvnode ");
   error = getnewvnode("edufs",mp,edufs_vnodeop_p,&vp);
   if(error) {
 	*vpp = NULL;
 	uma_zfree(uma_enode, ep);
-	uprintf("vget - error1\n");
+	ETRACE(ETR_VGET, "vget - error1\n");
 	return (error);
   }
 
@@ -520,14 +573,12 @@ edufs_vget(mp,ino,flags,vpp)
   ep->e_fs = emp->e_esb;
   ep->e_dev = dev;
   ep->e_number = ino;
-  uprintf("forcing vtype");
-  vp->v_type=VDIR;
   /*
    * Exclusively lock the vnode before adding to hash. Note, that we
    * must not release nor downgrade the lock (despite flags argument
    * says) till it is fully initialized.
    */
-  printf("lockmgr ");
+  ETRACE(ETR_VGET, "lockmgr ");
   lockmgr(vp->v_vnlock, LK_EXCLUSIVE, (struct mtx *)0, td);
   
   /*
@@ -535,49 +586,47 @@ edufs_vget(mp,ino,flags,vpp)
    * duplicate of vnode being created and add it to the hash. If a
    * duplicate vnode was found, it will be vget()ed from hash for us.
    */
-  printf("hashins ");
+  ETRACE(ETR_VGET, "hashins ");
   if ((error = edufs_ehashins(ep, flags, vpp)) != 0) {
 	vput(vp);
 	*vpp = NULL;
-	uprintf("vget - error hash insert!\n");
+	ETRACE(ETR_VGET, "vget - error hash insert!\n");
 	return (error);
   }  
   
   /* We lost the race, then throw away our vnode and return existing */
   if (*vpp != NULL) {
 	vput(vp);
-	uprintf("vget7");
+	ETRACE(ETR_VGET, "vget7");
 	return (0);
   }
 
 
   /* READ IN CONTENTS OF ENODE HERE! */
   
-  /*rintf("Enode #2 offset = %lld\n",enodeoff(ino,emp));*/
-
-  dechunkoff = enodechunkoff(ino,emp);
-  uprintf("enode block = %lld\n",dechunkoff);
-  printf("bread ");  
-  error = bread(emp->e_devvp,dechunkoff / emp->e_esb->fs_bps,(int)emp->e_esb->fs_bps, NOCRED, &bp);
+  dechunk = edufs_enodesec(&emp->e_geom, ino);
+  ETRACE(ETR_VGET, "enode block = %lld\n",(long long)dechunk);
+  ETRACE(ETR_VGET, "bread ");  
+  error = edufs_enodebread(emp, ino, dechunk, &bp);
   
   if(error) {
-	uprintf("CANT BREAD!\n");
+	ETRACE(ETR_VGET, "CANT BREAD!\n");
 	brelse(bp);
 	vput(vp);
 	*vpp = NULL;
 	return(error);
   } 
   
-    
-  ep->den = uma_zalloc(uma_denode,M_WAITOK);
 
-  printf("vinit/load ");  
+  ETRACE(ETR_VGET, "vinit/load ");  
   /*error = edufs_vinit(mp, 0, 0, &vp);*/
   
   if (ep->e_number == ROOTENO)
     vp->v_vflag |= VV_ROOT;
   
   edufs_loadenode(bp,ep,emp->e_esb,ino);
+  /* VNON for a free slot; edufs_makeenode() sets it */
+  vp->v_type = IFTOVT(ep->e_mode);
   
   /* this needs to go into its own function...*/
   /* ??? */
@@ -593,7 +642,7 @@ edufs_vget(mp,ino,flags,vpp)
   VREF(ep->e_devvp);
       
   *vpp = vp;    
-  printf("return ");  
+  ETRACE(ETR_VGET, "return ");  
   return (0);
 }
 
@@ -622,7 +671,7 @@ edufs_vinit(mntp, specops, fifoops, vpp)
 	case VBLK:
 	  uprintf("vblk here: specops?");
 
-	  vp = addaliasu(vp, ep->den->de_db[0]);
+	  vp = addaliasu(vp, ep->e_den.de_db[0]);
 	  ep->e_vnode = vp;
 	  break;
 	case VFIFO:
@@ -633,7 +682,7 @@ edufs_vinit(mntp, specops, fifoops, vpp)
 	  
 	}
 	*/
-	uprintf("vinit: v_type==%d\n",vp->v_type);
+	ETRACE(ETR_VGET, "vinit: v_type==%d\n",vp->v_type);
 	ASSERT_VOP_LOCKED(vp, "edufs_vinit");
 	
 	if (ep->e_number == ROOTENO)
@@ -655,53 +704,66 @@ edufs_vinit(mntp, specops, fifoops, vpp)
 
 void printsuper2(struct edufs_superblock *esb) {
 
-  uprintf("-------------------------------------------------\n");
-  uprintf("-- SUPERBLOCK INFO                             --\n");
-  uprintf("-------------------------------------------------\n");
-  uprintf("\tSize of filesystem blocks %d\n",esb->fs_bsize);
-  uprintf("\tNumber of blocks in filesystem %d\n",esb->fs_size);
-  uprintf("\tNumber of cylinder groups = %d\n",esb->fs_ncg);
-  uprintf("\tNumber of cylinders is each group = %d\n",esb->fs_cpg);
-  uprintf("\tDisk size = %d\n",esb->fs_size * esb->fs_bps);
-  uprintf("\tInterleave %d\n",esb->fs_interleave);
-  uprintf("\tBytes per sector: %d\n",esb->fs_bps);
-  uprintf("\tEnodes per group: %d\n",esb->fs_epg);
-  uprintf("\tNumber of blocks in fs: %d\n",esb->fs_size);
-  uprintf("\tNumber of data blocks in fs: %d\n",esb->fs_dsize);
-  uprintf("\tCG Offset in cylinder: %d\n",esb->fs__cgoffset);
-  uprintf("\tCylinder group size: %d\n",esb->fs_cgsize);
-  uprintf("\t-->Number of directories: %lld\n",esb->fs_cstotal.cs_ndir);
-  uprintf("\t-->Number of free blocks: %lld\n",esb->fs_cstotal.cs_nbfree);
-  uprintf("\t-->Number of free enodes: %lld\n",esb->fs_cstotal.cs_nefree);
-
-}
-
-
-/* JUST FOR DEVELOPMENT! */
-off_t enodeoff(int enodenum, struct edufsmount *emp) {
-  struct edufs_superblock *esb = emp->e_esb;
-  struct cg *ap = emp->cglist;
-  off_t offset;
+  ETRACE(ETR_VFS, "-------------------------------------------------\n");
+  ETRACE(ETR_VFS, "-- SUPERBLOCK INFO                             --\n");
+  ETRACE(ETR_VFS, "-------------------------------------------------\n");
+  ETRACE(ETR_VFS, "\tSize of filesystem blocks %d\n",esb->fs_bsize);
+  ETRACE(ETR_VFS, "\tNumber of blocks in filesystem %d\n",esb->fs_size);
+  ETRACE(ETR_VFS, "\tNumber of cylinder groups = %d\n",esb->fs_ncg);
+  ETRACE(ETR_VFS, "\tNumber of cylinders is each group = %d\n",esb->fs_cpg);
+  ETRACE(ETR_VFS, "\tDisk size = %d\n",esb->fs_size * esb->fs_bps);
+  ETRACE(ETR_VFS, "\tInterleave %d\n",esb->fs_interleave);
+  ETRACE(ETR_VFS, "\tBytes per sector: %d\n",esb->fs_bps);
+  ETRACE(ETR_VFS, "\tEnodes per group: %d\n",esb->fs_epg);
+  ETRACE(ETR_VFS, "\tNumber of blocks in fs: %d\n",esb->fs_size);
+  ETRACE(ETR_VFS, "\tNumber of data blocks in fs: %d\n",esb->fs_dsize);
+  ETRACE(ETR_VFS, "\tCG Offset in cylinder: %d\n",esb->fs__cgoffset);
+  ETRACE(ETR_VFS, "\tCylinder group size: %d\n",esb->fs_cgsize);
+  ETRACE(ETR_VFS, "\t-->Number of directories: %lld\n",esb->fs_cstotal.cs_ndir);
+  ETRACE(ETR_VFS, "\t-->Number of free blocks: %lld\n",esb->fs_cstotal.cs_nbfree);
+  ETRACE(ETR_VFS, "\t-->Number of free enodes: %lld\n",esb->fs_cstotal.cs_nefree);
 
-  int cg = enodenum / esb->fs_epg;
-  ap += cg;
-  offset = ap->cg_enodeoff + (sizeof(struct denode) * (enodenum % esb->fs_epg));
-  return offset;
 }
 
 
-/* get the 512 byte block that an enode belongs to! */
-/* im calling these "chunks" */
-off_t enodechunkoff(int enodenum, struct edufsmount *emp) {
+/*
+ * Read the enode table chunk at 'blkno', which holds enode 'ino'.
+ *
+ * If edufs_eraupdate() sees the misses clustering, also start async
+ * reads of the following chunks of this cg's table.  The later vgets
+ * then find them in the buffer cache and just decode their enode.  The
+ * detection state isn't locked; racing vgets can only make it guess
+ * wrong.
+ */
+static int
+edufs_enodebread(emp, ino, blkno, bpp)
+	 struct edufsmount *emp;
+	 ino_t ino;
+	 daddr_t blkno;
+	 struct buf **bpp;
+{
   struct edufs_superblock *esb = emp->e_esb;
-  struct cg *ap = emp->cglist;
-  off_t offset;
-  
-  int cg = enodenum / esb->fs_epg;
-  ap += cg;
-  /*offset = ap->cg_enodeoff + (sizeof(struct denode) * (enodenum % esb->fs_epg));*/
-  offset = ap->cg_enodeoff + (sizeof(struct denode) * (enodenum / (esb->fs_bps / sizeof(struct denode))));
-  return offset;    
+  struct cg *cgp;
+  daddr_t rablks[EDUFS_MAXENODERA], last;
+  int rasizes[EDUFS_MAXENODERA];
+  int i, nra, bps;
+
+  bps = esb->fs_bps;
+  cgp = emp->cglist + edufs_ino_cg(&emp->e_geom, ino);
+  last = edufs_btosec(&emp->e_geom, cgp->cg_enodeoff +
+	  (off_t)esb->fs_epg * sizeof(struct denode) - 1);
+  nra = edufs_eraupdate(&emp->e_era, blkno, last, edufs_enode_readahead);
+
+  edufs_statsbread(emp, emp->e_devvp, blkno);
+  if (nra == 0)
+	return (bread(emp->e_devvp, blkno, bps, NOCRED, bpp));
+  for (i = 0; i < nra; i++) {
+	rablks[i] = blkno + 1 + i;
+	rasizes[i] = bps;
+  }
+  ES_ADD(emp, ES_ENODERA, nra);
+  ETRACE(ETR_VGET, "enode chunk %lld readahead %d", (long long)blkno, nra);
+  return (breadn(emp->e_devvp, blkno, bps, rablks, rasizes, nra, NOCRED, bpp));
 }
 
 /* need to move this somewhere else */
@@ -713,44 +775,109 @@ void edufs_loadenode(bp,ep,esb,ino)
 
 {
   struct denode *dnode;
-  /* enodes per "chunk" */
-  /* is this offset correct??? */  
-  int offset = ino % (esb->fs_bps / sizeof(struct denode));
+  /* its slot in the chunk */
+  int offset = edufs_enodeslot(&ep->e_emp->e_geom, ino);
   
-  uprintf("offset into chunk is %d\n",offset);
+  ETRACE(ETR_VGET, "offset into chunk is %d\n",offset);
   
   dnode = (struct denode*)bp->b_data;
   dnode += offset;
-  uprintf("DENODE %d # %d\n",ino, dnode->de_spare[0]);
+  ETRACE(ETR_VGET, "DENODE %d # %d\n",ino, dnode->de_spare[0]);
   
-  *ep->den = *dnode;
+  ep->e_den = *dnode;
 
-  /*uprintf("Sneaky enode # = [%d]\n",ep->den->de_spare[0]);*/
+  /*uprintf("Sneaky enode # = [%d]\n",ep->e_den.de_spare[0]);*/
   /*uprintf("NLINK test = [%d]\n",dnode->de_nlink);*/
   
-   ep->e_mode = ep->den->de_mode;
-   uprintf("EMODE= %d",ep->e_mode);
-   uprintf("NLINK = %d",ep->e_nlink);
-   ep->e_nlink = ep->den->de_nlink;
-   /*********************************
-    *********************************
-    *********************************
-    */
-   uprintf("link hack? what is this?");
-   if(ep->e_nlink < 1)
-	 ep->e_nlink = 2;
-   uprintf("NLINK = %d",ep->e_nlink);
-   ep->e_size = ep->den->de_size;
-   uprintf("enode size in bytes=%lld",ep->e_size);
-   ep->e_flags = ep->den->de_flags;
-   ep->e_gen = ep->den->de_gen;
-   ep->e_uid = ep->den->de_uid;
-   ep->e_gid = ep->den->de_gid;	
+   ETRACE(ETR_VGET, "EMODE= %d",ep->e_mode);
+   ETRACE(ETR_VGET, "NLINK = %d",ep->e_nlink);
+   ETRACE(ETR_VGET, "enode size in bytes=%lld",ep->e_size);
   
   return;
 }
 
 
+/*
+ * Called by the syncer (MNT_LAZY) and sync(2).  File data goes first:
+ * vfs_stdsync() fsyncs every vnode with dirty buffers, waiting for
+ * them on MNT_WAIT, so the enodes and cg maps written after it never
+ * reach the disk ahead of the data they describe.
+ */
+int
+edufs_sync(mp, waitfor, cred, td)
+	 struct mount *mp;
+	 int waitfor;
+	 struct ucred *cred;
+	 struct thread *td;
+{
+  struct edufsmount *emp = VFSTOEDUFS(mp);
+  int error, error2;
+
+  if (mp->mnt_flag & MNT_RDONLY)
+	return (0);
+  error = vfs_stdsync(mp, waitfor, cred, td);
+  if ((error2 = edufs_esync(emp, waitfor)) != 0 && error == 0)
+	error = error2;
+  if ((error2 = edufs_cgflush(emp, waitfor)) != 0 && error == 0)
+	error = error2;
+  return (error);
+}
+
+
+/*
+ * Hang this mount's statistics off vfs.edufs.<device>.
+ */
+static void
+edufs_sysctl_attach(emp)
+	 struct edufsmount *emp;
+{
+  sysctl_ctx_init(&emp->e_sysctl_ctx);
+  emp->e_sysctl_tree = SYSCTL_ADD_NODE(&emp->e_sysctl_ctx,
+	  SYSCTL_STATIC_CHILDREN(_vfs_edufs), OID_AUTO, devtoname(emp->e_dev),
+	  CTLFLAG_RD, 0, "per mount statistics");
+  if (emp->e_sysctl_tree == NULL)
+	return;
+  SYSCTL_ADD_PROC(&emp->e_sysctl_ctx, SYSCTL_CHILDREN(emp->e_sysctl_tree),
+	  OID_AUTO, "ehash", CTLTYPE_STRING | CTLFLAG_RD, emp, 0,
+	  edufs_sysctl_ehash, "A", "enode hash chain statistics");
+  SYSCTL_ADD_INT(&emp->e_sysctl_ctx, SYSCTL_CHILDREN(emp->e_sysctl_tree),
+	  OID_AUTO, "cgmap_mem", CTLFLAG_RD, &emp->e_cgmapmem, 0,
+	  "bytes of cg maps in core");
+  SYSCTL_ADD_INT(&emp->e_sysctl_ctx, SYSCTL_CHILDREN(emp->e_sysctl_tree),
+	  OID_AUTO, "cgmap_maxmem", CTLFLAG_RD, &emp->e_cgmapmaxmem, 0,
+	  "most bytes of cg maps kept in core");
+  SYSCTL_ADD_INT(&emp->e_sysctl_ctx, SYSCTL_CHILDREN(emp->e_sysctl_tree),
+	  OID_AUTO, "excache_mem", CTLFLAG_RD, &emp->e_exmem, 0,
+	  "bytes of block map extent caches");
+  edufs_statsattach(emp);
+}
+
+static int
+edufs_sysctl_ehash(SYSCTL_HANDLER_ARGS)
+{
+  struct edufsmount *emp = arg1;
+  struct edufs_ehashstats es;
+  struct sbuf sb;
+  int error, i;
+
+  edufs_ehashstats(emp, &es);
+  sbuf_new(&sb, NULL, 256, SBUF_AUTOEXTEND);
+  sbuf_printf(&sb, "buckets %lu", es.es_buckets);
+  if (es.es_resizing)
+	sbuf_printf(&sb, " (resizing to %lu)", es.es_newbuckets);
+  sbuf_printf(&sb, " stripes %lu resizes %lu entries %lu used %lu maxchain %lu\n",
+	  es.es_stripes, es.es_resizes, es.es_entries, es.es_used, es.es_maxchain);
+  /* slot 0 counts empty chains, slot i chains of 2^(i-1) .. 2^i - 1 */
+  sbuf_printf(&sb, "chains 0:%lu", es.es_chains[0]);
+  for (i = 1; i < EHASH_STATSLOTS; i++)
+	sbuf_printf(&sb, " %d+:%lu", 1 << (i - 1), es.es_chains[i]);
+  sbuf_finish(&sb);
+  error = SYSCTL_OUT(req, sbuf_data(&sb), sbuf_len(&sb) + 1);
+  sbuf_delete(&sb);
+  return (error);
+}
+
+
 /* define the virtual filesystem operations */
 static struct vfsops edufs_vfsops = {  
   edufs_mount, 
@@ -759,7 +886,7 @@ static struct vfsops edufs_vfsops = {
   edufs_root,
   vfs_stdquotactl,
   edufs_statfs,
-  vfs_stdsync,
+  edufs_sync,
   edufs_vget,
   vfs_stdfhtovp,
   vfs_stdcheckexp,
@@ -34,8 +34,11 @@
 #include <sys/malloc.h>
 #include <sys/mount.h>
 #include <sys/mutex.h>
+#include <sys/proc.h>
 #include <sys/namei.h>
+#include <sys/pcpu.h>
 #include <sys/sysctl.h>
+#include <sys/time.h>
 #include <sys/vnode.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
@@ -43,11 +46,13 @@
 #include <sys/bio.h>
 #include <sys/buf.h>
 #include <sys/dirent.h>
-#include <fs/edufs/edufs_enode.h>
 #include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
 #include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_stats.h>
 #include <fs/edufs/edufs_dir.h>
 #include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_trace.h>
 #include <vm/vm.h>
 #include <vm/uma.h>
 #include <vm/vm_extern.h>
@@ -57,7 +62,6 @@
 
 static int edufs_access(struct vop_access_args *ap);
 static int edufs_bmap(struct vop_bmap_args *ap);
-static int edufs_lookup(struct vop_cachedlookup_args *ap);
 static int edufs_close(struct vop_close_args *ap);
 static int edufs_create(struct vop_create_args *ap);
 static int edufs_fsync(struct vop_fsync_args *ap);
@@ -70,6 +74,7 @@ static int edufs_pathconf(struct vop_pathconf_args *ap);
 static int edufs_print(struct vop_print_args *ap);
 static int edufs_read(struct vop_read_args *ap);
 static int edufs_readdir(struct vop_readdir_args *ap);
+static int edufs_readlink(struct vop_readlink_args *ap);
 static int edufs_reclaim(struct vop_reclaim_args *ap);
 static int edufs_remove(struct vop_remove_args *ap);
 static int edufs_rename(struct vop_rename_args *ap);
@@ -79,19 +84,16 @@ static int edufs_strategy(struct vop_strategy_args *ap);
 static int edufs_symlink(struct vop_symlink_args *ap);
 static int edufs_write(struct vop_write_args *ap);
 static int edufs_open(struct vop_open_args *ap);
+static int edufs_rastride(struct enode *ep, off_t off, int win,
+	daddr_t *rablks, int *rasizes);
 
 extern vfs_vget_t edufs_vget;
 
 
-void edufs_etimes(struct vnode *vp);
-
 /* the remaining functions should probably be broken out */
 
 /* allocation stuff */
-static int edufs_findfreeenode(struct edufsmount *emp, uint32_t *fenum,uint32_t *fcg);
 /*static int edufs_findfreeblock(struct edufsmount *emp, uint32_t *fbnum);*/
-/* not used? */
-/*atic int edufs_bmaparray(struct vnode *vp,int64_t bn,int *blk);*/
 
 /* unfinished */
 static int edufs_valloc(struct vnode *pvp,int mode,struct ucred *cred,struct vnode **vpp);
@@ -104,11 +106,14 @@ static int edufs_makeenode(int mode,struct vnode *dvp,struct vnode **vpp,struct
 
 
 extern uma_zone_t uma_enode;
-extern uma_zone_t uma_denode;
+
+/* the most blocks edufs_read() reads ahead, see edufs_readahead.h */
+static int edufs_readahead_max = 32;
+SYSCTL_INT(_vfs_edufs, OID_AUTO, readahead_max, CTLFLAG_RW,
+	&edufs_readahead_max, 0, "most blocks read ahead, 0 for none");
 
 
 
-extern int64_t startingoffsets[NIADDR]; 
 
 
 
@@ -127,7 +132,7 @@ edufs_create(ap)
 							   struct vattr *a_vap;
 							   } */ *ap;
 {
-  uprintf("EDUFS_CREATE\n");
+  ETRACE(ETR_VNOPS, "EDUFS_CREATE\n");
  
   int error;
 
@@ -140,7 +145,7 @@ edufs_create(ap)
   /* do i still need the freecg?? */
   error = edufs_makeenode(MAKEIMODE(ap->a_vap->va_type, ap->a_vap->va_mode),
 						  ap->a_dvp, ap->a_vpp, ap->a_cnp);
-  return (ENOSYS);
+  return (error);
 }
 
 
@@ -153,7 +158,7 @@ edufs_mknod(ap)
 							  struct vattr *a_vap;
 							  } */ *ap;
 {
-  uprintf("EDUFS_MKNOD\n");
+  ETRACE(ETR_VNOPS, "EDUFS_MKNOD\n");
   return (ENOSYS);
 }
 
@@ -166,7 +171,7 @@ edufs_open(ap)
 							 struct thread *a_td;
 							 } */ *ap;
 {
-  uprintf("EDUFS_OPEN\n");
+  ETRACE(ETR_VNOPS, "EDUFS_OPEN\n");
   /*if(ap->a_vp->filename != null) {
 	uprintf("--->FILENAME %d<---\n",ap->a_vp->filename);
 	}*/
@@ -183,7 +188,7 @@ edufs_close(ap)
 							  struct thread *a_td;
 							  } */ *ap;
 {
-  uprintf("EDUFS_CLOSE\n");
+  ETRACE(ETR_VNOPS, "EDUFS_CLOSE\n");
   struct vnode *vp = ap->a_vp;
   struct mount *mp;
   
@@ -205,7 +210,7 @@ edufs_close(ap)
 	 */
 	if (vp->v_type == VREG && VTOE(vp)->e_effnlink == 0) {
 	  (void) vn_start_write(vp, &mp, V_WAIT);
-	  uprintf("Calling rele!\n");
+	  ETRACE(ETR_VNOPS, "Calling rele!\n");
 	  vrele(vp);
 	  vn_finished_write(mp);
 	  return (EAGAIN);
@@ -216,20 +221,6 @@ edufs_close(ap)
 
 
 
-static int
-edufs_lookup(ap)
-	 struct vop_cachedlookup_args /* {
-									 struct vnode *a_dvp;
-									 struct vnode **a_vpp;
-									 struct componentname *a_cnp;
-									 } */ *ap;
-{
-  uprintf("EDUFS_LOOKUP\n");
-  panic("edufs_lookup");
-  return (ENOSYS);  
-}
-
-
 static int
 edufs_access(ap)
 	 struct vop_access_args /* {
@@ -239,7 +230,7 @@ edufs_access(ap)
 							   struct thread *a_td;
 							   } */ *ap;
 {
-  uprintf("EDUFS_ACCESS\n");
+  ETRACE(ETR_VNOPS, "EDUFS_ACCESS\n");
   struct vnode *vp = ap->a_vp;
   struct enode *ep = VTOE(vp);
   mode_t mode = ap->a_mode;
@@ -257,7 +248,7 @@ edufs_access(ap)
 	case VLNK:
 	case VREG:
 	  if (vp->v_mount->mnt_flag & MNT_RDONLY) {
-		uprintf("ERROR here\n");
+		ETRACE(ETR_VNOPS, "ERROR here\n");
 		return (EROFS);
 	  }
 	  
@@ -267,117 +258,14 @@ edufs_access(ap)
 	}
   }
 
-  uprintf("requested mode: ");
-  if(ap->a_mode & S_IRUSR) {
-	uprintf("r");
-  } else {
-	uprintf("-");
-  }
-  if(ap->a_mode & S_IWUSR) {
-	uprintf("w");
-  } else {
-	uprintf("-");
-  }
-  if(ap->a_mode & S_IXUSR) {
-	uprintf("x");
-  } else {
-	uprintf("-");
-  }
-  
-  if(ap->a_mode & S_IRGRP){
-	uprintf("r");
-  } else {
-	uprintf("-");
-  }
-  if(ap->a_mode & S_IWGRP){
-	uprintf("w");
-  } else {
-	uprintf("-");
-  }
-  if(ap->a_mode & S_IXGRP){
-	uprintf("x");
-  } else {
-	uprintf("-");
-  }
-
-
-  if(ap->a_mode & S_IROTH){
-	uprintf("r");
-  } else {
-	uprintf("-");
-  }
-  if(ap->a_mode & S_IWOTH){
-	uprintf("w");
-  } else {
-	uprintf("-");
-  }
-  if(ap->a_mode & S_IXOTH){
-	uprintf("x");
-  } else {
-	uprintf("-");
-  }
-  uprintf("\n");
-
-
-
-
-  uprintf("enode mode: ");
-  if(ep->e_mode & S_IRUSR) {
-	uprintf("r");
-  } else {
-	uprintf("-");
-  }
-  if(ep->e_mode & S_IWUSR) {
-	uprintf("w");
-  } else {
-	uprintf("-");
-  }
-  if(ep->e_mode & S_IXUSR) {
-	uprintf("x");
-  } else {
-	uprintf("-");
-  }
-  
-  if(ep->e_mode & S_IRGRP){
-	uprintf("r");
-  } else {
-	uprintf("-");
-  }
-  if(ep->e_mode & S_IWGRP){
-	uprintf("w");
-  } else {
-	uprintf("-");
-  }
-  if(ep->e_mode & S_IXGRP){
-	uprintf("x");
-  } else {
-	uprintf("-");
-  }
-
-
-  if(ep->e_mode & S_IROTH){
-	uprintf("r");
-  } else {
-	uprintf("-");
-  }
-  if(ep->e_mode & S_IWOTH){
-	uprintf("w");
-  } else {
-	uprintf("-");
-  }
-  if(ep->e_mode & S_IXOTH){
-	uprintf("x");
-  } else {
-	uprintf("-");
-  }
-  uprintf("\n");
-	
-  uprintf("file uid %d gid %d \n",ep->e_uid, ep->e_gid);  
-  uprintf("		uid %d gid %d \n",ap->a_cred->cr_uid,ap->a_cred->cr_gid);
-  uprintf("ruid uid %d gid %d \n",ap->a_cred->cr_ruid,ap->a_cred->cr_rgid);
+  ETRACE(ETR_VNOPS, "requested mode: %03o enode mode: %03o\n",
+		  ap->a_mode & ALLPERMS, ep->e_mode & ALLPERMS);
+  ETRACE(ETR_VNOPS, "file uid %d gid %d \n",ep->e_uid, ep->e_gid);  
+  ETRACE(ETR_VNOPS, "		uid %d gid %d \n",ap->a_cred->cr_uid,ap->a_cred->cr_gid);
+  ETRACE(ETR_VNOPS, "ruid uid %d gid %d \n",ap->a_cred->cr_ruid,ap->a_cred->cr_rgid);
   error = vaccess(vp->v_type, ep->e_mode, ep->e_uid, ep->e_gid,
 				  ap->a_mode, ap->a_cred, NULL);
-  uprintf("Error = %d",error);
+  ETRACE(ETR_VNOPS, "Error = %d",error);
   return (error);
 	
 }
@@ -391,7 +279,7 @@ edufs_getattr(ap)
 								struct thread *a_td;
 								} */ *ap;
 {
-  uprintf("EDUFS_GETATTR");
+  ETRACE(ETR_VNOPS, "EDUFS_GETATTR");
 
   struct vnode *vp = ap->a_vp;
   struct enode *ep = VTOE(vp);
@@ -409,19 +297,19 @@ edufs_getattr(ap)
   vap->va_uid = ep->e_uid;
   vap->va_gid = ep->e_gid;
   
-  vap->va_rdev = ep->den->de_db[0];
-  vap->va_size = ep->den->de_size;
-  vap->va_atime.tv_sec = ep->den->de_atime;
-  vap->va_atime.tv_nsec = ep->den->de_atimensec;
-  vap->va_mtime.tv_sec = ep->den->de_mtime;
-  vap->va_mtime.tv_nsec = ep->den->de_mtimensec;
-  vap->va_ctime.tv_sec = ep->den->de_ctime;
-  vap->va_ctime.tv_nsec = ep->den->de_ctimensec;
+  vap->va_rdev = ep->e_den.de_db[0];
+  vap->va_size = ep->e_size;
+  vap->va_atime.tv_sec = ep->e_den.de_atime;
+  vap->va_atime.tv_nsec = ep->e_den.de_atimensec;
+  vap->va_mtime.tv_sec = ep->e_den.de_mtime;
+  vap->va_mtime.tv_nsec = ep->e_den.de_mtimensec;
+  vap->va_ctime.tv_sec = ep->e_den.de_ctime;
+  vap->va_ctime.tv_nsec = ep->e_den.de_ctimensec;
   vap->va_birthtime.tv_sec = 0;
   vap->va_birthtime.tv_nsec = 0;
-  vap->va_bytes = dbtob((u_quad_t)ep->den->de_blocks);
+  vap->va_bytes = (u_quad_t)ep->e_blocks * ep->e_fs->fs_bsize;
   
-  vap->va_flags = 65536;/*ep->e_flags;*/
+  vap->va_flags = ep->e_flags & ~DE_INTERNAL;
   vap->va_gen = 0;/*ep->e_gen;*/
   vap->va_blocksize = vp->v_mount->mnt_stat.f_iosize;
 
@@ -463,7 +351,7 @@ edufs_setattr(ap)
 								struct thread *a_td;
 								} */ *ap;
 {
-  uprintf("EDUFS_SETATTR\n");
+  ETRACE(ETR_VNOPS, "EDUFS_SETATTR\n");
   return (ENOSYS);
 }
 
@@ -471,6 +359,39 @@ edufs_setattr(ap)
 
 
 
+/*
+ * List the blocks of the next win strides after a strided read at off,
+ * for breadn().  Stops at either end of the file and skips a block it
+ * has just listed.  Returns how many there are.
+ */
+static int
+edufs_rastride(ep, off, win, rablks, rasizes)
+	 struct enode *ep;
+	 off_t off;
+	 int win;
+	 daddr_t *rablks;
+	 int *rasizes;
+{
+  const struct edufs_geom *g = &ep->e_emp->e_geom;
+  daddr_t lbn, prev;
+  off_t next;
+  int i, n;
+
+  prev = edufs_lblkno(g, off);
+  for (i = 1, n = 0; i <= win; i++) {
+	next = off + i * ep->e_ra.ra_stride;
+	if (next < 0 || next >= ep->e_size)
+	  break;
+	if ((lbn = edufs_lblkno(g, next)) == prev)
+	  continue;
+	rablks[n] = lbn;
+	rasizes[n] = ep->e_fs->fs_bsize;
+	n++;
+	prev = lbn;
+  }
+  return (n);
+}
+
 static int
 edufs_read(ap)
 	 struct vop_read_args /* {
@@ -480,9 +401,10 @@ edufs_read(ap)
 							 struct ucred *a_cred;
 							 } */ *ap;
 {
-  uprintf("EDUFS_READ\n");	
+  ETRACE(ETR_READ, "EDUFS_READ\n");	
   struct vnode *vp;
   struct enode *ep;
+  struct edufsmount *emp;
   struct uio *uio;
   struct edufs_superblock *esb;
   struct buf *bp;
@@ -495,18 +417,20 @@ edufs_read(ap)
   int seqcount;
   int ioflag;
   vm_object_t object;
-  uprintf("r1");
+  daddr_t rablks[EDUFS_RAMAXSTRIDE];
+  int rasizes[EDUFS_RAMAXSTRIDE];
+  int nra;
+  ETRACE(ETR_READ, "r1");
   vp = ap->a_vp;
   uio = ap->a_uio;
   ioflag = ap->a_ioflag;
   if (ap->a_ioflag & IO_EXT)
+	return (EOPNOTSUPP);
 
-	GIANT_REQUIRED;
-
-  panic("edufs_read");
+  GIANT_REQUIRED;
   
-  seqcount = ap->a_ioflag >> 16;
   ep = VTOE(vp);
+  emp = ep->e_emp;
   mode = ep->e_mode;
 
 #ifdef DIAGNOSTIC
@@ -514,8 +438,8 @@ edufs_read(ap)
 	panic("ffs_read: mode");
 
   if (vp->v_type == VLNK) {
-	if ((int)ep->e_size < vp->v_mount->mnt_maxsymlinklen)
-	  panic("ffs_read: short symlink");
+	if (ep->e_flags & DE_INLINEDATA)
+	  panic("edufs_read: short symlink");
   } else if (vp->v_type != VREG && vp->v_type != VDIR)
 	panic("ffs_read: type %d",	vp->v_type);
 #endif
@@ -524,10 +448,10 @@ edufs_read(ap)
   if ((u_int64_t)uio->uio_offset > esb->fs_maxfilesize)
 	return (EFBIG);
 
-  uprintf("r2");
+  ETRACE(ETR_READ, "r2");
   orig_resid = uio->uio_resid;
   if (orig_resid <= 0) {
-	uprintf("r3");
+	ETRACE(ETR_READ, "r3");
 	return (0);
   }
 
@@ -535,32 +459,73 @@ edufs_read(ap)
 	
   bytesinfile = ep->e_size - uio->uio_offset;
   if (bytesinfile <= 0) {
-	uprintf("r4");
+	ETRACE(ETR_READ, "r4");
 	if ((vp->v_mount->mnt_flag & MNT_NOATIME) == 0) {
-	  uprintf("in access?\n");
+	  ETRACE(ETR_READ, "in access?\n");
 	  ep->e_flag |= EN_ACCESS;
 	}
-	uprintf("bytes in file <= 0\n");	  
+	ETRACE(ETR_READ, "bytes in file <= 0\n");	  
 	return 0;
   }
 
+  if (ep->e_flags & DE_INLINEDATA) {
+	/* tiny file, the data is right here in the denode */
+	xfersize = uio->uio_resid;
+	if (bytesinfile < xfersize)
+	  xfersize = bytesinfile;
+	error = uiomove(DE_INLINEPTR(&ep->e_den) + uio->uio_offset,
+		(int)xfersize, uio);
+	if (error == 0)
+	  ES_ADD(emp, ES_BYTESREAD, xfersize);
+	if ((vp->v_mount->mnt_flag & MNT_NOATIME) == 0)
+	  ep->e_flag |= EN_ACCESS;
+	return (error);
+  }
+
   if (object) {
 	vm_object_reference(object);
   }
 
+  /*
+   * The file's own read history sets the readahead, not the
+   * descriptor's seqcount in a_ioflag.  A sequential window goes to
+   * cluster_read() as its seqcount; a strided one becomes the blocks
+   * of the next strides, read along with the first block.
+   */
+  seqcount = edufs_raupdate(&ep->e_ra, uio->uio_offset, uio->uio_resid,
+	  edufs_readahead_max);
+  nra = 0;
+  switch (ep->e_ra.ra_mode) {
+  case EDUFS_RA_SEQ:
+	ES_INC(emp, ES_RASEQ);
+	break;
+  case EDUFS_RA_STRIDE:
+	ES_INC(emp, ES_RASTRIDE);
+	/* a stride of a block or less is sequential as far as blocks go */
+	if (ep->e_ra.ra_stride > 0 && ep->e_ra.ra_stride <= esb->fs_bsize)
+	  break;
+	nra = edufs_rastride(ep, uio->uio_offset, seqcount, rablks, rasizes);
+	seqcount = 0;
+	break;
+  default:
+	ES_INC(emp, ES_RARANDOM);
+	break;
+  }
+  ETRACE(ETR_READ, "ra %d %jd %d win %d mode %d", (int)ep->e_number,
+	  (intmax_t)uio->uio_offset, uio->uio_resid, ep->e_ra.ra_win,
+	  ep->e_ra.ra_mode);
+
   /*
    * Ok so we couldn't do it all in one vm trick...
    * so cycle around trying smaller bites..
    */
   for (error = 0, bp = NULL; uio->uio_resid > 0; bp = NULL) {
-	uprintf("r5");
+	ETRACE(ETR_READ, "r5");
 	/* check and see if we got to the end of data */
 	if ((bytesinfile = ep->e_size - uio->uio_offset) <= 0)
 	  break;
-	uprintf("r6");
-	/* calculates (loc / fs->fs_bsize) */
-	/*lbn = lblkno(esb, uio->uio_offset);*/
-	lbn = uio->uio_offset / esb->fs_bsize;
+	ETRACE(ETR_READ, "r6");
+	lbn = edufs_lblkno(&emp->e_geom, uio->uio_offset);
 	nextlbn = lbn + 1;
 	  
 	/*
@@ -570,8 +535,7 @@ edufs_read(ap)
 	 * depending ).
 	 */
 	size = esb->fs_bsize; /* doesnt do frags yet *//*blksize(fs, ep, lbn);*/
-	/*blkoffset = blkoff(esb, uio->uio_offset);*/ /* loc % fs->fs_bsize */
-	blkoffset = uio->uio_offset % esb->fs_bsize;
+	blkoffset = edufs_blkoff(&emp->e_geom, uio->uio_offset);
 	  
 	/*
 	 * The amount we want to transfer in this iteration is
@@ -589,17 +553,22 @@ edufs_read(ap)
 	  xfersize = uio->uio_resid;
 	if (bytesinfile < xfersize)
 	  xfersize = bytesinfile;
-	uprintf("r7");
-	/* calculates ((off_t)blk * fs->fs_bsize) */
-	/*if (lblktosize(esb, nextlbn) >= ep->e_size) {*/
-	if(nextlbn * esb->fs_bsize >= ep->e_size) {
+	ETRACE(ETR_READ, "r7");
+	if (nra > 0) {
+	  /* strided: the next strides' blocks come along with this one */
+	  edufs_statsbread(emp, vp, lbn);
+	  error = breadn(vp, lbn, size, rablks, rasizes, nra, NOCRED, &bp);
+	  ES_ADD(emp, ES_RASTRIDEBLK, nra);
+	  nra = 0;
+	} else if(edufs_lblktob(&emp->e_geom, nextlbn) >= ep->e_size) {
 	  /*
 	   * Don't do readahead if this is the end of the file.
 	   */
-	  uprintf("r8");
+	  ETRACE(ETR_READ, "r8");
 	  /**** error in here ****/
+	  edufs_statsbread(emp, vp, lbn);
 	  error = bread(vp, lbn, size, NOCRED, &bp);
-	  uprintf("THIS bread error = [%d]",error);
+	  ETRACE(ETR_READ, "THIS bread error = [%d]",error);
 
 	} else if ((vp->v_mount->mnt_flag & MNT_NOCLUSTERR) == 0) {
 	  /* 
@@ -609,7 +578,8 @@ edufs_read(ap)
 	   * XXX	This may not be a win if we are not
 	   * doing sequential access.
 	   */
-	  uprintf("r9");
+	  ETRACE(ETR_READ, "r9");
+	  edufs_statsbread(emp, vp, lbn);
 	  error = cluster_read(vp, ep->e_size, lbn,
 						   size, NOCRED, uio->uio_resid, seqcount, &bp);
 	} else if (seqcount > 1) {
@@ -622,7 +592,8 @@ edufs_read(ap)
 	   * the 6th argument.
 	   */
 	  int nextsize = esb->fs_bsize;/*blksize(esb, ep, nextlbn);*/
-	  uprintf("r10");
+	  ETRACE(ETR_READ, "r10");
+	  edufs_statsbread(emp, vp, lbn);
 	  error = breadn(vp, lbn,
 					 size, &nextlbn, &nextsize, 1, NOCRED, &bp);
 	} else {
@@ -631,11 +602,12 @@ edufs_read(ap)
 	   * user asked for. Interestingly, the same as
 	   * the first option above.
 	   */
-	  uprintf("r11");
+	  ETRACE(ETR_READ, "r11");
+	  edufs_statsbread(emp, vp, lbn);
 	  error = bread(vp, lbn, size, NOCRED, &bp);
 	}
 	if (error) {
-	  uprintf("r12: error code = %d\n",error);
+	  ETRACE(ETR_READ, "r12: error code = %d\n",error);
 		
 	  brelse(bp);
 	  bp = NULL;
@@ -669,14 +641,15 @@ edufs_read(ap)
 	  /*
 	   * otherwise use the general form
 	   */
-	  error =
-		uprintf("r13");
-	  uprintf("xfersize = [%ld]",xfersize);		
-	  uiomove((char *)bp->b_data /*+ blkoffset*/,
+	  ETRACE(ETR_READ, "r13");
+	  ETRACE(ETR_READ, "xfersize = [%ld]",xfersize);		
+	  error = uiomove((char *)bp->b_data + blkoffset,
 			  (int)xfersize, uio);
 		
-	  uprintf("iomove error = [%d]  ",error);
+	  ETRACE(ETR_READ, "iomove error = [%d]  ",error);
 	}
+	if (error == 0)
+	  ES_ADD(emp, ES_BYTESREAD, xfersize);
 	  
 	if (error)
 	  break;
@@ -688,7 +661,7 @@ edufs_read(ap)
 	   * then we don't need the buf, mark it available
 	   * for freeing. The VM has the data.
 	   */
-	  uprintf("r14");
+	  ETRACE(ETR_READ, "r14");
 	  bp->b_flags |= B_RELBUF;
 	  brelse(bp);
 	} else {
@@ -698,7 +671,7 @@ edufs_read(ap)
 	   * freeing it. We just queue
 	   * it onto another list.
 	   */
-	  uprintf("r15");
+	  ETRACE(ETR_READ, "r15");
 	  bqrelse(bp);
 	}
   } /* end for loop */
@@ -712,24 +685,24 @@ edufs_read(ap)
   if (bp != NULL) {
 	if ((ioflag & (IO_VMIO|IO_DIRECT)) &&
 		(LIST_FIRST(&bp->b_dep) == NULL)) {
-	  uprintf("r16");
+	  ETRACE(ETR_READ, "r16");
 	  bp->b_flags |= B_RELBUF;
 	  brelse(bp);
 	} else {
-	  uprintf("r17");
+	  ETRACE(ETR_READ, "r17");
 	  bqrelse(bp);
 	}
   }
 	
   if (object) {
-	uprintf("r18");
+	ETRACE(ETR_READ, "r18");
 	VM_OBJECT_LOCK(object);
 	vm_object_vndeallocate(object);
   }
   if ((error == 0 || uio->uio_resid != orig_resid) &&
 	  (vp->v_mount->mnt_flag & MNT_NOATIME) == 0)
 	ep->e_flag |= EN_ACCESS;
-  uprintf("EXIT--");
+  ETRACE(ETR_READ, "EXIT--");
   return (error);
 }
 
@@ -743,8 +716,95 @@ edufs_write(ap)
 							  struct ucred *a_cred;
 							  } */ *ap;
 {
-  uprintf("EDUFS_WRITE\n");
-  return (ENOSYS);
+  struct vnode *vp = ap->a_vp;
+  struct uio *uio = ap->a_uio;
+  int ioflag = ap->a_ioflag;
+  struct enode *ep = VTOE(vp);
+  struct edufsmount *emp = ep->e_emp;
+  struct edufs_superblock *esb = ep->e_fs;
+  struct buf *bp;
+  daddr_t lbn;
+  off_t blkoffset, xfersize, end;
+  int error, flags, seqcount, werror;
+
+  ETRACE(ETR_VNOPS, "EDUFS_WRITE\n");
+  seqcount = ioflag >> IO_SEQSHIFT;
+  /* VLNK for the target of a long symlink */
+  if (vp->v_type != VREG && vp->v_type != VLNK)
+	return (EISDIR);
+  if (ioflag & IO_APPEND)
+	uio->uio_offset = ep->e_size;
+  if (uio->uio_offset < 0)
+	return (EINVAL);
+  if (uio->uio_resid == 0)
+	return (0);
+  end = uio->uio_offset + uio->uio_resid;
+
+  /*
+   * Small enough to live in the denode: an inline file, or an
+   * empty one that hasn't got a block yet.
+   */
+  if (end <= emp->e_maxinline &&
+	  ((ep->e_flags & DE_INLINEDATA) ||
+	   (ep->e_size == 0 && ep->e_blocks == 0))) {
+	if ((ep->e_flags & DE_INLINEDATA) == 0) {
+	  bzero(DE_INLINEPTR(&ep->e_den), EDUFS_MAXINLINE);
+	  ep->e_flags |= DE_INLINEDATA;
+	}
+	error = uiomove(DE_INLINEPTR(&ep->e_den) + uio->uio_offset,
+		uio->uio_resid, uio);
+	if (uio->uio_offset > ep->e_size) {
+	  ep->e_size = uio->uio_offset;
+	  vnode_pager_setsize(vp, ep->e_size);
+	}
+	/* the data is in the denode, so it can't wait like a time stamp */
+	ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+	if (error == 0)
+	  error = edufs_update(vp, ioflag & IO_SYNC);
+	return (error);
+  }
+  if ((ep->e_flags & DE_INLINEDATA) &&
+	  (error = edufs_inlinepromote(vp)) != 0)
+	return (error);
+
+  for (error = 0; uio->uio_resid > 0;) {
+	lbn = edufs_lblkno(&emp->e_geom, uio->uio_offset);
+	blkoffset = edufs_blkoff(&emp->e_geom, uio->uio_offset);
+	xfersize = esb->fs_bsize - blkoffset;
+	if (uio->uio_resid < xfersize)
+	  xfersize = uio->uio_resid;
+
+	/* a partial block keeps whatever else is in it */
+	flags = xfersize < esb->fs_bsize ? EB_CLRBUF : 0;
+	if ((error = edufs_balloc(vp, lbn, flags, &bp)) != 0)
+	  break;
+	if (uio->uio_offset + xfersize > ep->e_size) {
+	  ep->e_size = uio->uio_offset + xfersize;
+	  vnode_pager_setsize(vp, ep->e_size);
+	  ep->e_flag |= EN_MODIFIED;
+	}
+	error = uiomove((char *)bp->b_data + blkoffset, (int)xfersize, uio);
+	if (ioflag & IO_SYNC) {
+	  if ((werror = bwrite(bp)) != 0 && error == 0)
+		error = werror;
+	} else if (xfersize + blkoffset == esb->fs_bsize) {
+	  /* a full block; let cluster_write() gather it with its neighbours */
+	  if ((vp->v_mount->mnt_flag & MNT_NOCLUSTERW) == 0) {
+		bp->b_flags |= B_CLUSTEROK;
+		cluster_write(bp, ep->e_size, seqcount);
+	  } else
+		bawrite(bp);
+	} else {
+	  bp->b_flags |= B_CLUSTEROK;
+	  bdwrite(bp);
+	}
+	if (error)
+	  break;
+	ep->e_flag |= EN_CHANGE | EN_UPDATE;
+  }
+  if (error == 0)
+	error = edufs_update(vp, ioflag & IO_SYNC);
+  return (error);
 }
 
 
@@ -757,8 +817,13 @@ edufs_fsync(ap)
 							  struct thread *a_td;
 							  } */ *ap;
 {
-  uprintf("EDUFS_FSYNC\n");
-  return (ENOSYS);
+  int error;
+
+  ETRACE(ETR_VNOPS, "EDUFS_FSYNC\n");
+  /* the dirty data buffers first, waited for on MNT_WAIT, then the enode */
+  if ((error = vop_stdfsync(ap)) != 0)
+	return (error);
+  return (edufs_update(ap->a_vp, ap->a_waitfor == MNT_WAIT));
 }
 
 static int
@@ -769,7 +834,7 @@ edufs_remove(ap)
 							   struct componentname *a_cnp;
 							   } */ *ap;
 {
-  uprintf("EDUFS_REMOVE\n");
+  ETRACE(ETR_VNOPS, "EDUFS_REMOVE\n");
   return (EOPNOTSUPP);
 }
 
@@ -781,7 +846,7 @@ edufs_link(ap)
 							 struct componentname *a_cnp;
 							 } */ *ap;
 {
-  uprintf("EDUFS_LINK\n");
+  ETRACE(ETR_VNOPS, "EDUFS_LINK\n");
   return (EOPNOTSUPP);
 }
 
@@ -797,7 +862,7 @@ edufs_rename(ap)
 							   struct componentname *a_tcnp;
 							   } */ *ap;
 {
-  uprintf("EDUFS_RENAME\n");
+  ETRACE(ETR_VNOPS, "EDUFS_RENAME\n");
   return (EOPNOTSUPP);
 }
 
@@ -810,7 +875,7 @@ edufs_mkdir(ap)
 							  struct vattr *a_vap;
 							  } */ *ap;
 {
-  uprintf("EDUFS_MKDIR\n");
+  ETRACE(ETR_VNOPS, "EDUFS_MKDIR\n");
   return (EOPNOTSUPP);
 }
 
@@ -822,7 +887,7 @@ edufs_rmdir(ap)
 							  struct componentname *a_cnp;
 							  } */ *ap;
 {
-  uprintf("EDUFS_RMDIR\n");
+  ETRACE(ETR_VNOPS, "EDUFS_RMDIR\n");
   return (EOPNOTSUPP);
 }
 
@@ -839,8 +904,51 @@ edufs_symlink(ap)
 								char *a_target;
 								} */ *ap;
 {
-  uprintf("EDUFS_SYMLINK\n");
-  return (EOPNOTSUPP);
+  struct vnode *vp, **vpp = ap->a_vpp;
+  struct enode *ep;
+  int len, error;
+
+  ETRACE(ETR_VNOPS, "EDUFS_SYMLINK\n");
+  error = edufs_makeenode(DIFLNK | ap->a_vap->va_mode, ap->a_dvp,
+						  vpp, ap->a_cnp);
+  if (error)
+	return (error);
+  vp = *vpp;
+  ep = VTOE(vp);
+  len = strlen(ap->a_target);
+  if (len <= ep->e_emp->e_maxinline) {
+	/* fast symlink: the target lives in the denode, no block */
+	bcopy(ap->a_target, DE_INLINEPTR(&ep->e_den), len);
+	ep->e_flags |= DE_INLINEDATA;
+	ep->e_size = len;
+	ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+	error = edufs_update(vp, 1);
+  } else
+	error = vn_rdwr(UIO_WRITE, vp, ap->a_target, len, (off_t)0,
+					UIO_SYSSPACE, IO_NODELOCKED, ap->a_cnp->cn_cred, NOCRED,
+					(int *)0, (struct thread *)0);
+  if (error)
+	vput(vp);
+  return (error);
+}
+
+
+static int
+edufs_readlink(ap)
+	 struct vop_readlink_args /* {
+								 struct vnode *a_vp;
+								 struct uio *a_uio;
+								 struct ucred *a_cred;
+								 } */ *ap;
+{
+  struct vnode *vp = ap->a_vp;
+  struct enode *ep = VTOE(vp);
+
+  ETRACE(ETR_VNOPS, "EDUFS_READLINK\n");
+  /* a fast symlink needs no buffer at all */
+  if (ep->e_flags & DE_INLINEDATA)
+	return (uiomove(DE_INLINEPTR(&ep->e_den), (int)ep->e_size, ap->a_uio));
+  return (VOP_READ(vp, ap->a_uio, 0, ap->a_cred));
 }
 
 
@@ -857,7 +965,7 @@ edufs_readdir(ap)
 								u_long **a_cookies;
 								} */ *ap;
 {
-  uprintf("EDUFS_READDIR\n");
+  ETRACE(ETR_READDIR, "EDUFS_READDIR\n");
   
   struct uio *uio  = ap->a_uio;
   struct vnode *vp = ap->a_vp;
@@ -888,22 +996,22 @@ edufs_readdir(ap)
   
   if (uio->uio_resid < sizeof(struct dirent) ||
 	  (offset & (sizeof(struct dirent) - 1))) {
-	uprintf("returning here");
+	ETRACE(ETR_READDIR, "returning here");
 	return (EINVAL);
   }
 
   
   if (ap->a_ncookies) {
-	uprintf("NOT NFS ENABLED");
+	ETRACE(ETR_READDIR, "NOT NFS ENABLED");
 	return (EINVAL);
   }
   
-  dpb = esb->fs_bps / sizeof(struct edufs_dirblock);
+  dpb = esb->fs_bsize / sizeof(struct edufs_dirblock);
 
-  uprintf("dirblocks per block = %ld\n",dpb);
+  ETRACE(ETR_READDIR, "dirblocks per block = %ld\n",dpb);
   
   while (uio->uio_resid > 0) { 
-    uprintf("residue = %d\n",uio->uio_resid);
+    ETRACE(ETR_READDIR, "residue = %d\n",uio->uio_resid);
 	count++;
     if(count == 5000) 
       panic("readdir count == 5000");
@@ -911,51 +1019,49 @@ edufs_readdir(ap)
     /* check for offset greater than file size */  
     diff = ep->e_size - offset;
     if (diff <= 0) {
-      uprintf("breaking out of loop!\n");
+      ETRACE(ETR_READDIR, "breaking out of loop!\n");
       goto out;
     }
 
     
     /* figure out what logical block we are on */
 	/* this code needs to be in a function etc */
-    logblock = offset / esb->fs_bsize;
+    logblock = edufs_lblkno(&emp->e_geom, offset);
 
   
     /* read in a block */					
-    uprintf("Calling bread with log %d %d\n",logblock,esb->fs_bps);
-    error = bread(vp,logblock,esb->fs_bps,NOCRED,&bp);
-    uprintf("after bread");
+    ETRACE(ETR_READDIR, "Calling bread with log %d %d\n",logblock,esb->fs_bps);
+    edufs_statsbread(emp, vp, logblock);
+    error = bread(vp,logblock,esb->fs_bsize,NOCRED,&bp);
+    ETRACE(ETR_READDIR, "after bread");
 
     if(error) {
       brelse(bp);
       return(error);
     } else {
-      uprintf("READ BLOCK %d OK\n",logblock);
+      ETRACE(ETR_READDIR, "READ BLOCK %d OK\n",logblock);
     }
     
     /* read the dirs on the block */
-	dataoffset = offset % esb->fs_bps;
-	uprintf("dataoffset = %lld\n",dataoffset);
-	uprintf("\t\t\t offset %lld physblock %lld  d\n",bp->b_offset,bp->b_blkno);
+	dataoffset = edufs_blkoff(&emp->e_geom, offset);
+	ETRACE(ETR_READDIR, "dataoffset = %lld\n",dataoffset);
+	ETRACE(ETR_READDIR, "\t\t\t offset %lld physblock %lld  d\n",bp->b_offset,bp->b_blkno);
 	db = (struct edufs_dirblock *)(bp->b_data + dataoffset);
 
-    for(dn = 0,emptydirslots=0; dn < dpb; dn++,db++) {
-      if(offset > esb->fs_bps) {
-		uprintf("DIR %d BIGGER THAN 1 DISK BLOCK\n",dn);		
-		goto out;
-      }
+    for(dn = dataoffset / sizeof(struct edufs_dirblock),emptydirslots=0;
+		dn < dpb && offset < ep->e_size; dn++,db++) {
 	  
       if(db->d_type == 0) {
 		/* found an empty dir slot */
 		emptydirslots++;
-		uprintf("emptydir.");
+		ETRACE(ETR_READDIR, "emptydir.");
 		/*--------------------------*/
 		/* NEED to update offset... */
 		/*--------------------------*/
 		offset += sizeof(struct edufs_dirblock);      
 		continue;		
       } else {
-		uprintf("realdir.");
+		ETRACE(ETR_READDIR, "realdir.");
 	  }
       
       /*bzero(dirbuf.d_name, sizeof(dirbuf.d_name));*/
@@ -972,14 +1078,14 @@ edufs_readdir(ap)
       /*dirbuf.d_name[dirbuf.d_namlen] = 0;*/				  
       dirbuf.d_reclen = GENERIC_DIRSIZ(&dirbuf);
       
-      uprintf("\n directory block enode = %d \n",dirbuf.d_fileno);
-      uprintf("d_type= %d \n",dirbuf.d_type);
-      uprintf("name len = %d \n",dirbuf.d_namlen);
-      uprintf("name = %s \n",dirbuf.d_name);
-      uprintf("reclen = %d \n",dirbuf.d_reclen);
+      ETRACE(ETR_READDIR, "\n directory block enode = %d \n",dirbuf.d_fileno);
+      ETRACE(ETR_READDIR, "d_type= %d \n",dirbuf.d_type);
+      ETRACE(ETR_READDIR, "name len = %d \n",dirbuf.d_namlen);
+      ETRACE(ETR_READDIR, "name = %s \n",dirbuf.d_name);
+      ETRACE(ETR_READDIR, "reclen = %d \n",dirbuf.d_reclen);
 
       if (uio->uio_resid < dirbuf.d_reclen) {
-		uprintf("resid < reclen	 ");
+		ETRACE(ETR_READDIR, "resid < reclen	 ");
 		brelse(bp);
 		goto out;
       }	
@@ -987,7 +1093,7 @@ edufs_readdir(ap)
       error = uiomove(&dirbuf, dirbuf.d_reclen, uio);
       
       if(error) {
-		uprintf("uiomove error\n");
+		ETRACE(ETR_READDIR, "uiomove error\n");
 		brelse(bp);
 		goto out;	  
       }
@@ -997,10 +1103,10 @@ edufs_readdir(ap)
             
     brelse(bp);	
   }
-  uprintf("getting out!");
+  ETRACE(ETR_READDIR, "getting out!");
  out:	
   uio->uio_offset = offset;		
-  uprintf("new uio offset = %lld\n",uio->uio_offset);
+  ETRACE(ETR_READDIR, "new uio offset = %lld\n",uio->uio_offset);
   return (error);
 }
 
@@ -1015,8 +1121,13 @@ edufs_bmap(ap)
 							 int *a_runb;
 							 } */ *ap;
 {
-  uprintf("EDUFS_BMP\n");
-  return (ENOSYS);
+  ETRACE(ETR_VNOPS, "EDUFS_BMAP\n");
+  if (ap->a_vpp != NULL)
+	*ap->a_vpp = VTOE(ap->a_vp)->e_devvp;
+  if (ap->a_bnp == NULL)
+	return (0);
+  return (edufs_bmaparray(ap->a_vp, ap->a_bn, ap->a_bnp, ap->a_runp,
+	  ap->a_runb));
 }
 
 
@@ -1034,11 +1145,11 @@ edufs_strategy(ap)
 
   struct vnode *dvp; /* device vnode ptr */
   
-  uint32_t logblock = 0;
-  int bn = 0;
+  daddr_t logblock, bn;
+  int error, n;
   
 
-  uprintf("EDUFS_STRATEGY\n");  
+  ETRACE(ETR_STRATEGY, "EDUFS_STRATEGY\n");  
   
   ep = VTOE(vp);
   
@@ -1046,12 +1157,36 @@ edufs_strategy(ap)
 
   if (vp->v_type == VBLK || vp->v_type == VCHR)
 	panic("edufs_strategy: spec");
+
+  if (ep->e_flags & DE_INLINEDATA) {
+	/* inline data: fill the buffer from the denode, no I/O */
+	if (bp->b_iocmd == BIO_READ) {
+	  n = 0;
+	  if (bp->b_offset < ep->e_size)
+		n = imin(bp->b_bcount, ep->e_size - bp->b_offset);
+	  if (n > 0)
+		bcopy(DE_INLINEPTR(&ep->e_den) + bp->b_offset, bp->b_data, n);
+	  bzero(bp->b_data + n, bp->b_bcount - n);
+	  bp->b_resid = 0;
+	} else {
+	  /* edufs_write never leaves inline data in a buffer */
+	  bp->b_error = EIO;
+	  bp->b_ioflags |= BIO_ERROR;
+	}
+	bufdone(bp);
+	return (0);
+  }
   
   if(bp->b_blkno == bp->b_lblkno) {
-	logblock = bp->b_offset / ep->e_fs->fs_bsize;
-	uprintf("logical block = %d\n",logblock);
-	bn = ep->den->de_db[logblock] / ep->e_fs->fs_bps;
-	uprintf("Try to read %d\n",bn);
+	logblock = edufs_lblkno(&ep->e_emp->e_geom, bp->b_offset);
+	ETRACE(ETR_STRATEGY, "logical block = %lld\n",(long long)logblock);
+	if ((error = edufs_bmaparray(vp, logblock, &bn, NULL, NULL)) != 0) {
+	  bp->b_error = error;
+	  bp->b_ioflags |= BIO_ERROR;
+	  bufdone(bp);
+	  return (0);
+	}
+	ETRACE(ETR_STRATEGY, "Try to read %lld\n",(long long)bn);
 	/* set physical block number */
 	bp->b_blkno = bn;	
 	
@@ -1059,25 +1194,25 @@ edufs_strategy(ap)
 	bp->b_lblkno = logblock;
 
 	if((long)bp->b_blkno == -1) {
-	  uprintf("clrbuf");
+	  ETRACE(ETR_STRATEGY, "clrbuf");
 	  vfs_bio_clrbuf(bp);
 	}
 	
   }
-  uprintf("here");
+  ETRACE(ETR_STRATEGY, "here");
   if((long)bp->b_blkno == -1) {
-	uprintf("blkno==-1");
+	ETRACE(ETR_STRATEGY, "blkno==-1");
 	bufdone(bp);
 	return(0);
   }
 
-  uprintf("strategy foo");
+  ETRACE(ETR_STRATEGY, "strategy foo");
   dvp=ep->e_devvp;
   bp->b_dev = dvp->v_rdev;
   bp->b_iooffset = dbtob(bp->b_blkno);
   VOP_SPECSTRATEGY(dvp,bp);
   
-  uprintf("strategy done");
+  ETRACE(ETR_STRATEGY, "strategy done");
   return (0);	 
 }
 
@@ -1088,7 +1223,13 @@ edufs_print(ap)
 							  struct vnode *vp;
 							  } */ *ap;
 {
-  uprintf("EDUFS_PRINT\n");
+  struct enode *ep = VTOE(ap->a_vp);
+  static const char *ramodes[] = { "random", "sequential", "strided" };
+
+  ETRACE(ETR_VNOPS, "EDUFS_PRINT\n");
+  printf("\tino %lu, readahead %s window %d stride %jd\n",
+	  (u_long)ep->e_number, ramodes[ep->e_ra.ra_mode], ep->e_ra.ra_win,
+	  (intmax_t)ep->e_ra.ra_stride);
   return (0);
 }
 
@@ -1100,7 +1241,7 @@ edufs_pathconf(ap)
 								 int *a_retval;
 								 } */ *ap;
 {
-  uprintf("EDUFS_PATHCONF\n");
+  ETRACE(ETR_VNOPS, "EDUFS_PATHCONF\n");
   int error;
   
   error = 0;
@@ -1109,7 +1250,7 @@ edufs_pathconf(ap)
 	*ap->a_retval = LINK_MAX;
 	break;
   case _PC_NAME_MAX:
-	*ap->a_retval = NAME_MAX;
+	*ap->a_retval = EDUFS_MAXNAMLEN;
 	break;
   case _PC_PATH_MAX:
 	*ap->a_retval = PATH_MAX;
@@ -1182,7 +1323,7 @@ edufs_inactive(ap)
 								 struct thread *a_td;
 								 } */ *ap;
 {
-  uprintf("VNOPS::INACTIVE\n");	 
+  ETRACE(ETR_VNOPS, "VNOPS::INACTIVE\n");	 
 
   struct vnode *vp = ap->a_vp;
   struct enode *ep = VTOE(vp);
@@ -1192,41 +1333,36 @@ edufs_inactive(ap)
 	
   VI_LOCK(vp);
   if (prtactive && vp->v_usecount != 0)
-	uprintf("edufs_inactive: pushing active");
+	ETRACE(ETR_VNOPS, "edufs_inactive: pushing active");
   VI_UNLOCK(vp);
 	
   /*
    * Ignore inodes related to stale file handles.
    */
   if (ep->e_mode == 0) {
-	uprintf("MODE is 0 - go to out\n");
+	ETRACE(ETR_VNOPS, "MODE is 0 - go to out\n");
 	goto out;
   }
   if (ep->e_nlink <= 0) {
 	(void) vn_write_suspend_wait(vp, NULL, V_WAIT);
 
+	error = edufs_freeblocks(vp, td);
 	mode = ep->e_mode;
 	ep->e_mode = 0;
-	ep->den->de_mode = 0;
-	ep->e_flag |= EN_CHANGE | EN_UPDATE;
-	/*edufs_vfree(vp, ep->e_number, mode);*/
-	uprintf("************Supposed to call edufs vfree\n");
+	ep->e_flag |= EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+	(void) edufs_enodefree(ep->e_emp, ep->e_number, mode);
   }
 
-  /*
-    if (ep->e_flag & (EN_ACCESS | EN_CHANGE | EN_MODIFIED | EN_UPDATE)) {
-    uprintf("IN: 1:");
-    if ((ep->e_flag & (EN_CHANGE | EN_UPDATE | EN_MODIFIED)) == 0 &&
-    vn_write_suspend_wait(vp, NULL, V_NOWAIT)) {
-    ep->e_flag &= ~EN_ACCESS;
-    uprintf("IN: 2:");
-    } else {
-    (void) vn_write_suspend_wait(vp, NULL, V_WAIT);
-    
-    deupdate(vp, 0);
-    uprintf("supposed to update timestamps etc\n");		
-    }
-    }*/
+  if (ep->e_flag & (EN_ACCESS | EN_CHANGE | EN_MODIFIED | EN_UPDATE)) {
+	if ((ep->e_flag & (EN_CHANGE | EN_UPDATE | EN_MODIFIED)) == 0 &&
+		vn_write_suspend_wait(vp, NULL, V_NOWAIT)) {
+	  ep->e_flag &= ~EN_ACCESS;
+	} else {
+	  (void) vn_write_suspend_wait(vp, NULL, V_WAIT);
+	  /* queued; the syncer writes it with its neighbours */
+	  error = edufs_update(vp, 0);
+	}
+  }
   
  out:  
   VOP_UNLOCK(vp, 0, td);
@@ -1236,9 +1372,9 @@ edufs_inactive(ap)
    */
   if (ep->e_mode == 0) {
 	vrecycle(vp, NULL, td);
-	uprintf("INACTIVE_>RECYCLE");
+	ETRACE(ETR_VNOPS, "INACTIVE_>RECYCLE");
   }
-  uprintf("IN-error[%d]\n",error);
+  ETRACE(ETR_VNOPS, "IN-error[%d]\n",error);
   return (error);
 		  
 }
@@ -1254,10 +1390,14 @@ edufs_reclaim(ap)
   struct vnode *vp = ap->a_vp;
   struct enode *ep = VTOE(vp);
   /*	struct edufsmount *emp = ep->e_emp;*/
-  uprintf("VNOPS::RECLAIM\n");
+  ETRACE(ETR_VNOPS, "VNOPS::RECLAIM\n");
 
   if (prtactive && vrefcnt(vp) != 0)
 	vprint("edufs_reclaim(): pushing active", vp);
+  /*
+   * Anything still queued for writeback has to go out now.
+   */
+  (void) edufs_update(vp, 1);
   /*
    * Remove the enode from its hash chain.
    */
@@ -1266,15 +1406,16 @@ edufs_reclaim(ap)
    * Purge old data structures associated with the denode.
    */
   cache_purge(vp);
+  edufs_expurge(ep);
   if (ep->e_devvp) {
 	vrele(ep->e_devvp);
 	ep->e_devvp = 0;
   }
   
-  uma_zfree(uma_denode,ep->den);
-  uma_zfree(uma_enode,ep);	
+  /* lockless ehash readers may still be looking at ep */
+  edufs_ehashfree(ep);
   vp->v_data = NULL;
-  uprintf("reclaimed!");
+  ETRACE(ETR_VNOPS, "reclaimed!");
   return (0);	 
 }
 
@@ -1293,85 +1434,6 @@ edufs_reclaim(ap)
 */
 
 
-/* can probably break the enode stuff out of here */
-
-static int edufs_findfreeenode(struct edufsmount *emp, uint32_t *fenum,uint32_t *fcg) {
-  struct edufs_superblock *esb = emp->e_esb;
-  struct cg *acg = emp->cglist;
-  struct buf *bp;
-  int error;
-  int cgcount;
-  unsigned char *bm;
-  int bmcount;
-  int bit;
-  uint32_t fblockct, fsblock;
-  
-  if(emp->e_esb->fs_cstotal.cs_nefree < 1 ||
-	 emp->e_esb->fs_cstotal.cs_nbfree < 1) {
-	uprintf("NO BLOCKS/ENODES LEFT\n");
-	return 1;
-  }
-
-	 
-  for(cgcount = 0; cgcount < esb->fs_ncg;cgcount++,acg++) {
-	if(acg->cg_cs.cs_nefree > 0 && acg->cg_cs.cs_nbfree) {
-	  /* check and see if this cyl group has free enodes and free blocks */
-	  uprintf("Cyl group %d has free space	 ",cgcount);
-	  uprintf("enode used list is at phys block %d\n",acg->cg_eusedoff / esb->fs_bps);
-
-
-	  /* phys blocks per filesystem block */
-	  /* bread can only read 512 bytes blocks, but FS blocks are probably 4096 or
-		 something... so we need to read several phys blocks to check the free list */
-	  for(fblockct = 0; fblockct < (esb->fs_bsize / esb->fs_bps); fblockct++) {
-		
-		fsblock = (acg->cg_eusedoff / esb->fs_bps) + fblockct;
-		error = bread(emp->e_devvp,fsblock,esb->fs_bsize,NOCRED,&bp);
-		if(error) {
-		  brelse(bp);
-		  uprintf("cant read in used enode map in cg # %d\n",cgcount);
-		  return 1;
-		}
-		
-		uprintf("searching for free enode\n");
-		for(bmcount = 0,bm = (char*)bp->b_data;
-			bmcount < esb->fs_bsize;bmcount++,bm++) {
-		  uprintf("this byte looks like this: %d\n",*bm);
-		  if(*bm != 0xFF) {
-			uprintf("found a byte thats not full  ");
-			
-			/* dont let people pick enodes 0,1, or 2 */
-			if(bmcount == 0 && cgcount == 0) {
-			  bit = 4;
-			} else {
-			  bit = 7;
-			}
-			
-			for(; bit >= 0; bit--) {
-			  uprintf("b%d",bit);
-			  if((*bm & (1 << bit)) == 0) {
-				uprintf("found free bit: %d bit #%d \n",bmcount,bit);
-				
-				*fenum = (fblockct * esb->fs_bps) +		  /* phys block of enode list		*/
-				  (8 * bmcount) +						  /* byte number in this phys block */
-				  (8-bit-1);							  /* bits 7..0						*/
-				*fcg = cgcount;
-				return 0;
-			  }
-			}  
-		  }
-		}
-		uprintf("\n");
-		bqrelse(bp);	
-		
-	  } /* for(fblockct) */	  
-	}
-  }
-  /* enospc probably isnt the correct error... */
-  return ENOSPC;
-}
-
-
 static int edufs_valloc(pvp, mode, cred, vpp)
 	 struct vnode *pvp;
 	 int mode;
@@ -1381,29 +1443,29 @@ static int edufs_valloc(pvp, mode, cred, vpp)
   struct enode *pep;  
   /*struct enode *ep;*/
   /*struct timespec ts;*/
-  uint32_t fenum, fcg;
+  ino_t fenum;
   struct edufsmount *emp;  
   int error;
-  uprintf("edufs_valloc ");
+  ETRACE(ETR_ALLOC, "edufs_valloc ");
   emp = VFSTOEDUFS(pvp->v_mount); 
   *vpp = NULL;
   pep = VTOE(pvp);
   /* check for free enodes */
 
-  error = edufs_findfreeenode(emp,&fenum,&fcg);
+  error = edufs_enodealloc(pvp,mode,&fenum);
   if(error)
 	return error;
-  uprintf("found free enode - calling vget");
+  ETRACE(ETR_ALLOC, "found free enode - calling vget");
   /* mark this enode used
 	 on error, free up the enode */
   error = edufs_vget(pvp->v_mount, fenum, LK_EXCLUSIVE, vpp);	   
   if (error) {
 	/*UFS_VFREE(pvp, fenum, mode);*/
-	uprintf("error from vget");
+	ETRACE(ETR_ALLOC, "error from vget");
 	return (error);
   }
-  uprintf("no error in valloc");
-  return 3;
+  ETRACE(ETR_ALLOC, "no error in valloc");
+  return 0;
   
   /*ep = VTOI(*vpp);
 	ip->i_flags = 0;
@@ -1426,24 +1488,58 @@ edufs_makeenode(mode, dvp, vpp, cnp)
 	 struct vnode **vpp;
 	 struct componentname *cnp;
 {
-  struct enode *pdir;
-  /*struct direct newdir;*/
+  struct enode *pdir, *ep;
   struct vnode *tvp;
 
   int error;
 
-  uprintf("makeenode");
+  ETRACE(ETR_ALLOC, "makeenode");
 	
   pdir = VTOE(dvp);
-  uprintf("dir enode # is %d\n",pdir->e_number);
+  ETRACE(ETR_ALLOC, "dir enode # is %d\n",pdir->e_number);
   *vpp = NULL;
 
   if ((mode & DIFMT) == 0)
 	mode |= DIFREG;
+  if (cnp->cn_namelen > EDUFS_MAXNAMLEN)
+	return (ENAMETOOLONG);
 	
   error = edufs_valloc(dvp, mode, cnp->cn_cred, &tvp);
-	
-  return 3;
+  if (error)
+	return (error);
+
+  /* whatever a previous owner left in the slot goes */
+  ep = VTOE(tvp);
+  bzero(ep->e_den.de_db, sizeof(ep->e_den.de_db));
+  bzero(ep->e_den.de_ib, sizeof(ep->e_den.de_ib));
+  ep->e_flags = 0;
+  ep->e_size = 0;
+  ep->e_blocks = 0;
+  if (ep->e_gen == 0 || ++ep->e_gen == 0)
+	ep->e_gen = arc4random() / 2 + 1;
+  ep->e_uid = cnp->cn_cred->cr_uid;
+  ep->e_gid = pdir->e_gid;
+  ep->e_mode = mode;
+  tvp->v_type = IFTOVT(mode);
+  ep->e_effnlink = 1;
+  ep->e_nlink = 1;
+  if ((ep->e_mode & DISGID) && !groupmember(ep->e_gid, cnp->cn_cred) &&
+	  suser_cred(cnp->cn_cred, PRISON_ROOT))
+	ep->e_mode &= ~DISGID;
+  ep->e_flag |= EN_ACCESS | EN_CHANGE | EN_UPDATE | EN_MODIFIED;
+
+  /* the enode goes to disk before the directory entry naming it */
+  if ((error = edufs_update(tvp, 1)) != 0 ||
+	  (error = edufs_direnter(dvp, ep->e_number, IFTODT(mode), cnp)) != 0) {
+	/* edufs_inactive() throws it away */
+	ep->e_effnlink = 0;
+	ep->e_nlink = 0;
+	ep->e_flag |= EN_CHANGE | EN_MODIFIED;
+	vput(tvp);
+	return (error);
+  }
+  *vpp = tvp;
+  return (0);
 }
 
 /*	
@@ -1531,27 +1627,36 @@ edufs_etimes(vp)
   if ((ep->e_flag & (EN_ACCESS | EN_CHANGE | EN_UPDATE)) == 0)
 	return;
 
-  /*if ((vp->v_type == VBLK || vp->v_type == VCHR) && !DOINGSOFTDEP(vp))
+  /*
+   * With lazytime the stamps stay in core until something else
+   * writes the enode, see edufs_elazy().  Only stamps may wait: any
+   * other change sets EN_MODIFIED, and then the stamps go with it.
+   */
+  if ((ep->e_flag & EN_MODIFIED) == 0 &&
+	  (ep->e_emp->e_mntflags & EDUFSMNT_LAZYTIME))
 	ep->e_flag |= EN_LAZYMOD;
-	else*/
-	
-  ep->e_flag |= EN_MODIFIED;
+  else
+	ep->e_flag |= EN_MODIFIED;
   if ((vp->v_mount->mnt_flag & MNT_RDONLY) == 0) {
 	vfs_timestamp(&ts);
 	if (ep->e_flag & EN_ACCESS) {
-	  ep->den->de_atime = ts.tv_sec;
-	  ep->den->de_atimensec = ts.tv_nsec;
+	  ep->e_den.de_atime = ts.tv_sec;
+	  ep->e_den.de_atimensec = ts.tv_nsec;
 	}
 	if (ep->e_flag & EN_UPDATE) {
-	  ep->den->de_mtime = ts.tv_sec;
-	  ep->den->de_mtimensec = ts.tv_nsec;
+	  ep->e_den.de_mtime = ts.tv_sec;
+	  ep->e_den.de_mtimensec = ts.tv_nsec;
 	}
 	if (ep->e_flag & EN_CHANGE) {
-	  ep->den->de_ctime = ts.tv_sec;
-	  ep->den->de_ctimensec = ts.tv_nsec;
+	  ep->e_den.de_ctime = ts.tv_sec;
+	  ep->e_den.de_ctimensec = ts.tv_nsec;
 	}
   }
   ep->e_flag &= ~(EN_ACCESS | EN_CHANGE | EN_UPDATE);
+  if (ep->e_flag & EN_MODIFIED)
+	edufs_edirty(ep);
+  else
+	edufs_elazy(ep);
 }
 
 
@@ -1560,33 +1665,81 @@ edufs_etimes(vp)
  * Global vfs data structures
  */
 vop_t **edufs_vnodeop_p;
+/*
+ * Every entry in the table below goes through one of these so that
+ * vfs.edufs.<device>.vop.<op> can report how long the op took.  The
+ * edufsmount is looked up before the call; reclaim and friends may tear
+ * down the vnode's private data.
+ */
+#define	EDUFS_TIMEDVOP(fn, op, vpfield, idx)				\
+static int								\
+fn##_timed(struct vop_##op##_args *ap)					\
+{									\
+	struct edufsmount *emp = VFSTOEDUFS(ap->vpfield->v_mount);	\
+	struct bintime bt;						\
+	int error;							\
+									\
+	binuptime(&bt);							\
+	error = fn(ap);							\
+	edufs_statsvop(emp, idx, &bt);					\
+	return (error);							\
+}
+
+EDUFS_TIMEDVOP(edufs_access, access, a_vp, ES_VOP_ACCESS)
+EDUFS_TIMEDVOP(edufs_bmap, bmap, a_vp, ES_VOP_BMAP)
+EDUFS_TIMEDVOP(edufs_lookup, cachedlookup, a_dvp, ES_VOP_CACHEDLOOKUP)
+EDUFS_TIMEDVOP(edufs_close, close, a_vp, ES_VOP_CLOSE)
+EDUFS_TIMEDVOP(edufs_create, create, a_dvp, ES_VOP_CREATE)
+EDUFS_TIMEDVOP(edufs_fsync, fsync, a_vp, ES_VOP_FSYNC)
+EDUFS_TIMEDVOP(edufs_getattr, getattr, a_vp, ES_VOP_GETATTR)
+EDUFS_TIMEDVOP(edufs_inactive, inactive, a_vp, ES_VOP_INACTIVE)
+EDUFS_TIMEDVOP(edufs_link, link, a_tdvp, ES_VOP_LINK)
+EDUFS_TIMEDVOP(vfs_cache_lookup, lookup, a_dvp, ES_VOP_LOOKUP)
+EDUFS_TIMEDVOP(edufs_mkdir, mkdir, a_dvp, ES_VOP_MKDIR)
+EDUFS_TIMEDVOP(edufs_mknod, mknod, a_dvp, ES_VOP_MKNOD)
+EDUFS_TIMEDVOP(edufs_open, open, a_vp, ES_VOP_OPEN)
+EDUFS_TIMEDVOP(edufs_pathconf, pathconf, a_vp, ES_VOP_PATHCONF)
+EDUFS_TIMEDVOP(edufs_print, print, a_vp, ES_VOP_PRINT)
+EDUFS_TIMEDVOP(edufs_read, read, a_vp, ES_VOP_READ)
+EDUFS_TIMEDVOP(edufs_readdir, readdir, a_vp, ES_VOP_READDIR)
+EDUFS_TIMEDVOP(edufs_readlink, readlink, a_vp, ES_VOP_READLINK)
+EDUFS_TIMEDVOP(edufs_reclaim, reclaim, a_vp, ES_VOP_RECLAIM)
+EDUFS_TIMEDVOP(edufs_remove, remove, a_dvp, ES_VOP_REMOVE)
+EDUFS_TIMEDVOP(edufs_rename, rename, a_fdvp, ES_VOP_RENAME)
+EDUFS_TIMEDVOP(edufs_rmdir, rmdir, a_dvp, ES_VOP_RMDIR)
+EDUFS_TIMEDVOP(edufs_setattr, setattr, a_vp, ES_VOP_SETATTR)
+EDUFS_TIMEDVOP(edufs_strategy, strategy, a_vp, ES_VOP_STRATEGY)
+EDUFS_TIMEDVOP(edufs_symlink, symlink, a_dvp, ES_VOP_SYMLINK)
+EDUFS_TIMEDVOP(edufs_write, write, a_vp, ES_VOP_WRITE)
+
 static struct vnodeopv_entry_desc edufs_vnodeop_entries[] = {
   { &vop_default_desc,		(vop_t *) vop_defaultop },
-  { &vop_access_desc,			(vop_t *) edufs_access },
-  { &vop_bmap_desc,			(vop_t *) edufs_bmap },
-  { &vop_cachedlookup_desc,	(vop_t *) edufs_lookup },
-  { &vop_close_desc,			(vop_t *) edufs_close },
-  { &vop_create_desc,			(vop_t *) edufs_create },
-  { &vop_fsync_desc,			(vop_t *) edufs_fsync },
-  { &vop_getattr_desc,		(vop_t *) edufs_getattr },
-  { &vop_inactive_desc,		(vop_t *) edufs_inactive },
-  { &vop_link_desc,			(vop_t *) edufs_link },
-  { &vop_lookup_desc,			(vop_t *) vfs_cache_lookup },
-  { &vop_mkdir_desc,			(vop_t *) edufs_mkdir },
-  { &vop_mknod_desc,			(vop_t *) edufs_mknod },
-  { &vop_open_desc,			(vop_t *) edufs_open },
-  { &vop_pathconf_desc,		(vop_t *) edufs_pathconf },
-  { &vop_print_desc,			(vop_t *) edufs_print },
-  { &vop_read_desc,			(vop_t *) edufs_read },
-  { &vop_readdir_desc,		(vop_t *) edufs_readdir },
-  { &vop_reclaim_desc,		(vop_t *) edufs_reclaim },
-  { &vop_remove_desc,			(vop_t *) edufs_remove },
-  { &vop_rename_desc,			(vop_t *) edufs_rename },
-  { &vop_rmdir_desc,			(vop_t *) edufs_rmdir },
-  { &vop_setattr_desc,		(vop_t *) edufs_setattr },
-  { &vop_strategy_desc,		(vop_t *) edufs_strategy },
-  { &vop_symlink_desc,		(vop_t *) edufs_symlink },
-  { &vop_write_desc,			(vop_t *) edufs_write },
+  { &vop_access_desc,			(vop_t *) edufs_access_timed },
+  { &vop_bmap_desc,			(vop_t *) edufs_bmap_timed },
+  { &vop_cachedlookup_desc,	(vop_t *) edufs_lookup_timed },
+  { &vop_close_desc,			(vop_t *) edufs_close_timed },
+  { &vop_create_desc,			(vop_t *) edufs_create_timed },
+  { &vop_fsync_desc,			(vop_t *) edufs_fsync_timed },
+  { &vop_getattr_desc,		(vop_t *) edufs_getattr_timed },
+  { &vop_inactive_desc,		(vop_t *) edufs_inactive_timed },
+  { &vop_link_desc,			(vop_t *) edufs_link_timed },
+  { &vop_lookup_desc,			(vop_t *) vfs_cache_lookup_timed },
+  { &vop_mkdir_desc,			(vop_t *) edufs_mkdir_timed },
+  { &vop_mknod_desc,			(vop_t *) edufs_mknod_timed },
+  { &vop_open_desc,			(vop_t *) edufs_open_timed },
+  { &vop_pathconf_desc,		(vop_t *) edufs_pathconf_timed },
+  { &vop_print_desc,			(vop_t *) edufs_print_timed },
+  { &vop_read_desc,			(vop_t *) edufs_read_timed },
+  { &vop_readdir_desc,		(vop_t *) edufs_readdir_timed },
+  { &vop_readlink_desc,		(vop_t *) edufs_readlink_timed },
+  { &vop_reclaim_desc,		(vop_t *) edufs_reclaim_timed },
+  { &vop_remove_desc,			(vop_t *) edufs_remove_timed },
+  { &vop_rename_desc,			(vop_t *) edufs_rename_timed },
+  { &vop_rmdir_desc,			(vop_t *) edufs_rmdir_timed },
+  { &vop_setattr_desc,		(vop_t *) edufs_setattr_timed },
+  { &vop_strategy_desc,		(vop_t *) edufs_strategy_timed },
+  { &vop_symlink_desc,		(vop_t *) edufs_symlink_timed },
+  { &vop_write_desc,			(vop_t *) edufs_write_timed },
 
   { NULL, NULL }
 };
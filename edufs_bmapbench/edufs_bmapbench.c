@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_bmapbench: the transfers cluster_read() gets out of edufs's
+ * block map (edufs_bmap.c, with edufs_alloc.c and edufs_cg.c, on
+ * edufs_kshim).
+ *
+ * A -s megabyte file is written a block at a time with edufs_balloc()
+ * on an empty file system, so it is laid out as edufs lays out any
+ * large file written in order, indirect blocks and all.  It is then
+ * read from start to end the way cluster_read() does: edufs_bmaparray()
+ * is asked for a block and how many after it follow on, and those
+ * blocks make up one transfer, of at most mnt_iosize_max (-i) bytes.
+ * Before VOP_BMAP was there every transfer was a single block.  The
+ * time a transfer takes is put at -t microseconds plus -m megabytes a
+ * second; the shim's disk has no buffer cache, so the indirect blocks
+ * read on the way are reported but not counted in the time.
+ *
+ * Then -r random blocks of the file are read, a block each, and what
+ * is reported is how many indirect blocks each one had to read with
+ * nothing cached, how often the extent cache saved that, and how much
+ * indirect block a buffer cache must hold for them all to be hits.
+ */
+
+#include "edufs_kshim.h"
+
+#include <sys/time.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <fs/edufs/edufs_alloc.c>
+#include <fs/edufs/edufs_bmap.c>
+#include <fs/edufs/edufs_cg.c>
+
+#define	BSIZE		4096
+#define	BPS		512
+#define	EPG		256
+#define	DATASTART	(64 * 1024 * 1024)
+
+struct edufs_superblock sb;
+struct edufsmount mnt;
+struct mount mp;
+struct vnode devvp;
+struct enode en;
+struct vnode vn;
+int ncg = 60;
+int ndblk = 8192;
+int filemb = 1024;
+int iosize = 128 * 1024;		/* MAXPHYS */
+int xfertime = 100;
+int mbps = 50;
+int nrand = 100000;
+daddr_t nblk;
+
+void mkfs(void);
+void mkfile(void);
+double now(void);
+void seqread(const char *name, int maxblks);
+void randread(void);
+void usage(void);
+
+/* empty cgs of ndblk blocks each, laid out as in edufs_createbench */
+void mkfs(void) {
+  struct cg *cgp;
+  int32_t off;
+  int c;
+
+  kshim_secsize = BPS;
+  kshim_disksize = DATASTART + (off_t)ncg * ndblk * BSIZE;
+  if ((kshim_disk = calloc(1, kshim_disksize)) == NULL)
+	err(1, "calloc");
+  bzero(&sb, sizeof(sb));
+  sb.fs_magic = EDUFS_MAGIC;
+  sb.fs_version = EDUFS_VERSION;
+  sb.fs_bsize = BSIZE;
+  sb.fs_bps = BPS;
+  sb.fs_epg = EPG;
+  sb.fs_bpg = ndblk;
+  sb.fs_ncg = ncg;
+  sb.fs_cblkno = 2 * BSIZE;
+  sb.fs_sbsize = sizeof(sb);
+  for (c = 0; c < ncg; c++) {
+	off = sb.fs_cblkno + c * 3 * BSIZE;
+	cgp = (struct cg *)(kshim_disk + off);
+	cgp->cg_magic = EDUFS_MAGIC;
+	cgp->cg_cgx = c;
+	cgp->cg_next = off + 3 * BSIZE;
+	cgp->cg_eusedoff = off + BSIZE;
+	cgp->cg_freeoff = off + 2 * BSIZE;
+	cgp->cg_dboff = DATASTART + c * ndblk * BSIZE;
+	cgp->cg_ndblk = ndblk;
+	cgp->cg_cs.cs_nbfree = ndblk;
+	cgp->cg_cs.cs_nefree = EPG;
+  }
+  bcopy(&sb, kshim_disk, sizeof(sb));
+}
+
+/* write the file in order; its data blocks themselves never hit the disk */
+void mkfile(void) {
+  struct buf *bp;
+  daddr_t lbn;
+  int error;
+
+  nblk = (daddr_t)filemb * (1024 * 1024 / BSIZE);
+  en.e_emp = &mnt;
+  en.e_fs = &sb;
+  vn.v_data = &en;
+  vn.v_mount = &mp;
+  for (lbn = 0; lbn < nblk; lbn++) {
+	if ((error = edufs_balloc(&vn, lbn, 0, &bp)) != 0)
+	  errx(1, "edufs_balloc of block %jd: %s", (intmax_t)lbn,
+		   strerror(error));
+	brelse(bp);
+  }
+}
+
+double now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* read the whole file in transfers of up to maxblks blocks */
+void seqread(const char *name, int maxblks) {
+  daddr_t bn, lbn, next;
+  u_long nread;
+  long nxfer, npiece;
+  double disk, t;
+  int error, run;
+
+  mp.mnt_iosize_max = maxblks * BSIZE;
+  edufs_expurge(&en);
+  nread = kshim_nread;
+  nxfer = npiece = 0;
+  next = -1;
+  t = now();
+  for (lbn = 0; lbn < nblk; lbn += run + 1) {
+	if (maxblks == 1) {
+	  /* VOP_BMAP failing: cluster_read() goes a block at a time */
+	  error = edufs_bmaparray(&vn, lbn, &bn, NULL, NULL);
+	  run = 0;
+	} else
+	  error = edufs_bmaparray(&vn, lbn, &bn, &run, NULL);
+	if (error != 0 || bn == -1)
+	  errx(1, "block %jd did not map", (intmax_t)lbn);
+	if (bn != next)
+	  npiece++;
+	next = bn + (run + 1) * (BSIZE / BPS);
+	nxfer++;
+  }
+  t = now() - t;
+  disk = nxfer * xfertime / 1e6 + (double)filemb / mbps;
+  printf("%-5s %8ld transfers of %5.1f KB, %4.2f indirect reads each, "
+		 "%ld pieces; %6.1f MB/s (%.0f ns of bmap a transfer)\n", name,
+		 nxfer, (double)nblk * BSIZE / 1024 / nxfer,
+		 (double)(kshim_nread - nread) / nxfer, npiece, filemb / disk,
+		 t * 1e9 / nxfer);
+}
+
+/* nrand reads of a block picked at random */
+void randread(void) {
+  daddr_t bn, lbn;
+  u_int64_t hit, miss;
+  u_long nread;
+  double t;
+  int i, run;
+
+  mp.mnt_iosize_max = iosize;
+  edufs_expurge(&en);
+  hit = edufs_statsum(mnt.e_stats, mp_maxid, ES_EXHIT);
+  miss = edufs_statsum(mnt.e_stats, mp_maxid, ES_EXMISS);
+  nread = kshim_nread;
+  srandom(1);
+  t = now();
+  for (i = 0; i < nrand; i++) {
+	lbn = random() % nblk;
+	if (edufs_bmaparray(&vn, lbn, &bn, &run, NULL) != 0 || bn == -1)
+	  errx(1, "block %jd did not map", (intmax_t)lbn);
+  }
+  t = now() - t;
+  hit = edufs_statsum(mnt.e_stats, mp_maxid, ES_EXHIT) - hit;
+  miss = edufs_statsum(mnt.e_stats, mp_maxid, ES_EXMISS) - miss;
+  printf("rand  %8d reads of 4.0 KB, %4.2f indirect reads each, "
+		 "%4.1f%% extent cache hits, %jd KB of indirect blocks in all "
+		 "(%.0f ns of bmap a read)\n", nrand,
+		 (double)(kshim_nread - nread) / nrand,
+		 hit + miss ? 100.0 * hit / (hit + miss) : 0.0,
+		 (intmax_t)(en.e_blocks - nblk) * BSIZE / 1024, t * 1e9 / nrand);
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+
+  while ((ch = getopt(argc, argv, "b:g:i:m:r:s:t:")) != -1) {
+	switch (ch) {
+	case 'b':
+	  ndblk = atoi(optarg);
+	  break;
+	case 'g':
+	  ncg = atoi(optarg);
+	  break;
+	case 'i':
+	  iosize = atoi(optarg) * 1024;
+	  break;
+	case 'm':
+	  mbps = atoi(optarg);
+	  break;
+	case 'r':
+	  nrand = atoi(optarg);
+	  break;
+	case 's':
+	  filemb = atoi(optarg);
+	  break;
+	case 't':
+	  xfertime = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  /* block pointers are 32 bit byte offsets */
+  if (ndblk <= 0 || ndblk > BSIZE * NBBY || ndblk % 64 != 0 || ncg <= 0 ||
+	  DATASTART + (off_t)ncg * ndblk * BSIZE > INT32_MAX ||
+	  iosize < BSIZE || filemb <= 0 || mbps <= 0 || xfertime < 0 ||
+	  nrand < 0)
+	usage();
+
+  kshim_init(1);
+  edufs_cgmap_maxmem = ncg * (sizeof(struct edufs_cgmap) + 2 * BSIZE);
+  mkfs();
+  mnt.e_esb = &sb;
+  mnt.e_devvp = &devvp;
+  mnt.e_mountp = &mp;
+  if ((mnt.e_stats = calloc(1, sizeof(struct edufs_pcpustats))) == NULL)
+	err(1, "calloc");
+  if (edufs_cginit(&mnt) != 0)
+	errx(1, "edufs_cginit failed");
+  edufs_exinit(&mnt);
+  mkfile();
+  printf("%d MB file in %d cgs of %d blocks, %jd indirect blocks; "
+		 "a transfer takes %d us + %d MB/s\n", filemb, ncg, ndblk,
+		 (intmax_t)(en.e_blocks - nblk), xfertime, mbps);
+  seqread("old", 1);
+  seqread("new", iosize / BSIZE);
+  randread();
+  edufs_expurge(&en);
+  edufs_exuninit(&mnt);
+  edufs_cguninit(&mnt);
+  (free)(mnt.e_stats);
+  (free)(kshim_disk);
+  return (0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_bmapbench [-b blocks_per_cg] [-g cgs] "
+		  "[-i iosize_kb] [-m mb_per_sec] [-r reads] [-s file_mb] "
+		  "[-t usec]\n");
+  exit(1);
+}
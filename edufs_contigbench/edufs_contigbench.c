@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_contigbench: how contiguous sequential files come out on an
+ * aged file system, through the kernel's block allocator (edufs_alloc.c
+ * and edufs_cg.c on edufs_kshim).
+ *
+ * The file system is aged first: for -r rounds, files picked at random
+ * are removed until it is -f percent full less a tenth, then new files
+ * of mostly small, sometimes large, random sizes are written until it
+ * is back to -f percent.  Then -n files of -s blocks each are written
+ * one after the other, and what is reported is how many pieces they
+ * came out in.  Each file is written a block at a time with the block
+ * before it as the preference, as edufs_balloc() does; indirect blocks
+ * are left out.
+ *
+ * The same is done with the first free block allocator edufs_blkalloc()
+ * replaced, which ages the file system in its own way.
+ */
+
+#include "edufs_kshim.h"
+
+#include <sys/time.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <fs/edufs/edufs_alloc.c>
+#include <fs/edufs/edufs_cg.c>
+
+#define	BSIZE		4096
+#define	BPS		512
+#define	EPG		256
+#define	DATASTART	(64 * 1024 * 1024)
+
+struct file {
+  int32_t *f_blk;
+  int f_n;
+};
+
+struct edufs_superblock sb;
+struct edufsmount mnt;
+struct mount mp;
+struct vnode devvp;
+struct file *files;
+int nfile, maxfile;
+int ncg = 16;
+int ndblk = 8192;
+int rounds = 50;
+int fill = 80;
+int ntest = 16;
+int testsize = 1024;
+long used;
+int (*blkalloc)(struct edufsmount *, int32_t, int32_t *);
+
+void mkfs(void);
+int old_blkalloc(struct edufsmount *emp, int32_t pref, int32_t *offp);
+int mkfile(struct file *f, int n);
+void rmfile(struct file *f);
+int randsize(void);
+void age(void);
+void measure(const char *name);
+void usage(void);
+
+/* empty cgs of ndblk blocks each, laid out as in edufs_createbench */
+void mkfs(void) {
+  struct cg *cgp;
+  int32_t off;
+  int c;
+
+  kshim_secsize = BPS;
+  kshim_disksize = 2 * BSIZE + ncg * 3 * BSIZE;
+  if ((kshim_disk = calloc(1, kshim_disksize)) == NULL)
+	err(1, "calloc");
+  bzero(&sb, sizeof(sb));
+  sb.fs_magic = EDUFS_MAGIC;
+  sb.fs_version = EDUFS_VERSION;
+  sb.fs_bsize = BSIZE;
+  sb.fs_bps = BPS;
+  sb.fs_epg = EPG;
+  sb.fs_bpg = ndblk;
+  sb.fs_ncg = ncg;
+  sb.fs_cblkno = 2 * BSIZE;
+  sb.fs_sbsize = sizeof(sb);
+  for (c = 0; c < ncg; c++) {
+	off = sb.fs_cblkno + c * 3 * BSIZE;
+	cgp = (struct cg *)(kshim_disk + off);
+	cgp->cg_magic = EDUFS_MAGIC;
+	cgp->cg_cgx = c;
+	cgp->cg_next = off + 3 * BSIZE;
+	cgp->cg_eusedoff = off + BSIZE;
+	cgp->cg_freeoff = off + 2 * BSIZE;
+	cgp->cg_dboff = DATASTART + c * ndblk * BSIZE;
+	cgp->cg_ndblk = ndblk;
+	cgp->cg_cs.cs_nbfree = ndblk;
+	cgp->cg_cs.cs_nefree = EPG;
+  }
+  bcopy(&sb, kshim_disk, sizeof(sb));
+}
+
+/*
+ * The allocator from before edufs_blkalloc() learnt about pref: the
+ * first free block of the first cg with one, from fs_cgrotor on.
+ */
+int old_blkalloc(struct edufsmount *emp, int32_t pref, int32_t *offp) {
+  struct edufs_cgmap *cm;
+  struct cg *cgp;
+  int b, c, error, i;
+
+  for (i = 0; i < sb.fs_ncg; i++) {
+	c = (sb.fs_cgrotor + i) % sb.fs_ncg;
+	cgp = &emp->cglist[c];
+	if (cgp->cg_cs.cs_nbfree <= 0)
+	  continue;
+	EDUFS_CGLOCK(emp, c);
+	if ((error = edufs_cgmapget(emp, c, &cm)) != 0) {
+	  EDUFS_CGUNLOCK(emp, c);
+	  return (error);
+	}
+	if ((b = edufs_mapfind(cm->cm_fmap, 0, cgp->cg_ndblk, 0)) < 0) {
+	  EDUFS_CGUNLOCK(emp, c);
+	  continue;
+	}
+	edufs_clusteracct(cm, cgp->cg_ndblk, b, -1);
+	MAPSET(cm->cm_fmap, b);
+	cm->cm_flags |= CM_FDIRTY;
+	cgp->cg_cs.cs_nbfree--;
+	EDUFS_CSADD(emp, cd_nbfree, -1);
+	sb.fs_cgrotor = c;
+	edufs_cgmod(emp, cgp);
+	EDUFS_CGUNLOCK(emp, c);
+	*offp = edufs_dblkoff(&emp->e_geom, c, b);
+	return (0);
+  }
+  return (ENOSPC);
+}
+
+/* write an n block file; 0, or ENOSPC with what fit freed again */
+int mkfile(struct file *f, int n) {
+  int32_t pref;
+  int error, i;
+
+  if ((f->f_blk = calloc(n, sizeof(int32_t))) == NULL)
+	err(1, "calloc");
+  for (i = 0, pref = 0; i < n; pref = f->f_blk[i++])
+	if ((error = blkalloc(&mnt, pref, &f->f_blk[i])) != 0) {
+	  f->f_n = i;
+	  rmfile(f);
+	  return (error);
+	}
+  f->f_n = n;
+  used += n;
+  return (0);
+}
+
+void rmfile(struct file *f) {
+  int i;
+
+  for (i = 0; i < f->f_n; i++)
+	if (edufs_blkfree(&mnt, f->f_blk[i]) != 0)
+	  errx(1, "blkfree failed");
+  used -= f->f_n;
+  (free)(f->f_blk);
+  f->f_blk = NULL;
+}
+
+/* mostly a few blocks, now and then a few hundred */
+int randsize(void) {
+  int r = random() % 100;
+
+  if (r < 70)
+	return (1 + random() % 4);
+  if (r < 95)
+	return (5 + random() % 60);
+  return (65 + random() % 448);
+}
+
+void age(void) {
+  long total = (long)ncg * ndblk;
+  int i, r;
+
+  for (r = 0; r < rounds; r++) {
+	while (nfile > 0 && used > total * (fill - fill / 10) / 100) {
+	  i = random() % nfile;
+	  rmfile(&files[i]);
+	  files[i] = files[--nfile];
+	}
+	while (used < total * fill / 100) {
+	  if (nfile == maxfile) {
+		maxfile = maxfile ? 2 * maxfile : 1024;
+		if ((files = realloc(files, maxfile * sizeof(*files))) == NULL)
+		  err(1, "realloc");
+	  }
+	  if (mkfile(&files[nfile], randsize()) != 0)
+		break;
+	  nfile++;
+	}
+  }
+}
+
+/* pieces the test files came out in */
+void measure(const char *name) {
+  struct file *t;
+  long pieces, adj, runs16;
+  int c, i, j, worst, p;
+
+  if ((t = calloc(ntest, sizeof(*t))) == NULL)
+	err(1, "calloc");
+  /* free space left in runs of EDUFS_MAXCONTIG or more */
+  for (runs16 = 0, c = 0; c < ncg; c++)
+	if (mnt.e_cgmap[c] != NULL)
+	  runs16 += mnt.e_cgmap[c]->cm_clustersum[EDUFS_MAXCONTIG];
+  pieces = adj = worst = 0;
+  for (i = 0; i < ntest; i++) {
+	if (mkfile(&t[i], testsize) != 0)
+	  errx(1, "%s: no room for the test files", name);
+	for (p = 1, j = 1; j < testsize; j++) {
+	  if (t[i].f_blk[j] == t[i].f_blk[j - 1] + BSIZE)
+		adj++;
+	  else
+		p++;
+	}
+	pieces += p;
+	worst = imax(worst, p);
+  }
+  printf("%-6s %5.1f pieces a file (worst %d), %5.1f blocks a piece, "
+		 "%4.1f%% of blocks follow on; %ld free runs of %d+\n", name,
+		 (double)pieces / ntest, worst, (double)ntest * testsize / pieces,
+		 100.0 * adj / (ntest * (testsize - 1)), runs16, EDUFS_MAXCONTIG);
+  for (i = 0; i < ntest; i++)
+	rmfile(&t[i]);
+  (free)(t);
+}
+
+int main(int argc, char *argv[]) {
+  int ch, i, pass;
+
+  while ((ch = getopt(argc, argv, "b:f:g:n:r:s:")) != -1) {
+	switch (ch) {
+	case 'b':
+	  ndblk = atoi(optarg);
+	  break;
+	case 'f':
+	  fill = atoi(optarg);
+	  break;
+	case 'g':
+	  ncg = atoi(optarg);
+	  break;
+	case 'n':
+	  ntest = atoi(optarg);
+	  break;
+	case 'r':
+	  rounds = atoi(optarg);
+	  break;
+	case 's':
+	  testsize = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  if (ndblk <= 0 || ndblk > BSIZE * NBBY || ndblk % 64 != 0 || fill <= 0 ||
+	  fill >= 100 || ncg <= 0 || ntest <= 0 || rounds < 0 || testsize <= 1)
+	usage();
+
+  kshim_init(1);
+  /* keep every map in core */
+  edufs_cgmap_maxmem = ncg * (sizeof(struct edufs_cgmap) + 2 * BSIZE);
+  printf("%d cgs of %d blocks, aged %d rounds to %d%% full; "
+		 "%d files of %d blocks\n", ncg, ndblk, rounds, fill, ntest, testsize);
+  for (pass = 0; pass < 2; pass++) {
+	mkfs();
+	bzero(&mnt, sizeof(mnt));
+	mnt.e_esb = &sb;
+	mnt.e_devvp = &devvp;
+	mnt.e_mountp = &mp;
+	if ((mnt.e_stats = calloc(1, sizeof(struct edufs_pcpustats))) == NULL)
+	  err(1, "calloc");
+	if (edufs_cginit(&mnt) != 0)
+	  errx(1, "edufs_cginit failed");
+	blkalloc = pass == 0 ? old_blkalloc : edufs_blkalloc;
+	srandom(1);
+	age();
+	measure(pass == 0 ? "old" : "new");
+	for (i = 0; i < nfile; i++)
+	  rmfile(&files[i]);
+	nfile = 0;
+	edufs_cguninit(&mnt);
+	(free)(mnt.e_stats);
+	(free)(kshim_disk);
+  }
+  return (0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_contigbench [-b blocks_per_cg] [-f percent] "
+		  "[-g cgs] [-n files] [-r rounds] [-s blocks]\n");
+  exit(1);
+}
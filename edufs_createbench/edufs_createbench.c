@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_createbench: creates per second against thread count, through
+ * the kernel's allocator (edufs_alloc.c and edufs_cg.c on edufs_kshim).
+ *
+ * Each thread has a directory of its own, made at the top so that
+ * edufs_dirpref() puts it in a cg of its own, and creates empty files
+ * in it with edufs_enodealloc().  Every -b files it removes them again
+ * with edufs_enodefree(), so the fs never fills; a create and its
+ * remove count as one create.  The run is repeated for 1, 2, 4, ... -t
+ * threads.  The cg maps all stay in core, so nothing in the timed part
+ * waits for I/O.
+ */
+
+#include "edufs_kshim.h"
+
+#include <sys/time.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <fs/edufs/edufs_alloc.c>
+#include <fs/edufs/edufs_cg.c>
+
+#define	MAXTHREAD	32
+#define	NCG		64
+#define	EPG		2048
+#define	NDBLK		4096
+#define	BSIZE		4096
+#define	BPS		512
+#define	DATASTART	(64 * 1024 * 1024)
+
+struct edufs_superblock sb;
+struct edufsmount mnt;
+struct mount mp;
+struct vnode devvp;
+struct vnode rootvp, dirvp[MAXTHREAD];
+struct enode rootep, direp[MAXTHREAD];
+int ncreate = 200000;			/* per run, split between the threads */
+int batch = 256;
+int ncpu = 32;
+int maxthread = MAXTHREAD;
+int nthread;
+pthread_barrier_t start;
+
+void mkfs(void);
+void *creator(void *arg);
+double now(void);
+double run(int n);
+void usage(void);
+
+/* empty cgs, laid out as in edufs_cstest */
+void mkfs(void) {
+  int32_t off;
+  struct cg *cgp;
+  int c;
+
+  kshim_secsize = BPS;
+  kshim_disksize = 2 * BSIZE + NCG * 3 * BSIZE;
+  if ((kshim_disk = calloc(1, kshim_disksize)) == NULL)
+	err(1, "calloc");
+  sb.fs_magic = EDUFS_MAGIC;
+  sb.fs_version = EDUFS_VERSION;
+  sb.fs_bsize = BSIZE;
+  sb.fs_bps = BPS;
+  sb.fs_epg = EPG;
+  sb.fs_bpg = NDBLK;
+  sb.fs_ncg = NCG;
+  sb.fs_cblkno = 2 * BSIZE;
+  sb.fs_sbsize = sizeof(sb);
+  for (c = 0; c < NCG; c++) {
+	off = sb.fs_cblkno + c * 3 * BSIZE;
+	cgp = (struct cg *)(kshim_disk + off);
+	cgp->cg_magic = EDUFS_MAGIC;
+	cgp->cg_cgx = c;
+	cgp->cg_next = off + 3 * BSIZE;
+	cgp->cg_eusedoff = off + BSIZE;
+	cgp->cg_freeoff = off + 2 * BSIZE;
+	cgp->cg_dboff = DATASTART + c * NDBLK * BSIZE;
+	cgp->cg_ndblk = NDBLK;
+	cgp->cg_cs.cs_nbfree = NDBLK;
+	cgp->cg_cs.cs_nefree = EPG;
+  }
+  bcopy(&sb, kshim_disk, sizeof(sb));
+}
+
+void *creator(void *arg) {
+  struct vnode *dvp = arg;
+  ino_t *ino;
+  int error, i, j, n;
+
+  if ((ino = calloc(batch, sizeof(*ino))) == NULL)
+	err(1, "calloc");
+  pthread_barrier_wait(&start);
+  for (i = 0; i < ncreate / nthread; i += n) {
+	for (n = 0; n < batch && i + n < ncreate / nthread; n++)
+	  if ((error = edufs_enodealloc(dvp, 0, &ino[n])) != 0)
+		errx(1, "create: %d", error);
+	for (j = 0; j < n; j++)
+	  if ((error = edufs_enodefree(&mnt, ino[j], 0)) != 0)
+		errx(1, "remove: %d", error);
+  }
+  (free)(ino);
+  return (NULL);
+}
+
+double now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* creates per second with n threads */
+double run(int n) {
+  pthread_t tid[MAXTHREAD];
+  double t0;
+  int i;
+
+  nthread = n;
+  pthread_barrier_init(&start, NULL, n + 1);
+  for (i = 0; i < n; i++)
+	if (pthread_create(&tid[i], NULL, creator, &dirvp[i]) != 0)
+	  errx(1, "pthread_create");
+  t0 = now();
+  pthread_barrier_wait(&start);
+  for (i = 0; i < n; i++)
+	pthread_join(tid[i], NULL);
+  pthread_barrier_destroy(&start);
+  return (ncreate / n * n / (now() - t0));
+}
+
+int main(int argc, char *argv[]) {
+  double base, r;
+  ino_t ino;
+  int ch, i, n;
+
+  while ((ch = getopt(argc, argv, "b:c:n:t:")) != -1) {
+	switch (ch) {
+	case 'b':
+	  batch = atoi(optarg);
+	  break;
+	case 'c':
+	  ncpu = atoi(optarg);
+	  break;
+	case 'n':
+	  ncreate = atoi(optarg);
+	  break;
+	case 't':
+	  maxthread = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  if (batch <= 0 || batch > EPG || ncpu <= 0 || ncpu > KSHIM_MAXCPU ||
+	  ncreate <= 0 || maxthread <= 0 || maxthread > MAXTHREAD)
+	usage();
+
+  kshim_init(ncpu);
+  mkfs();
+  mnt.e_esb = &sb;
+  mnt.e_devvp = &devvp;
+  mnt.e_mountp = &mp;
+  if ((mnt.e_stats = calloc(ncpu, sizeof(struct edufs_pcpustats))) == NULL)
+	err(1, "calloc");
+  if (edufs_cginit(&mnt) != 0)
+	errx(1, "edufs_cginit failed");
+
+  /* each thread's directory is made at the top, as mkdir would */
+  rootep.e_emp = &mnt;
+  rootep.e_number = 2;
+  rootvp.v_data = &rootep;
+  rootvp.v_vflag = VV_ROOT;
+  for (i = 0; i < maxthread; i++) {
+	if (edufs_enodealloc(&rootvp, DIFDIR, &ino) != 0)
+	  errx(1, "mkdir failed");
+	direp[i].e_emp = &mnt;
+	direp[i].e_number = ino;
+	direp[i].e_vnode = &dirvp[i];
+	dirvp[i].v_data = &direp[i];
+  }
+
+  printf("%d cgs, %d cpus, %d creates a run, removed every %d\n", NCG, ncpu,
+		 ncreate, batch);
+  base = 0;
+  for (n = 1; n <= maxthread; n *= 2) {
+	r = run(n);
+	if (n == 1)
+	  base = r;
+	printf("%2d thread%s %10.0f creates/s  %5.2fx\n", n, n == 1 ? " " : "s",
+		   r, r / base);
+  }
+  return (0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_createbench [-b batch] [-c cpus] "
+		  "[-n creates] [-t threads]\n");
+  exit(1);
+}
@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_cstest: run the kernel's allocator (edufs_alloc.c) and cg code
+ * (edufs_cg.c) from several threads at once over a made up filesystem
+ * on edufs_kshim's memory disk, and after each round check that the
+ * counts it keeps up as it goes still agree with the maps.
+ *
+ * The threads allocate and free blocks and enodes at random through
+ * edufs_blkalloc(), edufs_blkfree(), edufs_enodealloc() and
+ * edufs_enodefree(), holding the fs close to full so the slow paths and
+ * ENOSPC get their turn too.  The map cache is kept small enough that
+ * cgs' maps are thrown out and read back all the time.  After each
+ * round
+ *
+ *  - edufs_cscheck() recounts every cg's free blocks and enodes from its
+ *    maps, and the totals from those, and mustn't complain;
+ *  - every cg's cm_clustersum has to match what edufs_clusterinit()
+ *    counts from its free map;
+ *  - the directory counts have to match the directories handed out.
+ *
+ * At the end everything is written out with edufs_cgflush(), read back
+ * in from the disk with edufs_cginit(), and checked again.  Nothing
+ * the kernel prints is expected at any point.  cg_ndblk and fs_epg
+ * aren't multiples of 8 or 64, so the ends of the maps get used.
+ */
+
+#define	DIAGNOSTIC
+
+#include "edufs_kshim.h"
+
+#include <err.h>
+#include <unistd.h>
+
+#include <fs/edufs/edufs_alloc.c>
+#include <fs/edufs/edufs_cg.c>
+
+#define	NCPU		4
+#define	NTHREAD		8
+#define	NCG		6
+#define	EPG		100
+#define	BSIZE		4096
+#define	BPS		512
+#define	CGNDBLK(c)	(500 - 37 * (c))
+#define	DATASTART	(64 * 1024 * 1024)
+#define	NHBLK		200
+#define	NHENO		50
+
+/* the blocks and enodes a thread has allocated */
+struct held {
+  int32_t h_blk[NHBLK];
+  int h_nblk;
+  ino_t h_eno[NHENO];
+  int h_emode[NHENO];
+  int h_neno;
+  u_int h_seed;
+};
+
+struct edufs_superblock sb;
+struct edufsmount mnt;
+struct mount mp;
+struct vnode devvp;
+struct vnode dirvp[NCG + 1];		/* one per cg, and the root */
+struct enode direp[NCG + 1];
+int ndir[NCG];				/* directories handed out, by cg */
+pthread_mutex_t ndirmtx = PTHREAD_MUTEX_INITIALIZER;
+int iters = 20000;
+int rounds = 10;
+int nerrs;
+
+void mkfs(void);
+void churn(struct held *h);
+void *worker(void *arg);
+void check(const char *when);
+void usage(void);
+
+/*
+ * Lay out NCG cgs as newfs_edufs would, but only what the allocator
+ * reads: the superblock, and each cg's header and two maps, which are
+ * filled in about half at random.  The data areas are past the end of
+ * the memory disk, since nothing is ever read from them.
+ */
+void mkfs(void) {
+  u_int8_t *emap, *fmap;
+  int32_t off;
+  struct cg *cgp;
+  int c, i;
+
+  kshim_secsize = BPS;
+  kshim_disksize = 2 * BSIZE + NCG * 3 * BSIZE;
+  if ((kshim_disk = calloc(1, kshim_disksize)) == NULL)
+	err(1, "calloc");
+  sb.fs_magic = EDUFS_MAGIC;
+  sb.fs_version = EDUFS_VERSION;
+  sb.fs_bsize = BSIZE;
+  sb.fs_bps = BPS;
+  sb.fs_epg = EPG;
+  sb.fs_bpg = CGNDBLK(0);
+  sb.fs_ncg = NCG;
+  sb.fs_cblkno = 2 * BSIZE;
+  sb.fs_sbsize = sizeof(sb);
+  sb.fs_clean = 1;
+  srandom(1);
+  for (c = 0; c < NCG; c++) {
+	off = sb.fs_cblkno + c * 3 * BSIZE;
+	cgp = (struct cg *)(kshim_disk + off);
+	cgp->cg_magic = EDUFS_MAGIC;
+	cgp->cg_cgx = c;
+	cgp->cg_next = off + 3 * BSIZE;
+	cgp->cg_eusedoff = off + BSIZE;
+	cgp->cg_freeoff = off + 2 * BSIZE;
+	cgp->cg_dboff = DATASTART + c * CGNDBLK(0) * BSIZE;
+	cgp->cg_ndblk = CGNDBLK(c);
+	cgp->cg_cs.cs_nbfree = cgp->cg_ndblk;
+	cgp->cg_cs.cs_nefree = EPG;
+	emap = kshim_disk + cgp->cg_eusedoff;
+	fmap = kshim_disk + cgp->cg_freeoff;
+	for (i = 0; i < cgp->cg_ndblk; i++)
+	  if (random() & 1) {
+		MAPSET(fmap, i);
+		cgp->cg_cs.cs_nbfree--;
+	  }
+	/* enodes below EDUFS_FIRSTENO in cg 0 are in use for good */
+	for (i = 0; i < EPG; i++)
+	  if ((c == 0 && i < EDUFS_FIRSTENO) || (random() & 1)) {
+		MAPSET(emap, i);
+		cgp->cg_cs.cs_nefree--;
+	  }
+	/* directories the test never frees */
+	cgp->cg_cs.cs_ndir = 5;
+	ndir[c] = 5;
+  }
+  bcopy(&sb, kshim_disk, sizeof(sb));
+}
+
+/* allocate or free a block or an enode, keeping each thread's share */
+void churn(struct held *h) {
+  u_int *seed = &h->h_seed;
+  struct vnode *pvp;
+  int32_t off, pref;
+  ino_t ino;
+  int c, error, i, mode;
+
+  if (rand_r(seed) & 1) {
+	if (h->h_nblk > 0 && (h->h_nblk == NHBLK ||
+						  rand_r(seed) % 2 == 0)) {
+	  i = rand_r(seed) % h->h_nblk;
+	  if ((error = edufs_blkfree(&mnt, h->h_blk[i])) != 0) {
+		printf("blkfree %d: %d\n", h->h_blk[i], error);
+		nerrs++;
+	  }
+	  h->h_blk[i] = h->h_blk[--h->h_nblk];
+	  return;
+	}
+	/* half the time carry on from the block before, as a file would */
+	pref = h->h_nblk > 0 && (rand_r(seed) & 1) ? h->h_blk[h->h_nblk - 1] : 0;
+	if ((error = edufs_blkalloc(&mnt, pref, &off)) == ENOSPC)
+	  return;
+	if (error != 0 || edufs_dtog(&mnt.e_geom, off) < 0) {
+	  printf("blkalloc: %d, block %d\n", error, off);
+	  nerrs++;
+	  return;
+	}
+	h->h_blk[h->h_nblk++] = off;
+	return;
+  }
+
+  if (h->h_neno > 0 && (h->h_neno == NHENO ||
+						rand_r(seed) % 2 == 0)) {
+	i = rand_r(seed) % h->h_neno;
+	if ((error = edufs_enodefree(&mnt, h->h_eno[i], h->h_emode[i])) != 0) {
+	  printf("enodefree %d: %d\n", (int)h->h_eno[i], error);
+	  nerrs++;
+	}
+	if ((h->h_emode[i] & DIFMT) == DIFDIR) {
+	  pthread_mutex_lock(&ndirmtx);
+	  ndir[edufs_ino_cg(&mnt.e_geom, h->h_eno[i])]--;
+	  pthread_mutex_unlock(&ndirmtx);
+	}
+	h->h_neno--;
+	h->h_eno[i] = h->h_eno[h->h_neno];
+	h->h_emode[i] = h->h_emode[h->h_neno];
+	return;
+  }
+  pvp = &dirvp[rand_r(seed) % (NCG + 1)];
+  mode = rand_r(seed) % 4 == 0 ? DIFDIR : 0;
+  if ((error = edufs_enodealloc(pvp, mode, &ino)) == ENOSPC)
+	return;
+  c = edufs_ino_cg(&mnt.e_geom, ino);
+  if (error != 0 || c >= NCG ||
+	  (c == 0 && edufs_ino_idx(&mnt.e_geom, ino) < EDUFS_FIRSTENO)) {
+	printf("enodealloc: %d, enode %d\n", error, (int)ino);
+	nerrs++;
+	return;
+  }
+  if (mode == DIFDIR) {
+	pthread_mutex_lock(&ndirmtx);
+	ndir[c]++;
+	pthread_mutex_unlock(&ndirmtx);
+  }
+  h->h_eno[h->h_neno] = ino;
+  h->h_emode[h->h_neno++] = mode;
+}
+
+void *worker(void *arg) {
+  struct held *h = arg;
+  int i;
+
+  for (i = 0; i < iters; i++)
+	churn(h);
+  return (NULL);
+}
+
+/* the checks listed at the top; nobody else is running */
+void check(const char *when) {
+  struct edufs_cgmap *cm, recm;
+  struct ecsum_total cst;
+  u_long nprintf;
+  int c, dirs;
+
+  nprintf = kshim_nprintf;
+  edufs_cscheck(&mnt);
+  if (kshim_nprintf != nprintf) {
+	printf("%s: edufs_cscheck complained\n", when);
+	nerrs++;
+  }
+  dirs = 0;
+  for (c = 0; c < NCG; c++) {
+	EDUFS_CGLOCK(&mnt, c);
+	if (edufs_cgmapget(&mnt, c, &cm) != 0)
+	  errx(1, "%s: can't get cg %d's maps", when, c);
+	recm = *cm;
+	edufs_clusterinit(&mnt, &recm);
+	if (bcmp(recm.cm_clustersum, cm->cm_clustersum,
+			 sizeof(cm->cm_clustersum)) != 0) {
+	  printf("%s: cg %d's cluster summary is off\n", when, c);
+	  nerrs++;
+	}
+	if (mnt.cglist[c].cg_cs.cs_ndir != ndir[c]) {
+	  printf("%s: cg %d has %d directories, summary says %d\n", when, c,
+			 ndir[c], mnt.cglist[c].cg_cs.cs_ndir);
+	  nerrs++;
+	}
+	EDUFS_CGUNLOCK(&mnt, c);
+	dirs += ndir[c];
+  }
+  edufs_cstotal(&mnt, &cst);
+  if (cst.cs_ndir != dirs) {
+	printf("%s: %d directories, totals say %jd\n", when, dirs,
+		   (intmax_t)cst.cs_ndir);
+	nerrs++;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct held held[NTHREAD];
+  pthread_t tid[NTHREAD];
+  u_long nprintf;
+  char when[32];
+  int c, ch, i, r;
+
+  while ((ch = getopt(argc, argv, "n:r:")) != -1) {
+	switch (ch) {
+	case 'n':
+	  iters = atoi(optarg);
+	  break;
+	case 'r':
+	  rounds = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  if (iters <= 0 || rounds <= 0)
+	usage();
+
+  kshim_init(NCPU);
+  mkfs();
+  mnt.e_esb = &sb;
+  mnt.e_devvp = &devvp;
+  mnt.e_mountp = &mp;
+  if ((mnt.e_stats = calloc(NCPU, sizeof(struct edufs_pcpustats))) == NULL)
+	err(1, "calloc");
+  /* room for the maps of 2 cgs out of NCG */
+  edufs_cgmap_maxmem = 2 * (sizeof(struct edufs_cgmap) + 2 * BSIZE);
+  if (edufs_cginit(&mnt) != 0)
+	errx(1, "edufs_cginit failed");
+  /* a parent directory in each cg, and the root */
+  for (c = 0; c <= NCG; c++) {
+	dirvp[c].v_data = &direp[c];
+	direp[c].e_emp = &mnt;
+	direp[c].e_number = c < NCG ? c * EPG : 2;
+	direp[c].e_vnode = &dirvp[c];
+  }
+  dirvp[NCG].v_vflag = VV_ROOT;
+  check("mount");
+
+  bzero(held, sizeof(held));
+  for (i = 0; i < NTHREAD; i++)
+	held[i].h_seed = i + 1;
+  nprintf = kshim_nprintf;
+  for (r = 0; r < rounds; r++) {
+	for (i = 0; i < NTHREAD; i++)
+	  if (pthread_create(&tid[i], NULL, worker, &held[i]) != 0)
+		errx(1, "pthread_create");
+	for (i = 0; i < NTHREAD; i++)
+	  pthread_join(tid[i], NULL);
+	if (kshim_nprintf != nprintf) {
+	  printf("round %d: the kernel complained\n", r);
+	  nerrs++;
+	}
+	snprintf(when, sizeof(when), "round %d", r);
+	check(when);
+	nprintf = kshim_nprintf;
+  }
+
+  if (edufs_cgflush(&mnt, MNT_WAIT) != 0)
+	errx(1, "edufs_cgflush failed");
+  edufs_cguninit(&mnt);
+  if (edufs_cginit(&mnt) != 0)
+	errx(1, "edufs_cginit failed after the flush");
+  check("remount");
+
+  printf("%d threads, %d cpus, %d rounds of %d, %lu maps read, %lu "
+		 "written: %d problem%s\n", NTHREAD, NCPU, rounds, iters,
+		 (u_long)edufs_statsum(mnt.e_stats, mp_maxid, ES_CGMAPLOAD),
+		 (u_long)edufs_statsum(mnt.e_stats, mp_maxid, ES_CGMAPWRITE),
+		 nerrs, nerrs == 1 ? "" : "s");
+  return (nerrs ? 1 : 0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_cstest [-n iterations] [-r rounds]\n");
+  exit(1);
+}
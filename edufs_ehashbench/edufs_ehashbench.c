@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_ehashbench: lookups per second in the kernel's enode hash
+ * (edufs_ehash.c on edufs_kshim) against the number of threads looking.
+ *
+ * The hash is loaded with -e enodes, numbered 0 up, which grows it
+ * through its incremental resizes on the way.  Then 1, 2, 4, ... -t
+ * threads call edufs_ehashlookup() on enode numbers picked at random
+ * for -s seconds each, and every hit is checked to be the enode asked
+ * for.  About half the numbers looked up aren't in the hash, as when
+ * vget misses.
+ *
+ * With -w, that many writer threads run alongside the readers.  Each
+ * one owns a slice of the numbers the readers miss on and cycles
+ * through it, putting enodes in with edufs_ehashins() and taking them
+ * out again with edufs_ehashrem() and edufs_ehashfree(), so the readers
+ * keep meeting chain updates, limbo frees and resizes.  The shim
+ * poisons freed enodes, so a reader that walks onto one loses its way.
+ */
+
+#include "edufs_kshim.h"
+
+#include <sys/time.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <fs/edufs/edufs_ehash.c>
+
+#define	MAXTHREAD	64
+
+struct edufsmount mnt;
+int nenode = 100000;
+int ncpu = 8;
+int maxthread = 32;
+int nwriter;
+double secs = 1;
+volatile int stop;
+int nerrs;
+pthread_barrier_t start;
+struct vnode *vnodes;			/* one per enode number, never freed */
+struct enode **wenodes;			/* the writers' enodes, by number */
+
+/* one looking thread's count */
+struct reader {
+  u_long r_lookups;
+  u_int r_seed;
+} __aligned(64);
+
+struct reader readers[MAXTHREAD];
+
+/* one writing thread's slice and count */
+struct writer {
+  ino_t w_base;
+  int w_span;
+  u_long w_ops;
+  u_long w_next;
+} __aligned(64);
+
+struct writer writers[MAXTHREAD];
+
+void load(void);
+void *reader(void *arg);
+void *writer(void *arg);
+void wenter(ino_t ino);
+double now(void);
+double run(int n, double *wrate);
+void wsetup(void);
+void usage(void);
+
+void load(void) {
+  struct enode *ep;
+  struct vnode *ovp;
+  int i;
+
+  if ((vnodes = calloc(2 * nenode, sizeof(*vnodes))) == NULL ||
+	  (wenodes = calloc(nenode, sizeof(*wenodes))) == NULL)
+	err(1, "calloc");
+  for (i = 0; i < nenode; i++) {
+	if ((ep = calloc(1, sizeof(*ep))) == NULL)
+	  err(1, "calloc");
+	ep->e_emp = &mnt;
+	ep->e_number = i;
+	ep->e_vnode = &vnodes[i];
+	vnodes[i].v_data = ep;
+	if (edufs_ehashins(ep, 0, &ovp) != 0 || ovp != NULL)
+	  errx(1, "enode %d went in twice", i);
+  }
+}
+
+/* hash a new enode for ino, which is in some writer's slice */
+void wenter(ino_t ino) {
+  struct enode *ep;
+  struct vnode *ovp;
+
+  if ((ep = calloc(1, sizeof(*ep))) == NULL)
+	err(1, "calloc");
+  ep->e_emp = &mnt;
+  ep->e_number = ino;
+  ep->e_vnode = &vnodes[ino];
+  vnodes[ino].v_data = ep;
+  if (edufs_ehashins(ep, 0, &ovp) != 0 || ovp != NULL)
+	errx(1, "enode %d went in twice", (int)ino);
+  wenodes[ino - nenode] = ep;
+}
+
+void *reader(void *arg) {
+  struct reader *r = arg;
+  struct vnode *vp;
+  ino_t ino;
+
+  pthread_barrier_wait(&start);
+  while (!stop) {
+	ino = rand_r(&r->r_seed) % (2 * nenode);
+	vp = edufs_ehashlookup(&mnt, ino);
+	if ((vp != NULL && vp != &vnodes[ino]) ||
+		(vp == NULL && ino < nenode)) {
+	  printf("lookup of %d found %d\n", (int)ino,
+			 vp != NULL ? (int)(vp - vnodes) : -1);
+	  nerrs++;
+	}
+	r->r_lookups++;
+  }
+  return (NULL);
+}
+
+/*
+ * Keep the first half of a window over the slice hashed: each step
+ * puts the next number in and takes the one half a slice back out.
+ */
+void *writer(void *arg) {
+  struct writer *w = arg;
+  struct enode *ep;
+  int half = w->w_span / 2;
+
+  pthread_barrier_wait(&start);
+  while (!stop) {
+	ep = wenodes[w->w_base + (w->w_next + w->w_span - half) % w->w_span -
+				 nenode];
+	edufs_ehashrem(ep);
+	edufs_ehashfree(ep);
+	wenter(w->w_base + w->w_next % w->w_span);
+	w->w_next++;
+	w->w_ops++;
+  }
+  return (NULL);
+}
+
+double now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* lookups per second with n readers, and writer steps in *wrate */
+double run(int n, double *wrate) {
+  pthread_t tid[MAXTHREAD], wtid[MAXTHREAD];
+  u_long total, wtotal;
+  double t0, t1;
+  int i;
+
+  stop = 0;
+  pthread_barrier_init(&start, NULL, n + nwriter + 1);
+  for (i = 0; i < n; i++) {
+	readers[i].r_lookups = 0;
+	readers[i].r_seed = i + 1;
+	if (pthread_create(&tid[i], NULL, reader, &readers[i]) != 0)
+	  errx(1, "pthread_create");
+  }
+  for (i = 0; i < nwriter; i++) {
+	writers[i].w_ops = 0;
+	if (pthread_create(&wtid[i], NULL, writer, &writers[i]) != 0)
+	  errx(1, "pthread_create");
+  }
+  pthread_barrier_wait(&start);
+  t0 = now();
+  usleep(secs * 1e6);
+  stop = 1;
+  for (i = 0; i < n; i++)
+	pthread_join(tid[i], NULL);
+  for (i = 0; i < nwriter; i++)
+	pthread_join(wtid[i], NULL);
+  t1 = now();
+  pthread_barrier_destroy(&start);
+  for (total = 0, i = 0; i < n; i++)
+	total += readers[i].r_lookups;
+  for (wtotal = 0, i = 0; i < nwriter; i++)
+	wtotal += writers[i].w_ops;
+  *wrate = wtotal / (t1 - t0);
+  return (total / (t1 - t0));
+}
+
+/* give each writer its slice and hash the first half of it */
+void wsetup(void) {
+  struct writer *w;
+  int i, span;
+
+  span = nenode / nwriter;
+  for (i = 0; i < nwriter; i++) {
+	w = &writers[i];
+	w->w_base = nenode + i * span;
+	w->w_span = span;
+	for (w->w_next = 0; w->w_next < span / 2; w->w_next++)
+	  wenter(w->w_base + w->w_next);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct edufs_ehashstats es;
+  double base, r, wr;
+  int ch, n;
+
+  while ((ch = getopt(argc, argv, "c:e:s:t:w:")) != -1) {
+	switch (ch) {
+	case 'c':
+	  ncpu = atoi(optarg);
+	  break;
+	case 'e':
+	  nenode = atoi(optarg);
+	  break;
+	case 's':
+	  secs = atof(optarg);
+	  break;
+	case 't':
+	  maxthread = atoi(optarg);
+	  break;
+	case 'w':
+	  nwriter = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  if (ncpu <= 0 || ncpu > KSHIM_MAXCPU || nenode <= 0 || secs <= 0 ||
+	  maxthread <= 0 || maxthread > MAXTHREAD || nwriter < 0 ||
+	  nwriter > MAXTHREAD || (nwriter > 0 && nenode / nwriter < 2))
+	usage();
+
+  kshim_init(ncpu);
+  edufs_ehashinit(&mnt);
+  load();
+  if (nwriter > 0)
+	wsetup();
+  edufs_ehashstats(&mnt, &es);
+  printf("%d enodes, %lu buckets, %lu stripes, longest chain %lu\n", nenode,
+		 es.es_buckets, es.es_stripes, es.es_maxchain);
+
+  base = 0;
+  for (n = 1; n <= maxthread; n *= 2) {
+	r = run(n, &wr);
+	if (n == 1)
+	  base = r;
+	printf("%2d thread%s %12.0f lookups/s  %5.2fx", n, n == 1 ? " " : "s",
+		   r, r / base);
+	if (nwriter > 0)
+	  printf("  %10.0f ins+rem/s", wr);
+	printf("\n");
+  }
+  edufs_ehashstats(&mnt, &es);
+  printf("%lu resizes\n", es.es_resizes);
+  if (nerrs)
+	printf("%d bad lookups\n", nerrs);
+  return (nerrs ? 1 : 0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_ehashbench [-c cpus] [-e enodes] "
+		  "[-s seconds] [-t threads] [-w writers]\n");
+  exit(1);
+}
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_erasim: what ls -l on a big directory costs in enode table
+ * reads, for each vfs.edufs.enode_readahead setting, with edufs_vget()'s
+ * policy (edufs_eraupdate() in edufs_readahead.h) over an LRU cache of
+ * table chunks.
+ *
+ * The enode numbers stat()ed are read one a line from the named file
+ * (ls -fi | awk '{print $1}' gives them in directory order), or made
+ * up: -n files made one after the other in an empty directory, so they
+ * are numbered in a row across as many cgs as they fill, with -a
+ * percent of them put anywhere else instead, as on an aged file system.
+ *
+ * Time is counted too.  Each stat takes -t microseconds of its own, and
+ * each chunk read arrives -l microseconds after it is started, however
+ * many are under way, so a stat waits for a chunk that was read ahead
+ * only if it hasn't arrived yet.
+ */
+
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sys/fs/edufs/edufs_denode.h"
+#include "../sys/fs/edufs/edufs_readahead.h"
+
+#define	NHASH	4096
+
+struct chunk {
+  LIST_ENTRY(chunk) c_hash;
+  TAILQ_ENTRY(chunk) c_lru;
+  int64_t c_blkno;
+  int c_ra;			/* read ahead, not asked for yet */
+  double c_ready;		/* when it arrives, usec */
+};
+
+LIST_HEAD(, chunk) chunkhash[NHASH];
+TAILQ_HEAD(, chunk) lru = TAILQ_HEAD_INITIALIZER(lru);
+int ncached;
+
+int bps = 512;			/* fs_bps, the chunk size */
+int epg = 2048;
+int cachesize = 1024;		/* chunks */
+int nfiles = 100000;
+int aged;
+int latency = 5000;
+int cpu = 10;
+double now;			/* usec */
+
+/* the results for one setting */
+u_int64_t nmisses, nraissued, nraused, nrawasted;
+
+int64_t *readinos(FILE *fp, int *np);
+int64_t *makeinos(int *np);
+struct chunk *lookup(int64_t blkno);
+void insert(int64_t blkno, int ra, double ready);
+void demand(int64_t blkno);
+void prefetch(int64_t blkno);
+void flush(void);
+void simulate(const int64_t *inos, int n, int max);
+void usage(void);
+
+int main(int argc, char *argv[]) {
+  int64_t *inos;
+  FILE *fp;
+  int ch, max, n;
+
+  while ((ch = getopt(argc, argv, "a:b:c:e:l:n:t:")) != -1) {
+	switch (ch) {
+	case 'a':
+	  aged = atoi(optarg);
+	  break;
+	case 'b':
+	  bps = atoi(optarg);
+	  break;
+	case 'c':
+	  cachesize = atoi(optarg);
+	  break;
+	case 'e':
+	  epg = atoi(optarg);
+	  break;
+	case 'l':
+	  latency = atoi(optarg);
+	  break;
+	case 'n':
+	  nfiles = atoi(optarg);
+	  break;
+	case 't':
+	  cpu = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc > 1 || aged < 0 || aged > 100 || bps < (int)sizeof(struct denode) ||
+	  cachesize <= 0 || epg <= 0 || latency < 0 || nfiles <= 0 || cpu < 0)
+	usage();
+
+  if (argc == 0)
+	inos = makeinos(&n);
+  else {
+	if (strcmp(argv[0], "-") == 0)
+	  fp = stdin;
+	else if ((fp = fopen(argv[0], "r")) == NULL)
+	  err(1, "%s", argv[0]);
+	inos = readinos(fp, &n);
+  }
+
+  printf("%d stats, %d enodes a cg, %d byte chunks of %d denodes, "
+		 "cache %d chunks\n", n, epg, bps, bps / (int)sizeof(struct denode),
+		 cachesize);
+  printf("%d usec a read, %d usec a stat\n", latency, cpu);
+  printf("readahead  reads  read ahead  wasted     time\n");
+  for (max = 0; max <= EDUFS_MAXENODERA; max = max ? max * 2 : 2) {
+	simulate(inos, n, max);
+	printf("%9d %6ju %11ju %7ju %8.2f s\n", max, (uintmax_t)nmisses,
+		   (uintmax_t)nraissued, (uintmax_t)nrawasted, now / 1e6);
+  }
+  return (0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_erasim [-a aged%%] [-b bps] [-c cachechunks] "
+		  "[-e epg] [-l usec] [-n files] [-t usec] [file]\n");
+  exit(1);
+}
+
+int64_t *readinos(FILE *fp, int *np) {
+  int64_t *inos = NULL;
+  intmax_t ino;
+  int n, max;
+
+  n = max = 0;
+  while (fscanf(fp, "%jd%*[^\n]", &ino) == 1) {
+	if (n == max) {
+	  max = max ? max * 2 : 1024;
+	  if ((inos = realloc(inos, max * sizeof(*inos))) == NULL)
+		err(1, "realloc");
+	}
+	if (ino >= 0)
+	  inos[n++] = ino;
+  }
+  if (ferror(fp))
+	err(1, "read");
+  *np = n;
+  return (inos);
+}
+
+/* a directory's files, numbered from the start of a cg on */
+int64_t *makeinos(int *np) {
+  int64_t *inos, span;
+  int i;
+
+  if ((inos = calloc(nfiles, sizeof(*inos))) == NULL)
+	err(1, "calloc");
+  span = (int64_t)(nfiles / epg + 1) * epg * 4;
+  srandom(1);
+  for (i = 0; i < nfiles; i++)
+	inos[i] = random() % 100 < aged ? random() % span : epg + i;
+  *np = nfiles;
+  return (inos);
+}
+
+struct chunk *lookup(int64_t blkno) {
+  struct chunk *cp;
+
+  LIST_FOREACH(cp, &chunkhash[blkno % NHASH], c_hash)
+	if (cp->c_blkno == blkno)
+	  return (cp);
+  return (NULL);
+}
+
+/* put a chunk in the cache, throwing out the least recently used */
+void insert(int64_t blkno, int ra, double ready) {
+  struct chunk *cp;
+
+  if (ncached == cachesize) {
+	cp = TAILQ_FIRST(&lru);
+	if (cp->c_ra)
+	  nrawasted++;
+	TAILQ_REMOVE(&lru, cp, c_lru);
+	LIST_REMOVE(cp, c_hash);
+	ncached--;
+  } else if ((cp = malloc(sizeof(*cp))) == NULL)
+	err(1, "malloc");
+  cp->c_blkno = blkno;
+  cp->c_ra = ra;
+  cp->c_ready = ready;
+  LIST_INSERT_HEAD(&chunkhash[blkno % NHASH], cp, c_hash);
+  TAILQ_INSERT_TAIL(&lru, cp, c_lru);
+  ncached++;
+}
+
+/* the chunk a vget miss reads, waiting for it if it isn't in yet */
+void demand(int64_t blkno) {
+  struct chunk *cp;
+
+  if ((cp = lookup(blkno)) == NULL) {
+	nmisses++;
+	now += latency;
+	insert(blkno, 0, now);
+	return;
+  }
+  if (cp->c_ready > now)
+	now = cp->c_ready;
+  if (cp->c_ra) {
+	nraused++;
+	cp->c_ra = 0;
+  }
+  TAILQ_REMOVE(&lru, cp, c_lru);
+  TAILQ_INSERT_TAIL(&lru, cp, c_lru);
+}
+
+/* a chunk read ahead; like breadn(), nothing if it's cached already */
+void prefetch(int64_t blkno) {
+  if (lookup(blkno) != NULL)
+	return;
+  nraissued++;
+  insert(blkno, 1, now + latency);
+}
+
+void flush(void) {
+  struct chunk *cp;
+
+  while ((cp = TAILQ_FIRST(&lru)) != NULL) {
+	if (cp->c_ra)
+	  nrawasted++;
+	TAILQ_REMOVE(&lru, cp, c_lru);
+	LIST_REMOVE(cp, c_hash);
+	free(cp);
+  }
+  ncached = 0;
+}
+
+/*
+ * Each cg's table starts on a chunk of its own, as newfs_edufs lays
+ * them out; where the tables are relative to each other doesn't matter.
+ */
+void simulate(const int64_t *inos, int n, int max) {
+  struct edufs_era era;
+  int64_t base, blkno, tchunks;
+  int i, nra, r;
+
+  nmisses = nraissued = nraused = nrawasted = 0;
+  now = 0;
+  memset(&era, 0, sizeof(era));
+  tchunks = ((int64_t)epg * sizeof(struct denode) + bps - 1) / bps;
+  for (i = 0; i < n; i++) {
+	base = inos[i] / epg * tchunks;
+	blkno = base + inos[i] % epg * sizeof(struct denode) / bps;
+	now += cpu;
+	nra = edufs_eraupdate(&era, blkno, base + tchunks - 1, max);
+	demand(blkno);
+	for (r = 1; r <= nra; r++)
+	  prefetch(blkno + r);
+  }
+  flush();
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_geomtest: check the shift and mask translations in edufs_geom.h
+ * against the divide and modulo formulas they replaced, over a few
+ * made up layouts, and time both.
+ *
+ * The cgs are laid out unevenly and the enode tables don't start on a
+ * sector boundary, as newfs_edufs can leave them, so the per-cg base
+ * offsets and the enode slot arithmetic both get exercised.  Some layouts
+ * have fs_epg a power of two and some don't, to cover both ino_cg/ino_idx
+ * paths.
+ */
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/time.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sys/fs/edufs/edufs_denode.h"
+#include "../sys/fs/edufs/edufs.h"
+#include "../sys/fs/edufs/edufs_geom.h"
+
+#define	NCG	7
+
+struct layout {
+  int l_bsize;
+  int l_bps;
+  int l_epg;
+} layouts[] = {
+  { 4096, 512, 64 },
+  { 4096, 512, 100 },
+  { 512, 512, 37 },
+  { 8192, 1024, 256 },
+  { 16384, 2048, 1000 },
+};
+#define	NLAYOUT	(sizeof(layouts) / sizeof(layouts[0]))
+
+struct edufs_superblock esb;
+struct cg cgs[NCG];
+struct edufs_geom geom;
+int nerrs;
+int nbench = 10000000;
+volatile int64_t sink;
+
+void mklayout(struct layout *l);
+void check(void);
+void bench(void);
+double now(void);
+void usage(void);
+
+/* the old formulas, from before edufs_geom.h */
+off_t old_enodeoff(ino_t ino);
+int old_dtog(off_t off);
+
+off_t old_enodeoff(ino_t ino) {
+  return (cgs[ino / esb.fs_epg].cg_enodeoff +
+		  (off_t)sizeof(struct denode) * (ino % esb.fs_epg));
+}
+
+int old_dtog(off_t off) {
+  int c;
+
+  for (c = 0; c < esb.fs_ncg; c++)
+	if (off >= cgs[c].cg_dboff &&
+		off < cgs[c].cg_dboff + (off_t)cgs[c].cg_ndblk * esb.fs_bsize)
+	  return (c);
+  return (-1);
+}
+
+#define	CHECK(what, arg, got, want) do {				\
+  if ((int64_t)(got) != (int64_t)(want)) {				\
+	printf("bsize %d bps %d epg %d: %s(%jd) is %jd, want %jd\n",	\
+		   esb.fs_bsize, esb.fs_bps, esb.fs_epg, (what), (intmax_t)(arg),	\
+		   (intmax_t)(got), (intmax_t)(want));		\
+	nerrs++;							\
+  }									\
+} while (0)
+
+int main(int argc, char *argv[]) {
+  int ch, i;
+
+  while ((ch = getopt(argc, argv, "n:")) != -1) {
+	switch (ch) {
+	case 'n':
+	  nbench = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  if (nbench < 0)
+	usage();
+
+  for (i = 0; i < (int)NLAYOUT; i++) {
+	mklayout(&layouts[i]);
+	check();
+	if (nbench > 0)
+	  bench();
+  }
+  printf("%d layouts: %d problem%s\n", (int)NLAYOUT, nerrs,
+		 nerrs == 1 ? "" : "s");
+  return (nerrs ? 1 : 0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_geomtest [-n benchmark_iterations]\n");
+  exit(1);
+}
+
+/*
+ * Lay out NCG cgs of differing sizes back to back: a header block, the
+ * enode table (at an odd number of denodes past a sector boundary),
+ * then the data blocks.
+ */
+void mklayout(struct layout *l) {
+  off_t off;
+  int c;
+
+  bzero(&esb, sizeof(esb));
+  bzero(cgs, sizeof(cgs));
+  esb.fs_bsize = l->l_bsize;
+  esb.fs_bps = l->l_bps;
+  esb.fs_epg = l->l_epg;
+  esb.fs_ncg = NCG;
+  off = 8192;
+  for (c = 0; c < NCG; c++) {
+	off += esb.fs_bsize;
+	cgs[c].cg_enodeoff = off + (c % 3) * sizeof(struct denode);
+	off = cgs[c].cg_enodeoff + (off_t)esb.fs_epg * sizeof(struct denode);
+	off = roundup(off, esb.fs_bsize);
+	cgs[c].cg_dboff = off;
+	cgs[c].cg_ndblk = 50 + 13 * c;
+	off += (off_t)cgs[c].cg_ndblk * esb.fs_bsize;
+  }
+  if (edufs_geominit(&geom, &esb, cgs) != 0)
+	errx(1, "bsize %d bps %d: edufs_geominit failed", esb.fs_bsize,
+		 esb.fs_bps);
+}
+
+void check(void) {
+  off_t off, end;
+  int64_t lbn;
+  ino_t ino;
+  int c;
+
+  for (ino = 0; ino < (ino_t)NCG * esb.fs_epg; ino++) {
+	CHECK("ino_cg", ino, edufs_ino_cg(&geom, ino), ino / esb.fs_epg);
+	CHECK("ino_idx", ino, edufs_ino_idx(&geom, ino), ino % esb.fs_epg);
+	CHECK("enodeoff", ino, edufs_enodeoff(&geom, ino), old_enodeoff(ino));
+	CHECK("enodesec", ino, edufs_enodesec(&geom, ino),
+		  old_enodeoff(ino) / esb.fs_bps);
+	CHECK("enodeslot", ino, edufs_enodeslot(&geom, ino),
+		  old_enodeoff(ino) % esb.fs_bps / sizeof(struct denode));
+  }
+
+  /* every data block, the bytes either side of it, and the gaps */
+  end = cgs[NCG - 1].cg_dboff +
+	(off_t)cgs[NCG - 1].cg_ndblk * esb.fs_bsize + esb.fs_bsize;
+  for (off = 0; off < end; off += esb.fs_bps) {
+	c = old_dtog(off);
+	CHECK("dtog", off, edufs_dtog(&geom, off), c);
+	if (c >= 0) {
+	  CHECK("dtogd", off, edufs_dtogd(&geom, c, off),
+			(off - cgs[c].cg_dboff) / esb.fs_bsize);
+	  CHECK("dblkoff", off, edufs_dblkoff(&geom, c,
+			edufs_dtogd(&geom, c, off)),
+			off - (off - cgs[c].cg_dboff) % esb.fs_bsize);
+	}
+	CHECK("btosec", off, edufs_btosec(&geom, off), off / esb.fs_bps);
+  }
+  for (c = 0; c < NCG; c++) {
+	CHECK("dtog", cgs[c].cg_dboff - 1, edufs_dtog(&geom,
+		  cgs[c].cg_dboff - 1), old_dtog(cgs[c].cg_dboff - 1));
+	off = cgs[c].cg_dboff + (off_t)cgs[c].cg_ndblk * esb.fs_bsize - 1;
+	CHECK("dtog", off, edufs_dtog(&geom, off), c);
+  }
+
+  /* file offsets, including some far past 32 bits */
+  for (off = 0; off < (off_t)1 << 42; off = off * 3 + 1 + (off & 1)) {
+	CHECK("lblkno", off, edufs_lblkno(&geom, off), off / esb.fs_bsize);
+	CHECK("blkoff", off, edufs_blkoff(&geom, off), off % esb.fs_bsize);
+	lbn = off / esb.fs_bsize;
+	CHECK("lblktob", lbn, edufs_lblktob(&geom, lbn), lbn * esb.fs_bsize);
+  }
+}
+
+double now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* ns per translation, old formulas against the helpers */
+void bench(void) {
+  double t0, t1, t2;
+  int64_t s;
+  off_t off;
+  ino_t ino, nino;
+  int i;
+
+  nino = (ino_t)NCG * esb.fs_epg;
+  s = 0;
+  t0 = now();
+  for (i = 0; i < nbench; i++) {
+	off = (off_t)i * 1237;
+	ino = i % nino;
+	s += off / esb.fs_bsize + off % esb.fs_bsize;
+	s += old_enodeoff(ino) / esb.fs_bps +
+	  old_enodeoff(ino) % esb.fs_bps / sizeof(struct denode);
+  }
+  t1 = now();
+  for (i = 0; i < nbench; i++) {
+	off = (off_t)i * 1237;
+	ino = i % nino;
+	s += edufs_lblkno(&geom, off) + edufs_blkoff(&geom, off);
+	s += edufs_enodesec(&geom, ino) + edufs_enodeslot(&geom, ino);
+  }
+  t2 = now();
+  sink = s;
+  printf("bsize %d bps %d epg %d: old %.1f ns, new %.1f ns per lookup\n",
+		 esb.fs_bsize, esb.fs_bps, esb.fs_epg, (t1 - t0) * 1e9 / nbench,
+		 (t2 - t1) * 1e9 / nbench);
+}
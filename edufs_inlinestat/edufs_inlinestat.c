@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_inlinestat: what keeping small files' data in the denode saves
+ * on a corpus.  It walks the trees it is given and, for the regular
+ * files in them, counts the data blocks edufs would use with and
+ * without inline data, and the block reads it would take to read each
+ * file once.  Files of up to EDUFS_MAXINLINE bytes go inline and need
+ * neither; the denode is read either way, so it isn't counted.
+ * Indirect blocks and read clustering are left out.
+ *
+ * Symbolic links are counted the same way: a target of up to
+ * EDUFS_MAXINLINE bytes is a fast symlink, kept in the denode, and
+ * following it costs no block read; a longer one takes a block.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <fts.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sys/fs/edufs/edufs_denode.h"
+
+int bsize = 4096;
+long nfile, ninline;
+long long blocks, inlineblocks;
+long nlink, nfastlink;
+
+void count(const struct stat *st);
+void usage(void);
+
+void count(const struct stat *st) {
+  long long n;
+
+  n = (st->st_size + bsize - 1) / bsize;
+  nfile++;
+  blocks += n;
+  if (st->st_size > 0 && st->st_size <= (off_t)EDUFS_MAXINLINE)
+	ninline++;
+  else
+	inlineblocks += n;
+}
+
+int main(int argc, char *argv[]) {
+  FTS *fts;
+  FTSENT *e;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "b:")) != -1) {
+	switch (ch) {
+	case 'b':
+	  bsize = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc == 0 || bsize <= 0)
+	usage();
+
+  if ((fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR, NULL)) == NULL)
+	err(1, "fts_open");
+  while ((e = fts_read(fts)) != NULL) {
+	switch (e->fts_info) {
+	case FTS_F:
+	  count(e->fts_statp);
+	  break;
+	case FTS_SL:
+	case FTS_SLNONE:
+	  nlink++;
+	  if (e->fts_statp->st_size <= (off_t)EDUFS_MAXINLINE)
+		nfastlink++;
+	  break;
+	case FTS_DNR:
+	case FTS_ERR:
+	case FTS_NS:
+	  warnx("%s: %s", e->fts_path, strerror(e->fts_errno));
+	  break;
+	}
+  }
+  fts_close(fts);
+
+  printf("%ld files, %ld of 1-%d bytes (%.1f%%)\n", nfile, ninline,
+		 (int)EDUFS_MAXINLINE, nfile ? 100.0 * ninline / nfile : 0.0);
+  printf("%d byte blocks: %lld without inline data, %lld with (%.1f%% fewer)\n",
+		 bsize, blocks, inlineblocks,
+		 blocks ? 100.0 * (blocks - inlineblocks) / blocks : 0.0);
+  printf("block reads to read every file once: the same %lld and %lld\n",
+		 blocks, inlineblocks);
+  printf("%ld symlinks, %ld fast (%.1f%%): %ld blocks and block reads a "
+		 "pass saved\n", nlink, nfastlink,
+		 nlink ? 100.0 * nfastlink / nlink : 0.0, nfastlink);
+  return (0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_inlinestat [-b bsize] dir ...\n");
+  exit(1);
+}
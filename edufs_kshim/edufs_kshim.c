@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * The kernel stand-ins edufs_kshim.h declares.
+ */
+
+#include "edufs_kshim.h"
+
+#include <unistd.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_denode.h>
+#include <fs/edufs/edufs_enode.h>
+#include <fs/edufs/edufs.h>
+#include <fs/edufs/edufs_stats.h>
+
+/* a thread's cpu, while it's in a critical section */
+struct kshim_td {
+  int kt_cpu;
+  int kt_nest;
+  u_int kt_seed;
+};
+
+u_int mp_maxid;
+int mp_ncpus;
+static pthread_mutex_t kshim_cpulock[KSHIM_MAXCPU];
+static pthread_key_t kshim_tdkey;
+static u_int kshim_nthread;
+static pthread_mutex_t kshim_tdmtx = PTHREAD_MUTEX_INITIALIZER;
+
+u_int8_t *kshim_disk;
+off_t kshim_disksize;
+int kshim_secsize = DEV_BSIZE;
+u_long kshim_nread, kshim_nwrite;
+static pthread_mutex_t kshim_diskmtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* blocks (plus one) breadn() has started reading ahead */
+#define	KSHIM_NRA	64
+static daddr_t kshim_ra[KSHIM_NRA];
+static int kshim_nra;
+int kshim_latency;
+u_long kshim_nrahit;
+
+u_long kshim_nprintf;
+
+/* what the other edufs sources would define */
+MALLOC_DEFINE(M_EDUFSMNT, "EDUFS mount", "EDUFS mount structure");
+uma_zone_t uma_enode;
+
+static struct kshim_td *kshim_td(void);
+static struct buf *kshim_getbuf(daddr_t blkno, int size);
+static int kshim_diskio(struct buf *bp, int write);
+
+void kshim_init(int ncpu) {
+  int i;
+
+  if (ncpu < 1 || ncpu > KSHIM_MAXCPU)
+	kshim_panic("kshim_init: %d cpus", ncpu);
+  mp_ncpus = ncpu;
+  mp_maxid = ncpu - 1;
+  for (i = 0; i < ncpu; i++)
+	pthread_mutex_init(&kshim_cpulock[i], NULL);
+  pthread_key_create(&kshim_tdkey, NULL);
+}
+
+static struct kshim_td *kshim_td(void) {
+  struct kshim_td *td;
+
+  if ((td = pthread_getspecific(kshim_tdkey)) == NULL) {
+	td = (malloc)(sizeof(*td));
+	if (td == NULL)
+	  kshim_panic("kshim_td: out of memory");
+	td->kt_cpu = 0;
+	td->kt_nest = 0;
+	pthread_mutex_lock(&kshim_tdmtx);
+	td->kt_seed = ++kshim_nthread;
+	pthread_mutex_unlock(&kshim_tdmtx);
+	pthread_setspecific(kshim_tdkey, td);
+  }
+  return (td);
+}
+
+/* critical sections nest, as they do in the kernel */
+void critical_enter(void) {
+  struct kshim_td *td = kshim_td();
+
+  if (td->kt_nest++ == 0) {
+	td->kt_cpu = rand_r(&td->kt_seed) % mp_ncpus;
+	pthread_mutex_lock(&kshim_cpulock[td->kt_cpu]);
+  }
+}
+
+void critical_exit(void) {
+  struct kshim_td *td = kshim_td();
+
+  if (--td->kt_nest == 0)
+	pthread_mutex_unlock(&kshim_cpulock[td->kt_cpu]);
+}
+
+int kshim_curcpu(void) {
+  struct kshim_td *td = kshim_td();
+
+  if (td->kt_nest == 0)
+	kshim_panic("PCPU_GET outside a critical section");
+  return (td->kt_cpu);
+}
+
+void *kshim_malloc(size_t size, struct malloc_type *type, int flags) {
+  void *p;
+
+  p = (flags & M_ZERO) ? calloc(1, size) : (malloc)(size);
+  if (p == NULL && (flags & M_WAITOK))
+	kshim_panic("kshim_malloc: out of memory");
+  if (p != NULL)
+	atomic_add_long(&type->ks_calls, 1);
+  return (p);
+}
+
+void kshim_free(void *addr, struct malloc_type *type) {
+  (free)(addr);
+}
+
+/*
+ * Poison a freed zone item and hold it back for a while before it goes
+ * to libc, which would otherwise hand it straight out again.
+ */
+#define	KSHIM_QUARANTINE	4096
+static void *kshim_quar[KSHIM_QUARANTINE];
+static int kshim_nquar;
+static pthread_mutex_t kshim_quarmtx = PTHREAD_MUTEX_INITIALIZER;
+
+void kshim_zfree(void *item, size_t size) {
+  void *old;
+
+  memset(item, 0xa5, size);
+  pthread_mutex_lock(&kshim_quarmtx);
+  old = kshim_quar[kshim_nquar % KSHIM_QUARANTINE];
+  kshim_quar[kshim_nquar++ % KSHIM_QUARANTINE] = item;
+  pthread_mutex_unlock(&kshim_quarmtx);
+  (free)(old);
+}
+
+static struct buf *kshim_getbuf(daddr_t blkno, int size) {
+  struct buf *bp;
+
+  if ((bp = calloc(1, sizeof(*bp) + size)) == NULL)
+	kshim_panic("kshim_getbuf: out of memory");
+  bp->b_data = (caddr_t)(bp + 1);
+  bp->b_blkno = blkno;
+  bp->b_bcount = size;
+  return (bp);
+}
+
+static int kshim_diskio(struct buf *bp, int write) {
+  off_t off = (off_t)bp->b_blkno * kshim_secsize;
+
+  if (off < 0 || off + bp->b_bcount > kshim_disksize)
+	return (EIO);
+  pthread_mutex_lock(&kshim_diskmtx);
+  if (write) {
+	bcopy(bp->b_data, kshim_disk + off, bp->b_bcount);
+	kshim_nwrite++;
+  } else {
+	bcopy(kshim_disk + off, bp->b_data, bp->b_bcount);
+	kshim_nread++;
+  }
+  pthread_mutex_unlock(&kshim_diskmtx);
+  return (0);
+}
+
+int bread(struct vnode *vp, daddr_t blkno, int size, struct ucred *cred,
+		  struct buf **bpp) {
+  int i, wait;
+
+  wait = kshim_latency;
+  if (wait > 0) {
+	pthread_mutex_lock(&kshim_diskmtx);
+	for (i = 0; i < KSHIM_NRA; i++)
+	  if (kshim_ra[i] == blkno + 1) {
+		kshim_ra[i] = 0;
+		kshim_nrahit++;
+		wait = 0;
+		break;
+	  }
+	pthread_mutex_unlock(&kshim_diskmtx);
+	if (wait > 0)
+	  usleep(wait);
+  }
+  *bpp = kshim_getbuf(blkno, size);
+  return (kshim_diskio(*bpp, 0));
+}
+
+/*
+ * The read ahead is only noted, so that reading those blocks later
+ * doesn't wait; the data is still copied when they are read.
+ */
+int breadn(struct vnode *vp, daddr_t blkno, int size, daddr_t *rablkno,
+		   int *rabsize, int cnt, struct ucred *cred, struct buf **bpp) {
+  int i;
+
+  if (kshim_latency > 0) {
+	pthread_mutex_lock(&kshim_diskmtx);
+	for (i = 0; i < cnt; i++)
+	  kshim_ra[kshim_nra++ % KSHIM_NRA] = rablkno[i] + 1;
+	pthread_mutex_unlock(&kshim_diskmtx);
+  }
+  return (bread(vp, blkno, size, cred, bpp));
+}
+
+struct buf *getblk(struct vnode *vp, daddr_t blkno, int size, int slpflag,
+				   int slptimeo, int flags) {
+
+  return (kshim_getbuf(blkno, size));
+}
+
+int bwrite(struct buf *bp) {
+  int error;
+
+  error = kshim_diskio(bp, 1);
+  (free)(bp);
+  return (error);
+}
+
+void bawrite(struct buf *bp) {
+  (void)bwrite(bp);
+}
+
+void bdwrite(struct buf *bp) {
+  (void)bwrite(bp);
+}
+
+void brelse(struct buf *bp) {
+  (free)(bp);
+}
+
+void bqrelse(struct buf *bp) {
+  (free)(bp);
+}
+
+void vfs_bio_clrbuf(struct buf *bp) {
+  bzero(bp->b_data, bp->b_bcount);
+}
+
+/* the tests never have a vnode go away under them */
+int vget(struct vnode *vp, int flags, struct thread *td) {
+  if (flags & LK_INTERLOCK)
+	mtx_unlock(&vp->v_interlock);
+  return (0);
+}
+
+int vinvalbuf(struct vnode *vp, int flags, struct ucred *cred,
+			  struct thread *td, int slpflag, int slptimeo) {
+  return (0);
+}
+
+void kshim_panic(const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "panic: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  abort();
+}
+
+int kshim_printf(const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  atomic_add_long(&kshim_nprintf, 1);
+  va_start(ap, fmt);
+  n = vprintf(fmt, ap);
+  va_end(ap);
+  return (n);
+}
+
+/* no buffer cache to look in */
+void edufs_statsbread(struct edufsmount *emp, struct vnode *vp,
+					  daddr_t blkno) {
+}
+
+/*
+ * The parts of edufs_bmap.c and edufs_extent.c the allocator calls.
+ * Those that build edufs_bmap.c in define KSHIM_BMAP.
+ */
+#ifndef KSHIM_BMAP
+void edufs_exinval(struct enode *ep, daddr_t lbn) {
+  kshim_panic("edufs_exinval");
+}
+
+void edufs_expurge(struct enode *ep) {
+  kshim_panic("edufs_expurge");
+}
+
+int edufs_getlbns(const struct edufs_geom *g, daddr_t lbn, int *slotp,
+				  int idx[NIADDR]) {
+  kshim_panic("edufs_getlbns");
+  return (-1);
+}
+#endif
+
+int edufs_dxlookup(struct enode *ep, daddr_t lbn, struct edufs_dextent *xp) {
+  kshim_panic("edufs_dxlookup");
+  return (EIO);
+}
+
+int edufs_dxalloc(struct enode *ep, daddr_t lbn, int32_t *offp, int *newp) {
+  kshim_panic("edufs_dxalloc");
+  return (EIO);
+}
+
+int edufs_dxfree(struct enode *ep) {
+  kshim_panic("edufs_dxfree");
+  return (EIO);
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Just enough of the kernel to run edufs's own allocator, cg, block map
+ * and enode hash code (edufs_alloc.c, edufs_cg.c, edufs_bmap.c,
+ * edufs_ehash.c) in userland, for the tests and benchmarks.  Include this first; it ends by defining
+ * _KERNEL, so the edufs headers and sources that follow compile as they
+ * do in the module.
+ *
+ * Each "cpu" is a mutex.  critical_enter() picks one at random and
+ * holds it until the matching critical_exit(), so a thread moves
+ * between cpus from one critical section to the next the way it can in
+ * the kernel, and only one thread at a time ever touches a cpu's copy
+ * of anything.  mtx and sx locks are pthread mutexes.  The disk is a
+ * block of memory: bread() and friends copy in and out of it, by
+ * kshim_secsize sector, whatever vnode they are handed, and nothing is
+ * cached.  A read can be made to wait kshim_latency microseconds, as for
+ * a disk; one that breadn() asked for ahead of time doesn't.  Functions
+ * from the edufs sources that aren't built in abort.
+ */
+
+#ifndef _EDUFS_KSHIM_H_
+#define	_EDUFS_KSHIM_H_
+
+#include <sys/param.h>
+#include <sys/endian.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <machine/atomic.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* the kernel headers the edufs sources include are all in here */
+#define	_SYS_SYSTM_H_
+#define	_SYS_KERNEL_H_
+#define	_SYS_BIO_H_
+#define	_SYS_BUF_H_
+#define	_SYS_LOCK_H_
+#define	_SYS_MALLOC_H_
+#define	_SYS_MOUNT_H_
+#define	_SYS_MUTEX_H_
+#define	_SYS_PCPU_H_
+#define	_SYS_PROC_H_
+#define	_SYS_SMP_H_
+#define	_SYS_SX_H_
+#define	_SYS_SYSCTL_H_
+#define	_SYS_VNODE_H_
+#define	VM_UMA_H
+
+/* cpus */
+#define	KSHIM_MAXCPU	64
+
+extern u_int mp_maxid;
+extern int mp_ncpus;
+
+void	kshim_init(int ncpu);
+void	critical_enter(void);
+void	critical_exit(void);
+int	kshim_curcpu(void);
+
+#define	PCPU_GET(name)	kshim_curcpu()
+
+/* mtx(9) and sx(9) */
+struct mtx {
+  pthread_mutex_t mtx_lock;
+};
+
+#define	MTX_DEF		0x0000
+#define	MTX_DUPOK	0x0001
+#define	MA_OWNED	0x0001
+#define	SX_XLOCKED	0x0001
+
+#define	mtx_init(m, name, type, opts)	pthread_mutex_init(&(m)->mtx_lock, NULL)
+#define	mtx_destroy(m)		pthread_mutex_destroy(&(m)->mtx_lock)
+#define	mtx_lock(m)		pthread_mutex_lock(&(m)->mtx_lock)
+#define	mtx_unlock(m)		pthread_mutex_unlock(&(m)->mtx_lock)
+#define	mtx_trylock(m)		(pthread_mutex_trylock(&(m)->mtx_lock) == 0)
+#define	mtx_assert(m, what)	do { } while (0)
+
+struct sx {
+  pthread_mutex_t sx_lock;
+};
+
+#define	sx_init(s, name)	pthread_mutex_init(&(s)->sx_lock, NULL)
+#define	sx_destroy(s)		pthread_mutex_destroy(&(s)->sx_lock)
+#define	sx_xlock(s)		pthread_mutex_lock(&(s)->sx_lock)
+#define	sx_xunlock(s)		pthread_mutex_unlock(&(s)->sx_lock)
+#define	sx_try_xlock(s)		(pthread_mutex_trylock(&(s)->sx_lock) == 0)
+#define	sx_assert(s, what)	do { } while (0)
+
+/* malloc(9) and uma(9) */
+struct malloc_type {
+  u_long ks_calls;
+};
+
+#define	M_NOWAIT	0x0001
+#define	M_WAITOK	0x0002
+#define	M_ZERO		0x0100
+
+#define	MALLOC_DECLARE(type)	extern struct malloc_type type[1]
+#define	MALLOC_DEFINE(type, shortdesc, longdesc) struct malloc_type type[1]
+
+void	*kshim_malloc(size_t size, struct malloc_type *type, int flags);
+void	kshim_free(void *addr, struct malloc_type *type);
+
+typedef void *uma_zone_t;
+
+/* freed enodes are poisoned, to catch a reader still on one */
+void	kshim_zfree(void *item, size_t size);
+#define	uma_zfree(zone, item)	kshim_zfree((item), sizeof(*(item)))
+
+/* sysctl(9), which goes nowhere */
+struct sysctl_ctx_list {
+  void *sc_unused;
+};
+struct sysctl_oid;
+
+#define	SYSCTL_DECL(name)	extern int kshim_sysctl_##name
+#define	SYSCTL_INT(parent, nbr, name, access, ptr, val, descr)		\
+	extern int kshim_sysctl_##name
+
+/* vnodes and mounts, what edufs looks at of them */
+struct thread;
+struct ucred;
+struct cdev;
+struct lockf;
+struct dirhash;
+
+struct mount {
+  int mnt_flag;
+  void *mnt_data;
+  int mnt_iosize_max;
+};
+
+#define	MNT_RDONLY	0x0001
+#define	MNT_WAIT	1
+#define	MNT_NOWAIT	2
+
+struct vnode {
+  struct mtx v_interlock;
+  int v_vflag;
+  struct mount *v_mount;
+  void *v_data;
+};
+
+#define	VV_ROOT		0x0001
+#define	NULLVP		((struct vnode *)NULL)
+#define	LK_INTERLOCK	0x0001
+#define	VI_LOCK(vp)	mtx_lock(&(vp)->v_interlock)
+#define	curthread	((struct thread *)NULL)
+#define	NOCRED		((struct ucred *)NULL)
+
+int	vget(struct vnode *vp, int flags, struct thread *td);
+int	vinvalbuf(struct vnode *vp, int flags, struct ucred *cred,
+	    struct thread *td, int slpflag, int slptimeo);
+
+/* buf(9) on the memory disk */
+struct buf {
+  caddr_t b_data;
+  daddr_t b_blkno;
+  long b_bcount;
+  int b_flags;
+};
+
+#define	B_AGE		0x0001
+#define	B_INVAL		0x0002
+#define	B_NOCACHE	0x0004
+
+extern u_int8_t *kshim_disk;
+extern off_t kshim_disksize;
+extern int kshim_secsize;
+extern u_long kshim_nread;		/* buffers read from the disk */
+extern u_long kshim_nwrite;		/* ... and written to it */
+extern int kshim_latency;		/* usec a read waits, 0 for none */
+extern u_long kshim_nrahit;		/* reads already started by breadn */
+
+int	bread(struct vnode *vp, daddr_t blkno, int size, struct ucred *cred,
+	    struct buf **bpp);
+int	breadn(struct vnode *vp, daddr_t blkno, int size, daddr_t *rablkno,
+	    int *rabsize, int cnt, struct ucred *cred, struct buf **bpp);
+struct buf *getblk(struct vnode *vp, daddr_t blkno, int size, int slpflag,
+	    int slptimeo, int flags);
+int	bwrite(struct buf *bp);
+void	bawrite(struct buf *bp);
+void	bdwrite(struct buf *bp);
+void	brelse(struct buf *bp);
+void	bqrelse(struct buf *bp);
+void	vfs_bio_clrbuf(struct buf *bp);
+
+/* the rest of systm.h */
+#define	KASSERT(exp, msg)	do {					\
+	if (!(exp))							\
+		kshim_panic msg;					\
+} while (0)
+
+extern u_long kshim_nprintf;		/* kernel printf()s so far */
+
+void	kshim_panic(const char *fmt, ...);
+int	kshim_printf(const char *fmt, ...);
+
+static __inline int imax(int a, int b) { return (a > b ? a : b); }
+static __inline int imin(int a, int b) { return (a < b ? a : b); }
+
+#define	malloc(size, type, flags)	kshim_malloc((size), (type), (flags))
+#define	free(addr, type)		kshim_free((addr), (type))
+#define	printf				kshim_printf
+
+#define	_KERNEL
+
+#endif /* !_EDUFS_KSHIM_H_ */
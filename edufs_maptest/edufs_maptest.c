@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_maptest: check edufs_mapscan(), edufs_mapfind() and
+ * edufs_maprun() from edufs_map.h against a bit at a time reference over
+ * random maps, then time handing out every enode of a cg both ways.
+ *
+ * The old way is the loop edufs_findfreeenode() had: look at the map a
+ * byte at a time from the start, skip 0xff bytes, then try bits 7 down
+ * to 0.  The new way is what edufs_enodealloc() does: edufs_mapfind()
+ * from just past the last enode handed out.  edufs_mapscan() from the
+ * start each time is timed too, to split the word loads from the rotor.
+ */
+
+#include <sys/param.h>
+#include <sys/time.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sys/fs/edufs/edufs_map.h"
+
+#define	MAXBITS	(1 << 20)
+
+u_int8_t map[MAXBITS / NBBY];
+int nbits = 65536;
+int ncheck = 200000;
+int nerrs;
+
+void randmap(int nbits, int pct);
+int ref_scan(int from, int to, int set);
+int ref_find(int lo, int hi, int start);
+int ref_run(int from, int to, int n);
+void check(void);
+int old_alloc(int nbits);
+void bcheck(const char *what, int n, int nfree);
+void bench(int pct);
+double now(void);
+void usage(void);
+
+#define	CHECK(what, a, b, c, got, want) do {				\
+  if ((got) != (want)) {						\
+	printf("%s(%d, %d, %d) is %d, want %d\n", (what), (a), (b), (c),	\
+		   (got), (want));						\
+	nerrs++;							\
+  }									\
+} while (0)
+
+int main(int argc, char *argv[]) {
+  int ch;
+
+  while ((ch = getopt(argc, argv, "b:n:")) != -1) {
+	switch (ch) {
+	case 'b':
+	  nbits = atoi(optarg);
+	  break;
+	case 'n':
+	  ncheck = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  if (nbits <= 0 || nbits > MAXBITS || nbits % 64 != 0 || ncheck < 0)
+	usage();
+
+  srandom(1);
+  check();
+  bench(0);
+  bench(50);
+  bench(90);
+  printf("%d checks: %d problem%s\n", ncheck, nerrs, nerrs == 1 ? "" : "s");
+  return (nerrs ? 1 : 0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_maptest [-b bits] [-n checks]\n");
+  exit(1);
+}
+
+/* about pct percent of the first nbits set, the rest of the map set */
+void randmap(int nbits, int pct) {
+  int b;
+
+  memset(map, 0xff, sizeof(map));
+  for (b = 0; b < nbits; b++)
+	if (random() % 100 >= pct)
+	  MAPCLR(map, b);
+}
+
+int ref_scan(int from, int to, int set) {
+  int b;
+
+  for (b = from; b < to; b++)
+	if (MAPISSET(map, b) == (set != 0))
+	  return (b);
+  return (-1);
+}
+
+int ref_find(int lo, int hi, int start) {
+  int b;
+
+  if (start < lo || start >= hi)
+	start = lo;
+  if ((b = ref_scan(start, hi, 0)) < 0)
+	b = ref_scan(lo, start, 0);
+  return (b);
+}
+
+int ref_run(int from, int to, int n) {
+  int b, i;
+
+  for (b = from; b + n <= to; b++) {
+	for (i = 0; i < n; i++)
+	  if (MAPISSET(map, b + i))
+		break;
+	if (i == n)
+	  return (b);
+  }
+  return (-1);
+}
+
+/*
+ * Random ranges over maps from nearly empty to nearly full, so the
+ * answer lands anywhere in a word, in the partial words at either end,
+ * or nowhere.
+ */
+void check(void) {
+  int i, a, b, c, n;
+
+  for (i = 0; i < ncheck; i++) {
+	if (i % 1000 == 0)
+	  randmap(4096, (i / 1000) % 2 ? 2 + random() % 10 : 90 + random() % 10);
+	a = random() % 4096;
+	b = a + random() % (4096 - a + 1);
+	c = random() % 4200;
+	n = 1 + random() % 16;
+	CHECK("mapscan", a, b, 0, edufs_mapscan(map, a, b, 0), ref_scan(a, b, 0));
+	CHECK("mapscan", a, b, 1, edufs_mapscan(map, a, b, 1), ref_scan(a, b, 1));
+	if (a < b)
+	  CHECK("mapfind", a, b, c, edufs_mapfind(map, a, b, c),
+			ref_find(a, b, c));
+	CHECK("maprun", a, b, n, edufs_maprun(map, a, b, n), ref_run(a, b, n));
+  }
+}
+
+/* edufs_findfreeenode()'s search, from the start of the map every time */
+int old_alloc(int nbits) {
+  u_int8_t *bm;
+  int bit, idx;
+
+  for (bm = map; bm < map + nbits / NBBY; bm++) {
+	if (*bm == 0xff)
+	  continue;
+	for (bit = 7; bit >= 0; bit--) {
+	  if ((*bm & (1 << bit)) == 0) {
+		idx = NBBY * (bm - map) + (NBBY - bit - 1);
+		*bm |= 1 << bit;
+		return (idx);
+	  }
+	}
+  }
+  return (-1);
+}
+
+double now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/* each free bit should have been handed out once, leaving none */
+void bcheck(const char *what, int n, int nfree) {
+  if (n != nfree || ref_scan(0, nbits, 0) >= 0) {
+	printf("%s handed out %d of %d\n", what, n, nfree);
+	nerrs++;
+  }
+}
+
+/* hand out every free bit of a pct percent full map each way */
+void bench(int pct) {
+  double t0, t1, t2, t3;
+  int b, n, nfree, rotor;
+
+  randmap(nbits, pct);
+  for (nfree = 0, b = 0; b < nbits; b++)
+	nfree += MAPISCLR(map, b);
+  memcpy(map + sizeof(map) / 2, map, nbits / NBBY);
+
+  t0 = now();
+  for (n = 0; n <= nfree && old_alloc(nbits) >= 0; n++)
+	;
+  t1 = now();
+  bcheck("old scan", n, nfree);
+
+  memcpy(map, map + sizeof(map) / 2, nbits / NBBY);
+  for (n = 0; n <= nfree && (b = edufs_mapscan(map, 0, nbits, 0)) >= 0; n++)
+	MAPSET(map, b);
+  t2 = now();
+  bcheck("mapscan", n, nfree);
+
+  memcpy(map, map + sizeof(map) / 2, nbits / NBBY);
+  rotor = 0;
+  for (n = 0; n <= nfree &&
+		 (b = edufs_mapfind(map, 0, nbits, rotor + 1)) >= 0; n++) {
+	MAPSET(map, b);
+	rotor = b;
+  }
+  t3 = now();
+  bcheck("mapfind", n, nfree);
+
+  printf("%d enodes, %d%% in use: old %.0f ns, mapscan %.0f ns, "
+		 "mapfind from rotor %.0f ns per enode\n", nbits, pct,
+		 (t1 - t0) * 1e9 / nfree, (t2 - t1) * 1e9 / nfree,
+		 (t3 - t2) * 1e9 / nfree);
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_mountbench: how long mount takes to load the cg headers of a
+ * file system with hundreds of cgs, through edufs_cginit() (edufs_cg.c
+ * on edufs_kshim), each of the ways it can:
+ *
+ *  - "chain": the old domount loop, one bread() of a header after the
+ *    other, each found from the last one's cg_next;
+ *  - "scan": edufs_cgscan(), the same walk with breadn() reading ahead,
+ *    as when there is no summary area or it can't be trusted;
+ *  - "summary": edufs_cgsumread(), the summary area in a few big reads.
+ *
+ * Every read that wasn't read ahead waits -l microseconds, standing in
+ * for the disk.  The summary and scan mounts have to come up with the
+ * same cglist, and edufs_cgflush() has to write the summary area back
+ * out just as mkfs (newfs_edufs) laid it down.
+ */
+
+#include "edufs_kshim.h"
+
+#include <sys/time.h>
+#include <err.h>
+#include <unistd.h>
+
+#include <fs/edufs/edufs_alloc.c>
+#include <fs/edufs/edufs_cg.c>
+
+#define	EPG		2048
+#define	NDBLK		4096
+#define	BSIZE		4096
+#define	BPS		512
+#define	DATASTART	(64 * 1024 * 1024)
+
+struct edufs_superblock sb;
+struct edufsmount mnt;
+struct mount mp;
+struct vnode devvp;
+struct cg *scancg;
+int32_t *scanoff;
+int ncg = 500;
+int latency = 100;
+int nerrs;
+
+void mkfs(void);
+int old_cgload(void);
+double now(void);
+void load(const char *how);
+void compare(void);
+void usage(void);
+
+/*
+ * The headers are spread out the way newfs_edufs leaves them, a cg's
+ * worth of blocks apart, with the summary area after the last one.
+ */
+void mkfs(void) {
+  struct edufs_cgsum *sc;
+  struct cg *cgp;
+  int32_t off;
+  int c;
+
+  kshim_secsize = BPS;
+  sb.fs_magic = EDUFS_MAGIC;
+  sb.fs_version = EDUFS_VERSION;
+  sb.fs_bsize = BSIZE;
+  sb.fs_bps = BPS;
+  sb.fs_epg = EPG;
+  sb.fs_bpg = NDBLK;
+  sb.fs_ncg = ncg;
+  sb.fs_cblkno = 2 * BSIZE;
+  sb.fs_sbsize = sizeof(sb);
+  sb.fs_clean = 1;
+  sb.fs_csaddr = sb.fs_cblkno + ncg * 3 * BSIZE;
+  sb.fs_cssize = roundup(ncg * sizeof(*sc), BPS);
+  kshim_disksize = sb.fs_csaddr + roundup(sb.fs_cssize, MAXBSIZE);
+  if ((kshim_disk = calloc(1, kshim_disksize)) == NULL)
+	err(1, "calloc");
+  sc = (struct edufs_cgsum *)(kshim_disk + sb.fs_csaddr);
+  for (c = 0; c < ncg; c++, sc++) {
+	off = sb.fs_cblkno + c * 3 * BSIZE;
+	cgp = (struct cg *)(kshim_disk + off);
+	cgp->cg_magic = EDUFS_MAGIC;
+	cgp->cg_cgx = c;
+	cgp->cg_next = off + 3 * BSIZE;
+	cgp->cg_eusedoff = off + BSIZE;
+	cgp->cg_freeoff = off + 2 * BSIZE;
+	cgp->cg_dboff = DATASTART + c * NDBLK * BSIZE;
+	cgp->cg_ndblk = NDBLK;
+	cgp->cg_cs.cs_nbfree = NDBLK - c;
+	cgp->cg_cs.cs_nefree = EPG - c;
+	cgp->cg_rotor = c;
+	sc->sc_cgoff = off;
+	sc->sc_next = cgp->cg_next;
+	sc->sc_ndblk = cgp->cg_ndblk;
+	sc->sc_dboff = cgp->cg_dboff;
+	sc->sc_eusedoff = cgp->cg_eusedoff;
+	sc->sc_freeoff = cgp->cg_freeoff;
+	sc->sc_cs = cgp->cg_cs;
+	sc->sc_rotor = cgp->cg_rotor;
+  }
+  bcopy(&sb, kshim_disk, sizeof(sb));
+}
+
+/* the header loop domount had before the summary area */
+int old_cgload(void) {
+  struct buf *bp;
+  int32_t next;
+  int c, error;
+
+  next = sb.fs_cblkno;
+  for (c = 0; c < ncg; c++) {
+	error = bread(&devvp, next / BPS, BSIZE, NOCRED, &bp);
+	if (error) {
+	  brelse(bp);
+	  return (error);
+	}
+	bcopy(bp->b_data, &mnt.cglist[c], sizeof(struct cg));
+	brelse(bp);
+	next = mnt.cglist[c].cg_next;
+  }
+  return (0);
+}
+
+double now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+void load(const char *how) {
+  u_long nread, nrahit;
+  double t0, t;
+  int error;
+
+  nread = kshim_nread;
+  nrahit = kshim_nrahit;
+  t0 = now();
+  if (strcmp(how, "chain") == 0) {
+	mnt.cglist = calloc(ncg, sizeof(struct cg));
+	error = old_cgload();
+  } else
+	error = edufs_cginit(&mnt);
+  t = now() - t0;
+  if (error)
+	errx(1, "%s: mount failed: %d", how, error);
+  printf("%-8s %5lu reads, %5lu read ahead  %8.1f ms\n", how,
+		 kshim_nread - nread, kshim_nrahit - nrahit, t * 1e3);
+}
+
+/* what the summary area gave against what the headers say */
+void compare(void) {
+  struct cg *a, *b;
+  int c;
+
+  for (c = 0; c < ncg; c++) {
+	a = &mnt.cglist[c];
+	b = &scancg[c];
+	if (mnt.e_cgoff[c] != scanoff[c] || a->cg_next != b->cg_next ||
+		a->cg_ndblk != b->cg_ndblk || a->cg_dboff != b->cg_dboff ||
+		a->cg_eusedoff != b->cg_eusedoff || a->cg_freeoff != b->cg_freeoff ||
+		bcmp(&a->cg_cs, &b->cg_cs, sizeof(a->cg_cs)) != 0 ||
+		a->cg_rotor != b->cg_rotor) {
+	  printf("cg %d: summary area and header differ\n", c);
+	  nerrs++;
+	}
+  }
+}
+
+int main(int argc, char *argv[]) {
+  void *sums;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "g:l:")) != -1) {
+	switch (ch) {
+	case 'g':
+	  ncg = atoi(optarg);
+	  break;
+	case 'l':
+	  latency = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  if (ncg <= 0 || latency < 0)
+	usage();
+
+  kshim_init(1);
+  mkfs();
+  mnt.e_esb = &sb;
+  mnt.e_devvp = &devvp;
+  mnt.e_mountp = &mp;
+  if ((mnt.e_stats = calloc(1, sizeof(struct edufs_pcpustats))) == NULL)
+	err(1, "calloc");
+  kshim_latency = latency;
+  printf("%d cgs, %d usec a read\n", ncg, latency);
+
+  load("chain");
+  (free)(mnt.cglist);
+
+  sb.fs_clean = 0;			/* don't trust the summary area */
+  load("scan");
+  if ((scancg = calloc(ncg, sizeof(struct cg))) == NULL ||
+	  (scanoff = calloc(ncg, sizeof(int32_t))) == NULL)
+	err(1, "calloc");
+  bcopy(mnt.cglist, scancg, ncg * sizeof(struct cg));
+  bcopy(mnt.e_cgoff, scanoff, ncg * sizeof(int32_t));
+  edufs_cguninit(&mnt);
+
+  sb.fs_clean = 1;
+  load("summary");
+  compare();
+
+  if ((sums = calloc(1, sb.fs_cssize)) == NULL)
+	err(1, "calloc");
+  bcopy(kshim_disk + sb.fs_csaddr, sums, sb.fs_cssize);
+  bzero(kshim_disk + sb.fs_csaddr, sb.fs_cssize);
+  sb.fs_fmod = 1;
+  if (edufs_cgflush(&mnt, MNT_WAIT) != 0)
+	errx(1, "edufs_cgflush failed");
+  if (bcmp(kshim_disk + sb.fs_csaddr, sums, sb.fs_cssize) != 0) {
+	printf("summary area written back differently\n");
+	nerrs++;
+  }
+  if (nerrs)
+	printf("%d problems\n", nerrs);
+  return (nerrs ? 1 : 0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_mountbench [-g cgs] [-l usec]\n");
+  exit(1);
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_rasim: replay recorded reads through the kernel's readahead
+ * policy (edufs_readahead.h) and an LRU buffer cache, to see what a
+ * policy setting would have cost.
+ *
+ * Input is either the output of sysctl vfs.edufs.trace from a kernel
+ * built with ETR_READ tracing, whose "ra <enode> <offset> <length> ..."
+ * records are picked out and put back in time order, or plain lines of
+ * "<file> <offset> <length>".  Files are taken to have no end.
+ */
+
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sys/fs/edufs/edufs_readahead.h"
+
+#define	NHASH	1024
+
+struct rec {
+  u_int64_t r_time;
+  int r_file;
+  int64_t r_off;
+  int64_t r_len;
+};
+
+struct file {
+  LIST_ENTRY(file) f_hash;
+  int f_id;
+  struct edufs_ra f_ra;
+};
+
+struct blk {
+  LIST_ENTRY(blk) b_hash;
+  TAILQ_ENTRY(blk) b_lru;
+  int b_file;
+  int64_t b_lbn;
+  int b_ra;			/* read ahead, not asked for yet */
+};
+
+LIST_HEAD(, file) filehash[NHASH];
+LIST_HEAD(, blk) blkhash[NHASH];
+TAILQ_HEAD(, blk) lru = TAILQ_HEAD_INITIALIZER(lru);
+int ncached;
+
+int bsize = 4096;		/* edufs BLOCKSIZE */
+int cachesize = 1024;		/* blocks */
+int ramax = 32;
+
+/* the results */
+u_int64_t nreads, nblocks, nhits, nmisses, nraissued, nraused, nrawasted;
+u_int64_t nmode[3];
+
+struct rec *readrecs(FILE *fp, int *np);
+int reccmp(const void *a, const void *b);
+struct file *getfile(int id);
+struct blk *lookup(int file, int64_t lbn);
+void insert(int file, int64_t lbn, int ra);
+void demand(int file, int64_t lbn);
+void prefetch(int file, int64_t lbn);
+void simulate(struct rec *r);
+void usage(void);
+
+int main(int argc, char *argv[]) {
+  struct rec *recs;
+  FILE *fp;
+  int ch, i, n;
+
+  while ((ch = getopt(argc, argv, "b:c:m:")) != -1) {
+	switch (ch) {
+	case 'b':
+	  bsize = atoi(optarg);
+	  break;
+	case 'c':
+	  cachesize = atoi(optarg);
+	  break;
+	case 'm':
+	  ramax = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc > 1 || bsize <= 0 || cachesize <= 0 || ramax < 0)
+	usage();
+
+  if (argc == 0 || strcmp(argv[0], "-") == 0)
+	fp = stdin;
+  else if ((fp = fopen(argv[0], "r")) == NULL)
+	err(1, "%s", argv[0]);
+  recs = readrecs(fp, &n);
+  for (i = 0; i < n; i++)
+	simulate(&recs[i]);
+
+  /* whatever was read ahead and is still waiting was wasted too */
+  nrawasted += nraissued - nraused - nrawasted;
+  printf("block size %d, cache %d blocks, readahead max %d\n", bsize,
+		 cachesize, ramax);
+  printf("reads %ju: sequential %ju strided %ju random %ju\n",
+		 (uintmax_t)nreads, (uintmax_t)nmode[EDUFS_RA_SEQ],
+		 (uintmax_t)nmode[EDUFS_RA_STRIDE],
+		 (uintmax_t)nmode[EDUFS_RA_RANDOM]);
+  printf("blocks %ju: hits %ju misses %ju\n", (uintmax_t)nblocks,
+		 (uintmax_t)nhits, (uintmax_t)nmisses);
+  printf("read ahead %ju: used %ju wasted %ju\n", (uintmax_t)nraissued,
+		 (uintmax_t)nraused, (uintmax_t)nrawasted);
+  printf("blocks from disk %ju (%ju%% of those asked for)\n",
+		 (uintmax_t)(nmisses + nraissued),
+		 (uintmax_t)(nblocks ?
+					 (nmisses + nraissued) * 100 / nblocks : 0));
+  return (0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_rasim [-b bsize] [-c cacheblocks] "
+		  "[-m ramax] [file]\n");
+  exit(1);
+}
+
+/* read the whole trace, putting kernel trace records in time order */
+struct rec *readrecs(FILE *fp, int *np) {
+  struct rec *recs = NULL;
+  char line[256], *p;
+  intmax_t off, len;
+  u_int64_t t;
+  int file, n, max, sorted;
+  u_int cpu;
+  char c;
+
+  n = max = 0;
+  sorted = 1;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+	if (n == max) {
+	  max = max ? max * 2 : 1024;
+	  if ((recs = realloc(recs, max * sizeof(*recs))) == NULL)
+		err(1, "realloc");
+	}
+	if ((p = strstr(line, " ra ")) != NULL) {
+	  /* "<cpu> <time> <category> ra <enode> <offset> <length> ..." */
+	  if (sscanf(line, "%u %ju", &cpu, &t) != 2 ||
+		  sscanf(p, " ra %d %jd %jd", &file, &off, &len) != 3)
+		continue;
+	  sorted = 0;
+	} else if (sscanf(line, "%d %jd %jd %c", &file, &off, &len, &c) == 3)
+	  t = n;
+	else
+	  continue;
+	recs[n].r_time = t;
+	recs[n].r_file = file;
+	recs[n].r_off = off;
+	recs[n].r_len = len;
+	n++;
+  }
+  if (ferror(fp))
+	err(1, "read");
+  if (!sorted)
+	qsort(recs, n, sizeof(*recs), reccmp);
+  *np = n;
+  return (recs);
+}
+
+int reccmp(const void *a, const void *b) {
+  const struct rec *ra = a, *rb = b;
+
+  if (ra->r_time != rb->r_time)
+	return (ra->r_time < rb->r_time ? -1 : 1);
+  return (0);
+}
+
+struct file *getfile(int id) {
+  struct file *fp;
+
+  LIST_FOREACH(fp, &filehash[id % NHASH], f_hash)
+	if (fp->f_id == id)
+	  return (fp);
+  if ((fp = calloc(1, sizeof(*fp))) == NULL)
+	err(1, "calloc");
+  fp->f_id = id;
+  LIST_INSERT_HEAD(&filehash[id % NHASH], fp, f_hash);
+  return (fp);
+}
+
+struct blk *lookup(int file, int64_t lbn) {
+  struct blk *bp;
+
+  LIST_FOREACH(bp, &blkhash[(file + lbn) % NHASH], b_hash)
+	if (bp->b_file == file && bp->b_lbn == lbn)
+	  return (bp);
+  return (NULL);
+}
+
+/* put a block in the cache, throwing out the least recently used */
+void insert(int file, int64_t lbn, int ra) {
+  struct blk *bp;
+
+  if (ncached == cachesize) {
+	bp = TAILQ_FIRST(&lru);
+	if (bp->b_ra)
+	  nrawasted++;
+	TAILQ_REMOVE(&lru, bp, b_lru);
+	LIST_REMOVE(bp, b_hash);
+	ncached--;
+  } else if ((bp = malloc(sizeof(*bp))) == NULL)
+	err(1, "malloc");
+  bp->b_file = file;
+  bp->b_lbn = lbn;
+  bp->b_ra = ra;
+  LIST_INSERT_HEAD(&blkhash[(file + lbn) % NHASH], bp, b_hash);
+  TAILQ_INSERT_TAIL(&lru, bp, b_lru);
+  ncached++;
+}
+
+/* a block the reader asked for */
+void demand(int file, int64_t lbn) {
+  struct blk *bp;
+
+  nblocks++;
+  if ((bp = lookup(file, lbn)) == NULL) {
+	nmisses++;
+	insert(file, lbn, 0);
+	return;
+  }
+  nhits++;
+  if (bp->b_ra) {
+	nraused++;
+	bp->b_ra = 0;
+  }
+  TAILQ_REMOVE(&lru, bp, b_lru);
+  TAILQ_INSERT_TAIL(&lru, bp, b_lru);
+}
+
+/* a block read ahead; like breadn(), nothing if it's cached already */
+void prefetch(int file, int64_t lbn) {
+  if (lbn < 0 || lookup(file, lbn) != NULL)
+	return;
+  nraissued++;
+  insert(file, lbn, 1);
+}
+
+/*
+ * One read: the blocks it covers, then what edufs_read() would read
+ * ahead after it.
+ */
+void simulate(struct rec *r) {
+  struct file *fp;
+  int64_t first, last, lbn, prev;
+  int i, win;
+
+  if (r->r_len <= 0 || r->r_off < 0)
+	return;
+  fp = getfile(r->r_file);
+  win = edufs_raupdate(&fp->f_ra, r->r_off, r->r_len, ramax);
+  nreads++;
+  nmode[fp->f_ra.ra_mode]++;
+
+  first = r->r_off / bsize;
+  last = (r->r_off + r->r_len - 1) / bsize;
+  for (lbn = first; lbn <= last; lbn++)
+	demand(r->r_file, lbn);
+
+  if (fp->f_ra.ra_mode == EDUFS_RA_STRIDE &&
+	  (fp->f_ra.ra_stride <= 0 || fp->f_ra.ra_stride > bsize)) {
+	prev = first;
+	for (i = 1; i <= win; i++) {
+	  if (r->r_off + i * fp->f_ra.ra_stride < 0)
+		break;
+	  lbn = (r->r_off + i * fp->f_ra.ra_stride) / bsize;
+	  if (lbn != prev)
+		prefetch(r->r_file, lbn);
+	  prev = lbn;
+	}
+	return;
+  }
+  /* cluster_read() reads seqcount blocks past each block it is asked for */
+  for (lbn = last + 1; lbn <= last + win; lbn++)
+	prefetch(r->r_file, lbn);
+}
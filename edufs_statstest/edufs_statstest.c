@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * edufs_statstest: run the kernel's per-cpu counter code (ES_ADD and
+ * edufs_statsum() from edufs_stats.h) from several threads at once and
+ * check that no increment is lost.
+ *
+ * The kernel's guarantee is that only one thread at a time touches a
+ * cpu's counters, inside critical_enter()/critical_exit().  The cpus
+ * are edufs_kshim's, which start every critical section on a cpu
+ * picked at random, so threads move between cpus the way they would
+ * between critical sections in the kernel.  A reader sums the counters
+ * while the writers run and checks the sums never go down.
+ */
+
+#include "edufs_kshim.h"
+
+#include <err.h>
+#include <unistd.h>
+
+#include <fs/edufs/edufs_mount.h>
+#include <fs/edufs/edufs_stats.h>
+
+#define	NCPU		4
+#define	NTHREAD		8
+
+struct edufsmount mnt;
+int iters = 200000;
+volatile int writersdone;
+int nerrs;
+
+void *writer(void *arg);
+void *reader(void *arg);
+void usage(void);
+
+/* thread t adds 1 to ES_BREAD and t + 1 to ES_BYTESREAD, iters times */
+void *writer(void *arg) {
+  int i, t = (int)(intptr_t)arg;
+
+  for (i = 0; i < iters; i++) {
+	ES_INC(&mnt, ES_BREAD);
+	ES_ADD(&mnt, ES_BYTESREAD, t + 1);
+  }
+  return (NULL);
+}
+
+void *reader(void *arg) {
+  u_int64_t last, sum;
+  u_int64_t max = (u_int64_t)iters * NTHREAD;
+
+  last = 0;
+  while (!writersdone) {
+	sum = edufs_statsum(mnt.e_stats, mp_maxid, ES_BREAD);
+	if (sum < last || sum > max) {
+	  printf("ES_BREAD read %ju after %ju, at most %ju\n",
+			 (uintmax_t)sum, (uintmax_t)last, (uintmax_t)max);
+	  nerrs++;
+	}
+	last = sum;
+  }
+  return (NULL);
+}
+
+int main(int argc, char *argv[]) {
+  pthread_t w[NTHREAD], r;
+  u_int64_t want;
+  int ch, i;
+
+  while ((ch = getopt(argc, argv, "n:")) != -1) {
+	switch (ch) {
+	case 'n':
+	  iters = atoi(optarg);
+	  break;
+	default:
+	  usage();
+	}
+  }
+  if (iters <= 0)
+	usage();
+
+  kshim_init(NCPU);
+  if ((mnt.e_stats = calloc(mp_maxid + 1,
+							sizeof(struct edufs_pcpustats))) == NULL)
+	err(1, "calloc");
+
+  if (pthread_create(&r, NULL, reader, NULL) != 0)
+	errx(1, "pthread_create");
+  for (i = 0; i < NTHREAD; i++)
+	if (pthread_create(&w[i], NULL, writer, (void *)(intptr_t)i) != 0)
+	  errx(1, "pthread_create");
+  for (i = 0; i < NTHREAD; i++)
+	pthread_join(w[i], NULL);
+  writersdone = 1;
+  pthread_join(r, NULL);
+
+  want = (u_int64_t)iters * NTHREAD;
+  if (edufs_statsum(mnt.e_stats, mp_maxid, ES_BREAD) != want) {
+	printf("ES_BREAD is %ju, want %ju\n",
+		   (uintmax_t)edufs_statsum(mnt.e_stats, mp_maxid, ES_BREAD),
+		   (uintmax_t)want);
+	nerrs++;
+  }
+  /* 1 + 2 + ... + NTHREAD per iteration */
+  want = (u_int64_t)iters * NTHREAD * (NTHREAD + 1) / 2;
+  if (edufs_statsum(mnt.e_stats, mp_maxid, ES_BYTESREAD) != want) {
+	printf("ES_BYTESREAD is %ju, want %ju\n",
+		   (uintmax_t)edufs_statsum(mnt.e_stats, mp_maxid, ES_BYTESREAD),
+		   (uintmax_t)want);
+	nerrs++;
+  }
+  for (i = 0; i < ES_NCOUNTERS; i++)
+	if (i != ES_BREAD && i != ES_BYTESREAD &&
+		edufs_statsum(mnt.e_stats, mp_maxid, i) != 0) {
+	  printf("counter %d moved\n", i);
+	  nerrs++;
+	}
+
+  printf("%d threads, %d cpus, %d iterations: %d problem%s\n", NTHREAD,
+		 NCPU, iters, nerrs, nerrs == 1 ? "" : "s");
+  return (nerrs ? 1 : 0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: edufs_statstest [-n iterations]\n");
+  exit(1);
+}
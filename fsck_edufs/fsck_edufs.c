@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2003 David Parfitt
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * fsck_edufs: a read-only consistency check of an edufs file system.
+ * Walks the cylinder groups the same way the kernel does at mount time
+ * and reports what it finds; it never writes to the disk.
+ */
+
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../sys/fs/edufs/edufs_denode.h"
+#include "../sys/fs/edufs/edufs.h"
+
+#define ISSET(map, b)	((map)[(b) / NBBY] & (0x80 >> ((b) % NBBY)))
+
+struct edufs_superblock esb;
+struct cg *allcg;
+u_int8_t **refmap;		/* per cg, blocks referenced by some enode */
+int fd;
+int nerrs;
+
+void readcgs(void);
+void readat(off_t off, void *buf, size_t len);
+int blkref(int ino, edufs_daddr_t off);
+int checkindir(int ino, edufs_daddr_t off, int level);
+void checkext(int ino, struct edufs_dxhdr *dh, int max, int *np);
+void checkenode(int ino, struct denode *dp);
+void checkcg(int c);
+void checkblocks(int c);
+void checkcgsum(void);
+void usage(void);
+
+int main(int argc, char *argv[]) {
+  int c;
+
+  if (argc != 2)
+	usage();
+  if ((fd = open(argv[1], O_RDONLY)) < 0)
+	err(1, "%s", argv[1]);
+
+  readat(0, &esb, sizeof(esb));
+  if (esb.fs_magic != EDUFS_MAGIC || esb.fs_bps <= 0 || esb.fs_bsize <= 0 ||
+	  esb.fs_ncg <= 0)
+	errx(1, "%s: not an edufs file system", argv[1]);
+  /* the denodes and cgs of another version would all look corrupt */
+  if (esb.fs_version != EDUFS_VERSION)
+	errx(1, "%s: format version %d, fsck_edufs checks version %d",
+		 argv[1], esb.fs_version, EDUFS_VERSION);
+  if (esb.fs_maxsymlinklen < 0 || esb.fs_maxsymlinklen > EDUFS_MAXINLINE) {
+	printf("superblock: fs_maxsymlinklen %d out of range (0..%d)\n",
+		   esb.fs_maxsymlinklen, (int)EDUFS_MAXINLINE);
+	nerrs++;
+  }
+
+  readcgs();
+  if (esb.fs_csaddr != 0 && esb.fs_clean)
+	checkcgsum();
+  for (c = 0; c < esb.fs_ncg; c++)
+	checkcg(c);
+  /* only once every enode has claimed its blocks */
+  for (c = 0; c < esb.fs_ncg; c++)
+	checkblocks(c);
+
+  printf("%d cylinder groups, %d problem%s\n", esb.fs_ncg, nerrs,
+		 nerrs == 1 ? "" : "s");
+  close(fd);
+  return (nerrs ? 1 : 0);
+}
+
+void usage(void) {
+  fprintf(stderr, "usage: fsck_edufs device\n");
+  exit(1);
+}
+
+void readat(off_t off, void *buf, size_t len) {
+  if (pread(fd, buf, len, off) != (ssize_t)len)
+	err(1, "read of %lu bytes at %lld", (u_long)len, (long long)off);
+}
+
+/* the cg headers are a list starting at fs_cblkno */
+void readcgs(void) {
+  off_t next = esb.fs_cblkno;
+  int c;
+
+  if ((allcg = calloc(esb.fs_ncg, sizeof(struct cg))) == NULL ||
+	  (refmap = calloc(esb.fs_ncg, sizeof(u_int8_t *))) == NULL)
+	err(1, "calloc");
+  for (c = 0; c < esb.fs_ncg; c++) {
+	readat(next, &allcg[c], sizeof(struct cg));
+	if ((refmap[c] = calloc(1, esb.fs_bsize)) == NULL)
+	  err(1, "calloc");
+	next = allcg[c].cg_next;
+  }
+}
+
+/*
+ * Note a reference to the data block at byte offset off; complain if
+ * it isn't a data block, isn't marked in use, or is already taken.
+ */
+int blkref(int ino, edufs_daddr_t off) {
+  struct cg *cgp;
+  u_int8_t map[MAXBSIZE];
+  int b, c;
+
+  for (c = 0; c < esb.fs_ncg; c++) {
+	cgp = &allcg[c];
+	if (off >= cgp->cg_dboff &&
+		off < cgp->cg_dboff + (off_t)cgp->cg_ndblk * esb.fs_bsize)
+	  break;
+  }
+  if (c == esb.fs_ncg || (off - cgp->cg_dboff) % esb.fs_bsize) {
+	printf("enode %d: block offset %d is not a data block\n", ino, off);
+	return (-1);
+  }
+  b = (off - cgp->cg_dboff) / esb.fs_bsize;
+  readat(cgp->cg_freeoff, map, esb.fs_bsize);
+  if (!ISSET(map, b)) {
+	printf("enode %d: block %d of cg %d is marked free\n", ino, b, c);
+	return (-1);
+  }
+  if (ISSET(refmap[c], b)) {
+	printf("enode %d: block %d of cg %d is referenced twice\n", ino, b, c);
+	return (-1);
+  }
+  refmap[c][b / NBBY] |= 0x80 >> (b % NBBY);
+  return (0);
+}
+
+void checkenode(int ino, struct denode *dp) {
+  int i, n;
+
+  if (dp->de_flags & DE_INLINEDATA) {
+	/* data lives in de_db[]/de_ib[], so no blocks of its own */
+	if ((dp->de_mode & DIFMT) == DIFDIR) {
+	  printf("enode %d: inline directory\n", ino);
+	  nerrs++;
+	}
+	if (dp->de_size > esb.fs_maxsymlinklen) {
+	  printf("enode %d: inline size %lld exceeds %d\n", ino,
+			 (long long)dp->de_size, esb.fs_maxsymlinklen);
+	  nerrs++;
+	}
+	if (dp->de_blocks != 0) {
+	  printf("enode %d: inline but claims %d blocks\n", ino,
+			 (int)dp->de_blocks);
+	  nerrs++;
+	}
+	return;
+  }
+
+  n = 0;
+  if (dp->de_flags & DE_EXTENTS)
+	checkext(ino, DE_DXROOT(dp), EDUFS_NROOTEXT, &n);
+  else {
+	for (i = 0; i < NDADDR; i++)
+	  if (dp->de_db[i] != 0) {
+		if (blkref(ino, dp->de_db[i]) < 0)
+		  nerrs++;
+		else
+		  n++;
+	  }
+	for (i = 0; i < NIADDR; i++)
+	  if (dp->de_ib[i] != 0)
+		n += checkindir(ino, dp->de_ib[i], i);
+  }
+  if (n != dp->de_blocks) {
+	printf("enode %d: claims %d blocks, has %d\n", ino,
+		   (int)dp->de_blocks, n);
+	nerrs++;
+  }
+  if (esb.fs_maxfilesize != 0 && dp->de_size > esb.fs_maxfilesize) {
+	printf("enode %d: size %lld larger than the maximum\n", ino,
+		   (long long)dp->de_size);
+	nerrs++;
+  }
+}
+
+/*
+ * The indirect block at off, level levels above the data as in the
+ * kernel's edufs_getlbns(), and what it points to.  Returns the number
+ * of good blocks.
+ */
+int checkindir(int ino, edufs_daddr_t off, int level) {
+  edufs_daddr_t ptrs[MAXBSIZE / sizeof(edufs_daddr_t)];
+  int i, n;
+
+  if (blkref(ino, off) < 0) {
+	nerrs++;
+	return (0);
+  }
+  n = 1;
+  readat(off, ptrs, esb.fs_bsize);
+  for (i = 0; i < esb.fs_nindir; i++) {
+	if (ptrs[i] == 0)
+	  continue;
+	if (level > 0)
+	  n += checkindir(ino, ptrs[i], level - 1);
+	else if (blkref(ino, ptrs[i]) < 0)
+	  nerrs++;
+	else
+	  n++;
+  }
+  return (n);
+}
+
+/*
+ * An extent tree node with room for max entries, and everything under
+ * it.  *np counts the good blocks.
+ */
+void checkext(int ino, struct edufs_dxhdr *dh, int max, int *np) {
+  u_int8_t buf[MAXBSIZE];
+  struct edufs_dextent *dx = DX_ENTRY(dh);
+  struct edufs_dxhdr *child = (struct edufs_dxhdr *)buf;
+  u_int32_t k;
+  int i;
+
+  if (dh->dh_n > max) {
+	printf("enode %d: extent node with %d entries, room for %d\n", ino,
+		   dh->dh_n, max);
+	nerrs++;
+	return;
+  }
+  for (i = 0; i < dh->dh_n; i++) {
+	if (i > 0 && dx[i].dx_lbn <= dx[i - 1].dx_lbn) {
+	  printf("enode %d: extents out of order at block %u\n", ino,
+			 dx[i].dx_lbn);
+	  nerrs++;
+	}
+	if (dh->dh_depth == 0) {
+	  for (k = 0; k < dx[i].dx_len; k++)
+		if (blkref(ino, dx[i].dx_off + k * esb.fs_bsize) < 0)
+		  nerrs++;
+		else
+		  (*np)++;
+	  continue;
+	}
+	if (blkref(ino, dx[i].dx_off) < 0) {
+	  nerrs++;
+	  continue;
+	}
+	(*np)++;
+	readat(dx[i].dx_off, buf, esb.fs_bsize);
+	if (child->dh_depth != dh->dh_depth - 1) {
+	  printf("enode %d: extent node at %d has depth %d, not %d\n", ino,
+			 dx[i].dx_off, child->dh_depth, dh->dh_depth - 1);
+	  nerrs++;
+	  continue;
+	}
+	checkext(ino, child, EDUFS_NODEEXT(esb.fs_bsize), np);
+  }
+}
+
+void checkcg(int c) {
+  struct cg *cgp = &allcg[c];
+  u_int8_t map[MAXBSIZE];
+  struct denode *den;
+  size_t len;
+  int i, nused;
+
+  /* enodes marked in use */
+  len = esb.fs_epg * sizeof(struct denode);
+  if ((den = malloc(len)) == NULL)
+	err(1, "malloc");
+  readat(cgp->cg_enodeoff, den, len);
+  readat(cgp->cg_eusedoff, map, esb.fs_bsize);
+  for (i = nused = 0; i < esb.fs_epg; i++) {
+	if (!ISSET(map, i))
+	  continue;
+	nused++;
+	checkenode(c * esb.fs_epg + i, &den[i]);
+  }
+  free(den);
+  if (esb.fs_epg - nused != cgp->cg_cs.cs_nefree) {
+	printf("cg %d: %d free enodes in the map, summary says %d\n", c,
+		   esb.fs_epg - nused, cgp->cg_cs.cs_nefree);
+	nerrs++;
+  }
+}
+
+/* free block counts, and blocks in use that no enode owns */
+void checkblocks(int c) {
+  struct cg *cgp = &allcg[c];
+  u_int8_t map[MAXBSIZE];
+  int b, nused;
+
+  readat(cgp->cg_freeoff, map, esb.fs_bsize);
+  for (b = nused = 0; b < cgp->cg_ndblk; b++) {
+	if (!ISSET(map, b))
+	  continue;
+	nused++;
+	if (!ISSET(refmap[c], b)) {
+	  printf("cg %d: block %d marked in use but unreferenced\n", c, b);
+	  nerrs++;
+	}
+  }
+  if (cgp->cg_ndblk - nused != cgp->cg_cs.cs_nbfree) {
+	printf("cg %d: %d free blocks in the map, summary says %d\n", c,
+		   cgp->cg_ndblk - nused, cgp->cg_cs.cs_nbfree);
+	nerrs++;
+  }
+}
+
+/* after a clean unmount the summary area has to agree with the headers */
+void checkcgsum(void) {
+  struct edufs_cgsum *sums, *sc;
+  struct cg *cgp;
+  int32_t cgoff = esb.fs_cblkno;
+  int c;
+
+  if (esb.fs_cssize < esb.fs_ncg * (int)sizeof(struct edufs_cgsum)) {
+	printf("superblock: summary area too small for %d cgs\n", esb.fs_ncg);
+	nerrs++;
+	return;
+  }
+  if ((sums = malloc(esb.fs_cssize)) == NULL)
+	err(1, "malloc");
+  readat(esb.fs_csaddr, sums, esb.fs_cssize);
+  for (c = 0, sc = sums, cgp = allcg; c < esb.fs_ncg; c++, sc++, cgp++) {
+	if (sc->sc_cgoff != cgoff || sc->sc_next != cgp->cg_next ||
+		sc->sc_dboff != cgp->cg_dboff ||
+		sc->sc_cs.cs_nbfree != cgp->cg_cs.cs_nbfree ||
+		sc->sc_cs.cs_nefree != cgp->cg_cs.cs_nefree ||
+		sc->sc_cs.cs_ndir != cgp->cg_cs.cs_ndir) {
+	  printf("cg %d: summary area doesn't match the cg header\n", c);
+	  nerrs++;
+	}
+	cgoff = cgp->cg_next;
+  }
+  free(sums);
+}
@@ -52,17 +52,32 @@ main(int argc, char *argv[])
   char mntpath[MAXPATHLEN];
   char *device;
   char *dir;
+  int ch, flags;
 	
+  flags = 0;
+  while ((ch = getopt(argc, argv, "l")) != -1) {
+	switch (ch) {
+	case 'l':
+	  /* lazytime: don't write enodes just for time stamps */
+	  flags |= EDUFSMNT_LAZYTIME;
+	  break;
+	default:
+	  argc = 0;
+	  break;
+	}
+  }
+  argc -= optind;
+  argv += optind;
   
   /* device, then dir */
-  /* mount_edufs /dev/ad0s2d /scratch */
-  if(argc < 3) {
-	printf("Usage: mount_edufs device dir\n");
+  /* mount_edufs [-l] /dev/ad0s2d /scratch */
+  if(argc < 2) {
+	printf("Usage: mount_edufs [-l] device dir\n");
 	exit(1);
   }
 
-  device = argv[1];
-  dir    = argv[2];
+  device = argv[0];
+  dir    = argv[1];
   
   
   /*(void)checkpath(dir, mntpath);*/
@@ -77,7 +92,7 @@ main(int argc, char *argv[])
   
   ea.uid = getuid();
   ea.gid = getgid();
-  ea.flags = 0;
+  ea.flags = flags;
   ea.magic = 9250; /* remove this */
   
   if (mount("edufs", mntpath, 0/*MNT_RDONLY*/, &ea) < 0)
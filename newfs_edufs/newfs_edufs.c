@@ -34,6 +34,7 @@
 struct edufs_superblock esb;
 struct disklabel *lp, dlp;
 struct cg *allcg;
+struct edufs_geom geom;
 
 #ifndef VERBOSE
 #define VERBOSE 1
@@ -64,7 +65,8 @@ struct edufs_dirblock dots[] = {
 };
 
 
-#define MAGIC 0x5DFB
+/* adjustcg gives up past this many cgs; the summary area is sized for it */
+#define MAXCG 100
 #define VERSION "NEWFS_EDUFS v0.7"
 
 void adjustcg(int *bytespercg, int *numenodes, int *enodeheaderlen, int start);
@@ -77,16 +79,18 @@ void writeenode(int blocknum,struct denode *de);
 off_t blockoff(int blocknum);
 off_t enodeoff(int enodenum);
 void deprint(struct denode *dp);
+void writecgsum();
 
 int fd;
 time_t utime;
 
 int main(int argc, char *argv[]) {
-  static char opts[] = "Nv";
+  static char opts[] = "ENv";
   const char *fname;
   char buf[MAXPATHLEN];
   int ch, n;
   int fakeit = 0;
+  int extents = 0;
   struct stat sb;  
   char *superblock;
   struct cg *ncg;
@@ -102,6 +106,10 @@ int main(int argc, char *argv[]) {
   
   while((ch = getopt(argc, argv, opts)) != -1) {
 	switch(ch) {
+	case 'E':
+	  extents = 1;
+	  break;
+
 	case 'N':
 	  printf("Not really creating the filesystem\n");
 	  fakeit = 1;
@@ -164,7 +172,10 @@ int main(int argc, char *argv[]) {
   DBG(VERSION);DBG("\n\n");
   getdiskstats(fd,fname,0);
 
-  esb.fs_magic = MAGIC;
+  esb.fs_magic = EDUFS_MAGIC;
+  esb.fs_version = EDUFS_VERSION;
+  if(extents)
+	esb.fs_flags |= FS_EXTENTS;
   /* calculate cylindercount this way because floppy disks don't return
 	 sectors/cylinder */  
   esb.fs_ncyl = lp->d_secperunit / (lp->d_nsectors * lp->d_ntracks);  
@@ -191,9 +202,12 @@ int main(int argc, char *argv[]) {
   
   SDBG("Superblock bytes written %d\n",n);
 
-  /* this is the offset AFTER the superblock */
+  /* the cg summary area goes right after the superblock */
+  int cssize = roundup(MAXCG * sizeof(struct edufs_cgsum), lp->d_secsize);
+
+  /* this is the offset AFTER the superblock and summary area */
   /* start the CG's off here */
-  int start = lp->d_secsize *2;
+  int start = sblocksize + cssize;
   SDBG("Offset after superblock = %d\n",start);
 
   /* divide the drive into #cg equal parts, minus the superblock */
@@ -257,7 +271,7 @@ int main(int argc, char *argv[]) {
 	/* ------------------------------------ */	
 	
 	bzero(ncg,sizeof(struct cg));
-	ncg->cg_magic = MAGIC;     
+	ncg->cg_magic = EDUFS_MAGIC;     
 	ncg->cg_cgx  = cgloop;	   /* this is cylinder # cgloop */
 	ncg->cg_ncyl = esb.fs_cpg; /* cylinders per group */
 
@@ -267,9 +281,9 @@ int main(int argc, char *argv[]) {
 	
 	int bytesthisgrp = ncg->cg_ncyl * esb.fs_spc * esb.fs_bps;		
 	
-	/* the first cylinder group has sblocksize less bytes...*/
+	/* the first cylinder group has start less bytes...*/
 	if(!cgloop)
-	  bytesthisgrp -= sblocksize;	
+	  bytesthisgrp -= start;	
 	
 	/* check and see if the cylinder group starts on a bps boundary */
 	if((cgoffset % esb.fs_bps) > 0) {
@@ -396,6 +410,13 @@ int main(int argc, char *argv[]) {
 	/* need to think about this one... */	
 	ncg->cg_dboff = lseek(fd,0,SEEK_CUR);
 	SDBG("First block offset in the group %d\n",ncg->cg_dboff);
+
+	/* the header went out before cg_dboff was known; redo it */
+	if(lseek(fd,cgoffset,SEEK_SET) != cgoffset ||
+	   write(fd,ncg,sizeof(struct cg)) != sizeof(struct cg)) {
+	  perror("Error rewriting cylinder group header");
+	  exit(-1);
+	}
 	
 #ifndef NDEBUG	
 	int sanity = enodeheaderlen;
@@ -418,14 +439,17 @@ int main(int argc, char *argv[]) {
     
   
   /* populate superblock fields etc */
-  esb.fs_cblkno = esb.fs_bps *2;  
+  esb.fs_cblkno = start;
+  esb.fs_csaddr = sblocksize;
+  esb.fs_cssize = cssize;
   esb.fs_epg = numenodes;
   esb.fs_time = utime;
-  esb.fs_cssize = esb.fs_bsize * 3; /* cg + blockfree + enodelist */
   esb.fs_fmod = 0;
   esb.fs_clean = 1;
   esb.fs_ronly = 0;
   esb.fs_cgrotor = 0;
+  /* files this small keep their data in the denode */
+  esb.fs_maxsymlinklen = EDUFS_MAXINLINE;
   esb.fs_cstotal.cs_ndir = 1;
   
   int j;
@@ -439,6 +463,15 @@ int main(int argc, char *argv[]) {
 	cgp++;
   }
 
+  /* the same address translation the kernel uses */
+  if(edufs_geominit(&geom,&esb,allcg) != 0)
+	errx(1, "block size %d and sector size %d must be powers of 2",
+		 esb.fs_bsize, esb.fs_bps);
+  esb.fs_nindir = geom.g_nindir;
+  esb.fs_maxfilesize = edufs_maxfilesize(&geom);
+
+  writecgsum();
+
   bzero(superblock,sblocksize);  
   memcpy(superblock,&esb,sizeof(struct edufs_superblock));
   
@@ -501,6 +534,7 @@ void printusage() {
   fprintf(stderr,
 		  "usage: newfs_edufs [ -options ] special [disktype]\n");
   fprintf(stderr, "where the options are:\n");
+  fprintf(stderr, "\t-E extent mapped files\n");
   fprintf(stderr, "\t-N don't create file system\n");
   fprintf(stderr, "\t-v Verbose: \n");
   exit(1);
@@ -529,7 +563,7 @@ void adjustcg(int *bytespercg, int *numenodes, int *enodeheaderlen, int start) {
 	} else {
 	  cgguess = 0; /* done */
 	}
-	if(esb.fs_ncg > 99) {
+	if(esb.fs_ncg >= MAXCG) {
 	  /* something is not working out here */
 	  DBG("Can't calculate the number of CG's\n");
 	  exit(-1);
@@ -677,7 +711,18 @@ void initfs() {
   
   
   printf("directory size = %lld\n",node.de_size);
-  node.de_db[0] = blockoff(FIRSTBLOCK);
+  if(esb.fs_flags & FS_EXTENTS) {
+	/* one extent, in the root of the tree */
+	struct edufs_dxhdr *dh = DE_DXROOT(&node);
+
+	node.de_flags |= DE_EXTENTS;
+	dh->dh_n = 1;
+	dh->dh_depth = 0;
+	DX_ENTRY(dh)[0].dx_lbn = 0;
+	DX_ENTRY(dh)[0].dx_off = blockoff(FIRSTBLOCK);
+	DX_ENTRY(dh)[0].dx_len = 1;
+  } else
+	node.de_db[0] = blockoff(FIRSTBLOCK);
   node.de_blocks = 1;  
   
   /* block # of first available block is 0
@@ -835,7 +880,7 @@ void writeenode(int enodenum,struct denode* de) {
   SDBG("Trying to write enode %d\n",enodenum);  
 
 
-  readoffset -= offset % esb.fs_bps;
+  readoffset -= offset & geom.g_smask;
   SDBG("Offset = %lld\n",offset);
   SDBG("Beginning of enodechunk offset = %lld\n",readoffset);
 
@@ -857,7 +902,7 @@ void writeenode(int enodenum,struct denode* de) {
   }
 
   /* 2) find index into this group of enode to modify */
-  int offinchunk = enodenum % (esb.fs_bps / sizeof(struct denode));
+  int offinchunk = edufs_enodeslot(&geom,enodenum);
   SDBG("Offset into chunk = %d\n",offinchunk);
   dp = (struct denode*)ebuf;  
   dp += offinchunk;
@@ -885,30 +930,20 @@ void writeenode(int enodenum,struct denode* de) {
 
 /* get the offset of a block # on the disk */
 off_t blockoff(int blocknum) {
-  struct cg *ap = allcg;
   off_t offset;
 
   /* get the cylinder group */
   int cg = blocknum / esb.fs_bpg;  
-  ap += cg;
   
-  /* i dont think this is correct...*/
-  offset = ap->cg_dboff + (esb.fs_bps * (blocknum % esb.fs_bpg)) ;
+  offset = edufs_dblkoff(&geom,cg,blocknum % esb.fs_bpg);
   printf("Block # %d found in cg %d at %lld\n",blocknum,cg,offset);
   return offset;
 }
 
 
 off_t enodeoff(int enodenum) {
-  //numenodes;
-  //ncg->cg_neblk;
-  struct cg *ap = allcg;
-  off_t offset;
 
-  int cg = enodenum / esb.fs_epg;
-  ap += cg;
-  offset = ap->cg_enodeoff + (sizeof(struct denode) * (enodenum % esb.fs_epg));
-  return offset;
+  return edufs_enodeoff(&geom,enodenum);
 }
 
 
@@ -923,8 +958,15 @@ void deprint(struct denode *dp) {
   /*printf("mtimensec %d\n",dp->de_mtimensec);   */
   printf("ctime %d \n",dp->de_ctime);	       
   /*printf("ctimensec %d\n",dp->de_ctimensec);   */
-  printf("direct block[0] %d ",dp->de_db[0]/esb.fs_bps); 
-  printf("direct block[1] %d ",dp->de_db[1]/esb.fs_bps); 
+  if(dp->de_flags & DE_INLINEDATA) {
+	printf("inline data %.*s ",(int)dp->de_size,DE_INLINEPTR(dp));
+  } else if(dp->de_flags & DE_EXTENTS) {
+	printf("extents %d depth %d ",DE_DXROOT(dp)->dh_n,
+		   DE_DXROOT(dp)->dh_depth);
+  } else {
+	printf("direct block[0] %d ",dp->de_db[0]/esb.fs_bps); 
+	printf("direct block[1] %d ",dp->de_db[1]/esb.fs_bps); 
+  }
   /* printf("status %d\n",dp->de_flags);	       */
   printf("blocks %d ",dp->de_blocks);	       
   printf("gen %d ",dp->de_gen);		       
@@ -933,3 +975,36 @@ void deprint(struct denode *dp) {
   printf("enode # %d ",dp->de_spare[0]);	   
   printf("\n-->END DENODE<<-\n");
 }
+
+
+/* copy the cg headers into the summary area so mount can read them all at once */
+void writecgsum() {
+  struct edufs_cgsum *sums, *sc;
+  struct cg *cgp;
+  int32_t cgoff = esb.fs_cblkno;
+  int j;
+
+  if((sums = calloc(1,esb.fs_cssize)) == NULL)
+	err(1, NULL);
+  for(j = 0, cgp = allcg, sc = sums; j < esb.fs_ncg; j++, cgp++, sc++) {
+	sc->sc_cgoff = cgoff;
+	sc->sc_next = cgp->cg_next;
+	sc->sc_ndblk = cgp->cg_ndblk;
+	sc->sc_neblk = cgp->cg_neblk;
+	sc->sc_dboff = cgp->cg_dboff;
+	sc->sc_eusedoff = cgp->cg_eusedoff;
+	sc->sc_freeoff = cgp->cg_freeoff;
+	sc->sc_enodeoff = cgp->cg_enodeoff;
+	sc->sc_cs = cgp->cg_cs;
+	sc->sc_rotor = cgp->cg_rotor;
+	sc->sc_frotor = cgp->cg_frotor;
+	sc->sc_irotor = cgp->cg_irotor;
+	cgoff = cgp->cg_next;
+  }
+  if(lseek(fd,esb.fs_csaddr,SEEK_SET) != esb.fs_csaddr ||
+	 write(fd,sums,esb.fs_cssize) != esb.fs_cssize) {
+	perror("Error writing cg summary area");
+	exit(-1);
+  }
+  free(sums);
+}
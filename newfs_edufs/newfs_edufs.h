@@ -53,10 +53,11 @@
 
 
 /* need to fix up these includes */
-#include "../sys/fs/edufs/edufs_enode.h"
 #include "../sys/fs/edufs/edufs_denode.h"
+#include "../sys/fs/edufs/edufs_enode.h"
 #include "../sys/fs/edufs/edufs_dir.h"
 #include "../sys/fs/edufs/edufs.h"
+#include "../sys/fs/edufs/edufs_geom.h"
 
 /* prototypes */
 void printusage();
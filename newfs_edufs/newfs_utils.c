@@ -252,6 +252,7 @@ void printsuper2() {
   printf("\tMax length internal sym link: %d\n",esb.fs_maxsymlinklen);
   printf("\tMax representable file size: %d\n",0);
   printf("\tMagic number: %d\n",esb.fs_magic);
+  printf("\tFormat version: %d\n",esb.fs_version);
 
 }
 